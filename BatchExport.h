@@ -0,0 +1,263 @@
+#pragma once
+// 画面なしの一括書き出し (報告書用のキー画像・断面を送るシネ)
+//
+//   DICOM_Viewer --export <出力フォルダ> [--view axial,coronal,sagittal] [--sweep] [--step N] [--slab mip|minip|avg N]
+//                [--box WxH] [--window WL,WW] [--all-series] [--jobs N] [--encoder "<コマンド>"] <DICOMフォルダ>...
+//
+// ビューアーと同じ読み込み (VolumeLoader) と描画 (RenderPlaneRGB) を使い、MainFrame は作らない。
+// 既定では向きごとに中央の 1 枚、--sweep で全断面 (--step 枚おき) を <出力フォルダ>/<SeriesInstanceUID>/ へ PNG で書く。
+// --encoder を付けると、送りの各フレームを RGB24 でコマンドの標準入力へ渡す (PNG は書かない)。
+// コマンドの {out} は向きごとの出力名 (拡張子なし)、{w} {h} はフレームの大きさに置き換える。
+#include "DicomLoader.h"
+#include <cstdio>
+#include <csignal>
+#include <string>
+#include <future>
+
+struct ExportOptions {
+    std::vector<std::string> inputs; // DICOM フォルダ (UTF-8)
+    std::string outDir;              // UTF-8
+    int views = 1;             // 書き出す向きのビット (1: Axial / 2: Coronal / 4: Sagittal)
+    bool sweep = false;        // 全断面を書く (false なら中央の 1 枚)
+    int step = 1;              // 送りの間隔 (枚)
+    SlabMode slab = SLAB_NONE;
+    int slabThickness = 1;
+    int boxW = 0, boxH = 0;    // 収める大きさ。0 なら元の画素数 (縦横比の補正だけ)
+    bool hasWindow = false;    // false ならデータセットの指定、なければ画素値の分布から決める (指定はモダリティ値)
+    int wl = 40, ww = 400;
+    bool allSeries = false;    // フォルダ内の全シリーズ (false なら最も枚数の多いもの)
+    int jobs = 0;              // 同時に処理するシリーズの数 (0 なら自動)
+    std::string encoder;
+};
+
+inline const char* ExportUsage() {
+    return "usage: DICOM_Viewer --export <out dir> [--view axial,coronal,sagittal] [--sweep] [--step N] [--slab mip|minip|avg N]\n"
+           "                    [--box WxH] [--window WL,WW] [--all-series] [--jobs N] [--encoder \"<command with {out} {w} {h}>\"] <DICOM folder>...\n";
+}
+
+// --export があれば true。引数の誤りは error に入れる
+inline bool ParseExportArgs(const std::vector<std::string>& args, ExportOptions& opt, std::string& error) {
+    if (std::find(args.begin(), args.end(), "--export") == args.end()) return false;
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& a = args[i];
+        auto next = [&]() -> const char* { return i + 1 < args.size() ? args[++i].c_str() : nullptr; };
+        const char* v = nullptr;
+        if (a == "--export" && (v = next())) { opt.outDir = v; continue; }
+        if (a == "--sweep") { opt.sweep = true; continue; }
+        if (a == "--all-series") { opt.allSeries = true; continue; }
+        if (a == "--step" && (v = next())) { opt.step = std::max(1, std::atoi(v)); continue; }
+        if (a == "--jobs" && (v = next())) { opt.jobs = std::max(1, std::atoi(v)); continue; }
+        if (a == "--encoder" && (v = next())) { opt.encoder = v; continue; }
+        if (a == "--view" && (v = next())) {
+            opt.views = 0;
+            for (std::string s = v; !s.empty(); ) {
+                size_t comma = s.find(',');
+                std::string item = s.substr(0, comma);
+                s = comma == std::string::npos ? "" : s.substr(comma + 1);
+                if (item == "axial") opt.views |= 1;
+                else if (item == "coronal") opt.views |= 2;
+                else if (item == "sagittal") opt.views |= 4;
+                else { error = "unknown view: " + item; return true; }
+            }
+            continue;
+        }
+        if (a == "--slab" && (v = next())) {
+            std::string mode = v;
+            opt.slab = mode == "mip" ? SLAB_MIP : mode == "minip" ? SLAB_MINIP : mode == "avg" ? SLAB_AVERAGE : SLAB_NONE;
+            if (opt.slab == SLAB_NONE || !(v = next()) || std::atoi(v) < 2) { error = "--slab needs mip|minip|avg and a thickness of 2 or more"; return true; }
+            opt.slabThickness = std::atoi(v);
+            continue;
+        }
+        if (a == "--box" && (v = next())) {
+            if (std::sscanf(v, "%dx%d", &opt.boxW, &opt.boxH) != 2 || opt.boxW <= 0 || opt.boxH <= 0) { error = "bad --box"; return true; }
+            continue;
+        }
+        if (a == "--window" && (v = next())) {
+            if (std::sscanf(v, "%d,%d", &opt.wl, &opt.ww) != 2 || opt.ww < 1) { error = "bad --window"; return true; }
+            opt.hasWindow = true;
+            continue;
+        }
+        if (a.rfind("--", 0) == 0) { error = "unknown or incomplete option: " + a; return true; }
+        opt.inputs.push_back(a);
+    }
+    if (opt.outDir.empty()) error = "--export needs an output folder";
+    else if (opt.inputs.empty()) error = "no DICOM folder given";
+    else if (opt.views == 0) error = "no view selected";
+    return true;
+}
+
+// 1 枚の RGB を path へ PNG で保存する。PNG の符号化は UI 側 (wxImage) が持つので呼び出し側から渡す。
+// 複数のスレッドから同時に呼ばれる
+using PngWriter = std::function<bool(const std::string& path, const unsigned char* rgb, int w, int h)>;
+
+inline FILE* OpenEncoder(std::string cmd, const std::string& out, int w, int h) {
+    auto replace = [&](const std::string& key, const std::string& value) {
+        for (size_t p; (p = cmd.find(key)) != std::string::npos; ) cmd.replace(p, key.size(), value);
+    };
+    replace("{out}", out); replace("{w}", std::to_string(w)); replace("{h}", std::to_string(h));
+#ifdef _WIN32
+    return _popen(cmd.c_str(), "wb");
+#else
+    return popen(cmd.c_str(), "w");
+#endif
+}
+
+inline bool CloseEncoder(FILE* pipe) {
+#ifdef _WIN32
+    return _pclose(pipe) == 0;
+#else
+    return pclose(pipe) == 0;
+#endif
+}
+
+// 読み込み済みのボリュームを opt の向き・範囲で dir へ書き出し、書いたフレーム数を返す (失敗は -1)。
+// フレームはまとめて並列に描き、PNG はその場で、エンコーダへは描いた順に渡す
+inline int ExportVolume(const Volume& vol, double pxSpcX, double pxSpcY, double thickness, int wl, int ww,
+                        const ExportOptions& opt, const std::string& dir, const PngWriter& png) {
+    static const char* const names[3] = { "axial", "coronal", "sagittal" };
+    static constexpr int BATCH = 32;
+    WindowLut lut;
+    lut.Update(wl, ww);
+    SlabParams slab;
+    slab.mode = opt.slab; slab.thickness = opt.slabThickness;
+    std::vector<std::vector<unsigned char>> frames(BATCH);
+    int written = 0;
+    for (int viewType = 0; viewType < 3; ++viewType) {
+        if (!(opt.views & (1 << viewType))) continue;
+        int count = PlaneCount(vol, viewType);
+        if (count <= 0) continue;
+        std::vector<int> slices;
+        if (opt.sweep) for (int i = 0; i < count; i += std::max(1, opt.step)) slices.push_back(i);
+        else slices.push_back(count / 2);
+        int outW = 0, outH = 0;
+        PlaneFitSize(vol, viewType, PlaneAspect(viewType, pxSpcX, pxSpcY, thickness), opt.boxW, opt.boxH, outW, outH);
+        std::string base = dir + "/" + names[viewType] + (slab.Active() ? "_slab" : "");
+        FILE* pipe = nullptr;
+        if (!opt.encoder.empty() && !(pipe = OpenEncoder(opt.encoder, base, outW, outH))) return -1;
+        std::atomic<bool> failed{false};
+        for (size_t b = 0; b < slices.size() && !failed; b += BATCH) {
+            int n = (int)std::min<size_t>(BATCH, slices.size() - b);
+            ThreadPool::Shared().ParallelFor(n, [&](int i) {
+                std::vector<unsigned char>& rgb = frames[i];
+                rgb.resize((size_t)outW * outH * 3);
+                int slice = slices[b + i];
+                RenderPlaneRGB(vol, viewType, slice, outW, outH, false, &lut, wl, ww, rgb.data(), nullptr, nullptr, &slab);
+                if (pipe) return;
+                char suffix[16];
+                std::snprintf(suffix, sizeof(suffix), "_%04d.png", slice + 1);
+                if (!png(base + suffix, rgb.data(), outW, outH)) failed = true;
+            });
+            for (int i = 0; pipe && i < n && !failed; ++i) {
+                if (std::fwrite(frames[i].data(), 1, frames[i].size(), pipe) != frames[i].size()) failed = true;
+            }
+            if (!failed) written += n;
+        }
+        if (pipe && !CloseEncoder(pipe)) failed = true;
+        if (failed) return -1;
+    }
+    return written;
+}
+
+// フォルダを走査してシリーズを集め、opt.jobs 本の作業スレッドで読み込み → 書き出しを分担する。
+// 展開と描画はそれぞれ共有プールで並列に進むので、同時に扱うシリーズは走査・符号化の待ちを埋める程度でよい。
+// 進み具合と毎秒のスライス数は標準出力へ書き、終了コード (0 は全シリーズ成功) を返す
+inline int RunBatchExport(const ExportOptions& opt, const PngWriter& png) {
+    namespace fs = std::filesystem;
+    using Clock = std::chrono::steady_clock;
+    auto elapsed = [](Clock::time_point t) { return std::chrono::duration<double>(Clock::now() - t).count(); };
+    Clock::time_point start = Clock::now();
+#ifndef _WIN32
+    std::signal(SIGPIPE, SIG_IGN); // エンコーダが先に終わっても書き込みの失敗として扱う
+#endif
+
+    std::vector<SeriesEntry> series;
+    for (const std::string& dir : opt.inputs) {
+        std::vector<std::string> paths;
+        std::error_code ec;
+        for (fs::directory_iterator it(fs::u8path(dir), ec), end; !ec && it != end; it.increment(ec)) {
+            if (it->is_regular_file() && IsDicomFileName(it->path())) paths.push_back(it->path().string());
+        }
+        std::vector<SeriesEntry> found = GroupSeries(ScanHeaders(paths));
+        int largest = LargestSeries(found);
+        if (largest < 0) { std::fprintf(stderr, "no readable series in %s\n", dir.c_str()); continue; }
+        if (opt.allSeries) for (SeriesEntry& s : found) series.push_back(std::move(s));
+        else series.push_back(std::move(found[largest]));
+    }
+    if (series.empty()) return 1;
+    std::printf("export: %zu series, scanned in %.2f s\n", series.size(), elapsed(start));
+    std::fflush(stdout);
+
+    std::atomic<int> next{0}, failures{0};
+    std::atomic<uint64_t> framesOut{0}, slicesIn{0};
+    std::mutex printMtx;
+    auto worker = [&]() {
+        VolumeLoader loader;
+        for (int i; (i = next.fetch_add(1)) < (int)series.size(); ) {
+            const SeriesEntry& s = series[i];
+            const SliceHeader& first = s.slices.front();
+            const SliceHeader& middle = s.slices[s.slices.size() / 2];
+            if (first.color) {
+                std::lock_guard<std::mutex> lock(printMtx);
+                std::printf("  %s  FAILED (color images are not supported)\n", s.uid.c_str());
+                failures.fetch_add(1);
+                continue;
+            }
+            Clock::time_point t0 = Clock::now();
+            Volume vol;
+            vol.Reset(first.cols, first.rows, (int)s.slices.size(), Volume::LAYOUT_LINEAR);
+            std::vector<SliceHeader> slices = s.slices;
+            double scale = SeriesValueScale(slices);
+            for (SliceHeader& h : slices) h.valueScale = scale;
+            ValueHistogram histogram;
+            std::promise<int> done;
+            loader.Start(std::move(slices), &vol, nullptr, [&done](int count) { done.set_value(count); }, &histogram);
+            int loaded = done.get_future().get();
+            loader.Cancel(); // 読み込みスレッドが抜けきるのを待つ
+            SliceSpacing spacing = MeasureSpacing(s.slices);
+            if (!spacing.uniform) {
+                Volume uniform;
+                ResampleSlices(vol, spacing.offsets, spacing.step, uniform);
+                if (!uniform.empty()) vol = std::move(uniform);
+            }
+            double loadSec = elapsed(t0);
+
+            // 画素は格納値 (モダリティ値 / scale) なので、モダリティ値のウィンドウは scale で割って当てる
+            int wl = (int)std::lround(opt.wl / scale), ww = std::max(1, (int)std::lround(opt.ww / scale));
+            if (!opt.hasWindow && middle.windowWidth > 0.0) {
+                wl = (int)std::lround(middle.windowCenter / scale); ww = std::max(1, (int)std::lround(middle.windowWidth / scale));
+            } else if (!opt.hasWindow) {
+                ValueRange range = histogram.Summarize();
+                if (range.valid) { wl = range.autoWL; ww = range.autoWW; }
+            }
+            std::string dir = (fs::u8path(opt.outDir) / s.uid).string();
+            std::error_code ec;
+            fs::create_directories(dir, ec);
+            Clock::time_point t1 = Clock::now();
+            if (middle.inverted) ww = -ww; // MONOCHROME1 は反転して書き出す
+            int frames = ec ? -1 : ExportVolume(vol, first.pxSpcX, first.pxSpcY, spacing.step, wl, ww, opt, dir, png);
+            double exportSec = elapsed(t1);
+            if (frames < 0 || loaded < (int)s.slices.size()) failures.fetch_add(1);
+            if (frames > 0) framesOut.fetch_add(frames);
+            slicesIn.fetch_add(loaded);
+
+            std::lock_guard<std::mutex> lock(printMtx);
+            std::printf("  %s  %dx%dx%d  load %.2f s (%d/%zu slices)  export %.2f s  %s\n", s.uid.c_str(), vol.Width(), vol.Height(), vol.Depth(),
+                        loadSec, loaded, s.slices.size(), exportSec, frames < 0 ? "FAILED" : (std::to_string(frames) + " frames").c_str());
+            if (scale != 1.0) std::printf("    stored as value / %g\n", scale);
+            if (loader.ClippedSlices() > 0) std::printf("    warning: %d slices had values outside the int16 range (clamped)\n", loader.ClippedSlices());
+            std::fflush(stdout);
+        }
+    };
+    int workers = opt.jobs > 0 ? opt.jobs : (int)std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u);
+    workers = std::min(workers, (int)series.size());
+    std::vector<std::thread> threads;
+    for (int i = 1; i < workers; ++i) threads.emplace_back(worker);
+    worker();
+    for (std::thread& t : threads) t.join();
+
+    double total = elapsed(start);
+    std::printf("export: %llu frames from %llu slices in %.2f s  (%.1f frames/s written, %.1f slices/s decoded, %d series failed)\n",
+                (unsigned long long)framesOut.load(), (unsigned long long)slicesIn.load(), total,
+                framesOut.load() / std::max(total, 1e-9), slicesIn.load() / std::max(total, 1e-9), failures.load());
+    return failures.load() == 0 ? 0 : 1;
+}
@@ -0,0 +1,827 @@
+// DICOM_Viewer の描画・読み込み経路を GUI なしで計測するベンチマーク
+//
+//   DICOM_Benchmark [--size 512] [--depths 100,500,2000] [--box 768x768] [--iters 20] [--bricked] [--compressed] [--slab 100] [--oblique] [--raycast] [--dir <DICOMフォルダ>] [--trace <出力.json>]
+//   DICOM_Benchmark --check
+//   DICOM_Benchmark --pacs AE@host:port --study <StudyInstanceUID> [--series <SeriesInstanceUID>] [--connections 1,4]
+//
+// 合成ボリュームは size x size x depth ごとに、--dir を指定したときはそのフォルダの実データで計測する。
+// 描画は断面の切り出し・拡大縮小・ウィンドウ処理の各段を ns/画素 で、読み込みは走査と展開を ms で出す。
+// --slab を付けると、その厚みのスラブ投影 (部分集約なし / あり) を単一断面と比べる。
+// --compressed を付けると、ブリック圧縮した形式でも描画を計測し、圧縮率と変換時間を出す。
+// --oblique を付けると、斜め断面を回しながら描く 1 フレームの時間を最近傍 / 3 線形で出す。
+// --raycast を付けると、ボリュームレンダリングの粗い 1 枚・仕上げの 1 枚を、空間の読み飛ばしあり / なしで出す。
+// --trace を付けると全区間を Chrome のトレース形式で書き出す (ビューアーの Save Trace と同じ形式)。
+// --check は計測せず、速い経路の結果を素直な計算と突き合わせる (不一致があれば終了コード 1)。
+// --pacs を付けると、問い合わせ (C-FIND) と、接続数ごとの取得 (C-GET) の最初の 1 枚までの時間・全体の時間を出す。
+#include "VolumeCore.h"
+#include "DicomLoader.h"
+#include "PacsLoader.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sstream>
+#include <future>
+#include <new>
+
+using Clock = std::chrono::steady_clock;
+
+// ヒープ確保の回数 (定常状態の描画が確保しないことを確かめる)
+static std::atomic<uint64_t> heapAllocs{0};
+
+void* operator new(std::size_t n) {
+    heapAllocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+// nothrow 版 (std::stable_sort の作業領域など) も同じ malloc から取る。ASan は別々に置き換えるので、揃えないと解放の組が合わない
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept {
+    heapAllocs.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(n ? n : 1);
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+static double ElapsedMs(Clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+}
+
+struct BenchOptions {
+    int size = 512;
+    std::vector<int> depths = { 100, 500, 2000 };
+    int boxW = 768, boxH = 768;
+    int iters = 20;
+    bool bricked = false;
+    bool compressed = false;
+    int slab = 0;
+    bool oblique = false;
+    bool raycast = false;
+    bool check = false;
+    std::string dir;
+    std::string trace;
+    PacsServer pacs;
+    std::string study, series;
+    std::vector<int> connections = { 1, 4 };
+};
+
+// 空気 (-1000) の中に楕円の軟部組織 (40 前後) と骨の輪 (1000 前後) を置いた CT 風の合成データ
+static void FillSynthetic(Volume& vol) {
+    int w = vol.Width(), h = vol.Height(), d = vol.Depth();
+    ThreadPool::Shared().ParallelFor(d, [&](int z) {
+        std::vector<int16_t> slice((size_t)w * h);
+        uint32_t seed = 2463534242u + (uint32_t)z * 7919u;
+        double rz = (2.0 * z / std::max(1, d - 1)) - 1.0;
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+                int noise = (int)(seed % 41) - 20;
+                double rx = (x - w * 0.5) / (w * 0.45), ry = (y - h * 0.5) / (h * 0.35);
+                double r = std::sqrt(rx * rx + ry * ry + 0.2 * rz * rz);
+                int v = -1000;
+                if (r < 1.0) v = (r > 0.85 && r < 0.92) ? 1000 : 40;
+                slice[(size_t)y * w + x] = (int16_t)(v + noise);
+            }
+        }
+        vol.WriteSlice(z, slice.data());
+    });
+}
+
+static const char* LayoutName(const Volume& vol) {
+    switch (vol.GetLayout()) {
+        case Volume::LAYOUT_BRICKED: return "bricked";
+        case Volume::LAYOUT_COMPRESSED: return "compressed";
+        case Volume::LAYOUT_PAGED: return "paged";
+        default: return "linear";
+    }
+}
+
+// 圧縮形式へ変換し、圧縮率と変換 (圧縮・展開) の時間を出す。vol は圧縮形式になって戻る
+static void BenchCompress(Volume& vol) {
+    uint64_t raw = (uint64_t)vol.Width() * vol.Height() * vol.Depth() * sizeof(int16_t);
+    Volume::Layout original = vol.GetLayout();
+    Clock::time_point start = Clock::now();
+    vol.SetLayout(Volume::LAYOUT_COMPRESSED);
+    double packMs = ElapsedMs(start);
+    uint64_t stored = vol.StoredBytes();
+    start = Clock::now();
+    vol.SetLayout(original);
+    double unpackMs = ElapsedMs(start);
+    vol.SetLayout(Volume::LAYOUT_COMPRESSED);
+    std::printf("\n[compress] %.0f MB -> %.0f MB (%.2fx)  pack %.1f ms (%.0f MB/s)  unpack %.1f ms (%.0f MB/s)\n",
+                raw / 1048576.0, stored / 1048576.0, (double)raw / std::max<uint64_t>(1, stored),
+                packMs, raw / 1048576.0 / (packMs / 1000.0), unpackMs, raw / 1048576.0 / (unpackMs / 1000.0));
+}
+
+static void PrintRange(const ValueHistogram& histogram) {
+    Clock::time_point start = Clock::now();
+    ValueRange r = histogram.Summarize();
+    double ms = ElapsedMs(start);
+    std::printf("  summarize   %10.1f ms  (values %d..%d, auto WL %d / WW %d)\n", ms, r.minValue, r.maxValue, r.autoWL, r.autoWW);
+}
+
+// 読み込みと同じくスライス単位で並列に数える
+static void BenchHistogram(const Volume& vol) {
+    int w = vol.Width(), h = vol.Height(), d = vol.Depth();
+    ValueHistogram histogram;
+    Clock::time_point start = Clock::now();
+    ThreadPool::Shared().ParallelFor(d, [&](int z) {
+        thread_local std::vector<int16_t> plane;
+        histogram.Add(ReadPlane(vol, 0, z, plane), (size_t)w * h);
+    });
+    double ms = ElapsedMs(start);
+    std::printf("\n[histogram] %dx%dx%d  count %.1f ms (%.2f ns/voxel)\n", w, h, d, ms, ms * 1e6 / ((double)w * h * d));
+    PrintRange(histogram);
+}
+
+static const char* ViewName(int viewType) {
+    return viewType == 0 ? "Axial" : (viewType == 1 ? "Coronal" : "Sagittal");
+}
+
+// 各向き・各品質で、スライス位置を範囲全体に散らして iters 回描く
+static void BenchRender(const char* label, const Volume& vol, double pxSpcX, double pxSpcY, double thickness, const BenchOptions& opt) {
+    std::printf("\n[render] %s  %dx%dx%d  %s  box %dx%d  %d iters\n", label, vol.Width(), vol.Height(), vol.Depth(),
+                LayoutName(vol), opt.boxW, opt.boxH, opt.iters);
+    std::printf("  %-9s %-8s %9s %12s %14s %12s %10s %8s\n", "view", "quality", "out", "extract", "resample", "window", "frame", "allocs");
+    std::printf("  %-9s %-8s %9s %12s %14s %12s %10s %8s\n", "", "", "", "ns/src px", "ns/out px", "ns/out px", "ms", "/frame");
+    WindowLut lut;
+    lut.Update(40, 400);
+    for (int viewType = 0; viewType < 3; ++viewType) {
+        int srcW = 0, srcH = 0;
+        vol.PlaneSize(viewType, srcW, srcH);
+        int count = viewType == 0 ? vol.Depth() : (viewType == 1 ? vol.Height() : vol.Width());
+        double scaleY = PlaneAspect(viewType, pxSpcX, pxSpcY, thickness);
+        int outW = 0, outH = 0;
+        PlaneFitSize(vol, viewType, scaleY, opt.boxW, opt.boxH, outW, outH);
+        std::vector<unsigned char> rgb((size_t)outW * outH * 3);
+        PlaneScratch scratch;
+
+        for (int coarse = 1; coarse >= 0; --coarse) {
+            PlaneTimings t;
+            ResampleQuality q = RESAMPLE_HIGH;
+            // 1 回目はキャッシュやページ、作業領域を温めるだけで数えない
+            RenderPlaneRGB(vol, viewType, count / 2, outW, outH, coarse != 0, &lut, 40, 400, rgb.data(), &scratch);
+            uint64_t allocs0 = heapAllocs.load();
+            Clock::time_point start = Clock::now();
+            for (int i = 0; i < opt.iters; ++i) {
+                int slice = opt.iters > 1 ? (int)((int64_t)i * (count - 1) / (opt.iters - 1)) : count / 2;
+                q = RenderPlaneRGB(vol, viewType, slice, outW, outH, coarse != 0, &lut, 40, 400, rgb.data(), &scratch, &t);
+            }
+            double totalMs = ElapsedMs(start);
+            double allocs = (double)(heapAllocs.load() - allocs0) / opt.iters;
+            double srcPx = (double)srcW * srcH * opt.iters, outPx = (double)outW * outH * opt.iters;
+            const char* qname = q == RESAMPLE_HIGH ? "high" : (q == RESAMPLE_BILINEAR ? "bilinear" : "nearest");
+            char out[32];
+            std::snprintf(out, sizeof(out), "%dx%d", outW, outH);
+            std::printf("  %-9s %-8s %9s %12.3f %14.3f %12.3f %10.2f %8.1f\n", ViewName(viewType), qname, out,
+                        t.extractMs * 1e6 / srcPx, t.resampleMs * 1e6 / outPx, t.windowMs * 1e6 / outPx, totalMs / opt.iters, allocs);
+        }
+    }
+}
+
+// 縮小版の作成時間と、操作中の描画 (縮小版から粗く) が元のボリュームからの粗い描画に比べてどれだけ速いか
+static void BenchPyramid(const Volume& vol, double pxSpcX, double pxSpcY, double thickness, const BenchOptions& opt) {
+    if (std::max(vol.Width(), vol.Height()) < VolumePyramid::MIN_SIZE) return;
+    VolumePyramid pyr;
+    std::atomic<bool> cancel{false};
+    Clock::time_point start = Clock::now();
+    pyr.Build(vol, cancel);
+    std::printf("\n[pyramid] built in %.1f ms  (+%.0f MB)\n", ElapsedMs(start), pyr.Bytes() / (1024.0 * 1024.0));
+    std::printf("  %-9s %9s %6s %12s %12s\n", "view", "out", "level", "full ms", "pyramid ms");
+    WindowLut lut;
+    lut.Update(40, 400);
+    for (int viewType = 0; viewType < 3; ++viewType) {
+        int count = viewType == 0 ? vol.Depth() : (viewType == 1 ? vol.Height() : vol.Width());
+        int outW = 0, outH = 0;
+        PlaneFitSize(vol, viewType, PlaneAspect(viewType, pxSpcX, pxSpcY, thickness), opt.boxW, opt.boxH, outW, outH);
+        std::vector<unsigned char> rgb((size_t)outW * outH * 3);
+        PlaneScratch scratch;
+        double ms[2] = { 0, 0 };
+        int level = 0;
+        for (int useLod = 0; useLod < 2; ++useLod) {
+            start = Clock::now();
+            for (int i = 0; i < opt.iters; ++i) {
+                int slice = opt.iters > 1 ? (int)((int64_t)i * (count - 1) / (opt.iters - 1)) : count / 2;
+                const Volume& src = useLod ? pyr.Source(vol, viewType, outW, outH, slice, level) : vol;
+                RenderPlaneRGB(src, viewType, slice, outW, outH, true, &lut, 40, 400, rgb.data(), &scratch);
+            }
+            ms[useLod] = ElapsedMs(start) / opt.iters;
+        }
+        char out[32];
+        std::snprintf(out, sizeof(out), "%dx%d", outW, outH);
+        std::printf("  %-9s %9s %6s %12.2f %12.2f\n", ViewName(viewType), out, level ? (level == 1 ? "1/2" : "1/4") : "1/1", ms[0], ms[1]);
+    }
+}
+
+// 同じスライス位置を中心に、単一断面・部分集約なし・部分集約あり (作る回と使い回す回) のスラブを描く
+static void BenchSlab(const Volume& vol, double pxSpcX, double pxSpcY, double thickness, const BenchOptions& opt) {
+    if (opt.slab < 2) return;
+    std::printf("\n[slab] %d slices  box %dx%d  %d iters\n", opt.slab, opt.boxW, opt.boxH, opt.iters);
+    std::printf("  %-9s %-8s %10s %10s %10s %10s\n", "view", "mode", "single ms", "naive ms", "cold ms", "cached ms");
+    WindowLut lut;
+    lut.Update(40, 400);
+    const SlabMode modes[3] = { SLAB_MIP, SLAB_MINIP, SLAB_AVERAGE };
+    const char* names[3] = { "MIP", "MinIP", "average" };
+    for (int viewType = 0; viewType < 3; ++viewType) {
+        int count = PlaneCount(vol, viewType);
+        int outW = 0, outH = 0;
+        PlaneFitSize(vol, viewType, PlaneAspect(viewType, pxSpcX, pxSpcY, thickness), opt.boxW, opt.boxH, outW, outH);
+        std::vector<unsigned char> rgb((size_t)outW * outH * 3);
+        PlaneScratch scratch;
+        for (int m = 0; m < 3; ++m) {
+            SlabCache cache;
+            SlabParams none, naive, cached;
+            naive.mode = cached.mode = modes[m];
+            naive.thickness = cached.thickness = opt.slab;
+            cached.cache = &cache;
+            auto run = [&](const SlabParams& p, int iters) {
+                Clock::time_point start = Clock::now();
+                for (int i = 0; i < iters; ++i) {
+                    int slice = iters > 1 ? (int)((int64_t)i * (count - 1) / (iters - 1)) : count / 2;
+                    RenderPlaneRGB(vol, viewType, slice, outW, outH, false, &lut, 40, 400, rgb.data(), &scratch, nullptr, &p);
+                }
+                return ElapsedMs(start) / iters;
+            };
+            run(naive, 1); // 作業領域を温める
+            double single = run(none, opt.iters), plain = run(naive, opt.iters);
+            double cold = run(cached, opt.iters), warm = run(cached, opt.iters);
+            std::printf("  %-9s %-8s %10.2f %10.2f %10.2f %10.2f\n", ViewName(viewType), names[m], single, plain, cold, warm);
+        }
+    }
+}
+
+// 中心のまま傾きを -45〜45 度、回転を 30 度で回しながら描く (ビューアーでスライダーを動かすのと同じ)
+static void BenchOblique(const Volume& vol, double pxSpcX, double pxSpcY, double thickness, const BenchOptions& opt) {
+    if (!opt.oblique || vol.IsPaged()) return;
+    std::printf("\n[oblique] %s  box %dx%d  %d iters\n", LayoutName(vol), opt.boxW, opt.boxH, opt.iters);
+    std::printf("  %-9s %9s %10s %12s %12s %8s\n", "view", "out", "axis ms", "nearest ms", "trilinear ms", "allocs");
+    WindowLut lut;
+    lut.Update(40, 400);
+    const double center[3] = { vol.Width() / 2.0, vol.Height() / 2.0, vol.Depth() / 2.0 };
+    for (int viewType = 0; viewType < 3; ++viewType) {
+        int outW = 0, outH = 0;
+        PlaneFitSize(vol, viewType, PlaneAspect(viewType, pxSpcX, pxSpcY, thickness), opt.boxW, opt.boxH, outW, outH);
+        std::vector<unsigned char> rgb((size_t)outW * outH * 3);
+        PlaneScratch scratch;
+        int slice = PlaneCount(vol, viewType) / 2;
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < opt.iters; ++i) RenderPlaneRGB(vol, viewType, slice, outW, outH, false, &lut, 40, 400, rgb.data(), &scratch);
+        double axisMs = ElapsedMs(start) / opt.iters;
+        double ms[2] = { 0, 0 };
+        uint64_t allocs0 = 0;
+        for (int tri = 0; tri < 2; ++tri) {
+            RenderObliqueRGB(vol, MakeObliquePlane(vol, viewType, center, 10, 30, pxSpcX, pxSpcY, thickness, outW, outH),
+                             outW, outH, !tri, &lut, 40, 400, rgb.data(), &scratch);
+            if (tri) allocs0 = heapAllocs.load();
+            start = Clock::now();
+            for (int i = 0; i < opt.iters; ++i) {
+                double tilt = opt.iters > 1 ? -45.0 + 90.0 * i / (opt.iters - 1) : 0.0;
+                ObliquePlane plane = MakeObliquePlane(vol, viewType, center, tilt, 30, pxSpcX, pxSpcY, thickness, outW, outH);
+                RenderObliqueRGB(vol, plane, outW, outH, !tri, &lut, 40, 400, rgb.data(), &scratch);
+            }
+            ms[tri] = ElapsedMs(start) / opt.iters;
+        }
+        char out[32];
+        std::snprintf(out, sizeof(out), "%dx%d", outW, outH);
+        std::printf("  %-9s %9s %10.2f %12.2f %12.2f %8.1f\n", ViewName(viewType), out, axisMs, ms[0], ms[1],
+                    (double)(heapAllocs.load() - allocs0) / opt.iters);
+    }
+}
+
+// 向きを変えながら、操作中の粗い 1 枚 (1/4) と仕上げの 1 枚を描く。読み飛ばしなしは同じ画像になるので、差がそのまま効果
+static void BenchRaycast(const Volume& vol, double pxSpcX, double pxSpcY, double thickness, const BenchOptions& opt) {
+    if (!opt.raycast || vol.IsPaged()) return;
+    VolumeRaycaster raycaster;
+    Clock::time_point start = Clock::now();
+    raycaster.Prepare(vol, 0);
+    std::printf("\n[raycast] %s  box %dx%d  %d iters  blocks %.1f ms\n", LayoutName(vol), opt.boxW, opt.boxH, opt.iters, ElapsedMs(start));
+    std::printf("  %-12s %10s %10s %12s\n", "preset", "coarse ms", "full ms", "no-skip ms");
+    static const char* names[VRT_PRESET_COUNT] = { "bone", "soft tissue", "skin" };
+    std::vector<unsigned char> rgb((size_t)opt.boxW * opt.boxH * 3);
+    int iters = std::max(1, opt.iters / 4); // 1 枚が断面よりずっと重いので回数を減らす
+    for (int preset = 0; preset < VRT_PRESET_COUNT; ++preset) {
+        const VrtTransfer& tf = VrtPresetTransfer(preset);
+        double ms[3] = { 0, 0, 0 };
+        for (int mode = 0; mode < 3; ++mode) {
+            start = Clock::now();
+            for (int i = 0; i < iters; ++i) {
+                VrtCamera cam;
+                cam.yaw = 360.0 * i / iters; cam.pitch = 20;
+                VrtView view = MakeVrtView(vol, pxSpcX, pxSpcY, thickness, cam, opt.boxW, opt.boxH);
+                raycaster.Render(vol, view, tf, opt.boxW, opt.boxH, 0, opt.boxH, mode == 0 ? VRT_COARSE : 1, rgb.data(), mode != 2);
+            }
+            ms[mode] = ElapsedMs(start) / iters;
+        }
+        std::printf("  %-12s %10.2f %10.2f %12.2f\n", names[preset], ms[0], ms[1], ms[2]);
+    }
+}
+
+// --- 自己検査 (--check) ---
+// 速い経路を、小さなボリュームで素直な計算と全画素で突き合わせる。大きさは 16 の倍数を外してあるので、
+// -fsanitize=address,undefined でビルドして走らせると端のブリック・行の範囲外アクセスも見つかる
+struct CheckVolume {
+    int w = 0, h = 0, d = 0;
+    std::vector<int16_t> raw; // x, y, z の順
+    int16_t At(int x, int y, int z) const { return raw[((size_t)z * h + y) * w + x]; }
+};
+
+static int checkFailures = 0;
+
+static void Report(const std::string& name, size_t mismatches) {
+    if (mismatches) ++checkFailures;
+    std::printf("  %-52s %s", name.c_str(), mismatches ? "FAILED" : "ok");
+    if (mismatches) std::printf(" (%zu mismatches)", mismatches);
+    std::printf("\n");
+}
+
+static void FillCheckVolume(CheckVolume& ref, int w, int h, int d, uint32_t seed, int lo, int hi) {
+    ref.w = w; ref.h = h; ref.d = d;
+    ref.raw.resize((size_t)w * h * d);
+    for (int16_t& v : ref.raw) {
+        seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+        v = (int16_t)(lo + (int64_t)(seed % ((uint32_t)(hi - lo) + 1)));
+    }
+}
+
+static void ToVolume(const CheckVolume& ref, Volume::Layout layout, Volume& vol) {
+    vol.Reset(ref.w, ref.h, ref.d, layout);
+    for (int z = 0; z < ref.d; ++z) vol.WriteSlice(z, ref.raw.data() + (size_t)z * ref.w * ref.h);
+}
+
+// ExtractPlane と同じ並び (PlaneSize の大きさ) の断面を素の画素から作る
+static std::vector<int16_t> RefPlane(const CheckVolume& ref, int viewType, int index) {
+    std::vector<int16_t> out;
+    if (viewType == 0) {
+        for (int y = 0; y < ref.h; ++y) for (int x = 0; x < ref.w; ++x) out.push_back(ref.At(x, y, index));
+    } else if (viewType == 1) {
+        for (int z = 0; z < ref.d; ++z) for (int x = 0; x < ref.w; ++x) out.push_back(ref.At(x, index, z));
+    } else {
+        for (int z = 0; z < ref.d; ++z) for (int y = 0; y < ref.h; ++y) out.push_back(ref.At(index, y, z));
+    }
+    return out;
+}
+
+static size_t CountMismatches(const int16_t* a, const int16_t* b, size_t n) {
+    size_t bad = 0;
+    for (size_t i = 0; i < n; ++i) bad += a[i] != b[i];
+    return bad;
+}
+
+// ProjectSlab (直接読み・部分集約の塊・端の枚数) を、断面ごとの画素の最大・最小・平均と比べる
+static void CheckSlab() {
+    std::printf("\n[check] slab projection vs per-pixel reduction\n");
+    CheckVolume ref;
+    FillCheckVolume(ref, 37, 29, 45, 12345u, -2048, 3071);
+    const SlabMode modes[3] = { SLAB_MIP, SLAB_MINIP, SLAB_AVERAGE };
+    const char* names[3] = { "MIP", "MinIP", "average" };
+    for (Volume::Layout layout : { Volume::LAYOUT_LINEAR, Volume::LAYOUT_BRICKED, Volume::LAYOUT_COMPRESSED }) {
+        Volume vol;
+        ToVolume(ref, layout, vol);
+        for (int viewType = 0; viewType < 3; ++viewType) {
+            int count = PlaneCount(vol, viewType);
+            std::vector<std::vector<int16_t>> planes;
+            for (int i = 0; i < count; ++i) planes.push_back(RefPlane(ref, viewType, i));
+            size_t n = planes[0].size();
+            std::vector<int16_t> out(n), expect(n);
+            SlabScratch scratch;
+            for (int m = 0; m < 3; ++m) {
+                SlabCache cache;
+                size_t bad = 0;
+                for (int thickness : { 2, 5, 16, 17, 33, 100 }) {
+                    for (int center : { 0, 1, count / 2, count - 2, count - 1 }) {
+                        int lo = std::clamp(center - (thickness - 1) / 2, 0, count - 1), hi = std::min(count, lo + thickness);
+                        for (size_t i = 0; i < n; ++i) {
+                            int64_t sum = 0;
+                            int16_t ext = planes[lo][i];
+                            for (int k = lo; k < hi; ++k) {
+                                sum += planes[k][i];
+                                ext = modes[m] == SLAB_MIP ? std::max(ext, planes[k][i]) : std::min(ext, planes[k][i]);
+                            }
+                            int64_t c = hi - lo;
+                            expect[i] = modes[m] != SLAB_AVERAGE ? ext : (int16_t)(sum >= 0 ? (sum + c / 2) / c : -((-sum + c / 2) / c));
+                        }
+                        ProjectSlab(vol, viewType, center, thickness, modes[m], out.data(), scratch);
+                        bad += CountMismatches(out.data(), expect.data(), n);
+                        ProjectSlab(vol, viewType, center, thickness, modes[m], out.data(), scratch, &cache);
+                        bad += CountMismatches(out.data(), expect.data(), n);
+                    }
+                }
+                Report(std::string(LayoutName(vol)) + " " + ViewName(viewType) + " " + names[m], bad);
+            }
+        }
+    }
+}
+
+// 斜め断面: 角度 0 は基準の断面と画素まで一致し、1 次式の場は回しても 3 線形で (丸めを除き) 正確に標本化される
+static void CheckOblique() {
+    std::printf("\n[check] oblique reslicing vs axis planes and a linear field\n");
+    const double spacing[3] = { 0.7, 0.8, 1.5 };
+    CheckVolume noise, field;
+    FillCheckVolume(noise, 37, 29, 45, 777u, -2048, 3071);
+    field = noise;
+    for (int z = 0; z < field.d; ++z)
+        for (int y = 0; y < field.h; ++y)
+            for (int x = 0; x < field.w; ++x) field.raw[((size_t)z * field.h + y) * field.w + x] = (int16_t)(3 * x + 2 * y + 5 * z - 1000);
+    for (Volume::Layout layout : { Volume::LAYOUT_LINEAR, Volume::LAYOUT_BRICKED, Volume::LAYOUT_COMPRESSED }) {
+        Volume vol;
+        ToVolume(noise, layout, vol);
+        for (int viewType = 0; viewType < 3; ++viewType) {
+            int w = 0, h = 0;
+            vol.PlaneSize(viewType, w, h);
+            std::vector<int16_t> out((size_t)w * h);
+            size_t bad = 0;
+            for (int index : { 0, PlaneCount(vol, viewType) / 3, PlaneCount(vol, viewType) - 1 }) {
+                double center[3] = { vol.Width() / 2.0, vol.Height() / 2.0, vol.Depth() / 2.0 };
+                center[viewType == 0 ? 2 : (viewType == 1 ? 1 : 0)] = index;
+                ObliquePlane plane = MakeObliquePlane(vol, viewType, center, 0, 0, spacing[0], spacing[1], spacing[2], w, h);
+                std::vector<int16_t> expect = RefPlane(noise, viewType, index);
+                for (bool trilinear : { false, true }) {
+                    ResliceOblique(vol, plane, w, h, trilinear, out.data());
+                    bad += CountMismatches(out.data(), expect.data(), out.size());
+                }
+            }
+            Report(std::string(LayoutName(vol)) + " " + ViewName(viewType) + " zero angle = axis plane", bad);
+        }
+
+        ToVolume(field, layout, vol);
+        const int outW = 61, outH = 53;
+        std::vector<int16_t> out((size_t)outW * outH);
+        const int dims[3] = { vol.Width(), vol.Height(), vol.Depth() };
+        for (int viewType = 0; viewType < 3; ++viewType) {
+            size_t bad = 0;
+            for (double tilt : { -60.0, 25.0 }) {
+                for (double spin : { -35.0, 50.0 }) {
+                    const double center[3] = { 17.3, 11.6, 23.9 };
+                    ObliquePlane p = MakeObliquePlane(vol, viewType, center, tilt, spin, spacing[0], spacing[1], spacing[2], outW, outH);
+                    ResliceOblique(vol, p, outW, outH, true, out.data());
+                    for (int y = 0; y < outH; ++y) {
+                        for (int i = 0; i < outW; ++i) {
+                            float f[3];
+                            bool inside = true, edge = false;
+                            for (int a = 0; a < 3; ++a) {
+                                f[a] = p.origin[a] + y * p.dv[a] + i * p.du[a];
+                                inside = inside && f[a] >= 0 && f[a] <= dims[a] - 1;
+                                edge = edge || std::fabs(f[a]) < 1e-3f || std::fabs(f[a] - (dims[a] - 1)) < 1e-3f;
+                            }
+                            int16_t v = out[(size_t)y * outW + i];
+                            if (edge) continue; // 境界上は丸め次第でどちらにもなる
+                            if (!inside) { bad += v != OBLIQUE_FILL; continue; }
+                            double expect = 3.0 * f[0] + 2.0 * f[1] + 5.0 * f[2] - 1000.0;
+                            bad += std::fabs(v - expect) > 0.51;
+                        }
+                    }
+                }
+            }
+            Report(std::string(LayoutName(vol)) + " " + ViewName(viewType) + " tilted trilinear on a linear field", bad);
+        }
+    }
+}
+
+// 圧縮形式: 全断面・ランダムな At・圧縮形式への書き込み・各形式の往復が素の画素と一致する (端数の大きさと int16 の全範囲で)
+static void CheckCompressed() {
+    std::printf("\n[check] compressed storage vs raw voxels\n");
+    struct Case { int w, h, d, lo, hi; };
+    const Case cases[] = { { 37, 29, 45, -32768, 32767 }, { 16, 16, 16, -1000, 3000 }, { 1, 1, 1, -32768, 32767 }, { 17, 33, 5, 0, 0 } };
+    for (const Case& c : cases) {
+        CheckVolume ref;
+        FillCheckVolume(ref, c.w, c.h, c.d, 4242u + c.w, c.lo, c.hi);
+        char size[64];
+        std::snprintf(size, sizeof(size), "%dx%dx%d [%d, %d]", c.w, c.h, c.d, c.lo, c.hi);
+        auto comparePlanes = [&](const Volume& vol) {
+            size_t bad = 0;
+            for (int viewType = 0; viewType < 3; ++viewType) {
+                for (int i = 0; i < PlaneCount(vol, viewType); ++i) {
+                    std::vector<int16_t> expect = RefPlane(ref, viewType, i), out(expect.size());
+                    vol.ExtractPlane(viewType, i, out.data());
+                    bad += CountMismatches(out.data(), expect.data(), out.size());
+                }
+            }
+            return bad;
+        };
+
+        Volume vol;
+        ToVolume(ref, Volume::LAYOUT_LINEAR, vol);
+        vol.SetLayout(Volume::LAYOUT_COMPRESSED);
+        Report(std::string(size) + " packed planes", comparePlanes(vol));
+        size_t bad = 0;
+        uint32_t seed = 99u;
+        for (int i = 0; i < 20000; ++i) {
+            seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+            int x = seed % c.w, y = (seed >> 8) % c.h, z = (seed >> 16) % c.d;
+            bad += vol.At(x, y, z) != ref.At(x, y, z);
+        }
+        Report(std::string(size) + " random At", bad);
+
+        Volume written;
+        ToVolume(ref, Volume::LAYOUT_COMPRESSED, written);
+        Report(std::string(size) + " WriteSlice into compressed", comparePlanes(written));
+
+        bad = 0;
+        const Volume::Layout trip[] = { Volume::LAYOUT_BRICKED, Volume::LAYOUT_COMPRESSED, Volume::LAYOUT_LINEAR,
+                                        Volume::LAYOUT_COMPRESSED, Volume::LAYOUT_BRICKED, Volume::LAYOUT_LINEAR };
+        for (Volume::Layout l : trip) {
+            vol.SetLayout(l);
+            bad += comparePlanes(vol);
+        }
+        Report(std::string(size) + " layout round trips", bad);
+    }
+}
+
+// 位置順の並べ替えと不等間隔の再標本化: 番号が逆順で、4 mm の抜けと同じ位置の撮り直しを含む 2 mm 間隔の合成シリーズ
+static void CheckSliceOrder() {
+    std::printf("\n[check] slice ordering, spacing and resampling\n");
+    const int w = 7, h = 5;
+    const double locations[] = { 0, 2, 4, 8, 10, 12, 4 }; // 最後は 4 mm の撮り直し (番号が大きい)
+    std::vector<SliceHeader> headers;
+    for (int i = 0; i < 7; ++i) {
+        SliceHeader s;
+        s.valid = true; s.seriesUID = "1.2.3"; s.rows = h; s.cols = w; s.thickness = 3.0;
+        s.instance = i + 1; // 足側から番号を振ってあるので、番号順は位置順の逆
+        s.hasPosition = true; s.location = locations[i];
+        headers.push_back(s);
+    }
+    std::vector<SeriesEntry> series = GroupSeries(headers);
+    const std::vector<SliceHeader>& slices = series.front().slices;
+    const int order[] = { 6, 5, 4, 3, 2, 1 }; // 頭側 (位置の大きい方) から。4 mm は番号の若い 3 を残す
+    size_t bad = series.size() != 1 || slices.size() != 6 || !series.front().byPosition;
+    for (size_t i = 0; i < slices.size() && i < 6; ++i) bad += slices[i].instance != order[i];
+    Report("position order, duplicate dropped", bad);
+
+    SliceSpacing spacing = MeasureSpacing(slices);
+    const double offsets[] = { 0, 2, 4, 8, 10, 12 };
+    bad = std::fabs(spacing.step - 2.0) > 1e-9 || spacing.uniform || spacing.offsets.size() != 6;
+    for (size_t i = 0; i < spacing.offsets.size() && i < 6; ++i) bad += std::fabs(spacing.offsets[i] - offsets[i]) > 1e-9;
+    Report("median spacing and offsets", bad);
+
+    std::vector<SliceHeader> unordered = slices;
+    unordered[2].hasPosition = false;
+    SliceSpacing fallback = MeasureSpacing(unordered);
+    Report("spacing falls back to SliceThickness", std::fabs(fallback.step - 3.0) > 1e-9 || !fallback.uniform);
+
+    // 画素は位置 (mm) の 1 次式なので、線形補間した各スライスは正確にその位置の値になる
+    Volume src, dst;
+    src.Reset(w, h, 6, Volume::LAYOUT_BRICKED);
+    std::vector<int16_t> plane((size_t)w * h);
+    auto fill = [&](double location) {
+        for (int y = 0; y < h; ++y) for (int x = 0; x < w; ++x) plane[(size_t)y * w + x] = (int16_t)(location * 10 + x + 3 * y);
+    };
+    for (int z = 0; z < 6; ++z) { fill(slices[z].location); src.WriteSlice(z, plane.data()); }
+    ResampleSlices(src, spacing.offsets, spacing.step, dst);
+    bad = dst.Depth() != 7;
+    for (int z = 0; z < dst.Depth() && !bad; ++z) {
+        fill(12.0 - 2.0 * z);
+        bad += CountMismatches(dst.SliceData(z), plane.data(), plane.size());
+    }
+    Report("6 uneven slices resampled to 7", bad);
+}
+
+// ボリュームレンダリング: 空間の読み飛ばしは画像を変えない。粗い 1 枚に仕上げの行の帯を重ねた結果も、一度に描いた仕上げと一致する
+static void CheckRaycast() {
+    std::printf("\n[check] raycast with and without empty-space skipping\n");
+    Volume vol;
+    vol.Reset(53, 47, 39, Volume::LAYOUT_LINEAR);
+    FillSynthetic(vol);
+    const int outW = 70, outH = 58;
+    const size_t bytes = (size_t)outW * outH * 3;
+    std::vector<unsigned char> skip(bytes), plain(bytes), split(bytes);
+    static const char* names[VRT_PRESET_COUNT] = { "bone", "soft tissue", "skin" };
+    const double angles[][2] = { { 0, 0 }, { 37, 20 }, { 200, -45 }, { 95, 80 } };
+    long revision = 0;
+    for (Volume::Layout layout : { Volume::LAYOUT_LINEAR, Volume::LAYOUT_BRICKED, Volume::LAYOUT_COMPRESSED }) {
+        vol.SetLayout(layout);
+        VolumeRaycaster raycaster;
+        raycaster.Prepare(vol, ++revision);
+        for (int preset = 0; preset < VRT_PRESET_COUNT; ++preset) {
+            const VrtTransfer& tf = VrtPresetTransfer(preset);
+            size_t bad = 0;
+            for (const auto& a : angles) {
+                VrtCamera cam;
+                cam.yaw = a[0]; cam.pitch = a[1];
+                VrtView view = MakeVrtView(vol, 0.7, 0.8, 1.5, cam, outW, outH);
+                for (int step : { VRT_COARSE, 1 }) { // plain は仕上げの 1 枚で終わる (下の比較に使う)
+                    raycaster.Render(vol, view, tf, outW, outH, 0, outH, step, skip.data());
+                    raycaster.Render(vol, view, tf, outW, outH, 0, outH, step, plain.data(), false);
+                    for (size_t i = 0; i < bytes; ++i) bad += skip[i] != plain[i];
+                }
+                raycaster.Render(vol, view, tf, outW, outH, 0, outH, VRT_COARSE, split.data());
+                raycaster.Render(vol, view, tf, outW, outH, 0, 23, 1, split.data());
+                raycaster.Render(vol, view, tf, outW, outH, 23, outH, 1, split.data());
+                for (size_t i = 0; i < bytes; ++i) bad += split[i] != plain[i];
+                bad += std::count(plain.begin(), plain.end(), VRT_BACKGROUND) == (ptrdiff_t)bytes; // 何も写っていなければ比べていないのと同じ
+            }
+            Report(std::string(LayoutName(vol)) + " " + names[preset], bad);
+        }
+    }
+}
+
+static int RunChecks() {
+    CheckSlab();
+    CheckOblique();
+    CheckCompressed();
+    CheckSliceOrder();
+    CheckRaycast();
+    std::printf("\ncheck: %s\n", checkFailures ? "FAILED" : "all passed");
+    return checkFailures ? 1 : 0;
+}
+
+static void BenchSynthetic(const BenchOptions& opt) {
+    for (int depth : opt.depths) {
+        Volume vol;
+        Clock::time_point start = Clock::now();
+        vol.Reset(opt.size, opt.size, depth, Volume::LAYOUT_LINEAR);
+        FillSynthetic(vol);
+        std::printf("\n[synthetic] %dx%dx%d generated in %.1f ms\n", opt.size, opt.size, depth, ElapsedMs(start));
+        BenchHistogram(vol);
+        BenchRender("synthetic", vol, 0.7, 0.7, 1.0, opt);
+        BenchPyramid(vol, 0.7, 0.7, 1.0, opt);
+        BenchSlab(vol, 0.7, 0.7, 1.0, opt);
+        BenchOblique(vol, 0.7, 0.7, 1.0, opt);
+        BenchRaycast(vol, 0.7, 0.7, 1.0, opt);
+        if (opt.bricked) {
+            vol.SetLayout(Volume::LAYOUT_BRICKED);
+            BenchRender("synthetic", vol, 0.7, 0.7, 1.0, opt);
+            BenchSlab(vol, 0.7, 0.7, 1.0, opt);
+            BenchOblique(vol, 0.7, 0.7, 1.0, opt);
+        }
+        if (opt.compressed) {
+            BenchCompress(vol);
+            BenchRender("synthetic", vol, 0.7, 0.7, 1.0, opt);
+            BenchSlab(vol, 0.7, 0.7, 1.0, opt);
+            BenchOblique(vol, 0.7, 0.7, 1.0, opt);
+        }
+    }
+}
+
+// OnLoadBtn と同じ順 (キー計算 → ヘッダ走査 → シリーズ選択 → 並列展開) で実データを読む
+static int BenchFolder(const BenchOptions& opt) {
+    namespace fs = std::filesystem;
+    std::vector<std::string> paths;
+    std::error_code ec;
+    for (fs::directory_iterator it(opt.dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_regular_file() && IsDicomFileName(it->path())) paths.push_back(it->path().string());
+    }
+    if (paths.empty()) { std::fprintf(stderr, "no *.dcm files in %s\n", opt.dir.c_str()); return 1; }
+    std::printf("\n[load] %s  %zu files  (run twice to compare cold and warm file cache)\n", opt.dir.c_str(), paths.size());
+
+    Clock::time_point start = Clock::now();
+    VolumeCache::MakeKey(paths);
+    std::printf("  cache key   %10.1f ms\n", ElapsedMs(start));
+
+    start = Clock::now();
+    std::vector<SliceHeader> headers = ScanHeaders(paths);
+    double scanMs = ElapsedMs(start);
+    std::printf("  scan        %10.1f ms  (%.1f us/file)\n", scanMs, scanMs * 1000.0 / paths.size());
+    if (headers.size() != paths.size()) std::printf("  frames      %10zu  (multi-frame files expanded)\n", headers.size());
+
+    start = Clock::now();
+    std::vector<SliceHeader> slices = SelectLargestSeries(headers);
+    std::printf("  select      %10.1f ms\n", ElapsedMs(start));
+    if (slices.empty()) { std::fprintf(stderr, "no readable series\n"); return 1; }
+    SliceHeader first = slices.front();
+    if (first.color) { std::fprintf(stderr, "color series are not supported\n"); return 1; }
+    int depth = (int)slices.size();
+    SliceSpacing spacing = MeasureSpacing(slices);
+    std::printf("  spacing     %10.3f mm  (%s, SliceThickness %.3f mm)\n", spacing.step,
+                spacing.uniform ? "uniform" : "non-uniform", first.thickness);
+
+    Volume vol;
+    vol.Reset(first.cols, first.rows, depth, opt.bricked ? Volume::LAYOUT_BRICKED : Volume::LAYOUT_LINEAR);
+    std::promise<int> done;
+    VolumeLoader loader;
+    ValueHistogram histogram;
+    double wc = first.windowCenter, ww = first.windowWidth;
+    start = Clock::now();
+    loader.Start(std::move(slices), &vol, nullptr, [&done](int count) { done.set_value(count); }, &histogram);
+    int loaded = done.get_future().get();
+    double decodeMs = ElapsedMs(start);
+    double mb = (double)first.cols * first.rows * depth * sizeof(int16_t) / (1024.0 * 1024.0);
+    std::printf("  decode      %10.1f ms  (%d/%d slices, %.2f ms/slice, %.0f MB/s)\n",
+                decodeMs, loaded, depth, decodeMs / std::max(1, depth), mb / std::max(decodeMs / 1000.0, 1e-9));
+    PrintRange(histogram);
+    if (ww > 0.0) std::printf("  dataset window  WL %.0f / WW %.0f\n", wc, ww);
+    if (!spacing.uniform) {
+        Volume uniform;
+        start = Clock::now();
+        ResampleSlices(vol, spacing.offsets, spacing.step, uniform);
+        std::printf("  resample    %10.1f ms  (%d -> %d slices)\n", ElapsedMs(start), depth, uniform.Depth());
+        vol = std::move(uniform);
+    }
+    first.thickness = spacing.step;
+
+    BenchRender("real", vol, first.pxSpcX, first.pxSpcY, first.thickness, opt);
+    BenchPyramid(vol, first.pxSpcX, first.pxSpcY, first.thickness, opt);
+    BenchSlab(vol, first.pxSpcX, first.pxSpcY, first.thickness, opt);
+    BenchOblique(vol, first.pxSpcX, first.pxSpcY, first.thickness, opt);
+    BenchRaycast(vol, first.pxSpcX, first.pxSpcY, first.thickness, opt);
+    if (opt.compressed) {
+        BenchCompress(vol);
+        BenchRender("real", vol, first.pxSpcX, first.pxSpcY, first.thickness, opt);
+        BenchOblique(vol, first.pxSpcX, first.pxSpcY, first.thickness, opt);
+    }
+    return 0;
+}
+
+// 最も枚数の多いシリーズを接続数を変えて取り寄せる。ビューアーと同じくファイルには書かない
+static int BenchPacs(const BenchOptions& opt) {
+    std::printf("\n[pacs] %s@%s:%d  study %s\n", opt.pacs.calledAE.c_str(), opt.pacs.host.c_str(), opt.pacs.port, opt.study.c_str());
+    Clock::time_point start = Clock::now();
+    std::vector<SliceHeader> headers;
+    std::string error;
+    if (!FindPacsStudy(opt.pacs, opt.study, opt.series, headers, error)) { std::fprintf(stderr, "%s\n", error.c_str()); return 1; }
+    std::printf("  query       %10.1f ms  (%zu slices)\n", ElapsedMs(start), headers.size());
+    std::vector<SeriesEntry> series = GroupSeries(headers);
+    int best = LargestSeries(series);
+    if (best < 0) { std::fprintf(stderr, "no readable series\n"); return 1; }
+    const std::vector<SliceHeader>& slices = series[best].slices;
+    int w = slices.front().cols, h = slices.front().rows, depth = (int)slices.size();
+    double mb = (double)w * h * depth * sizeof(int16_t) / (1024.0 * 1024.0);
+    for (int conns : opt.connections) {
+        Volume vol;
+        vol.Reset(w, h, depth, Volume::LAYOUT_LINEAR);
+        std::promise<int> done;
+        std::atomic<bool> first{false};
+        double firstMs = 0;
+        PacsLoader loader;
+        start = Clock::now();
+        loader.Start(opt.pacs, opt.study, slices, &vol, conns,
+                     [&](int) { if (!first.exchange(true)) firstMs = ElapsedMs(start); },
+                     [&done](int count) { done.set_value(count); });
+        int loaded = done.get_future().get();
+        double totalMs = ElapsedMs(start);
+        std::printf("  retrieve x%-2d %8.1f ms  (first slice %.1f ms, %d/%d slices, %.0f MB/s)%s%s\n", conns, totalMs, firstMs, loaded, depth,
+                    mb / std::max(totalMs / 1000.0, 1e-9), loader.Error().empty() ? "" : "  ", loader.Error().c_str());
+    }
+    return 0;
+}
+
+static bool ParseArgs(int argc, char** argv, BenchOptions& opt) {
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto next = [&]() -> const char* { return i + 1 < argc ? argv[++i] : nullptr; };
+        const char* v = nullptr;
+        if (a == "--bricked") { opt.bricked = true; continue; }
+        if (a == "--size" && (v = next())) { opt.size = std::max(1, std::atoi(v)); continue; }
+        if (a == "--iters" && (v = next())) { opt.iters = std::max(1, std::atoi(v)); continue; }
+        if (a == "--slab" && (v = next())) { opt.slab = std::max(0, std::atoi(v)); continue; }
+        if (a == "--oblique") { opt.oblique = true; continue; }
+        if (a == "--raycast") { opt.raycast = true; continue; }
+        if (a == "--check") { opt.check = true; continue; }
+        if (a == "--compressed") { opt.compressed = true; continue; }
+        if (a == "--dir" && (v = next())) { opt.dir = v; continue; }
+        if (a == "--trace" && (v = next())) { opt.trace = v; continue; }
+        if (a == "--pacs" && (v = next())) {
+            char ae[65] = {}, host[256] = {};
+            if (std::sscanf(v, "%64[^@]@%255[^:]:%d", ae, host, &opt.pacs.port) != 3) return false;
+            opt.pacs.calledAE = ae; opt.pacs.host = host;
+            continue;
+        }
+        if (a == "--study" && (v = next())) { opt.study = v; continue; }
+        if (a == "--series" && (v = next())) { opt.series = v; continue; }
+        if (a == "--connections" && (v = next())) {
+            opt.connections.clear();
+            std::stringstream ss(v);
+            std::string item;
+            while (std::getline(ss, item, ',')) if (std::atoi(item.c_str()) > 0) opt.connections.push_back(std::atoi(item.c_str()));
+            continue;
+        }
+        if (a == "--box" && (v = next())) {
+            if (std::sscanf(v, "%dx%d", &opt.boxW, &opt.boxH) != 2 || opt.boxW <= 0 || opt.boxH <= 0) return false;
+            continue;
+        }
+        if (a == "--depths" && (v = next())) {
+            opt.depths.clear();
+            std::stringstream ss(v);
+            std::string item;
+            while (std::getline(ss, item, ',')) if (std::atoi(item.c_str()) > 0) opt.depths.push_back(std::atoi(item.c_str()));
+            continue;
+        }
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opt;
+    if (!ParseArgs(argc, argv, opt)) {
+        std::fprintf(stderr, "usage: %s [--size N] [--depths 100,500,2000] [--box WxH] [--iters N] [--bricked] [--compressed] [--slab N] [--oblique] [--raycast] [--dir <DICOM folder>] [--trace <out.json>]\n"
+                             "       %s --check\n"
+                             "       %s --pacs AE@host:port --study <StudyInstanceUID> [--series <SeriesInstanceUID>] [--connections 1,4]\n", argv[0], argv[0], argv[0]);
+        return 2;
+    }
+    if (!VerifyWindowKernels()) { std::fprintf(stderr, "SIMD window kernels disagree with the scalar reference\n"); return 1; }
+    std::printf("threads: %u\n", ThreadPool::Shared().Size());
+    if (!opt.trace.empty()) Profiler::Get().SetTracing(true);
+    int rc = 0;
+    if (opt.check) rc = RunChecks();
+    else if (!opt.study.empty()) rc = BenchPacs(opt);
+    else if (!opt.dir.empty()) rc = BenchFolder(opt);
+    else BenchSynthetic(opt);
+    if (!opt.trace.empty()) {
+        Profiler& prof = Profiler::Get();
+        prof.SetTracing(false);
+        if (!prof.WriteChromeTrace(opt.trace)) { std::fprintf(stderr, "cannot write %s\n", opt.trace.c_str()); return 1; }
+        std::printf("\ntrace: %zu events -> %s", prof.EventCount(), opt.trace.c_str());
+        if (prof.Dropped()) std::printf(" (%zu dropped)", prof.Dropped());
+        std::printf("\n");
+    }
+    return rc;
+}
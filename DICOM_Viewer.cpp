@@ -1,582 +1,2742 @@
-#include <wx/wx.h>
-#include <wx/slider.h>
-#include <wx/choice.h>
-#include <wx/dir.h>
-#include <wx/progdlg.h>
-#include <wx/dcbuffer.h>
-#include <wx/splitter.h>
-#include <vector>
-#include <map>
-#include <algorithm>
-#include <cmath>
-#include <sstream>
-#include <functional>
-
-// DCMTK headers
-#include "dcmtk/dcmdata/dctk.h"
-#include "dcmtk/dcmimgle/dcmimage.h"
-
-// --- 定数カラー定義 ---
-const wxColour COL_AXIAL(255, 50, 50);     // Red
-const wxColour COL_CORONAL(50, 255, 50);   // Green
-const wxColour COL_SAGITTAL(50, 100, 255); // Blue
-
-// --- 描画用パネル ---
-class ImagePanel : public wxPanel {
-    wxBitmap displayedBitmap;
-    int viewType; // 0:Axial, 1:Coronal, 2:Sagittal
-    double crossX = -1.0;
-    double crossY = -1.0;
-    bool isJapanese = false; // デフォルト英語
-
-    wxColour borderColor;
-    wxColour vLineColor;
-    wxColour hLineColor;
-
-    std::function<void(int)> onClickCallback;
-    std::function<void(int, int)> onWheelCallback;
-
-public:
-    ImagePanel(wxWindow* parent, int type, 
-               std::function<void(int)> clickCb, 
-               std::function<void(int, int)> wheelCb) 
-        : wxPanel(parent, wxID_ANY), viewType(type), onClickCallback(clickCb), onWheelCallback(wheelCb)
-    {
-        SetBackgroundStyle(wxBG_STYLE_PAINT);
-        SetBackgroundColour(wxColour(20, 20, 20)); 
-
-        switch(viewType) {
-            case 0: // Axial
-                borderColor = COL_AXIAL;
-                vLineColor = COL_SAGITTAL; hLineColor = COL_CORONAL;
-                break;
-            case 1: // Coronal
-                borderColor = COL_CORONAL;
-                vLineColor = COL_SAGITTAL; hLineColor = COL_AXIAL;
-                break;
-            case 2: // Sagittal
-                borderColor = COL_SAGITTAL;
-                vLineColor = COL_CORONAL; hLineColor = COL_AXIAL;
-                break;
-        }
-
-        Bind(wxEVT_PAINT, &ImagePanel::OnPaint, this);
-        Bind(wxEVT_SIZE, &ImagePanel::OnSize, this);
-        Bind(wxEVT_LEFT_DOWN, &ImagePanel::OnMouseClick, this);
-        Bind(wxEVT_MOUSEWHEEL, &ImagePanel::OnMouseWheel, this);
-    }
-
-    void SetLanguage(bool jp) {
-        isJapanese = jp;
-        Refresh(false);
-    }
-
-    void SetImage(const wxImage& img, double cx, double cy) {
-        if (!img.IsOk()) return;
-        displayedBitmap = wxBitmap(img);
-        crossX = cx;
-        crossY = cy;
-        Refresh(false);
-        Update();
-    }
-
-    void OnMouseClick(wxMouseEvent& evt) {
-        SetFocus();
-        if (onClickCallback) onClickCallback(viewType);
-        evt.Skip();
-    }
-
-    void OnMouseWheel(wxMouseEvent& evt) {
-        if (onWheelCallback) {
-            int rotation = evt.GetWheelRotation();
-            int direction = (rotation > 0) ? 1 : -1;
-            onWheelCallback(viewType, direction);
-        }
-        evt.Skip();
-    }
-
-    void OnPaint(wxPaintEvent&) {
-        wxAutoBufferedPaintDC dc(this);
-        dc.SetBackground(wxBrush(GetBackgroundColour()));
-        dc.Clear();
-
-        wxSize panelSize = GetClientSize();
-        int x = 0, y = 0, w = 0, h = 0;
-        if (displayedBitmap.IsOk()) {
-            wxSize bmpSize = displayedBitmap.GetSize();
-            w = bmpSize.x; h = bmpSize.y;
-            x = (panelSize.x - w) / 2; y = (panelSize.y - h) / 2;
-            if (x < 0) x = 0; if (y < 0) y = 0;
-            dc.DrawBitmap(displayedBitmap, x, y, false);
-        }
-
-        wxPen borderPen(borderColor, 3, wxPENSTYLE_SOLID);
-        dc.SetPen(borderPen);
-        dc.SetBrush(*wxTRANSPARENT_BRUSH);
-        dc.DrawRectangle(1, 1, panelSize.x - 2, panelSize.y - 2);
-
-        if (displayedBitmap.IsOk() && crossX >= 0 && crossY >= 0) {
-            int lineX = x + (int)(w * crossX);
-            int lineY = y + (int)(h * crossY);
-            if (lineX >= x && lineX < x + w && lineY >= y && lineY < y + h) {
-                dc.SetPen(wxPen(vLineColor, 1, wxPENSTYLE_SOLID));
-                dc.DrawLine(lineX, y, lineX, y + h);
-                dc.SetPen(wxPen(hLineColor, 1, wxPENSTYLE_SOLID));
-                dc.DrawLine(x, lineY, x + w, lineY);
-            }
-        }
-        
-        dc.SetFont(wxFont(11, wxFONTFAMILY_DEFAULT, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_BOLD));
-        wxString label;
-        if (isJapanese) {
-            switch(viewType) {
-                case 0: label = L"Axial (上から)"; break;
-                case 1: label = L"Coronal (正面から)"; break;
-                case 2: label = L"Sagittal (横から)"; break;
-            }
-        } else {
-            switch(viewType) {
-                case 0: label = L"Axial (Top)"; break;
-                case 1: label = L"Coronal (Front)"; break;
-                case 2: label = L"Sagittal (Side)"; break;
-            }
-        }
-
-        dc.SetTextForeground(*wxBLACK);
-        dc.DrawText(label, 11, 11); 
-        dc.SetTextForeground(borderColor);
-        dc.DrawText(label, 10, 10);
-    }
-
-    void OnSize(wxSizeEvent& evt) {
-        Refresh(false);
-        evt.Skip();
-    }
-};
-
-class MainFrame : public wxFrame {
-public:
-    MainFrame() : wxFrame(NULL, wxID_ANY, L"DICOM Viewer", wxDefaultPosition, wxSize(1280, 900)) {
-        SetBackgroundColour(wxColour(30, 30, 30));
-
-        // --- Menu Bar ---
-        wxMenuBar* menuBar = new wxMenuBar();
-        
-        wxMenu* fileMenu = new wxMenu();
-        fileMenu->Append(wxID_OPEN, L"Open Folder");
-        fileMenu->Append(wxID_EXIT, L"Exit");
-        menuBar->Append(fileMenu, L"File");
-
-        wxMenu* viewMenu = new wxMenu();
-        viewMenu->Append(1010, L"Show/Hide Controls\tF11");
-        menuBar->Append(viewMenu, L"View");
-
-        wxMenu* langMenu = new wxMenu();
-        langMenu->AppendRadioItem(1001, L"English");
-        langMenu->AppendRadioItem(1002, L"日本語");
-        langMenu->Check(1001, true); 
-        menuBar->Append(langMenu, L"Language");
-
-        SetMenuBar(menuBar);
-        
-        Bind(wxEVT_MENU, &MainFrame::OnLoadBtn, this, wxID_OPEN);
-        Bind(wxEVT_MENU, [this](wxCommandEvent&){ Close(); }, wxID_EXIT);
-        Bind(wxEVT_MENU, &MainFrame::OnLanguageChange, this, 1001);
-        Bind(wxEVT_MENU, &MainFrame::OnLanguageChange, this, 1002);
-        Bind(wxEVT_MENU, &MainFrame::OnToggleControls, this, 1010);
-
-        // --- Layout ---
-        rootSizer = new wxBoxSizer(wxHORIZONTAL);
-        imageAreaSizer = new wxBoxSizer(wxVERTICAL);
-        bottomSizer = new wxBoxSizer(wxHORIZONTAL);
-
-        auto clickCb = [this](int type){ this->SwitchLayout(type); };
-        auto wheelCb = [this](int type, int dir){ this->OnPanelWheel(type, dir); };
-
-        panelAxial = new ImagePanel(this, 0, clickCb, wheelCb);
-        panelCoronal = new ImagePanel(this, 1, clickCb, wheelCb);
-        panelSagittal = new ImagePanel(this, 2, clickCb, wheelCb);
-
-        SwitchLayout(0);
-        rootSizer->Add(imageAreaSizer, 1, wxEXPAND | wxALL, 0);
-
-        // --- Control Panel ---
-        sidePanel = new wxPanel(this, wxID_ANY);
-        sidePanel->SetBackgroundColour(wxColour(40, 40, 40));
-        sidePanel->SetMinSize(wxSize(320, -1));
-        
-        wxBoxSizer* sideSizer = new wxBoxSizer(wxVERTICAL);
-
-        loadBtn = new wxButton(sidePanel, wxID_ANY, L"Open Folder");
-        sideSizer->Add(loadBtn, 0, wxEXPAND | wxALL, 10);
-
-        infoText = new wxTextCtrl(sidePanel, wxID_ANY, "", wxDefaultPosition, wxSize(-1, 120), wxTE_MULTILINE | wxTE_READONLY);
-        infoText->SetBackgroundColour(*wxWHITE);
-        infoText->SetForegroundColour(*wxBLACK);
-        sideSizer->Add(infoText, 0, wxEXPAND | wxALL, 10);
-
-        // Sliders
-        labelZ = new wxStaticText(sidePanel, wxID_ANY, ""); 
-        ConfigureLabel(labelZ, COL_AXIAL); sideSizer->Add(labelZ, 0, wxLEFT | wxTOP, 10);
-        
-        sliderZ = new wxSlider(sidePanel, wxID_ANY, 0, 0, 1, wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL | wxSL_LABELS);
-        sliderZ->SetForegroundColour(*wxWHITE); sideSizer->Add(sliderZ, 0, wxEXPAND | wxALL, 5);
-
-        labelY = new wxStaticText(sidePanel, wxID_ANY, ""); 
-        ConfigureLabel(labelY, COL_CORONAL); sideSizer->Add(labelY, 0, wxLEFT | wxTOP, 10);
-
-        sliderY = new wxSlider(sidePanel, wxID_ANY, 0, 0, 1, wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL | wxSL_LABELS);
-        sliderY->SetForegroundColour(*wxWHITE); sideSizer->Add(sliderY, 0, wxEXPAND | wxALL, 5);
-
-        labelX = new wxStaticText(sidePanel, wxID_ANY, ""); 
-        ConfigureLabel(labelX, COL_SAGITTAL); sideSizer->Add(labelX, 0, wxLEFT | wxTOP, 10);
-
-        sliderX = new wxSlider(sidePanel, wxID_ANY, 0, 0, 1, wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL | wxSL_LABELS);
-        sliderX->SetForegroundColour(*wxWHITE); sideSizer->Add(sliderX, 0, wxEXPAND | wxALL, 5);
-
-        // Quality
-        labelWL = new wxStaticText(sidePanel, wxID_ANY, "");
-        ConfigureLabel(labelWL, *wxWHITE); sideSizer->Add(labelWL, 0, wxLEFT | wxTOP, 20);
-
-        wlSlider = new wxSlider(sidePanel, wxID_ANY, 40, -1000, 3000, wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL | wxSL_LABELS);
-        wlSlider->SetForegroundColour(*wxWHITE);
-        wwSlider = new wxSlider(sidePanel, wxID_ANY, 400, 1, 4000, wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL | wxSL_LABELS);
-        wwSlider->SetForegroundColour(*wxWHITE);
-        sideSizer->Add(wlSlider, 0, wxEXPAND | wxALL, 5);
-        sideSizer->Add(wwSlider, 0, wxEXPAND | wxALL, 5);
-        
-        // リセットボタン (最初から有効化 + 黒文字)
-        resetBtn = new wxButton(sidePanel, wxID_ANY, L"Reset");
-        resetBtn->SetForegroundColour(*wxBLACK); // 文字色を黒に
-        resetBtn->Enable(true); // ★修正：最初から有効化
-        sideSizer->Add(resetBtn, 0, wxEXPAND | wxALL, 15);
-
-        hintLabel = new wxStaticText(sidePanel, wxID_ANY, "", wxDefaultPosition, wxDefaultSize, wxALIGN_CENTER);
-        hintLabel->SetForegroundColour(wxColour(200, 200, 200));
-        sideSizer->Add(hintLabel, 0, wxALL | wxEXPAND, 15);
-
-        sidePanel->SetSizer(sideSizer);
-        rootSizer->Add(sidePanel, 0, wxEXPAND | wxALL, 0); 
-        SetSizer(rootSizer);
-
-        // Binds
-        loadBtn->Bind(wxEVT_BUTTON, &MainFrame::OnLoadBtn, this);
-        resetBtn->Bind(wxEVT_BUTTON, &MainFrame::OnResetBtn, this);
-
-        auto BindS = [&](wxSlider* s, void (MainFrame::*f)(wxCommandEvent&), void (MainFrame::*g)(wxScrollEvent&)) {
-            s->Bind(wxEVT_SLIDER, f, this);
-            s->Bind(wxEVT_SCROLL_THUMBTRACK, g, this);
-        };
-        BindS(sliderX, &MainFrame::OnSliceChange, &MainFrame::OnSliceChangeRaw);
-        BindS(sliderY, &MainFrame::OnSliceChange, &MainFrame::OnSliceChangeRaw);
-        BindS(sliderZ, &MainFrame::OnSliceChange, &MainFrame::OnSliceChangeRaw);
-        BindS(wlSlider, &MainFrame::OnSliceChange, &MainFrame::OnSliceChangeRaw);
-        BindS(wwSlider, &MainFrame::OnSliceChange, &MainFrame::OnSliceChangeRaw);
-
-        EnableControls(false); 
-        // ★修正: リセットボタンだけは常に有効にしておく（ガード処理済み）
-        resetBtn->Enable(true); 
-        
-        UpdateUIText(); 
-    }
-
-private:
-    struct SliceRaw { int instance; std::vector<int16_t> pixels; };
-    std::vector<int16_t> volumeData;
-    int volWidth = 0, volHeight = 0, volDepth = 0;
-    double pxSpcX = 1.0, pxSpcY = 1.0, sliceThick = 1.0;
-    bool isJapanese = false; 
-
-    wxString patientName = "Unknown";
-    wxString patientID = "Unknown";
-
-    wxBoxSizer *rootSizer, *imageAreaSizer, *bottomSizer;
-    wxPanel* sidePanel;
-    ImagePanel *panelAxial, *panelCoronal, *panelSagittal;
-    
-    wxButton *loadBtn, *resetBtn;
-    wxTextCtrl* infoText;
-    wxStaticText *labelX, *labelY, *labelZ, *labelWL, *hintLabel;
-    wxSlider *sliderX, *sliderY, *sliderZ, *wlSlider, *wwSlider;
-
-    void ConfigureLabel(wxStaticText* t, const wxColour& col) {
-        t->SetForegroundColour(col);
-        t->SetFont(wxFont(9, wxFONTFAMILY_DEFAULT, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_BOLD));
-    }
-
-    void OnToggleControls(wxCommandEvent&) {
-        if (sidePanel->IsShown()) sidePanel->Hide();
-        else sidePanel->Show();
-        rootSizer->Layout();
-    }
-
-    void OnLanguageChange(wxCommandEvent& evt) {
-        if (evt.GetId() == 1001) isJapanese = false;
-        else isJapanese = true;
-        UpdateUIText();
-    }
-
-    // リセット処理 (データがないときは何もしない安全装置付き)
-    void OnResetBtn(wxCommandEvent&) {
-        if (volumeData.empty()) return;
-        
-        sliderX->SetValue(sliderX->GetMax() / 2);
-        sliderY->SetValue(sliderY->GetMax() / 2);
-        sliderZ->SetValue(sliderZ->GetMax() / 2);
-
-        wlSlider->SetValue(40);
-        wwSlider->SetValue(400);
-
-        UpdateAllViews();
-    }
-
-    void UpdateUIText() {
-        panelAxial->SetLanguage(isJapanese);
-        panelCoronal->SetLanguage(isJapanese);
-        panelSagittal->SetLanguage(isJapanese);
-
-        if (isJapanese) {
-            SetTitle(L"DICOM ビューアー");
-            loadBtn->SetLabel(L"フォルダを開く");
-            resetBtn->SetLabel(L"リセット");
-            infoText->SetValue(infoText->GetValue().IsEmpty() ? L"データなし" : GetInfoString());
-            labelZ->SetLabel(L"Axial 位置 (Z) - 赤枠");
-            labelY->SetLabel(L"Coronal 位置 (Y) - 緑枠");
-            labelX->SetLabel(L"Sagittal 位置 (X) - 青枠");
-            labelWL->SetLabel(L"ウィンドウレベル / 幅 (明るさ・コントラスト)");
-            hintLabel->SetLabel(L"ヒント: 下の画像をクリックすると\n上のメイン画面と入れ替わります");
-        } else {
-            SetTitle(L"DICOM Viewer");
-            loadBtn->SetLabel(L"Open Folder");
-            resetBtn->SetLabel(L"Reset");
-            infoText->SetValue(infoText->GetValue().IsEmpty() ? L"No Data" : GetInfoString());
-            labelZ->SetLabel(L"Axial Slice (Z) - Red Frame");
-            labelY->SetLabel(L"Coronal Slice (Y) - Green Frame");
-            labelX->SetLabel(L"Sagittal Slice (X) - Blue Frame");
-            labelWL->SetLabel(L"Window Level / Width");
-            hintLabel->SetLabel(L"Hint: Click a bottom image to\nswap it with the main view.");
-        }
-        Layout();
-    }
-
-    wxString GetInfoString() {
-        std::stringstream ss;
-        if (isJapanese) {
-            ss << "名前: " << patientName << "\r\nID: " << patientID << "\r\n";
-            ss << "サイズ: " << volWidth << " x " << volHeight << "\r\n";
-            ss << "スライス数: " << volDepth << "\r\n";
-            ss << "スライス厚: " << sliceThick << " mm";
-        } else {
-            ss << "Name: " << patientName << "\r\nID: " << patientID << "\r\n";
-            ss << "Size: " << volWidth << " x " << volHeight << "\r\n";
-            ss << "Slices: " << volDepth << "\r\n";
-            ss << "Thickness: " << sliceThick << " mm";
-        }
-        return wxString::FromUTF8(ss.str().c_str());
-    }
-
-    void SwitchLayout(int mainViewType) {
-        imageAreaSizer->Detach(bottomSizer);
-        imageAreaSizer->Clear(false); bottomSizer->Clear(false);
-        ImagePanel *mainP=nullptr, *sub1=nullptr, *sub2=nullptr;
-
-        if (mainViewType == 0) { mainP = panelAxial; sub1 = panelCoronal; sub2 = panelSagittal; }
-        else if (mainViewType == 1) { mainP = panelCoronal; sub1 = panelAxial; sub2 = panelSagittal; }
-        else { mainP = panelSagittal; sub1 = panelAxial; sub2 = panelCoronal; }
-
-        imageAreaSizer->Add(mainP, 3, wxEXPAND | wxALL, 2);
-        bottomSizer->Add(sub1, 1, wxEXPAND | wxALL, 2);
-        bottomSizer->Add(sub2, 1, wxEXPAND | wxALL, 2);
-        imageAreaSizer->Add(bottomSizer, 2, wxEXPAND | wxALL, 2);
-        Layout(); Refresh();
-    }
-
-    void OnPanelWheel(int viewType, int direction) {
-        if (volumeData.empty()) return;
-        wxSlider* targetSlider = nullptr;
-        if (viewType == 0) targetSlider = sliderZ; 
-        else if (viewType == 1) targetSlider = sliderY; 
-        else targetSlider = sliderX; 
-
-        if (targetSlider) {
-            int val = targetSlider->GetValue();
-            val += direction;
-            if (val < targetSlider->GetMin()) val = targetSlider->GetMin();
-            if (val > targetSlider->GetMax()) val = targetSlider->GetMax();
-            targetSlider->SetValue(val);
-            UpdateAllViews(); 
-        }
-    }
-
-    void EnableControls(bool enable) {
-        sliderX->Enable(enable); sliderY->Enable(enable); sliderZ->Enable(enable);
-        wlSlider->Enable(enable); wwSlider->Enable(enable);
-        // resetBtnは常に有効なのでここでは触らない
-    }
-
-    void OnLoadBtn(wxCommandEvent&) {
-        wxDirDialog dlg(this, isJapanese ? L"DICOMフォルダを選択" : L"Select DICOM Folder");
-        if (dlg.ShowModal() != wxID_OK) return;
-        wxArrayString files;
-        wxDir::GetAllFiles(dlg.GetPath(), &files, "*.dcm", wxDIR_FILES);
-        if (files.IsEmpty()) return;
-
-        std::map<std::string, std::vector<std::string>> seriesMap;
-        wxProgressDialog scanner(isJapanese ? L"スキャン中" : L"Scanning", 
-                                 isJapanese ? L"シリーズを分類しています..." : L"Grouping Series...", 
-                                 files.GetCount(), this, wxPD_APP_MODAL | wxPD_AUTO_HIDE);
-        for(size_t i=0; i<files.GetCount(); ++i) {
-            DcmFileFormat ff;
-            if(ff.loadFile(files[i].ToStdString().c_str(), EXS_Unknown, EGL_noChange, DCM_MaxReadLength, ERM_autoDetect).good()) {
-                const char* uid = nullptr;
-                ff.getDataset()->findAndGetString(DCM_SeriesInstanceUID, uid);
-                if(uid) seriesMap[uid].push_back(files[i].ToStdString());
-            }
-            if(i%20==0) scanner.Update(i);
-        }
-        if(seriesMap.empty()) return;
-
-        std::string bestUID; size_t maxCount = 0;
-        for(auto const& [uid, list] : seriesMap) {
-            if(list.size() > maxCount) { maxCount = list.size(); bestUID = uid; }
-        }
-
-        const auto& targetFiles = seriesMap[bestUID];
-        std::vector<SliceRaw> tempSlices;
-        scanner.Update(0, isJapanese ? L"画像データを読み込んでいます..." : L"Loading Pixel Data...");
-        scanner.SetRange(targetFiles.size());
-
-        volWidth = 0; volHeight = 0;
-        
-        for(size_t i=0; i<targetFiles.size(); ++i) {
-            DcmFileFormat ff;
-            if(ff.loadFile(targetFiles[i].c_str()).good()) {
-                DcmDataset* ds = ff.getDataset();
-                if(volWidth == 0) {
-                    Uint16 w, h;
-                    ds->findAndGetUint16(DCM_Rows, h); ds->findAndGetUint16(DCM_Columns, w);
-                    volWidth = w; volHeight = h;
-                    const Float64* sp = nullptr;
-                    if(ds->findAndGetFloat64Array(DCM_PixelSpacing, sp).good()) { pxSpcY = sp[0]; pxSpcX = sp[1]; }
-                    ds->findAndGetFloat64(DCM_SliceThickness, sliceThick);
-                    const char* tmp=nullptr;
-                    if(ds->findAndGetString(DCM_PatientName, tmp).good() && tmp) patientName=wxString::FromUTF8(tmp);
-                    if(ds->findAndGetString(DCM_PatientID, tmp).good() && tmp) patientID=wxString::FromUTF8(tmp);
-                }
-                DicomImage img(ds, EXS_Unknown);
-                if(img.getStatus() == EIS_Normal && img.getWidth()==volWidth && img.getHeight()==volHeight) {
-                    const int16_t* data = (const int16_t*)img.getOutputData(16);
-                    if(data) {
-                        Sint32 inst = 0;
-                        ds->findAndGetSint32(DCM_InstanceNumber, inst);
-                        std::vector<int16_t> buf(data, data + (volWidth * volHeight));
-                        tempSlices.push_back({(int)inst, buf});
-                    }
-                }
-            }
-            if(i%10==0) scanner.Update(i);
-        }
-        if(tempSlices.empty()) return;
-        std::sort(tempSlices.begin(), tempSlices.end(), [](const SliceRaw& a, const SliceRaw& b){ return a.instance < b.instance; });
-
-        volDepth = tempSlices.size();
-        volumeData.clear();
-        volumeData.reserve((size_t)volWidth * volHeight * volDepth);
-        for(const auto& s : tempSlices) volumeData.insert(volumeData.end(), s.pixels.begin(), s.pixels.end());
-
-        infoText->SetValue(GetInfoString());
-
-        sliderX->SetRange(0, volWidth - 1); sliderX->SetValue(volWidth / 2);
-        sliderY->SetRange(0, volHeight - 1); sliderY->SetValue(volHeight / 2);
-        sliderZ->SetRange(0, volDepth - 1); sliderZ->SetValue(volDepth / 2);
-
-        EnableControls(true);
-        UpdateAllViews();
-    }
-
-    void OnSliceChange(wxCommandEvent&) { UpdateAllViews(); }
-    void OnSliceChangeRaw(wxScrollEvent&) { UpdateAllViews(); }
-
-    void UpdateAllViews() {
-        if(volumeData.empty()) return;
-        int curX = sliderX->GetValue();
-        int curY = sliderY->GetValue();
-        int curZ = sliderZ->GetValue();
-        int wl = wlSlider->GetValue();
-        int ww = wwSlider->GetValue();
-
-        UpdateOneView(panelAxial, 0, curZ, curX, curY, wl, ww);
-        UpdateOneView(panelCoronal, 1, curY, curX, curZ, wl, ww);
-        UpdateOneView(panelSagittal, 2, curX, curY, curZ, wl, ww);
-    }
-
-    void UpdateOneView(ImagePanel* panel, int viewType, int sliceIdx, int cross1, int cross2, int wl, int ww) {
-        int w = 0, h = 0;
-        double scaleY = 1.0;
-        std::vector<int16_t> buf;
-        double sx = (pxSpcX > 0) ? pxSpcX : 1.0;
-        double sy = (pxSpcY > 0) ? pxSpcY : 1.0;
-        double sz = (sliceThick > 0) ? sliceThick : 1.0;
-
-        if (viewType == 0) { 
-            w = volWidth; h = volHeight; scaleY = sy / sx;
-            size_t off = (size_t)sliceIdx * w * h;
-            if(off + w*h <= volumeData.size()) buf.assign(volumeData.begin() + off, volumeData.begin() + off + w*h);
-        } else if (viewType == 1) { 
-            w = volWidth; h = volDepth; scaleY = sz / sx;
-            buf.resize(w * h);
-            for (int z = 0; z < h; ++z) {
-                size_t base = (size_t)z * (volWidth * volHeight) + (size_t)sliceIdx * volWidth;
-                if (base + w <= volumeData.size()) std::copy(volumeData.begin() + base, volumeData.begin() + base + w, buf.begin() + z * w);
-            }
-        } else { 
-            w = volHeight; h = volDepth; scaleY = sz / sy;
-            buf.resize(w * h);
-            for (int z = 0; z < h; ++z) {
-                for (int y = 0; y < w; ++y) {
-                    size_t idx = (size_t)z * (volWidth * volHeight) + (size_t)y * volWidth + sliceIdx;
-                    if(idx < volumeData.size()) buf[z * w + y] = volumeData[idx];
-                }
-            }
-        }
-
-        if(buf.empty()) return;
-        wxImage img(w, h);
-        unsigned char* rgb = img.GetData();
-        if(ww < 1) ww = 1;
-        double lower = wl - ww / 2.0;
-        double range = ww;
-
-        for(int i=0; i<w*h; ++i) {
-            double val = buf[i];
-            if(val <= lower) val = 0;
-            else if(val >= lower + range) val = 255;
-            else val = ((val - lower) / range) * 255.0;
-            unsigned char p = (unsigned char)val;
-            rgb[i*3] = p; rgb[i*3+1] = p; rgb[i*3+2] = p;
-        }
-
-        int finalW = w, finalH = (int)(h * scaleY);
-        double maxDim = 800.0;
-        if(finalW > maxDim || finalH > maxDim) {
-            double s = std::min(maxDim/finalW, maxDim/finalH);
-            finalW = (int)(finalW * s); finalH = (int)(finalH * s);
-        }
-        if(finalW < 1) finalW=1; if(finalH < 1) finalH=1;
-        img.Rescale(finalW, finalH, wxIMAGE_QUALITY_HIGH);
-
-        double relX = (double)cross1 / (w - 1);
-        double relY = (double)cross2 / (h - 1);
-        panel->SetImage(img, relX, relY);
-    }
-};
-
-class App : public wxApp {
-public:
-    bool OnInit() {
-        wxInitAllImageHandlers();
-        (new MainFrame())->Show();
-        return true;
-    }
-};
+#include <wx/wx.h>
+#include <wx/slider.h>
+#include <wx/choice.h>
+#include <wx/dir.h>
+#include <wx/progdlg.h>
+#include <wx/stopwatch.h>
+#include <wx/dcmemory.h>
+#include <wx/stdpaths.h>
+#include <wx/numdlg.h>
+#include <wx/rawbmp.h>
+#include <wx/fswatcher.h>
+#if wxUSE_GLCANVAS
+#include <wx/glcanvas.h>
+#if defined(__WXGTK__) || defined(__WXX11__)
+#include <GL/glx.h>
+#endif
+#endif
+#include <wx/dcbuffer.h>
+#include <wx/splitter.h>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <future>
+#include <deque>
+#include <list>
+#include <chrono>
+#include <memory>
+#include <cstring>
+#include <type_traits>
+#include <cstdint>
+
+#include "VolumeCore.h"
+#include "DicomLoader.h"
+#include "PacsLoader.h"
+#include "BatchExport.h"
+
+// --- 定数カラー定義 ---
+const wxColour COL_AXIAL(255, 50, 50);     // Red
+const wxColour COL_CORONAL(50, 255, 50);   // Green
+const wxColour COL_SAGITTAL(50, 100, 255); // Blue
+const wxColour COL_VOLUME(255, 200, 60);   // Amber (3D)
+
+// 起動時刻 (静的初期化の時点)。起動から最初の画素までの計測に使う
+static const std::chrono::steady_clock::time_point processStart = std::chrono::steady_clock::now();
+
+wxDEFINE_EVENT(EVT_SLICE_LOADED, wxThreadEvent);
+wxDEFINE_EVENT(EVT_VOLUME_LOADED, wxThreadEvent);
+wxDEFINE_EVENT(EVT_PAGE_LOADED, wxThreadEvent);
+
+// --- GPU 描画 (OpenGL) ---
+// ボリューム全体を 3D テクスチャ (GL_R16_SNORM) として一度だけ転送し、
+// 断面の切り出し・ウィンドウ処理・縦横比の補正はフラグメントシェーダで行う。
+// R16_SNORM は int16 をそのまま 16bit 精度で保持でき、線形補間も効く。
+#if wxUSE_GLCANVAS
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#ifndef GL_TEXTURE_3D
+#define GL_TEXTURE_3D 0x806F
+#endif
+#ifndef GL_TEXTURE_WRAP_R
+#define GL_TEXTURE_WRAP_R 0x8072
+#endif
+#ifndef GL_MAX_3D_TEXTURE_SIZE
+#define GL_MAX_3D_TEXTURE_SIZE 0x8073
+#endif
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+#ifndef GL_TEXTURE0
+#define GL_TEXTURE0 0x84C0
+#endif
+#ifndef GL_R8
+#define GL_R8 0x8229
+#endif
+#ifndef GL_R16_SNORM
+#define GL_R16_SNORM 0x8F98
+#endif
+#ifndef GL_FRAGMENT_SHADER
+#define GL_FRAGMENT_SHADER 0x8B30
+#define GL_VERTEX_SHADER 0x8B31
+#define GL_COMPILE_STATUS 0x8B81
+#define GL_LINK_STATUS 0x8B82
+#endif
+
+typedef char GLcharT;
+struct GLApi {
+    void (APIENTRY* TexImage3D)(GLenum, GLint, GLint, GLsizei, GLsizei, GLsizei, GLint, GLenum, GLenum, const void*) = nullptr;
+    void (APIENTRY* TexSubImage3D)(GLenum, GLint, GLint, GLint, GLint, GLsizei, GLsizei, GLsizei, GLenum, GLenum, const void*) = nullptr;
+    void (APIENTRY* ActiveTexture)(GLenum) = nullptr;
+    GLuint (APIENTRY* CreateShader)(GLenum) = nullptr;
+    void (APIENTRY* ShaderSource)(GLuint, GLsizei, const GLcharT* const*, const GLint*) = nullptr;
+    void (APIENTRY* CompileShader)(GLuint) = nullptr;
+    void (APIENTRY* GetShaderiv)(GLuint, GLenum, GLint*) = nullptr;
+    void (APIENTRY* DeleteShader)(GLuint) = nullptr;
+    GLuint (APIENTRY* CreateProgram)() = nullptr;
+    void (APIENTRY* AttachShader)(GLuint, GLuint) = nullptr;
+    void (APIENTRY* LinkProgram)(GLuint) = nullptr;
+    void (APIENTRY* GetProgramiv)(GLuint, GLenum, GLint*) = nullptr;
+    void (APIENTRY* UseProgram)(GLuint) = nullptr;
+    void (APIENTRY* DeleteProgram)(GLuint) = nullptr;
+    GLint (APIENTRY* GetUniformLocation)(GLuint, const GLcharT*) = nullptr;
+    void (APIENTRY* Uniform1i)(GLint, GLint) = nullptr;
+    void (APIENTRY* Uniform1f)(GLint, GLfloat) = nullptr;
+    void (APIENTRY* Uniform2f)(GLint, GLfloat, GLfloat) = nullptr;
+    void (APIENTRY* Uniform3f)(GLint, GLfloat, GLfloat, GLfloat) = nullptr;
+    void (APIENTRY* Uniform4f)(GLint, GLfloat, GLfloat, GLfloat, GLfloat) = nullptr;
+    void (APIENTRY* GenVertexArrays)(GLsizei, GLuint*) = nullptr;
+    void (APIENTRY* BindVertexArray)(GLuint) = nullptr;
+
+    static void* Proc(const char* name) {
+#if defined(__WXMSW__)
+        return (void*)wglGetProcAddress(name);
+#elif defined(__WXGTK__) || defined(__WXX11__)
+        return (void*)glXGetProcAddressARB((const GLubyte*)name);
+#else
+        (void)name;
+        return nullptr;
+#endif
+    }
+
+    // コンテキストが current の状態で呼ぶこと
+    bool Load() {
+        bool ok = true;
+        auto get = [&](auto& fn, const char* name) {
+            fn = reinterpret_cast<std::remove_reference_t<decltype(fn)>>(Proc(name));
+            if (!fn) ok = false;
+        };
+        get(TexImage3D, "glTexImage3D"); get(TexSubImage3D, "glTexSubImage3D"); get(ActiveTexture, "glActiveTexture");
+        get(CreateShader, "glCreateShader"); get(ShaderSource, "glShaderSource"); get(CompileShader, "glCompileShader");
+        get(GetShaderiv, "glGetShaderiv"); get(DeleteShader, "glDeleteShader"); get(CreateProgram, "glCreateProgram");
+        get(AttachShader, "glAttachShader"); get(LinkProgram, "glLinkProgram"); get(GetProgramiv, "glGetProgramiv");
+        get(UseProgram, "glUseProgram"); get(DeleteProgram, "glDeleteProgram"); get(GetUniformLocation, "glGetUniformLocation");
+        get(Uniform1i, "glUniform1i"); get(Uniform1f, "glUniform1f"); get(Uniform2f, "glUniform2f");
+        get(Uniform3f, "glUniform3f"); get(Uniform4f, "glUniform4f");
+        get(GenVertexArrays, "glGenVertexArrays"); get(BindVertexArray, "glBindVertexArray");
+        return ok;
+    }
+};
+
+// 1 画面分の描画パラメータ
+struct GLSliceParams {
+    int viewType = 0;
+    int slice = 0;
+    int wl = 40, ww = 400;
+    double scaleY = 1.0;  // 画素の縦横比 (縦 / 横)
+    double crossX = -1.0, crossY = -1.0;
+    // viewType 3 (ボリュームレンダリング) のときだけ使う。視線は CPU 版と同じ VrtView
+    VrtView vrt{};
+    VrtTransfer tf{};
+};
+
+// 4 画面で共有する GL コンテキスト・シェーダ・ボリュームテクスチャ (GL のオブジェクトはコンテキストと一緒に破棄される)。
+// GL の呼び出しは全て描画イベント内 (コンテキストが current) で行うため、
+// ボリュームの転送要求は記録だけしておき、次の描画時にまとめて処理する。
+class GLVolumeRenderer {
+    std::unique_ptr<wxGLContext> context;
+    GLApi api;
+    GLuint program = 0, vao = 0, volumeTex = 0;
+    bool initTried = false, usable = false;
+    int texW = 0, texH = 0, texD = 0;
+
+    const Volume* volume = nullptr;
+    bool needFullUpload = false;
+    std::vector<int> pendingSlices;
+
+    static constexpr const char* VERT_SRC = R"(#version 330
+uniform vec4 uRect;
+out vec2 vUV;
+void main() {
+    vec2 c = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+    vUV = c;
+    gl_Position = vec4(mix(uRect.xy, uRect.zw, c), 0.0, 1.0);
+})";
+
+    static constexpr const char* FRAG_SRC = R"(#version 330
+uniform int uMode;
+uniform sampler3D uVolume;
+uniform sampler2D uLabel;
+uniform int uViewType;
+uniform float uSlice;
+uniform vec3 uVolSize;
+uniform vec2 uWindow;
+uniform vec2 uViewport;
+uniform vec4 uImageRect;
+uniform vec2 uCross;
+uniform vec3 uBorderColor, uVColor, uHColor, uBackground, uTint;
+uniform vec3 uCamOrigin, uCamU, uCamV, uCamDir, uExtent, uRamp, uColorLo, uColorHi;
+uniform float uStep;
+in vec2 vUV;
+out vec4 fragColor;
+// ボリュームレンダリング: CPU 版と同じ視線・伝達関数・陰影で、テクスチャの 3 線形補間を使って歩く (読み飛ばしはしない)
+vec4 Raycast(vec2 q) {
+    vec3 o = uCamOrigin + uCamU * q.x + uCamV * q.y;
+    vec3 d = uCamDir + vec3(equal(uCamDir, vec3(0.0))) * 1e-6;
+    vec3 t0 = -o / d, t1 = (uExtent - o) / d;
+    vec3 tmin = min(t0, t1), tmax = max(t0, t1);
+    float tn = max(max(tmin.x, tmin.y), tmin.z), tf = min(min(tmax.x, tmax.y), tmax.z);
+    vec3 spacing = uExtent / max(uVolSize - 1.0, vec3(1.0)), texel = 1.0 / uVolSize;
+    vec3 acc = vec3(0.0);
+    float a = 0.0;
+    for (float t = tn; t <= tf && a < 0.98; t += uStep) {
+        vec3 tc = ((o + uCamDir * t) / spacing + 0.5) * texel;
+        float r = clamp((texture(uVolume, tc).r * 32767.0 - uRamp.x) / (uRamp.y - uRamp.x), 0.0, 1.0);
+        if (r <= 0.0) continue;
+        float alpha = 1.0 - pow(1.0 - min(uRamp.z * r, 0.999), uStep);
+        vec3 g = vec3(texture(uVolume, tc + vec3(texel.x, 0, 0)).r - texture(uVolume, tc - vec3(texel.x, 0, 0)).r,
+                      texture(uVolume, tc + vec3(0, texel.y, 0)).r - texture(uVolume, tc - vec3(0, texel.y, 0)).r,
+                      texture(uVolume, tc + vec3(0, 0, texel.z)).r - texture(uVolume, tc - vec3(0, 0, texel.z)).r) / spacing;
+        float len = length(g);
+        float shade = len > 1e-7 ? 0.3 + 0.7 * abs(dot(g, uCamDir)) / len : 1.0;
+        acc += (1.0 - a) * alpha * shade * mix(uColorLo, uColorHi, r);
+        a += (1.0 - a) * alpha;
+    }
+    return vec4(acc + (1.0 - a) * uBackground, 1.0);
+}
+void main() {
+    if (uMode == 1) { fragColor = vec4(uTint, texture(uLabel, vUV).r); return; }
+    vec2 p = vec2(gl_FragCoord.x, uViewport.y - gl_FragCoord.y);
+    if (p.x < 3.0 || p.y < 3.0 || p.x > uViewport.x - 3.0 || p.y > uViewport.y - 3.0) { fragColor = vec4(uBorderColor, 1.0); return; }
+    if (uMode == 2) { fragColor = Raycast(p - 0.5); return; }
+    vec2 uv = (p - uImageRect.xy) / uImageRect.zw;
+    if (uv.x < 0.0 || uv.y < 0.0 || uv.x >= 1.0 || uv.y >= 1.0) { fragColor = vec4(uBackground, 1.0); return; }
+    if (uCross.x >= 0.0 && uCross.y >= 0.0) {
+        vec2 c = floor(uImageRect.xy + uCross * uImageRect.zw);
+        if (floor(p.y) == c.y) { fragColor = vec4(uHColor, 1.0); return; }
+        if (floor(p.x) == c.x) { fragColor = vec4(uVColor, 1.0); return; }
+    }
+    vec3 t;
+    if (uViewType == 0)      t = vec3(uv.x, uv.y, (uSlice + 0.5) / uVolSize.z);
+    else if (uViewType == 1) t = vec3(uv.x, (uSlice + 0.5) / uVolSize.y, uv.y);
+    else                     t = vec3((uSlice + 0.5) / uVolSize.x, uv.x, uv.y);
+    float v = texture(uVolume, t).r * 32767.0;
+    float g = clamp((v - uWindow.x) / uWindow.y, 0.0, 1.0);
+    fragColor = vec4(g, g, g, 1.0);
+})";
+
+    GLuint Compile(GLenum type, const char* src) {
+        GLuint sh = api.CreateShader(type);
+        api.ShaderSource(sh, 1, &src, nullptr);
+        api.CompileShader(sh);
+        GLint ok = 0;
+        api.GetShaderiv(sh, GL_COMPILE_STATUS, &ok);
+        if (!ok) { api.DeleteShader(sh); return 0; }
+        return sh;
+    }
+
+    void Upload() {
+        if (!volume || volume->empty()) return;
+        // 全スライスを転送すると予算を超えて展開し続けるので、ページング中は CPU 描画に任せる
+        if (volume->IsPaged()) { Fail("paged volumes are drawn on the CPU"); return; }
+        int w = volume->Width(), h = volume->Height(), d = volume->Depth();
+        if (needFullUpload || w != texW || h != texH || d != texD) {
+            GLint maxSize = 0;
+            glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &maxSize);
+            if (w > maxSize || h > maxSize || d > maxSize) { Fail("volume exceeds GL_MAX_3D_TEXTURE_SIZE"); return; }
+            if (!volumeTex) glGenTextures(1, &volumeTex);
+            glBindTexture(GL_TEXTURE_3D, volumeTex);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+            api.TexImage3D(GL_TEXTURE_3D, 0, GL_R16_SNORM, w, h, d, 0, GL_RED, GL_SHORT, nullptr);
+            if (glGetError() != GL_NO_ERROR) { Fail("could not allocate the volume texture"); return; }
+            texW = w; texH = h; texD = d;
+            pendingSlices.clear();
+            for (int z = 0; z < d; ++z) pendingSlices.push_back(z);
+            needFullUpload = false;
+        }
+        if (pendingSlices.empty()) return;
+        glBindTexture(GL_TEXTURE_3D, volumeTex);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+        std::vector<int16_t> scratch;
+        for (int z : pendingSlices) {
+            if (z < 0 || z >= d) continue;
+            const int16_t* src = volume->SliceData(z);
+            if (!src) {
+                scratch.resize((size_t)w * h);
+                volume->ExtractPlane(0, z, scratch.data());
+                src = scratch.data();
+            }
+            api.TexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, z, w, h, 1, GL_RED, GL_SHORT, src);
+        }
+        pendingSlices.clear();
+    }
+
+    void Fail(const char* reason) {
+        usable = false;
+        if (onFailure) onFailure(wxString::FromUTF8(reason));
+    }
+
+public:
+    // GPU が使えないと分かったときに呼ばれる (描画イベント内から)
+    std::function<void(const wxString&)> onFailure;
+
+    // 最初の描画時にコンテキスト・関数ポインタ・シェーダを用意する
+    bool MakeCurrent(wxGLCanvas* canvas) {
+        if (!context) context = std::make_unique<wxGLContext>(canvas);
+        if (!context->SetCurrent(*canvas)) return false;
+        if (initTried) return usable;
+        initTried = true;
+        if (!api.Load()) { Fail("OpenGL 3.3 entry points are not available"); return false; }
+        GLuint vs = Compile(GL_VERTEX_SHADER, VERT_SRC), fs = Compile(GL_FRAGMENT_SHADER, FRAG_SRC);
+        if (!vs || !fs) { Fail("shader compilation failed"); return false; }
+        program = api.CreateProgram();
+        api.AttachShader(program, vs); api.AttachShader(program, fs);
+        api.LinkProgram(program);
+        api.DeleteShader(vs); api.DeleteShader(fs);
+        GLint linked = 0;
+        api.GetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked) { Fail("shader link failed"); return false; }
+        api.GenVertexArrays(1, &vao);
+        usable = true;
+        return true;
+    }
+
+    void SetVolume(const Volume* vol) { volume = vol; needFullUpload = true; }
+    void SliceChanged(int z) { pendingSlices.push_back(z); }
+
+    GLuint CreateLabelTexture(const wxImage& mask) {
+        GLuint tex = 0;
+        int w = mask.GetWidth(), h = mask.GetHeight();
+        std::vector<uint8_t> alpha((size_t)w * h);
+        const unsigned char* rgb = mask.GetData();
+        for (size_t i = 0; i < alpha.size(); ++i) alpha[i] = rgb[i * 3];
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, w, h, 0, GL_RED, GL_UNSIGNED_BYTE, alpha.data());
+        return tex;
+    }
+
+    // 表示先の矩形 (画素, 左上原点) を縦横比を保ってクライアント領域に収める
+    void ImageRect(const GLSliceParams& p, int cw, int ch, double rect[4]) const {
+        int w = 0, h = 0;
+        if (volume) volume->PlaneSize(p.viewType, w, h);
+        double iw = std::max(1, w), ih = std::max(1.0, h * p.scaleY);
+        double s = std::min(cw / iw, ch / ih);
+        rect[2] = iw * s; rect[3] = ih * s;
+        rect[0] = (cw - rect[2]) / 2; rect[1] = (ch - rect[3]) / 2;
+    }
+
+    struct Colors { float border[3], vLine[3], hLine[3]; };
+
+    void Draw(const GLSliceParams& p, const Colors& col, GLuint labelTex, int labelW, int labelH, int cw, int ch) {
+        if (!usable) return;
+        Upload();
+        if (!usable) return;
+        glViewport(0, 0, cw, ch);
+        glDisable(GL_BLEND);
+        api.UseProgram(program);
+        api.BindVertexArray(vao);
+        auto loc = [&](const char* n) { return api.GetUniformLocation(program, n); };
+
+        double rect[4];
+        ImageRect(p, cw, ch, rect);
+        int ww = p.ww < 0 ? std::min(p.ww, -1) : std::max(p.ww, 1); // 負の幅はシェーダーでそのまま反転になる
+        api.ActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_3D, volumeTex);
+        api.Uniform1i(loc("uVolume"), 0);
+        api.Uniform1i(loc("uLabel"), 1);
+        api.Uniform1i(loc("uMode"), p.viewType == 3 ? 2 : 0);
+        api.Uniform4f(loc("uRect"), -1.0f, 1.0f, 1.0f, -1.0f);
+        api.Uniform1i(loc("uViewType"), p.viewType);
+        api.Uniform1f(loc("uSlice"), (float)p.slice);
+        api.Uniform3f(loc("uVolSize"), (float)texW, (float)texH, (float)texD);
+        api.Uniform2f(loc("uWindow"), (float)(p.wl - ww / 2.0), (float)ww);
+        api.Uniform2f(loc("uViewport"), (float)cw, (float)ch);
+        api.Uniform4f(loc("uImageRect"), (float)rect[0], (float)rect[1], (float)rect[2], (float)rect[3]);
+        api.Uniform2f(loc("uCross"), (float)p.crossX, (float)p.crossY);
+        api.Uniform3f(loc("uBorderColor"), col.border[0], col.border[1], col.border[2]);
+        api.Uniform3f(loc("uVColor"), col.vLine[0], col.vLine[1], col.vLine[2]);
+        api.Uniform3f(loc("uHColor"), col.hLine[0], col.hLine[1], col.hLine[2]);
+        api.Uniform3f(loc("uBackground"), 20 / 255.0f, 20 / 255.0f, 20 / 255.0f);
+        if (p.viewType == 3) {
+            auto vec = [&](const char* n, const double* v) { api.Uniform3f(loc(n), (float)v[0], (float)v[1], (float)v[2]); };
+            vec("uCamOrigin", p.vrt.origin); vec("uCamU", p.vrt.du); vec("uCamV", p.vrt.dv); vec("uCamDir", p.vrt.dir); vec("uExtent", p.vrt.extent);
+            api.Uniform3f(loc("uRamp"), p.tf.lo, p.tf.hi > p.tf.lo ? p.tf.hi : p.tf.lo + 1, p.tf.opacity);
+            api.Uniform3f(loc("uColorLo"), p.tf.colorLo[0], p.tf.colorLo[1], p.tf.colorLo[2]);
+            api.Uniform3f(loc("uColorHi"), p.tf.colorHi[0], p.tf.colorHi[1], p.tf.colorHi[2]);
+            api.Uniform1f(loc("uStep"), (float)std::min({ p.vrt.spacing[0], p.vrt.spacing[1], p.vrt.spacing[2] }));
+        }
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+        if (labelTex) {
+            // ラベル: 影 (黒, +1px) → 本体 (枠の色) の順に重ねる
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            api.ActiveTexture(GL_TEXTURE0 + 1);
+            glBindTexture(GL_TEXTURE_2D, labelTex);
+            api.ActiveTexture(GL_TEXTURE0);
+            api.Uniform1i(loc("uMode"), 1);
+            auto quad = [&](int x, int y, const float* tint) {
+                api.Uniform4f(loc("uRect"), 2.0f * x / cw - 1.0f, 1.0f - 2.0f * y / ch,
+                              2.0f * (x + labelW) / cw - 1.0f, 1.0f - 2.0f * (y + labelH) / ch);
+                api.Uniform3f(loc("uTint"), tint[0], tint[1], tint[2]);
+                glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+            };
+            const float black[3] = { 0, 0, 0 };
+            quad(11, 11, black);
+            quad(10, 10, col.border);
+            glDisable(GL_BLEND);
+        }
+        api.UseProgram(0);
+    }
+
+};
+
+// ImagePanel に重ねて表示する GL キャンバス
+class GLSliceView : public wxGLCanvas {
+    GLVolumeRenderer* renderer;
+    GLSliceParams params;
+    GLVolumeRenderer::Colors colors;
+    wxString label;
+    bool labelDirty = true;
+    GLuint labelTex = 0;
+    int labelW = 0, labelH = 0;
+    bool hasSlice = false;
+
+    static int* Attribs() {
+        static int attribs[] = { WX_GL_RGBA, WX_GL_DOUBLEBUFFER, 0 };
+        return attribs;
+    }
+
+    static void ToFloat(const wxColour& c, float out[3]) {
+        out[0] = c.Red() / 255.0f; out[1] = c.Green() / 255.0f; out[2] = c.Blue() / 255.0f;
+    }
+
+    void RebuildLabel() {
+        labelDirty = false;
+        if (labelTex) { glDeleteTextures(1, &labelTex); labelTex = 0; }
+        if (label.IsEmpty()) return;
+        wxFont font(11, wxFONTFAMILY_DEFAULT, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_BOLD);
+        wxBitmap probe(1, 1);
+        wxMemoryDC mdc(probe);
+        mdc.SetFont(font);
+        wxSize ext = mdc.GetMultiLineTextExtent(label);
+        mdc.SelectObject(wxNullBitmap);
+        labelW = std::max(1, ext.x); labelH = std::max(1, ext.y);
+        wxBitmap bmp(labelW, labelH, 24);
+        mdc.SelectObject(bmp);
+        mdc.SetBackground(*wxBLACK_BRUSH); mdc.Clear();
+        mdc.SetFont(font);
+        mdc.SetTextForeground(*wxWHITE);
+        mdc.DrawText(label, 0, 0);
+        mdc.SelectObject(wxNullBitmap);
+        labelTex = renderer->CreateLabelTexture(bmp.ConvertToImage());
+    }
+
+    void OnPaint(wxPaintEvent&) {
+        ScopedTimer timer("OnPaint (GL)");
+        wxPaintDC dc(this);
+        wxSize sz = GetClientSize();
+        if (!renderer->MakeCurrent(this)) return;
+        if (labelDirty) RebuildLabel();
+        glClearColor(20 / 255.0f, 20 / 255.0f, 20 / 255.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        if (hasSlice) renderer->Draw(params, colors, labelTex, labelW, labelH, sz.x, sz.y);
+        SwapBuffers();
+    }
+
+public:
+    GLSliceView(wxWindow* parent, GLVolumeRenderer* r)
+        : wxGLCanvas(parent, wxID_ANY, Attribs(), wxDefaultPosition, parent->GetClientSize(), wxFULL_REPAINT_ON_RESIZE), renderer(r)
+    {
+        Bind(wxEVT_PAINT, &GLSliceView::OnPaint, this);
+    }
+
+    void SetOverlay(const wxColour& border, const wxColour& vLine, const wxColour& hLine, const wxString& text) {
+        ToFloat(border, colors.border); ToFloat(vLine, colors.vLine); ToFloat(hLine, colors.hLine);
+        if (text != label) { label = text; labelDirty = true; }
+        Refresh(false);
+    }
+
+    void SetSlice(const GLSliceParams& p) { params = p; hasSlice = true; Refresh(false); }
+    void SetCrosshair(double cx, double cy) { params.crossX = cx; params.crossY = cy; Refresh(false); }
+};
+#endif
+
+// --- ホイール操作の先読み ---
+// 画面・スライス・表示サイズ・ウィンドウ・スラブ・斜め断面・ボリュームの版が一致するフレームだけを使い回す
+struct FrameKey {
+    int viewType = 0, slice = 0, boxW = 0, boxH = 0, wl = 0, ww = 0;
+    int slabMode = 0, slabThickness = 1;
+    bool oblique = false;
+    long revision = 0;
+    bool operator==(const FrameKey& o) const {
+        return viewType == o.viewType && slice == o.slice && boxW == o.boxW && boxH == o.boxH &&
+               wl == o.wl && ww == o.ww && slabMode == o.slabMode && slabThickness == o.slabThickness &&
+               oblique == o.oblique && revision == o.revision;
+    }
+};
+
+// 1 本のワーカーで要求されたフレームを順に描く。新しい要求は古い要求を置き換える。
+// render はワーカースレッドから呼ばれる。
+class FramePrefetcher {
+    std::thread thread;
+    std::mutex mtx;
+    std::condition_variable cv, idle;
+    std::deque<FrameKey> queue;
+    bool busy = false, stopping = false;
+    std::function<void(const FrameKey&)> render;
+
+public:
+    explicit FramePrefetcher(std::function<void(const FrameKey&)> fn) : render(std::move(fn)) {
+        thread = std::thread([this]() {
+            std::unique_lock<std::mutex> lock(mtx);
+            for (;;) {
+                cv.wait(lock, [this]{ return stopping || !queue.empty(); });
+                if (stopping) return;
+                FrameKey key = queue.front();
+                queue.pop_front();
+                busy = true;
+                lock.unlock();
+                render(key);
+                lock.lock();
+                busy = false;
+                idle.notify_all();
+            }
+        });
+    }
+
+    ~FramePrefetcher() {
+        { std::lock_guard<std::mutex> lock(mtx); stopping = true; queue.clear(); }
+        cv.notify_one();
+        thread.join();
+    }
+
+    void Request(std::vector<FrameKey> keys) {
+        std::lock_guard<std::mutex> lock(mtx);
+        queue.assign(keys.begin(), keys.end());
+        cv.notify_one();
+    }
+
+    // 残りの要求を捨て、描画中のフレームが終わるまで待つ (ボリュームを作り直す前に呼ぶ)
+    void Cancel() {
+        std::unique_lock<std::mutex> lock(mtx);
+        queue.clear();
+        idle.wait(lock, [this]{ return !busy; });
+    }
+};
+
+// --- 描画用パネル ---
+class ImagePanel : public wxPanel {
+    wxBitmap displayedBitmap;
+    int viewType; // 0:Axial, 1:Coronal, 2:Sagittal, 3:3D (ボリュームレンダリング)
+    double crossX = -1.0;
+    double crossY = -1.0;
+    bool isJapanese = false; // デフォルト英語
+    bool oblique = false;    // 斜め断面を表示中
+
+    wxColour borderColor;
+    wxColour vLineColor;
+    wxColour hLineColor;
+
+    std::function<void(int)> onClickCallback;
+    std::function<void(int, int)> onWheelCallback;
+    std::function<void(int, int)> onDragCallback; // 左ドラッグの移動量 (3D 画面の回転)
+    wxPoint dragLast;
+
+    // 計測オーバーレイ (空なら描かない)。描画時間はこのパネル自身が測って足す
+    wxString statsText;
+    double lastPaintMs = 0.0;
+
+public:
+    static constexpr int FRAME_RING = 8;
+
+private:
+    // 先読み済みのフレーム (古いものから上書き)
+    struct ReadyFrame { FrameKey key; wxBitmap bitmap; bool valid = false; };
+    ReadyFrame frameRing[FRAME_RING];
+    int ringNext = 0;
+
+    // 通常の描画先。frameRGB に描いてから renderBitmap へ写す (どちらも使い回す)
+    std::vector<unsigned char> frameRGB;
+    wxBitmap renderBitmap;
+
+    static void CopyToBitmap(wxBitmap& bmp, const unsigned char* rgb, int w, int h) {
+        if (!bmp.IsOk() || bmp.GetWidth() != w || bmp.GetHeight() != h) {
+            bmp.Create(w, h, 24);
+            RenderAllocCount().fetch_add(1, std::memory_order_relaxed);
+        }
+        wxNativePixelData data(bmp);
+        if (!data) {
+            bmp = wxBitmap(wxImage(w, h, const_cast<unsigned char*>(rgb), true));
+            RenderAllocCount().fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        wxNativePixelData::Iterator p(data);
+        for (int y = 0; y < h; ++y) {
+            wxNativePixelData::Iterator row = p;
+            const unsigned char* src = rgb + (size_t)y * w * 3;
+            for (int x = 0; x < w; ++x, ++p, src += 3) { p.Red() = src[0]; p.Green() = src[1]; p.Blue() = src[2]; }
+            p = row;
+            p.OffsetY(data, 1);
+        }
+    }
+
+#if wxUSE_GLCANVAS
+    GLSliceView* glView = nullptr;
+
+    void PushOverlay() {
+        if (glView) glView->SetOverlay(borderColor, vLineColor, hLineColor, statsText.IsEmpty() ? ViewLabel() : ViewLabel() + "\n" + statsText);
+    }
+#endif
+
+public:
+    ImagePanel(wxWindow* parent, int type, 
+               std::function<void(int)> clickCb, 
+               std::function<void(int, int)> wheelCb) 
+        : wxPanel(parent, wxID_ANY), viewType(type), onClickCallback(clickCb), onWheelCallback(wheelCb)
+    {
+        SetBackgroundStyle(wxBG_STYLE_PAINT);
+        SetBackgroundColour(wxColour(20, 20, 20)); 
+
+        switch(viewType) {
+            case 0: // Axial
+                borderColor = COL_AXIAL;
+                vLineColor = COL_SAGITTAL; hLineColor = COL_CORONAL;
+                break;
+            case 1: // Coronal
+                borderColor = COL_CORONAL;
+                vLineColor = COL_SAGITTAL; hLineColor = COL_AXIAL;
+                break;
+            case 2: // Sagittal
+                borderColor = COL_SAGITTAL;
+                vLineColor = COL_CORONAL; hLineColor = COL_AXIAL;
+                break;
+            case 3: // 3D (十字線なし)
+                borderColor = vLineColor = hLineColor = COL_VOLUME;
+                break;
+        }
+
+        Bind(wxEVT_PAINT, &ImagePanel::OnPaint, this);
+        Bind(wxEVT_SIZE, &ImagePanel::OnSize, this);
+        Bind(wxEVT_LEFT_DOWN, &ImagePanel::OnMouseClick, this);
+        Bind(wxEVT_MOTION, &ImagePanel::OnMouseMotion, this);
+        Bind(wxEVT_MOUSEWHEEL, &ImagePanel::OnMouseWheel, this);
+    }
+
+    void SetDragCallback(std::function<void(int, int)> cb) { onDragCallback = std::move(cb); }
+
+    void SetLanguage(bool jp) {
+        isJapanese = jp;
+#if wxUSE_GLCANVAS
+        PushOverlay();
+#endif
+        Refresh(false);
+    }
+
+#if wxUSE_GLCANVAS
+    // GPU 描画に切り替える。以降の画像・十字線・ラベルは GL キャンバスが描く
+    void AttachGL(GLVolumeRenderer* renderer) {
+        if (glView) return;
+        glView = new GLSliceView(this, renderer);
+        glView->SetSize(GetClientSize());
+        glView->Bind(wxEVT_LEFT_DOWN, &ImagePanel::OnMouseClick, this);
+        glView->Bind(wxEVT_MOTION, &ImagePanel::OnMouseMotion, this);
+        glView->Bind(wxEVT_MOUSEWHEEL, &ImagePanel::OnMouseWheel, this);
+        PushOverlay();
+    }
+
+    void DetachGL() {
+        delete glView;
+        glView = nullptr;
+        Refresh(false);
+    }
+
+    bool HasGL() const { return glView != nullptr; }
+
+    void SetGLSlice(const GLSliceParams& p) {
+        if (!glView) return;
+        crossX = p.crossX;
+        crossY = p.crossY;
+        glView->SetSlice(p);
+    }
+#endif
+
+    void SetOblique(bool on) {
+        if (on == oblique) return;
+        oblique = on;
+#if wxUSE_GLCANVAS
+        PushOverlay();
+#endif
+        Refresh(false);
+    }
+
+    wxString ViewLabel() const {
+        if (oblique) return BaseLabel() + (isJapanese ? L" - 斜め断面" : L" - Oblique");
+        return BaseLabel();
+    }
+
+    wxString BaseLabel() const {
+        if (isJapanese) {
+            switch(viewType) {
+                case 0: return L"Axial (上から)";
+                case 1: return L"Coronal (正面から)";
+                case 3: return L"3D (ボリュームレンダリング)";
+                default: return L"Sagittal (横から)";
+            }
+        }
+        switch(viewType) {
+            case 0: return L"Axial (Top)";
+            case 1: return L"Coronal (Front)";
+            case 3: return L"3D (Volume Rendering)";
+            default: return L"Sagittal (Side)";
+        }
+    }
+
+    // 描画スレッドが書き込む RGB バッファ。大きさが変わらない限り同じ領域を返す
+    unsigned char* FrameBuffer(int w, int h) {
+        return ScratchBuffer(frameRGB, (size_t)w * h * 3);
+    }
+
+    // FrameBuffer の中身を表示用ビットマップへ写す。ビットマップも大きさが変わったときだけ作り直す
+    void PresentFrame(int w, int h, double cx, double cy) {
+        displayedBitmap = wxNullBitmap; // 共有を外しておかないと書き込み時に複製される
+        CopyToBitmap(renderBitmap, frameRGB.data(), w, h);
+        displayedBitmap = renderBitmap;
+        crossX = cx;
+        crossY = cy;
+        Refresh(false);
+    }
+
+    void SetStats(const wxString& text) {
+        if (text == statsText) return;
+        statsText = text;
+#if wxUSE_GLCANVAS
+        if (glView) { PushOverlay(); return; }
+#endif
+        Refresh(false);
+    }
+
+    void StoreFrame(const FrameKey& key, const unsigned char* rgb, int w, int h) {
+        ReadyFrame& f = frameRing[ringNext];
+        // 表示中のフレームは上書きできないので、そのときだけ別のビットマップにする
+        if (f.bitmap.IsSameAs(displayedBitmap)) f.bitmap = wxBitmap();
+        CopyToBitmap(f.bitmap, rgb, w, h);
+        f.key = key; f.valid = true;
+        ringNext = (ringNext + 1) % FRAME_RING;
+    }
+
+    bool HasFrame(const FrameKey& key) const {
+        for (const ReadyFrame& f : frameRing) if (f.valid && f.key == key) return true;
+        return false;
+    }
+
+    // 当たれば変換も描画もせず、ビットマップを差し替えるだけ
+    bool ShowFrame(const FrameKey& key, double cx, double cy) {
+        for (const ReadyFrame& f : frameRing) {
+            if (!f.valid || !(f.key == key)) continue;
+            displayedBitmap = f.bitmap;
+            crossX = cx;
+            crossY = cy;
+            Refresh(false);
+            return true;
+        }
+        return false;
+    }
+
+    void ClearFrames() {
+        for (ReadyFrame& f : frameRing) { f.valid = false; f.bitmap = wxNullBitmap; }
+    }
+
+    // 画像はそのままで十字線だけを動かす
+    void SetCrosshair(double cx, double cy) {
+        if (cx == crossX && cy == crossY) return;
+        crossX = cx;
+        crossY = cy;
+#if wxUSE_GLCANVAS
+        if (glView) { glView->SetCrosshair(cx, cy); return; }
+#endif
+        Refresh(false);
+    }
+
+    void OnMouseClick(wxMouseEvent& evt) {
+        SetFocus();
+        dragLast = evt.GetPosition();
+        if (onClickCallback) onClickCallback(viewType);
+        evt.Skip();
+    }
+
+    void OnMouseMotion(wxMouseEvent& evt) {
+        wxPoint pos = evt.GetPosition();
+        if (evt.Dragging() && evt.LeftIsDown() && onDragCallback) onDragCallback(pos.x - dragLast.x, pos.y - dragLast.y);
+        dragLast = pos;
+        evt.Skip();
+    }
+
+    void OnMouseWheel(wxMouseEvent& evt) {
+        if (onWheelCallback) {
+            int rotation = evt.GetWheelRotation();
+            int direction = (rotation > 0) ? 1 : -1;
+            onWheelCallback(viewType, direction);
+        }
+        evt.Skip();
+    }
+
+    void OnPaint(wxPaintEvent&) {
+        ScopedTimer timer("OnPaint");
+        wxStopWatch paintWatch;
+        wxAutoBufferedPaintDC dc(this);
+        dc.SetBackground(wxBrush(GetBackgroundColour()));
+        dc.Clear();
+
+        wxSize panelSize = GetClientSize();
+        int x = 0, y = 0, w = 0, h = 0;
+        if (displayedBitmap.IsOk()) {
+            wxSize bmpSize = displayedBitmap.GetSize();
+            w = bmpSize.x; h = bmpSize.y;
+            x = (panelSize.x - w) / 2; y = (panelSize.y - h) / 2;
+            if (x < 0) x = 0; if (y < 0) y = 0;
+            dc.DrawBitmap(displayedBitmap, x, y, false);
+        }
+
+        wxPen borderPen(borderColor, 3, wxPENSTYLE_SOLID);
+        dc.SetPen(borderPen);
+        dc.SetBrush(*wxTRANSPARENT_BRUSH);
+        dc.DrawRectangle(1, 1, panelSize.x - 2, panelSize.y - 2);
+
+        if (displayedBitmap.IsOk() && crossX >= 0 && crossY >= 0) {
+            int lineX = x + (int)(w * crossX);
+            int lineY = y + (int)(h * crossY);
+            if (lineX >= x && lineX < x + w && lineY >= y && lineY < y + h) {
+                dc.SetPen(wxPen(vLineColor, 1, wxPENSTYLE_SOLID));
+                dc.DrawLine(lineX, y, lineX, y + h);
+                dc.SetPen(wxPen(hLineColor, 1, wxPENSTYLE_SOLID));
+                dc.DrawLine(x, lineY, x + w, lineY);
+            }
+        }
+        
+        dc.SetFont(wxFont(11, wxFONTFAMILY_DEFAULT, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_BOLD));
+        wxString label = ViewLabel();
+
+        dc.SetTextForeground(*wxBLACK);
+        dc.DrawText(label, 11, 11); 
+        dc.SetTextForeground(borderColor);
+        dc.DrawText(label, 10, 10);
+
+        if (!statsText.IsEmpty()) {
+            wxString text = statsText + wxString::Format(isJapanese ? L"\n表示 %.2f ms" : L"\npaint %.2f ms", lastPaintMs);
+            dc.SetFont(wxFont(9, wxFONTFAMILY_TELETYPE, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_NORMAL));
+            wxSize ext = dc.GetMultiLineTextExtent(text);
+            int ty = panelSize.y - ext.y - 10;
+            dc.SetTextForeground(*wxBLACK);
+            dc.DrawText(text, 11, ty + 1);
+            dc.SetTextForeground(wxColour(230, 230, 120));
+            dc.DrawText(text, 10, ty);
+            lastPaintMs = paintWatch.TimeInMicro() / 1000.0;
+        }
+    }
+
+    void OnSize(wxSizeEvent& evt) {
+#if wxUSE_GLCANVAS
+        if (glView) glView->SetSize(GetClientSize());
+#endif
+        Refresh(false);
+        evt.Skip();
+    }
+};
+
+class MainFrame : public wxFrame {
+public:
+    MainFrame() : wxFrame(NULL, wxID_ANY, L"DICOM Viewer", wxDefaultPosition, wxSize(1280, 900)) {
+        SetBackgroundColour(wxColour(30, 30, 30));
+
+        // --- Menu Bar ---
+        wxMenuBar* menuBar = new wxMenuBar();
+        
+        wxMenu* fileMenu = new wxMenu();
+        fileMenu->Append(wxID_OPEN, L"Open Folder");
+        fileMenu->Append(1019, L"Open from PACS...");
+        fileMenu->AppendCheckItem(1017, L"Follow Folder");
+        fileMenu->Append(wxID_EXIT, L"Exit");
+        menuBar->Append(fileMenu, L"File");
+
+        wxMenu* viewMenu = new wxMenu();
+        viewMenu->Append(1010, L"Show/Hide Controls\tF11");
+        viewMenu->AppendCheckItem(1011, L"Bricked Volume Layout");
+        viewMenu->AppendCheckItem(1018, L"Compressed Volume Storage");
+        viewMenu->Append(1013, L"Memory Budget...");
+        viewMenu->AppendCheckItem(1020, L"Volume Rendering Panel");
+        viewMenu->Check(1020, true);
+#if wxUSE_GLCANVAS
+        viewMenu->AppendCheckItem(1012, L"GPU Rendering (OpenGL)");
+#endif
+        viewMenu->AppendSeparator();
+        viewMenu->AppendCheckItem(1014, L"Performance Overlay\tF12");
+        viewMenu->AppendCheckItem(1015, L"Record Trace");
+        viewMenu->Append(1016, L"Save Trace...");
+        menuBar->Append(viewMenu, L"View");
+
+        wxMenu* langMenu = new wxMenu();
+        langMenu->AppendRadioItem(1001, L"English");
+        langMenu->AppendRadioItem(1002, L"日本語");
+        langMenu->Check(1001, true); 
+        menuBar->Append(langMenu, L"Language");
+
+        SetMenuBar(menuBar);
+        
+        Bind(wxEVT_MENU, &MainFrame::OnLoadBtn, this, wxID_OPEN);
+        Bind(wxEVT_MENU, [this](wxCommandEvent&){ Close(); }, wxID_EXIT);
+        Bind(wxEVT_MENU, &MainFrame::OnLanguageChange, this, 1001);
+        Bind(wxEVT_MENU, &MainFrame::OnLanguageChange, this, 1002);
+        Bind(wxEVT_MENU, &MainFrame::OnToggleControls, this, 1010);
+        Bind(wxEVT_MENU, &MainFrame::OnToggleBrickLayout, this, 1011);
+        Bind(wxEVT_MENU, &MainFrame::OnToggleCompressed, this, 1018);
+        Bind(wxEVT_MENU, &MainFrame::OnMemoryBudget, this, 1013);
+        Bind(wxEVT_MENU, &MainFrame::OnToggleStats, this, 1014);
+        Bind(wxEVT_MENU, &MainFrame::OnToggleTrace, this, 1015);
+        Bind(wxEVT_MENU, &MainFrame::OnSaveTrace, this, 1016);
+        Bind(wxEVT_MENU, &MainFrame::OnToggleFollow, this, 1017);
+        Bind(wxEVT_MENU, &MainFrame::OnOpenPacs, this, 1019);
+        Bind(wxEVT_MENU, &MainFrame::OnToggleVolumeView, this, 1020);
+#if wxUSE_GLCANVAS
+        Bind(wxEVT_MENU, &MainFrame::OnToggleGPU, this, 1012);
+#endif
+
+        // --- Layout ---
+        rootSizer = new wxBoxSizer(wxHORIZONTAL);
+        imageAreaSizer = new wxBoxSizer(wxVERTICAL);
+        bottomSizer = new wxBoxSizer(wxHORIZONTAL);
+
+        auto clickCb = [this](int type){ this->SwitchLayout(type); };
+        auto wheelCb = [this](int type, int dir){ this->OnPanelWheel(type, dir); };
+
+        panelAxial = new ImagePanel(this, 0, clickCb, wheelCb);
+        panelCoronal = new ImagePanel(this, 1, clickCb, wheelCb);
+        panelSagittal = new ImagePanel(this, 2, clickCb, wheelCb);
+        panelVolume = new ImagePanel(this, 3, clickCb, wheelCb);
+        panelVolume->SetDragCallback([this](int dx, int dy){ this->OnVolumeDrag(dx, dy); });
+
+        SwitchLayout(0);
+        rootSizer->Add(imageAreaSizer, 1, wxEXPAND | wxALL, 0);
+
+        // --- Control Panel ---
+        sidePanel = new wxPanel(this, wxID_ANY);
+        sidePanel->SetBackgroundColour(wxColour(40, 40, 40));
+        sidePanel->SetMinSize(wxSize(320, -1));
+        
+        wxBoxSizer* sideSizer = new wxBoxSizer(wxVERTICAL);
+
+        loadBtn = new wxButton(sidePanel, wxID_ANY, L"Open Folder");
+        sideSizer->Add(loadBtn, 0, wxEXPAND | wxALL, 10);
+
+        infoText = new wxTextCtrl(sidePanel, wxID_ANY, "", wxDefaultPosition, wxSize(-1, 120), wxTE_MULTILINE | wxTE_READONLY);
+        infoText->SetBackgroundColour(*wxWHITE);
+        infoText->SetForegroundColour(*wxBLACK);
+        sideSizer->Add(infoText, 0, wxEXPAND | wxALL, 10);
+
+        // Series
+        labelSeries = new wxStaticText(sidePanel, wxID_ANY, "");
+        ConfigureLabel(labelSeries, *wxWHITE); sideSizer->Add(labelSeries, 0, wxLEFT, 10);
+        seriesList = new wxListBox(sidePanel, wxID_ANY, wxDefaultPosition, wxSize(-1, 90));
+        sideSizer->Add(seriesList, 0, wxEXPAND | wxALL, 10);
+
+        // Sliders
+        labelZ = new wxStaticText(sidePanel, wxID_ANY, ""); 
+        ConfigureLabel(labelZ, COL_AXIAL); sideSizer->Add(labelZ, 0, wxLEFT | wxTOP, 10);
+        
+        sliderZ = new wxSlider(sidePanel, wxID_ANY, 0, 0, 1, wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL | wxSL_LABELS);
+        sliderZ->SetForegroundColour(*wxWHITE); sideSizer->Add(sliderZ, 0, wxEXPAND | wxALL, 5);
+
+        labelY = new wxStaticText(sidePanel, wxID_ANY, ""); 
+        ConfigureLabel(labelY, COL_CORONAL); sideSizer->Add(labelY, 0, wxLEFT | wxTOP, 10);
+
+        sliderY = new wxSlider(sidePanel, wxID_ANY, 0, 0, 1, wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL | wxSL_LABELS);
+        sliderY->SetForegroundColour(*wxWHITE); sideSizer->Add(sliderY, 0, wxEXPAND | wxALL, 5);
+
+        labelX = new wxStaticText(sidePanel, wxID_ANY, ""); 
+        ConfigureLabel(labelX, COL_SAGITTAL); sideSizer->Add(labelX, 0, wxLEFT | wxTOP, 10);
+
+        sliderX = new wxSlider(sidePanel, wxID_ANY, 0, 0, 1, wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL | wxSL_LABELS);
+        sliderX->SetForegroundColour(*wxWHITE); sideSizer->Add(sliderX, 0, wxEXPAND | wxALL, 5);
+
+        // Slab
+        labelSlab = new wxStaticText(sidePanel, wxID_ANY, "");
+        ConfigureLabel(labelSlab, *wxWHITE); sideSizer->Add(labelSlab, 0, wxLEFT | wxTOP, 20);
+        slabChoice = new wxChoice(sidePanel, wxID_ANY);
+        for (int i = 0; i < 4; ++i) slabChoice->Append(wxString());
+        slabChoice->SetSelection(0);
+        sideSizer->Add(slabChoice, 0, wxEXPAND | wxALL, 5);
+        slabSlider = new wxSlider(sidePanel, wxID_ANY, 20, 2, 200, wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL | wxSL_LABELS);
+        slabSlider->SetForegroundColour(*wxWHITE); sideSizer->Add(slabSlider, 0, wxEXPAND | wxALL, 5);
+
+        // Oblique (メイン画面だけを傾ける)
+        labelOblique = new wxStaticText(sidePanel, wxID_ANY, "");
+        ConfigureLabel(labelOblique, *wxWHITE); sideSizer->Add(labelOblique, 0, wxLEFT | wxTOP, 20);
+        obliqueCheck = new wxCheckBox(sidePanel, wxID_ANY, "");
+        obliqueCheck->SetForegroundColour(*wxWHITE); sideSizer->Add(obliqueCheck, 0, wxALL, 5);
+        tiltSlider = new wxSlider(sidePanel, wxID_ANY, 0, -90, 90, wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL | wxSL_LABELS);
+        tiltSlider->SetForegroundColour(*wxWHITE); sideSizer->Add(tiltSlider, 0, wxEXPAND | wxALL, 5);
+        spinSlider = new wxSlider(sidePanel, wxID_ANY, 0, -90, 90, wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL | wxSL_LABELS);
+        spinSlider->SetForegroundColour(*wxWHITE); sideSizer->Add(spinSlider, 0, wxEXPAND | wxALL, 5);
+
+        // Volume Rendering (3D 画面の伝達関数)
+        labelVrt = new wxStaticText(sidePanel, wxID_ANY, "");
+        ConfigureLabel(labelVrt, COL_VOLUME); sideSizer->Add(labelVrt, 0, wxLEFT | wxTOP, 20);
+        vrtChoice = new wxChoice(sidePanel, wxID_ANY);
+        for (int i = 0; i < VRT_PRESET_COUNT; ++i) vrtChoice->Append(wxString());
+        vrtChoice->SetSelection(VRT_BONE);
+        sideSizer->Add(vrtChoice, 0, wxEXPAND | wxALL, 5);
+
+        // Quality
+        labelWL = new wxStaticText(sidePanel, wxID_ANY, "");
+        ConfigureLabel(labelWL, *wxWHITE); sideSizer->Add(labelWL, 0, wxLEFT | wxTOP, 20);
+
+        wlSlider = new wxSlider(sidePanel, wxID_ANY, 40, -1000, 3000, wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL | wxSL_LABELS);
+        wlSlider->SetForegroundColour(*wxWHITE);
+        wwSlider = new wxSlider(sidePanel, wxID_ANY, 400, 1, 4000, wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL | wxSL_LABELS);
+        wwSlider->SetForegroundColour(*wxWHITE);
+        sideSizer->Add(wlSlider, 0, wxEXPAND | wxALL, 5);
+        sideSizer->Add(wwSlider, 0, wxEXPAND | wxALL, 5);
+        
+        // リセットボタン (最初から有効化 + 黒文字)
+        resetBtn = new wxButton(sidePanel, wxID_ANY, L"Reset");
+        resetBtn->SetForegroundColour(*wxBLACK); // 文字色を黒に
+        resetBtn->Enable(true); // ★修正：最初から有効化
+        sideSizer->Add(resetBtn, 0, wxEXPAND | wxALL, 15);
+
+        hintLabel = new wxStaticText(sidePanel, wxID_ANY, "", wxDefaultPosition, wxDefaultSize, wxALIGN_CENTER);
+        hintLabel->SetForegroundColour(wxColour(200, 200, 200));
+        sideSizer->Add(hintLabel, 0, wxALL | wxEXPAND, 15);
+
+        sidePanel->SetSizer(sideSizer);
+        rootSizer->Add(sidePanel, 0, wxEXPAND | wxALL, 0); 
+        SetSizer(rootSizer);
+        CreateStatusBar();
+        volumeCache.SetDirectory((wxStandardPaths::Get().GetUserLocalDataDir() + wxFILE_SEP_PATH + "VolumeCache").ToStdString());
+
+        // Binds
+        loadBtn->Bind(wxEVT_BUTTON, &MainFrame::OnLoadBtn, this);
+        seriesList->Bind(wxEVT_LISTBOX, &MainFrame::OnSeriesSelected, this);
+        slabChoice->Bind(wxEVT_CHOICE, &MainFrame::OnSlabMode, this);
+        obliqueCheck->Bind(wxEVT_CHECKBOX, &MainFrame::OnObliqueToggle, this);
+        vrtChoice->Bind(wxEVT_CHOICE, &MainFrame::OnVrtPreset, this);
+        resetBtn->Bind(wxEVT_BUTTON, &MainFrame::OnResetBtn, this);
+
+        auto BindS = [&](wxSlider* s, void (MainFrame::*f)(wxCommandEvent&), void (MainFrame::*g)(wxScrollEvent&)) {
+            s->Bind(wxEVT_SLIDER, f, this);
+            s->Bind(wxEVT_SCROLL_THUMBTRACK, g, this);
+        };
+        BindS(sliderX, &MainFrame::OnSliceChange, &MainFrame::OnSliceChangeRaw);
+        BindS(sliderY, &MainFrame::OnSliceChange, &MainFrame::OnSliceChangeRaw);
+        BindS(sliderZ, &MainFrame::OnSliceChange, &MainFrame::OnSliceChangeRaw);
+        BindS(wlSlider, &MainFrame::OnWindowChange, &MainFrame::OnWindowChangeRaw);
+        BindS(wwSlider, &MainFrame::OnWindowChange, &MainFrame::OnWindowChangeRaw);
+        BindS(slabSlider, &MainFrame::OnSliceChange, &MainFrame::OnSliceChangeRaw);
+        BindS(tiltSlider, &MainFrame::OnSliceChange, &MainFrame::OnSliceChangeRaw);
+        BindS(spinSlider, &MainFrame::OnSliceChange, &MainFrame::OnSliceChangeRaw);
+
+        Bind(EVT_SLICE_LOADED, &MainFrame::OnSliceLoaded, this);
+        Bind(EVT_VOLUME_LOADED, &MainFrame::OnVolumeLoaded, this);
+        Bind(EVT_PAGE_LOADED, &MainFrame::OnPageLoaded, this);
+        renderTimer.SetOwner(this);
+        Bind(wxEVT_TIMER, &MainFrame::OnRenderTimer, this, renderTimer.GetId());
+        settleTimer.SetOwner(this);
+        Bind(wxEVT_TIMER, &MainFrame::OnSettleTimer, this, settleTimer.GetId());
+        followTimer.SetOwner(this);
+        Bind(wxEVT_TIMER, &MainFrame::OnFollowTimer, this, followTimer.GetId());
+        Bind(wxEVT_FSWATCHER, &MainFrame::OnFolderChanged, this);
+
+        // パネルの大きさが変わったら、その画面を新しいサイズで描き直す
+        ImagePanel* panels[3] = { panelAxial, panelCoronal, panelSagittal };
+        for (int v = 0; v < 3; ++v) {
+            panels[v]->Bind(wxEVT_SIZE, [this, v](wxSizeEvent& e) {
+                dirtyViews |= 1 << v;
+                ScheduleRender();
+                e.Skip();
+            });
+        }
+        panelVolume->Bind(wxEVT_SIZE, [this](wxSizeEvent& e) {
+            vrtDirty = true;
+            ScheduleRender();
+            e.Skip();
+        });
+
+        EnableControls(false); 
+        // ★修正: リセットボタンだけは常に有効にしておく（ガード処理済み）
+        resetBtn->Enable(true); 
+        
+        UpdateUIText(); 
+    }
+
+    ~MainFrame() {
+        renderTimer.Stop();
+        settleTimer.Stop();
+        followTimer.Stop();
+        folderWatcher.reset();
+#if wxUSE_GLCANVAS
+        DisableGPU(); // 子ウィンドウより先にレンダラが破棄されるので、ここで外す
+#endif
+        StopIndexer();
+        StopFollower();
+        loader.Cancel(); // volumeData を解放する前にワーカーを止める
+        pacsLoader.Cancel();
+        prefetcher.Cancel();
+        StopCacheWrite();
+        StopPyramidBuild();
+        volumeData.Clear(); // ページングの展開ジョブがこのウィンドウへ通知しなくなるまで待つ
+    }
+
+    // 起動時に App から呼ぶ。path (フォルダかファイル) があれば、画面を出した直後にヘッダの走査を裏で始める
+    void ShowAndOpen(const wxString& path) {
+        Show();
+        windowShownMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - processStart).count();
+        if(path.IsEmpty()) return;
+        StartFirstPixelClock(true);
+        OpenStartupPath(path);
+    }
+
+private:
+    Volume volumeData;
+    bool brickedLayout = false;
+    bool compressedStorage = false; // 読み終えたボリュームをブリック圧縮して持つ (LRU にも圧縮したまま残る)
+    uint64_t memoryBudget = 4ull << 30; // これを超えるシリーズはページングで開く
+    WindowLut windowLut;
+#if wxUSE_GLCANVAS
+    std::unique_ptr<GLVolumeRenderer> glRenderer;
+#endif
+
+    // 再描画が必要な画面 (ビット位置 = viewType)
+    enum { VIEW_AXIAL = 1 << 0, VIEW_CORONAL = 1 << 1, VIEW_SAGITTAL = 1 << 2, VIEW_ALL = 7 };
+    int dirtyViews = VIEW_ALL;
+    int shownX = -1, shownY = -1, shownZ = -1;
+    SlabParams shownSlab;
+    int mainView = 0;          // 上の大きな画面に出している viewType
+    int shownOblique = -1;     // 斜め断面を描いた画面 (-1 = なし)
+    int shownTilt = 0, shownSpin = 0;
+    mutable SlabCache slabCache; // 描画と先読みで共有する (ボリュームか中身の版が変わると自分で捨てる)
+
+    // 描画スケジューラ: 要求は記録だけして、1 フレームに 1 回だけ描画する
+    static constexpr int FRAME_MS = 16;
+    wxTimer renderTimer;
+    wxStopWatch sinceLastFrame;
+    bool renderPending = false;
+    double lastFrameMs = 0.0;
+    uint64_t lastFrameAllocs = 0; // 直近フレームで描画用バッファを確保し直した回数 (定常状態では 0)
+
+    // 計測オーバーレイ: 直近 1 秒のフレーム数、画面ごとの最後の内訳、読み込み速度
+    bool showStats = false;
+    std::deque<std::chrono::steady_clock::time_point> frameStamps;
+    PlaneTimings viewTimings[3];
+    ResampleQuality viewQuality[3] = { RESAMPLE_HIGH, RESAMPLE_HIGH, RESAMPLE_HIGH };
+    int viewLevel[3] = { 0, 0, 0 };
+    wxStopWatch loadWatch;
+    double loadMBps = 0.0; // 読み込み完了時点の値 (0 ならまだ測っていない)
+    // 最初の画素: 起動 (コマンドラインで開いたとき) かフォルダを選んだ時点から、画像を初めて描くまで
+    std::chrono::steady_clock::time_point openStart = processStart;
+    // 時計を動かした後に始まった最初の読み込み (BeginVolume) の loadGeneration だけを測る。-1 は測っていない
+    bool firstPixelArmed = false, firstPixelFromLaunch = false;
+    long firstPixelGeneration = -1;
+    double firstPixelMs = -1.0, windowShownMs = -1.0;
+
+    // 操作中は軽量な拡大縮小で描き、操作が止まったら高品質で描き直す
+    static constexpr int SETTLE_MS = 250;
+    wxTimer settleTimer;
+    bool interacting = false;
+    int coarseViews = 0; // 軽量版で描いたままの画面
+    VolumeLoader loader;
+    // ボリュームの中身が変わるたびに進める (先読みフレームの照合用)
+    long contentRevision = 0;
+    struct ScrollState { int dir = 0; double rate = 0; std::chrono::steady_clock::time_point last; };
+    ScrollState scrollState[3];
+    PlaneScratch viewScratch[3]; // UpdateAllViews の画面ごと
+    PlaneScratch prefetchScratch; // 以下 2 つは先読みスレッド専用
+    std::vector<std::shared_ptr<std::vector<unsigned char>>> prefetchBuffers;
+    FramePrefetcher prefetcher{ [this](const FrameKey& key) { PrefetchFrame(key); } };
+    VolumeCache volumeCache;
+    static constexpr uint64_t CACHE_BUDGET = 8ull << 30;
+    uint64_t volumeKey = 0;
+    VolumeInfo volumeInfo;
+    // 読み込み中のシリーズの画素値の分布。スライダーの範囲と自動ウィンドウに使う
+    ValueHistogram histogram;
+    bool windowTouched = false; // 利用者が動かしたウィンドウは自動で上書きしない
+    bool rangeShown = false;    // 読み込み途中の分布をスライダーへ反映したか
+    std::thread cacheWriter;
+    std::atomic<bool> cacheCancel{false};
+    std::atomic<bool> cacheWriting{false}; // 書き出しが終わっていない (止めたら書き直す)
+    // フォルダ内の全シリーズ (seriesKeys は必要になった時点で求める)
+    std::vector<SeriesEntry> seriesIndex;
+    std::vector<uint64_t> seriesKeys;
+    uint64_t folderKey = 0;
+    long folderGeneration = 0;
+    std::thread indexer;
+    std::atomic<bool> indexCancel{false};
+    struct StashedVolume { uint64_t key; VolumeInfo info; Volume vol; std::shared_ptr<const VolumePyramid> pyramid; };
+    // 操作中に描く縮小版。読み込み後に裏で作り、できた時点で UI スレッドから差し込む
+    std::shared_ptr<const VolumePyramid> pyramid;
+    std::thread pyramidBuilder;
+    std::atomic<bool> pyramidCancel{false};
+    std::list<StashedVolume> volumeLru; // 先頭が最近表示したもの
+
+    // フォルダの追従 (撮影中に届くスライスを表示中のボリュームへ差し込む)
+    static constexpr int FOLLOW_MS = 500;
+    std::unique_ptr<wxFileSystemWatcher> folderWatcher; // 追従中だけ生きている
+    wxString folderPath;
+    std::set<std::string> knownFiles;   // 走査済みのファイル
+    std::set<std::string> pendingFiles; // 通知を受けてまだ読んでいないファイル
+    wxTimer followTimer;
+    std::thread follower;
+    std::atomic<bool> followCancel{false};
+    bool followBusy = false;
+    long followSerial = 0;
+    bool followChanged = false; // 追従中に差し込んだので、キャッシュは追従を止めたときに書く
+    struct FollowBatch { std::vector<SliceHeader> headers; std::vector<std::vector<int16_t>> pixels; };
+
+    // PACS から開いたスタディ (seriesIndex の path は PACS_PATH_PREFIX 付き)
+    static constexpr int PACS_CONNECTIONS = 4;
+    PacsLoader pacsLoader;
+    PacsServer pacsServer;
+    std::string pacsStudy, pacsSeries; // 直前に開いた値 (次の問い合わせの初期値)
+    long loadGeneration = 0;
+    int loadedSlices = 0;
+    bool isLoading = false;
+    wxStopWatch progressiveTimer;
+
+    // 3D 画面 (レイキャスト): カメラ・伝達関数・中身の版・大きさが変わったら粗い 1 枚をすぐ出し、
+    // 操作が止まっている間は行の帯ごとに 1 フレーム VRT_REFINE_MS ずつ仕上げる
+    static constexpr double VRT_REFINE_MS = 30.0;
+    bool showVolumeView = true;
+    VrtCamera vrtCamera;
+    VolumeRaycaster raycaster;
+    VrtView vrtView{};
+    bool vrtDirty = true;
+    long vrtRevision = -1;
+    int vrtW = 0, vrtH = 0;
+    int vrtRefineRow = -1;    // ここから下がまだ粗いまま (-1 = 仕上げ済み)
+    double vrtMsPerRow = 1.0; // 直近の仕上げの 1 行あたりの時間 (帯の行数を決める)
+    int volWidth = 0, volHeight = 0, volDepth = 0;
+    double pxSpcX = 1.0, pxSpcY = 1.0, sliceThick = 1.0;
+    std::vector<double> sliceOffsets; // 間隔が一様でないシリーズの先頭からの距離 (読み終えたら一様な格子へ並べ直す)
+    bool isJapanese = false; 
+
+    wxString patientName = "Unknown";
+    wxString patientID = "Unknown";
+
+    wxBoxSizer *rootSizer, *imageAreaSizer, *bottomSizer;
+    wxPanel* sidePanel;
+    ImagePanel *panelAxial, *panelCoronal, *panelSagittal, *panelVolume;
+    
+    wxButton *loadBtn, *resetBtn;
+    wxTextCtrl* infoText;
+    wxStaticText *labelX, *labelY, *labelZ, *labelWL, *hintLabel, *labelSeries, *labelSlab, *labelOblique, *labelVrt;
+    wxCheckBox* obliqueCheck = nullptr;
+    wxListBox* seriesList;
+    wxChoice *slabChoice, *vrtChoice;
+    wxSlider *sliderX, *sliderY, *sliderZ, *wlSlider, *wwSlider, *slabSlider, *tiltSlider, *spinSlider;
+
+    void ConfigureLabel(wxStaticText* t, const wxColour& col) {
+        t->SetForegroundColour(col);
+        t->SetFont(wxFont(9, wxFONTFAMILY_DEFAULT, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_BOLD));
+    }
+
+    void OnToggleControls(wxCommandEvent&) {
+        if (sidePanel->IsShown()) sidePanel->Hide();
+        else sidePanel->Show();
+        rootSizer->Layout();
+    }
+
+#if wxUSE_GLCANVAS
+    void OnToggleGPU(wxCommandEvent& evt) {
+        if (evt.IsChecked()) {
+            EnableGPU();
+            if (slabChoice->GetSelection() > 0) {
+                slabChoice->SetSelection(0); // シェーダは単一断面しか描けない
+                slabSlider->Enable(false);
+                SetStatusText(isJapanese ? L"GPU 描画中はスラブ投影を使えません" : L"Slab projection is not available with GPU rendering");
+            }
+            if (obliqueCheck->GetValue()) {
+                obliqueCheck->SetValue(false);
+                tiltSlider->Enable(false); spinSlider->Enable(false);
+                SetStatusText(isJapanese ? L"GPU 描画中は斜め断面を使えません" : L"Oblique reslicing is not available with GPU rendering");
+            }
+        }
+        else DisableGPU();
+        dirtyViews = VIEW_ALL;
+        UpdateAllViews();
+    }
+
+    void EnableGPU() {
+        if (glRenderer) return;
+        glRenderer = std::make_unique<GLVolumeRenderer>();
+        glRenderer->SetVolume(&volumeData);
+        // 描画イベントの中から呼ばれるので、切り替えはイベント処理後に行う
+        glRenderer->onFailure = [this](const wxString& reason) {
+            CallAfter([this, reason]() {
+                DisableGPU();
+                GetMenuBar()->Check(1012, false);
+                SetStatusText((isJapanese ? L"GPU 描画を無効化: " : L"GPU rendering disabled: ") + reason);
+                dirtyViews = VIEW_ALL;
+                UpdateAllViews();
+            });
+        };
+        panelAxial->AttachGL(glRenderer.get());
+        panelCoronal->AttachGL(glRenderer.get());
+        panelSagittal->AttachGL(glRenderer.get());
+        panelVolume->AttachGL(glRenderer.get());
+        vrtDirty = true;
+    }
+
+    void DisableGPU() {
+        if (!glRenderer) return;
+        panelAxial->DetachGL();
+        panelCoronal->DetachGL();
+        panelSagittal->DetachGL();
+        panelVolume->DetachGL();
+        glRenderer.reset();
+        vrtDirty = true;
+    }
+#endif
+
+    void OnToggleBrickLayout(wxCommandEvent& evt) {
+        brickedLayout = evt.IsChecked();
+        ApplyVolumeLayout();
+    }
+
+    void OnToggleCompressed(wxCommandEvent& evt) {
+        compressedStorage = evt.IsChecked();
+        ApplyVolumeLayout();
+        TrimVolumeLru();
+        infoText->SetValue(GetInfoString());
+    }
+
+    // 追従中はスライスを差し込めるよう線形のまま持つ
+    Volume::Layout PreferredLayout() const {
+        if (folderWatcher) return Volume::LAYOUT_LINEAR;
+        if (compressedStorage) return Volume::LAYOUT_COMPRESSED;
+        return brickedLayout ? Volume::LAYOUT_BRICKED : Volume::LAYOUT_LINEAR;
+    }
+
+    // ローダーは複数のスレッドから WriteSlice するので、圧縮形式には読み終えてから変換する
+    Volume::Layout LoadLayout() const {
+        Volume::Layout l = PreferredLayout();
+        if (l != Volume::LAYOUT_COMPRESSED) return l;
+        return brickedLayout ? Volume::LAYOUT_BRICKED : Volume::LAYOUT_LINEAR;
+    }
+
+    // 読み込み中はローダーが書き込んでいるので、変換は読み込み完了時に行う
+    void ApplyVolumeLayout() {
+        if (volumeData.empty() || isLoading || volumeData.IsPaged() || volumeData.GetLayout() == PreferredLayout()) return;
+        prefetcher.Cancel(); // 読み出し中のバッファを差し替えないように
+        bool resumeCache = cacheWriting;
+        StopCacheWrite();
+        StopPyramidBuild();
+        volumeData.SetLayout(PreferredLayout());
+        if (!pyramid) StartPyramidBuild(); // 中身は変わらないので、できている縮小版はそのまま使える
+        if (resumeCache && loadedSlices == volDepth) StartCacheWrite(); // 途中で止めた書き出しは並べ替えた後のボリュームで書き直す
+        UpdateAllViews();
+    }
+
+    void OnMemoryBudget(wxCommandEvent&) {
+        long mb = wxGetNumberFromUser(isJapanese ? L"ボリュームに使うメモリの上限 (MB)。超えるシリーズはページングで開き、最近表示したシリーズはこの範囲でメモリに残します。"
+                                                 : L"Memory limit for volume data (MB). Larger series are paged from disk; recently viewed series are kept in memory within this limit.",
+                                      L"MB", isJapanese ? L"メモリ予算" : L"Memory Budget",
+                                      (long)(memoryBudget >> 20), 256, 1L << 20, this);
+        if (mb < 0) return;
+        memoryBudget = (uint64_t)mb << 20;
+        TrimVolumeLru();
+        if (SlicePager* pager = volumeData.Pager()) {
+            pager->SetBudget(memoryBudget);
+            dirtyViews = VIEW_ALL;
+            ScheduleRender();
+        }
+    }
+
+    // fromLaunch なら起動時刻から、そうでなければ今から測る。次の BeginVolume で測る読み込みが決まる
+    void StartFirstPixelClock(bool fromLaunch) {
+        openStart = fromLaunch ? processStart : std::chrono::steady_clock::now();
+        firstPixelFromLaunch = fromLaunch;
+        firstPixelArmed = true;
+        firstPixelGeneration = -1;
+        firstPixelMs = -1.0;
+    }
+
+    // 開けなかったときは、後で別の操作から始まる読み込みを測らないように止める
+    void CancelFirstPixelClock() { firstPixelArmed = false; }
+
+    void OnToggleStats(wxCommandEvent& evt) {
+        showStats = evt.IsChecked();
+        frameStamps.clear();
+        if (showStats) { dirtyViews = VIEW_ALL; ScheduleRender(); }
+        else { panelAxial->SetStats(""); panelCoronal->SetStats(""); panelSagittal->SetStats(""); }
+    }
+
+    void OnToggleTrace(wxCommandEvent& evt) {
+        Profiler::Get().SetTracing(evt.IsChecked());
+        SetStatusText(evt.IsChecked() ? (isJapanese ? L"トレースを記録中" : L"Recording trace")
+                                      : wxString::Format(isJapanese ? L"トレースを停止: %lu 区間" : L"Trace stopped: %lu events",
+                                                         (unsigned long)Profiler::Get().EventCount()));
+    }
+
+    void OnSaveTrace(wxCommandEvent&) {
+        Profiler& prof = Profiler::Get();
+        if (prof.EventCount() == 0) {
+            SetStatusText(isJapanese ? L"記録されたトレースがありません (View > Record Trace で記録)" : L"No trace recorded (View > Record Trace)");
+            return;
+        }
+        wxFileDialog dlg(this, isJapanese ? L"トレースを保存" : L"Save Trace", "", "trace.json",
+                         "Chrome trace (*.json)|*.json", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (dlg.ShowModal() != wxID_OK) return;
+        size_t count = prof.EventCount(), dropped = prof.Dropped();
+        if (!prof.WriteChromeTrace(dlg.GetPath().ToStdString())) {
+            SetStatusText(isJapanese ? L"トレースを保存できませんでした" : L"Failed to save trace");
+            return;
+        }
+        wxString msg = wxString::Format(isJapanese ? L"トレースを保存: %lu 区間" : L"Trace saved: %lu events", (unsigned long)count);
+        if (dropped) msg += wxString::Format(isJapanese ? L" (上限超過で %lu 区間を破棄)" : L" (%lu dropped at the limit)", (unsigned long)dropped);
+        SetStatusText(msg);
+    }
+
+    // 読み込み中は経過時間からの実測値、終わった後は完了時点の値
+    double LoadThroughputMBps() {
+        if (!isLoading) return loadMBps;
+        double sec = loadWatch.Time() / 1000.0;
+        if (sec <= 0) return 0.0;
+        return (double)volWidth * volHeight * loadedSlices * sizeof(int16_t) / (1024.0 * 1024.0) / sec;
+    }
+
+    void UpdateStatsOverlay() {
+        auto now = std::chrono::steady_clock::now();
+        frameStamps.push_back(now);
+        while (now - frameStamps.front() > std::chrono::seconds(1)) frameStamps.pop_front();
+        wxString common = wxString::Format(isJapanese ? L"FPS %d  フレーム %.1f ms  確保 %d" : L"FPS %d  frame %.1f ms  allocs %d",
+                                           (int)frameStamps.size(), lastFrameMs, (int)lastFrameAllocs);
+        double mbps = LoadThroughputMBps();
+        wxString load = mbps > 0 ? wxString::Format(isJapanese ? L"\n読み込み %.0f MB/s" : L"\nload %.0f MB/s", mbps) : wxString();
+        if (firstPixelMs >= 0) {
+            if (firstPixelFromLaunch) load += wxString::Format(isJapanese ? L"\n起動から: 画面 %.0f ms  最初の画素 %.0f ms" : L"\nfrom launch: window %.0f ms  first pixel %.0f ms",
+                                                               windowShownMs, firstPixelMs);
+            else load += wxString::Format(isJapanese ? L"\n開いてから最初の画素 %.0f ms" : L"\nfirst pixel %.0f ms after open", firstPixelMs);
+        }
+        for (int v = 0; v < 3; ++v) {
+            wxString stages;
+#if wxUSE_GLCANVAS
+            if (glRenderer && PanelFor(v)->HasGL()) stages = L"\nGPU";
+            else
+#endif
+            {
+                const PlaneTimings& t = viewTimings[v];
+                const char* q = viewQuality[v] == RESAMPLE_HIGH ? "high" : (viewQuality[v] == RESAMPLE_BILINEAR ? "bilinear" : "nearest");
+                stages = wxString::Format(isJapanese ? L"\n切出 %.2f  拡縮 %.2f  WL %.2f ms (%s, 1/%d)" : L"\nextract %.2f  rescale %.2f  window %.2f ms (%s, 1/%d)",
+                                          t.extractMs, t.resampleMs, t.windowMs, q, 1 << viewLevel[v]);
+            }
+            PanelFor(v)->SetStats(common + stages + load);
+        }
+    }
+
+    void OnLanguageChange(wxCommandEvent& evt) {
+        if (evt.GetId() == 1001) isJapanese = false;
+        else isJapanese = true;
+        UpdateUIText();
+    }
+
+    // リセット処理 (データがないときは何もしない安全装置付き)
+    void OnResetBtn(wxCommandEvent&) {
+        if (volumeData.empty()) return;
+        
+        sliderX->SetValue(sliderX->GetMax() / 2);
+        sliderY->SetValue(sliderY->GetMax() / 2);
+        sliderZ->SetValue(sliderZ->GetMax() / 2);
+
+        int wl, ww;
+        InitialWindow(wl, ww);
+        wlSlider->SetValue(wl);
+        wwSlider->SetValue(ww);
+        windowTouched = false;
+        UpdateWindowLabel();
+        slabChoice->SetSelection(0);
+        slabSlider->Enable(false);
+        obliqueCheck->SetValue(false);
+        tiltSlider->SetValue(0); spinSlider->SetValue(0);
+        tiltSlider->Enable(false); spinSlider->Enable(false);
+        vrtCamera = VrtCamera();
+        vrtDirty = true;
+
+        ScheduleRender();
+    }
+
+    void UpdateUIText() {
+        panelAxial->SetLanguage(isJapanese);
+        panelCoronal->SetLanguage(isJapanese);
+        panelSagittal->SetLanguage(isJapanese);
+        panelVolume->SetLanguage(isJapanese);
+
+        if (isJapanese) {
+            SetTitle(L"DICOM ビューアー");
+            loadBtn->SetLabel(L"フォルダを開く");
+            resetBtn->SetLabel(L"リセット");
+            infoText->SetValue(infoText->GetValue().IsEmpty() ? L"データなし" : GetInfoString());
+            labelZ->SetLabel(L"Axial 位置 (Z) - 赤枠");
+            labelY->SetLabel(L"Coronal 位置 (Y) - 緑枠");
+            labelX->SetLabel(L"Sagittal 位置 (X) - 青枠");
+            labelSeries->SetLabel(L"シリーズ");
+            labelSlab->SetLabel(L"スラブ投影 (厚み: スライス数)");
+            labelOblique->SetLabel(L"斜め断面 (傾き / 回転: 度)");
+            obliqueCheck->SetLabel(L"メイン画面を傾ける");
+            labelVrt->SetLabel(L"3D 表示 (ドラッグで回転 / ホイールで拡大)");
+            hintLabel->SetLabel(L"ヒント: 下の画像をクリックすると\n上のメイン画面と入れ替わります");
+        } else {
+            SetTitle(L"DICOM Viewer");
+            loadBtn->SetLabel(L"Open Folder");
+            resetBtn->SetLabel(L"Reset");
+            infoText->SetValue(infoText->GetValue().IsEmpty() ? L"No Data" : GetInfoString());
+            labelZ->SetLabel(L"Axial Slice (Z) - Red Frame");
+            labelY->SetLabel(L"Coronal Slice (Y) - Green Frame");
+            labelX->SetLabel(L"Sagittal Slice (X) - Blue Frame");
+            labelSeries->SetLabel(L"Series");
+            labelSlab->SetLabel(L"Slab Projection (thickness in slices)");
+            labelOblique->SetLabel(L"Oblique MPR (tilt / spin in degrees)");
+            obliqueCheck->SetLabel(L"Tilt main view");
+            labelVrt->SetLabel(L"3D View (drag to rotate / wheel to zoom)");
+            hintLabel->SetLabel(L"Hint: Click a bottom image to\nswap it with the main view.");
+        }
+        UpdateWindowLabel();
+        for(size_t i = 0; i < seriesIndex.size() && i < seriesList->GetCount(); ++i) seriesList->SetString((unsigned)i, SeriesLabel(seriesIndex[i]));
+        const wchar_t* slabNames[4] = { isJapanese ? L"オフ (単一断面)" : L"Off (single slice)", L"MIP", L"MinIP", isJapanese ? L"平均" : L"Average" };
+        for(int i = 0; i < 4; ++i) slabChoice->SetString(i, slabNames[i]);
+        const wchar_t* vrtNames[VRT_PRESET_COUNT] = { isJapanese ? L"骨" : L"Bone", isJapanese ? L"軟部組織" : L"Soft Tissue", isJapanese ? L"皮膚" : L"Skin" };
+        for(int i = 0; i < VRT_PRESET_COUNT; ++i) vrtChoice->SetString(i, vrtNames[i]);
+        Layout();
+    }
+
+    wxString GetInfoString() {
+        std::stringstream ss;
+        if (isJapanese) {
+            ss << "名前: " << patientName << "\r\nID: " << patientID << "\r\n";
+            ss << "サイズ: " << volWidth << " x " << volHeight << "\r\n";
+            ss << "スライス数: " << volDepth << "\r\n";
+            if (isLoading) ss << "読み込み中: " << loadedSlices << " / " << volDepth << "\r\n";
+            if (volumeData.IsPaged()) ss << "常駐 (ページング): " << volumeData.Pager()->Resident() << " / " << volDepth << "\r\n";
+            if (volumeData.IsCompressed()) ss << "圧縮: " << CompressionText() << "\r\n";
+            ss << "スライス厚: " << sliceThick << " mm";
+        } else {
+            ss << "Name: " << patientName << "\r\nID: " << patientID << "\r\n";
+            ss << "Size: " << volWidth << " x " << volHeight << "\r\n";
+            ss << "Slices: " << volDepth << "\r\n";
+            if (isLoading) ss << "Loading: " << loadedSlices << " / " << volDepth << "\r\n";
+            if (volumeData.IsPaged()) ss << "Resident (paged): " << volumeData.Pager()->Resident() << " / " << volDepth << "\r\n";
+            if (volumeData.IsCompressed()) ss << "Compressed: " << CompressionText() << "\r\n";
+            ss << "Thickness: " << sliceThick << " mm";
+        }
+        return wxString::FromUTF8(ss.str().c_str());
+    }
+
+    std::string CompressionText() const {
+        uint64_t stored = volumeData.StoredBytes();
+        char text[64];
+        std::snprintf(text, sizeof(text), "%llu MB (%.1fx)", (unsigned long long)(stored >> 20),
+                      (double)volWidth * volHeight * volDepth * sizeof(int16_t) / std::max<uint64_t>(1, stored));
+        return text;
+    }
+
+    void SwitchLayout(int mainViewType) {
+        imageAreaSizer->Detach(bottomSizer);
+        imageAreaSizer->Clear(false); bottomSizer->Clear(false);
+        // メイン以外は viewType の順に下へ並べる (3D 画面は表示中だけ)
+        ImagePanel* panels[4] = { panelAxial, panelCoronal, panelSagittal, panelVolume };
+        if (mainViewType == 3 && !showVolumeView) mainViewType = 0;
+        imageAreaSizer->Add(panels[mainViewType], 3, wxEXPAND | wxALL, 2);
+        for (int v = 0; v < 4; ++v) {
+            if (v != mainViewType && (v < 3 || showVolumeView)) bottomSizer->Add(panels[v], 1, wxEXPAND | wxALL, 2);
+        }
+        panelVolume->Show(showVolumeView);
+        imageAreaSizer->Add(bottomSizer, 2, wxEXPAND | wxALL, 2);
+        mainView = mainViewType;
+        // 斜め断面はメイン画面に付いて回る
+        if (obliqueCheck && obliqueCheck->GetValue() && !volumeData.empty()) ScheduleRender();
+        Layout(); Refresh();
+    }
+
+    void OnPanelWheel(int viewType, int direction) {
+        if (volumeData.empty()) return;
+        if (viewType == 3) {
+            vrtCamera.zoom = std::clamp(vrtCamera.zoom * (direction > 0 ? 1.1 : 1 / 1.1), 0.5, 8.0);
+            vrtDirty = true;
+            BeginInteraction();
+            ScheduleRender();
+            return;
+        }
+        wxSlider* targetSlider = nullptr;
+        if (viewType == 0) targetSlider = sliderZ; 
+        else if (viewType == 1) targetSlider = sliderY; 
+        else targetSlider = sliderX; 
+
+        if (targetSlider) {
+            int val = targetSlider->GetValue();
+            val += direction;
+            if (val < targetSlider->GetMin()) val = targetSlider->GetMin();
+            if (val > targetSlider->GetMax()) val = targetSlider->GetMax();
+            targetSlider->SetValue(val);
+            BeginInteraction();
+            ScheduleRender();
+            PrefetchAhead(viewType, val, direction, targetSlider->GetMax());
+        }
+    }
+
+    void EnableControls(bool enable) {
+        sliderX->Enable(enable); sliderY->Enable(enable); sliderZ->Enable(enable);
+        wlSlider->Enable(enable); wwSlider->Enable(enable);
+        slabChoice->Enable(enable); slabSlider->Enable(enable && slabChoice->GetSelection() > 0);
+        obliqueCheck->Enable(enable);
+        tiltSlider->Enable(enable && obliqueCheck->GetValue()); spinSlider->Enable(enable && obliqueCheck->GetValue());
+        vrtChoice->Enable(enable);
+        // resetBtnは常に有効なのでここでは触らない
+    }
+
+    void OnLoadBtn(wxCommandEvent&) {
+        wxDirDialog dlg(this, isJapanese ? L"DICOMフォルダを選択" : L"Select DICOM Folder");
+        if (dlg.ShowModal() != wxID_OK) return;
+        StartFirstPixelClock(false);
+        std::vector<std::string> paths = ListDicomFiles(dlg.GetPath());
+        if (paths.empty()) { CancelFirstPixelClock(); return; }
+        // 0) フォルダの中身が前回と同じなら、キャッシュを写像するだけで開く
+        if (BeginFolder(dlg.GetPath(), paths)) return;
+
+        // 1) ヘッダのみのスキャンを全コアで実行 (UI はプログレス更新のみ)
+        std::vector<SliceHeader> headers;
+        std::atomic<int> scanned{0};
+        {
+            wxProgressDialog scanner(isJapanese ? L"スキャン中" : L"Scanning", 
+                                     isJapanese ? L"シリーズを分類しています..." : L"Grouping Series...", 
+                                     (int)paths.size(), this, wxPD_APP_MODAL | wxPD_AUTO_HIDE);
+            auto scanJob = std::async(std::launch::async, [&]() { headers = ScanHeaders(paths, &scanned); });
+            while(scanJob.wait_for(std::chrono::milliseconds(50)) != std::future_status::ready) scanner.Update(scanned.load());
+            scanJob.get();
+        }
+
+        // 2) 走査結果はシリーズ一覧として残し、最も枚数の多いシリーズを開く
+        if(!SetSeriesIndex(GroupSeries(headers))) { CancelFirstPixelClock(); return; }
+        OpenSeries(LargestSeries(seriesIndex));
+    }
+
+    // 拡張子は IsDicomFileName で選ぶ (Unix の wxDir はワイルドカードの大文字小文字を区別する)
+    std::vector<std::string> ListDicomFiles(const wxString& dir) const {
+        wxArrayString files;
+        wxDir::GetAllFiles(dir, &files, wxEmptyString, wxDIR_FILES);
+        std::vector<std::string> paths;
+        paths.reserve(files.GetCount());
+        for(size_t i=0; i<files.GetCount(); ++i) {
+            std::string path = files[i].ToStdString();
+            if(IsDicomFileName(path)) paths.push_back(std::move(path));
+        }
+        return paths;
+    }
+
+    // フォルダを切り替える共通処理。中身が前回と同じならキャッシュを写像するだけで開き (シリーズ一覧は裏で作る)、true を返す。
+    // openFile を渡すと、一覧ができた時点でそのファイルが写像したものと別のシリーズならそちらへ切り替える
+    bool BeginFolder(const wxString& dir, std::vector<std::string>& paths, const std::string& openFile = std::string()) {
+        StopIndexer();
+        StopFollower();
+        ++folderGeneration;
+        folderPath = dir;
+        knownFiles = std::set<std::string>(paths.begin(), paths.end());
+        pendingFiles.clear();
+        if(folderWatcher) WatchFolder();
+
+        folderKey = VolumeCache::MakeKey(paths);
+        if(!OpenReadyVolume(folderKey)) return false;
+        seriesIndex.clear(); seriesKeys.clear();
+        seriesList->Clear();
+        StartIndexer(std::move(paths), false, openFile);
+        return true;
+    }
+
+    // コマンドラインで渡されたフォルダ (またはファイル) を開く。画面を出した直後に呼び、走査は裏で進める。
+    // ファイルを渡したときはそのフォルダを開き、そのファイルを含むシリーズを表示する
+    void OpenStartupPath(const wxString& path) {
+        wxString dir = path, file;
+        if(!wxFileName::DirExists(path)) {
+            if(!wxFileName::FileExists(path)) { CancelFirstPixelClock(); SetStatusText((isJapanese ? L"開けません: " : L"Cannot open: ") + path); return; }
+            wxFileName name(path);
+            name.MakeAbsolute();
+            dir = name.GetPath();
+            file = name.GetFullPath();
+        }
+        std::vector<std::string> paths = ListDicomFiles(dir);
+        if(paths.empty()) { CancelFirstPixelClock(); SetStatusText((isJapanese ? L"DICOM ファイルがありません: " : L"No DICOM files in ") + dir); return; }
+        std::string openFile = file.ToStdString();
+        if(BeginFolder(dir, paths, openFile)) return;
+        SetStatusText(isJapanese ? L"シリーズを分類しています..." : L"Grouping Series...");
+        StartIndexer(std::move(paths), true, openFile);
+    }
+
+    // --- PACS ---
+    // C-FIND でスタディのスライス一覧を作り、フォルダと同じく最も枚数の多いシリーズを開く (画素は C-GET で届いた順に展開する)
+    void OnOpenPacs(wxCommandEvent&) {
+        if(!AskPacsQuery()) return;
+        StopIndexer();
+        StopFollower();
+        ++folderGeneration;
+        // PACS のスタディには追従するフォルダがない
+        if(folderWatcher) { followTimer.Stop(); folderWatcher.reset(); GetMenuBar()->Check(1017, false); }
+        folderPath.clear();
+        knownFiles.clear(); pendingFiles.clear();
+
+        std::vector<SliceHeader> headers;
+        std::string error;
+        bool ok = false;
+        {
+            wxProgressDialog finder(isJapanese ? L"問い合わせ中" : L"Querying",
+                                    wxString::FromUTF8((pacsServer.calledAE + "@" + pacsServer.host).c_str()), 100, this, wxPD_APP_MODAL | wxPD_AUTO_HIDE);
+            auto findJob = std::async(std::launch::async, [&]() { ok = FindPacsStudy(pacsServer, pacsStudy, pacsSeries, headers, error); });
+            while(findJob.wait_for(std::chrono::milliseconds(50)) != std::future_status::ready) finder.Pulse();
+            findJob.get();
+        }
+        if(!ok) {
+            wxMessageBox(wxString::FromUTF8(error.c_str()), isJapanese ? L"PACS から開けませんでした" : L"Could not open from PACS", wxOK | wxICON_ERROR, this);
+            return;
+        }
+        std::vector<std::string> ids(headers.size());
+        for(size_t i = 0; i < headers.size(); ++i) ids[i] = headers[i].path;
+        folderKey = VolumeCache::MakeKey(std::move(ids));
+        if(!SetSeriesIndex(GroupSeries(headers))) return;
+        OpenSeries(LargestSeries(seriesIndex));
+    }
+
+    // 接続先とスタディを聞く。入力した値は次回の初期値として残す
+    bool AskPacsQuery() {
+        wxDialog dlg(this, wxID_ANY, isJapanese ? L"PACS から開く" : L"Open from PACS");
+        wxFlexGridSizer* grid = new wxFlexGridSizer(2, 6, 8);
+        grid->AddGrowableCol(1);
+        auto field = [&](const wchar_t* en, const wchar_t* ja, const std::string& value) {
+            grid->Add(new wxStaticText(&dlg, wxID_ANY, isJapanese ? ja : en), 0, wxALIGN_CENTER_VERTICAL);
+            wxTextCtrl* t = new wxTextCtrl(&dlg, wxID_ANY, wxString::FromUTF8(value.c_str()), wxDefaultPosition, wxSize(360, -1));
+            grid->Add(t, 1, wxEXPAND);
+            return t;
+        };
+        wxTextCtrl* host = field(L"Host", L"ホスト", pacsServer.host);
+        wxTextCtrl* port = field(L"Port", L"ポート", std::to_string(pacsServer.port));
+        wxTextCtrl* called = field(L"Called AE Title", L"接続先 AE タイトル", pacsServer.calledAE);
+        wxTextCtrl* calling = field(L"Calling AE Title", L"自分の AE タイトル", pacsServer.callingAE);
+        wxTextCtrl* study = field(L"Study Instance UID", L"Study Instance UID", pacsStudy);
+        wxTextCtrl* series = field(L"Series Instance UID (optional)", L"Series Instance UID (省略可)", pacsSeries);
+        wxBoxSizer* box = new wxBoxSizer(wxVERTICAL);
+        box->Add(grid, 1, wxEXPAND | wxALL, 10);
+        box->Add(dlg.CreateStdDialogButtonSizer(wxOK | wxCANCEL), 0, wxEXPAND | wxLEFT | wxRIGHT | wxBOTTOM, 10);
+        dlg.SetSizerAndFit(box);
+        if(dlg.ShowModal() != wxID_OK) return false;
+
+        auto text = [](wxTextCtrl* t) { return t->GetValue().Trim().Trim(false).ToStdString(); };
+        long portNo = 0;
+        if(text(study).empty() || text(host).empty() || !port->GetValue().ToLong(&portNo) || portNo <= 0 || portNo > 65535) {
+            SetStatusText(isJapanese ? L"ホスト・ポート番号・Study Instance UID を確認してください" : L"Check the host, port and Study Instance UID");
+            return false;
+        }
+        pacsServer.host = text(host); pacsServer.port = (int)portNo;
+        pacsServer.calledAE = text(called); pacsServer.callingAE = text(calling);
+        pacsStudy = text(study); pacsSeries = text(series);
+        return true;
+    }
+
+    // --- シリーズ一覧 ---
+    // 最大のシリーズはフォルダ全体のキー (キャッシュから開く経路と同じ) で、それ以外は各シリーズのファイルから求める
+    bool SetSeriesIndex(std::vector<SeriesEntry> series) {
+        int best = LargestSeries(series);
+        if(best < 0) return false;
+        seriesIndex = std::move(series);
+        seriesKeys.assign(seriesIndex.size(), 0);
+        seriesKeys[best] = folderKey;
+        seriesList->Clear();
+        for(const SeriesEntry& e : seriesIndex) seriesList->Append(SeriesLabel(e));
+        for(size_t i = 0; i < seriesIndex.size(); ++i) {
+            if(!volumeData.empty() && seriesIndex[i].uid == volumeInfo.seriesUID) seriesList->SetSelection((int)i);
+        }
+        return true;
+    }
+
+    uint64_t SeriesKey(int i) {
+        if(!seriesKeys[i]) seriesKeys[i] = VolumeCache::MakeKey(seriesIndex[i].Paths());
+        return seriesKeys[i];
+    }
+
+    wxString SeriesLabel(const SeriesEntry& e) const {
+        wxString desc = e.description.empty() ? wxString(isJapanese ? L"(説明なし)" : L"(no description)") : wxString::FromUTF8(e.description.c_str());
+        return wxString::Format(isJapanese ? L"#%d %s %s - %d 枚" : L"#%d %s %s - %d slices",
+                                e.number, wxString::FromUTF8(e.modality.c_str()), desc, (int)e.slices.size());
+    }
+
+    void OnSeriesSelected(wxCommandEvent& evt) {
+        int i = evt.GetSelection();
+        if(i < 0 || i >= (int)seriesIndex.size()) return;
+        OpenSeries(i);
+    }
+
+    void OpenSeries(int i) {
+        uint64_t key = SeriesKey(i);
+        seriesList->SetSelection(i);
+        if(OpenReadyVolume(key)) return;
+        DecodeSeries(key, seriesIndex[i]);
+    }
+
+    // キャッシュから開いたときはシリーズ一覧がまだないので、裏でヘッダを走査して埋める。
+    // open なら走査が終わった時点で、openFile を含むシリーズ (なければ最も枚数の多いもの) を開く。
+    // open でなくても、openFile を含むシリーズが表示中のものと違えばそちらを開く
+    void StartIndexer(std::vector<std::string> paths, bool open = false, std::string openFile = std::string()) {
+        StopIndexer();
+        indexCancel = false;
+        long gen = folderGeneration;
+        indexer = std::thread([this, gen, open, openFile = std::move(openFile), paths = std::move(paths)]() {
+            auto series = std::make_shared<std::vector<SeriesEntry>>(GroupSeries(ScanHeaders(paths, nullptr, &indexCancel)));
+            if(indexCancel) return;
+            CallAfter([this, gen, open, openFile, series]() {
+                if(gen != folderGeneration) return;
+                if(!SetSeriesIndex(std::move(*series))) { if(open) CancelFirstPixelClock(); return; }
+                int pick = -1;
+                for(size_t i = 0; i < seriesIndex.size() && !openFile.empty(); ++i) {
+                    for(const SliceHeader& h : seriesIndex[i].slices) if(h.path == openFile) pick = (int)i;
+                }
+                if(!open && (pick < 0 || seriesIndex[pick].uid == volumeInfo.seriesUID)) return;
+                if(pick < 0) pick = LargestSeries(seriesIndex);
+                SetStatusText(wxString());
+                OpenSeries(pick);
+            });
+        });
+    }
+
+    void StopIndexer() {
+        indexCancel = true;
+        if(indexer.joinable()) indexer.join();
+    }
+
+    // --- フォルダの追従 ---
+    // 撮影中のフォルダに届いた .dcm だけを走査・展開し、表示中のボリュームとシリーズ一覧へ差し込む
+    void OnToggleFollow(wxCommandEvent& evt) {
+        if(evt.IsChecked() && folderPath.empty()) {
+            GetMenuBar()->Check(1017, false);
+            SetStatusText(isJapanese ? L"先にフォルダを開いてください" : L"Open a folder first");
+            return;
+        }
+        if(evt.IsChecked()) {
+            folderWatcher = std::make_unique<wxFileSystemWatcher>();
+            folderWatcher->SetOwner(this);
+            WatchFolder();
+            ApplyVolumeLayout();
+            return;
+        }
+        StopFollower();
+        followTimer.Stop();
+        folderWatcher.reset();
+        pendingFiles.clear();
+        ApplyVolumeLayout();
+        if(followChanged && !volumeData.empty() && !volumeData.IsPaged() && !isLoading && loadedSlices == volDepth) StartCacheWrite();
+        followChanged = false;
+    }
+
+    // 監視していなかった間に増えたファイルも拾う
+    void WatchFolder() {
+        folderWatcher->RemoveAll();
+        folderWatcher->Add(wxFileName::DirName(folderPath), wxFSW_EVENT_CREATE | wxFSW_EVENT_MODIFY | wxFSW_EVENT_RENAME);
+        for(const std::string& path : ListDicomFiles(folderPath)) if(!knownFiles.count(path)) pendingFiles.insert(path);
+        if(!pendingFiles.empty()) followTimer.StartOnce(FOLLOW_MS);
+    }
+
+    void OnFolderChanged(wxFileSystemWatcherEvent& evt) {
+        int type = evt.GetChangeType();
+        if(!(type & (wxFSW_EVENT_CREATE | wxFSW_EVENT_MODIFY | wxFSW_EVENT_RENAME))) return;
+        wxFileName fn = type == wxFSW_EVENT_RENAME ? evt.GetNewPath() : evt.GetPath();
+        std::string path = fn.GetFullPath().ToStdString();
+        if(!IsDicomFileName(path)) return;
+        if(knownFiles.count(path)) return;
+        pendingFiles.insert(path);
+        followTimer.StartOnce(FOLLOW_MS); // 書き込み中は MODIFY が続くので、止んでから読む
+    }
+
+    // ヘッダ走査と展開はバックグラウンドで行い、差し込みだけを UI スレッドで行う
+    void OnFollowTimer(wxTimerEvent&) {
+        if(pendingFiles.empty()) return;
+        // 読み込み中・シリーズ一覧の作成待ち・前回分の処理中は、終わってから拾い直す
+        if(isLoading || seriesIndex.empty() || followBusy) { followTimer.StartOnce(FOLLOW_MS); return; }
+        std::vector<std::string> paths(pendingFiles.begin(), pendingFiles.end());
+        pendingFiles.clear();
+        if(follower.joinable()) follower.join();
+        followCancel = false;
+        followBusy = true;
+        long serial = ++followSerial, gen = folderGeneration;
+        std::string uid = volumeData.IsPaged() ? std::string() : volumeInfo.seriesUID;
+        int w = volWidth, h = volHeight;
+        double scale = volumeInfo.valueScale;
+        follower = std::thread([this, serial, gen, uid, w, h, scale, paths = std::move(paths)]() {
+            auto batch = std::make_shared<FollowBatch>();
+            batch->headers = ScanHeaders(paths, nullptr, &followCancel);
+            batch->pixels.resize(batch->headers.size());
+            FrameFilePool pool;
+            ThreadPool::Shared().ParallelFor((int)batch->headers.size(), [&](int i) {
+                SliceHeader& hd = batch->headers[i];
+                if(followCancel || !hd.valid || uid.empty() || hd.seriesUID != uid) return;
+                std::vector<int16_t> px((size_t)w * h);
+                hd.valueScale = scale; // 読み込み済みのスライスと同じ倍率で格納する
+                if(DecodeSlice(hd, px.data(), w, h, &pool)) batch->pixels[i] = std::move(px);
+                else hd.valid = false; // 書き込み途中のファイルは次の変更通知で拾い直す
+            });
+            if(followCancel) return;
+            CallAfter([this, serial, gen, batch]() {
+                if(serial != followSerial) return;
+                followBusy = false;
+                if(gen == folderGeneration) ApplyFollowBatch(*batch);
+            });
+        });
+    }
+
+    void StopFollower() {
+        followCancel = true;
+        if(follower.joinable()) follower.join();
+        ++followSerial; // 届いていない結果は捨てる
+        followBusy = false;
+    }
+
+    void ApplyFollowBatch(FollowBatch& batch) {
+        int current = -1;
+        for(size_t i = 0; i < seriesIndex.size(); ++i) {
+            if(!volumeData.empty() && seriesIndex[i].uid == volumeInfo.seriesUID) current = (int)i;
+        }
+        // 一様な格子へ並べ直したボリュームはスライスと 1 対 1 でないので差し込まない
+        bool growable = current >= 0 && !volumeData.IsPaged() && !isLoading && volumeData.GetLayout() == Volume::LAYOUT_LINEAR &&
+                        volumeData.Depth() == (int)seriesIndex[current].slices.size();
+        // 番号順に差し込めば、同じバッチ内で位置がずれることはない
+        std::vector<int> order(batch.headers.size());
+        for(size_t i = 0; i < order.size(); ++i) order[i] = (int)i;
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return SliceBefore(batch.headers[a], batch.headers[b]); });
+
+        int added = 0, inserted = 0, z = sliderZ->GetValue();
+        std::vector<bool> changed(seriesIndex.size(), false);
+        for(int i : order) {
+            const SliceHeader& hd = batch.headers[i];
+            if(!hd.valid) continue;
+            int s = 0;
+            while(s < (int)seriesIndex.size() && seriesIndex[s].uid != hd.seriesUID) ++s;
+            if(s == (int)seriesIndex.size()) {
+                SeriesEntry e;
+                e.uid = hd.seriesUID; e.description = hd.seriesDescription; e.modality = hd.modality; e.number = hd.seriesNumber;
+                seriesIndex.push_back(std::move(e));
+                changed.push_back(true);
+                seriesList->Append(wxString());
+            }
+            bool intoVolume = s == current && growable;
+            // 展開した後に表示中のシリーズが変わった場合は、画素がないので読み直す
+            if(intoVolume && batch.pixels[i].empty()) { pendingFiles.insert(hd.path); continue; }
+            int pos = seriesIndex[s].Insert(hd);
+            knownFiles.insert(hd.path);
+            if(pos < 0) continue;
+            ++added;
+            changed[s] = true;
+            if(!intoVolume) continue;
+            if(inserted == 0) {
+                prefetcher.Cancel(); // 差し込みでバッファが動くので、読んでいるスレッドを先に止める
+                StopCacheWrite();
+                StopPyramidBuild();
+                pyramid.reset();
+            }
+            std::copy(batch.pixels[i].begin(), batch.pixels[i].end(), volumeData.InsertSlice(pos));
+            if(volumeInfo.range.valid) {
+                auto [mn, mx] = std::minmax_element(batch.pixels[i].begin(), batch.pixels[i].end());
+                volumeInfo.range.minValue = std::min(volumeInfo.range.minValue, (int)*mn);
+                volumeInfo.range.maxValue = std::max(volumeInfo.range.maxValue, (int)*mx);
+            }
+            if(pos <= z) ++z; // 見ているスライスがずれないように
+            ++inserted;
+        }
+        if(!pendingFiles.empty()) followTimer.StartOnce(FOLLOW_MS);
+        if(added == 0) return;
+
+        // フォルダの中身が変わったのでキーを作り直す (最大のシリーズはフォルダ全体のキー)
+        folderKey = VolumeCache::MakeKey(std::vector<std::string>(knownFiles.begin(), knownFiles.end()));
+        seriesKeys.assign(seriesIndex.size(), 0);
+        seriesKeys[LargestSeries(seriesIndex)] = folderKey;
+        for(size_t i = 0; i < seriesIndex.size(); ++i) {
+            if(changed[i]) seriesList->SetString((unsigned int)i, SeriesLabel(seriesIndex[i]));
+        }
+        if(current >= 0) volumeKey = SeriesKey(current);
+        if(inserted == 0) return;
+
+        ++contentRevision;
+        panelAxial->ClearFrames(); panelCoronal->ClearFrames(); panelSagittal->ClearFrames();
+        volDepth = volumeData.Depth();
+        loadedSlices += inserted;
+        sliderZ->SetRange(0, volDepth - 1); sliderZ->SetValue(z);
+        ApplyValueRange();
+        dirtyViews = VIEW_ALL;
+        followChanged = true;
+        StartPyramidBuild();
+        TrimVolumeLru();
+#if wxUSE_GLCANVAS
+        if (glRenderer) glRenderer->SetVolume(&volumeData); // 奥行きが変わったのでテクスチャごと作り直す
+#endif
+        infoText->SetValue(GetInfoString());
+        SetStatusText(wxString::Format(isJapanese ? L"%d 枚追加しました (計 %d 枚)" : L"Added %d slices (%d total)", inserted, volDepth));
+        ScheduleRender();
+    }
+
+    // --- 読み終えたボリュームの LRU ---
+    // 表示中のボリュームと合わせて memoryBudget に収まるだけ、最近表示したものを手元に残す
+    void StashCurrentVolume() {
+        if(volumeData.empty() || isLoading || volumeData.IsPaged()) return;
+        loader.Cancel();
+        pacsLoader.Cancel();
+        prefetcher.Cancel(); // 読み出し中のバッファを持ち去らないように
+        StopCacheWrite();
+        StopPyramidBuild();
+        volumeLru.push_front({ volumeKey, volumeInfo, std::move(volumeData), std::move(pyramid) });
+    }
+
+    // 圧縮形式は詰めた後の大きさで数えるので、圧縮するとそれだけ多くのシリーズが残る
+    static uint64_t VolumeBytes(const Volume& v) { return v.StoredBytes(); }
+
+    void TrimVolumeLru() {
+        auto bytes = [](const Volume& v, const std::shared_ptr<const VolumePyramid>& p) { return VolumeBytes(v) + (p ? p->Bytes() : 0); };
+        uint64_t total = volumeData.IsPaged() ? memoryBudget : bytes(volumeData, pyramid);
+        for(const StashedVolume& s : volumeLru) total += bytes(s.vol, s.pyramid);
+        while(!volumeLru.empty() && total > memoryBudget) {
+            total -= bytes(volumeLru.back().vol, volumeLru.back().pyramid);
+            volumeLru.pop_back();
+        }
+    }
+
+    // 表示中・メモリ上の LRU・ディスクキャッシュの順に探し、見つかれば読み込みなしで表示する
+    bool OpenReadyVolume(uint64_t key) {
+        if(key == volumeKey && !volumeData.empty()) return true;
+        for(auto it = volumeLru.begin(); it != volumeLru.end(); ++it) {
+            if(it->key != key) continue;
+            StashedVolume hit = std::move(*it);
+            volumeLru.erase(it);
+            ShowReadyVolume(key, hit.info, std::move(hit.vol), std::move(hit.pyramid),
+                            isJapanese ? L"メモリ上のシリーズに切り替えました" : L"Switched to a series in memory");
+            return true;
+        }
+        Volume cached; VolumeInfo info;
+        if(!volumeCache.Load(key, cached, info)) return false;
+        ShowReadyVolume(key, info, std::move(cached), nullptr, isJapanese ? L"キャッシュから読み込みました" : L"Loaded from cache");
+        return true;
+    }
+
+    void ShowReadyVolume(uint64_t key, const VolumeInfo& info, Volume vol, std::shared_ptr<const VolumePyramid> lod, const wxString& status) {
+        StashCurrentVolume();
+        BeginVolume(key, info, vol.Width(), vol.Height(), vol.Depth());
+        volumeData = std::move(vol);
+        volumeData.SetLayout(PreferredLayout());
+        pyramid = std::move(lod);
+        if(!pyramid) StartPyramidBuild();
+        loadedSlices = volDepth;
+        isLoading = false;
+        TrimVolumeLru();
+#if wxUSE_GLCANVAS
+        if (glRenderer) glRenderer->SetVolume(&volumeData);
+#endif
+        infoText->SetValue(GetInfoString());
+        SetStatusText(status);
+        ScheduleRender();
+    }
+
+    // スキャン結果のメタデータをそのまま使い、画素だけをバックグラウンドで読む
+    void DecodeSeries(uint64_t key, const SeriesEntry& series) {
+        std::vector<SliceHeader> slices = series.slices;
+        // 小数の Rescale は倍率を掛けて int16 に収める (シリーズで 1 つ)
+        double scale = SeriesValueScale(slices);
+        for(SliceHeader& s : slices) s.valueScale = scale;
+        const SliceHeader first = slices.front();
+        if(first.color) {
+            SetStatusText(isJapanese ? L"カラー画像のシリーズには対応していません" : L"Color series are not supported");
+            return;
+        }
+
+        StashCurrentVolume();
+        VolumeInfo info;
+        info.seriesUID = first.seriesUID;
+        info.patientName = first.patientName; info.patientID = first.patientID;
+        // 間隔は SliceThickness ではなく位置の差から。一様でなければ読み終えてから並べ直す (ページングは中央値の間隔のまま)
+        SliceSpacing spacing = MeasureSpacing(slices);
+        info.pxSpcX = first.pxSpcX; info.pxSpcY = first.pxSpcY; info.thickness = spacing.step;
+        const SliceHeader& middle = slices[slices.size() / 2];
+        info.windowCenter = middle.windowCenter; info.windowWidth = middle.windowWidth;
+        info.valueScale = scale;
+        info.invertWindow = middle.inverted;
+        BeginVolume(key, info, first.cols, first.rows, (int)slices.size());
+
+        long gen = loadGeneration;
+        loadedSlices = 0;
+        // 予算に収まらないシリーズは全体を読まず、表示に必要なスライスだけをその都度展開する (PACS のシリーズは手元にファイルがないので常に全体を読む)
+        bool network = IsPacsPath(first.path);
+        if(!network && (uint64_t)volWidth * volHeight * volDepth * sizeof(int16_t) > memoryBudget) {
+            auto source = std::make_shared<std::vector<SliceHeader>>(std::move(slices));
+            auto pool = std::make_shared<FrameFilePool>(); // 複数フレームのファイルはページを読むたびに開き直さない
+            int w = volWidth, h = volHeight;
+            volumeData.ResetPaged(volWidth, volHeight, volDepth, std::make_shared<SlicePager>(volWidth, volHeight, volDepth, memoryBudget,
+                [source, pool, w, h](int z, int16_t* dst) { return DecodeSlice((*source)[z], dst, w, h, pool.get()); },
+                [this, gen](int z) {
+                    wxThreadEvent* e = new wxThreadEvent(EVT_PAGE_LOADED);
+                    e->SetInt(z); e->SetExtraLong(gen);
+                    wxQueueEvent(this, e);
+                }));
+            isLoading = false;
+            TrimVolumeLru();
+#if wxUSE_GLCANVAS
+            if (glRenderer) glRenderer->SetVolume(&volumeData);
+#endif
+            infoText->SetValue(GetInfoString());
+            progressiveTimer.Start();
+            ScheduleRender();
+            return;
+        }
+
+        sliceOffsets = std::move(spacing.offsets);
+        volumeData.Reset(volWidth, volHeight, volDepth, LoadLayout());
+        isLoading = true;
+        loadWatch.Start();
+        TrimVolumeLru();
+#if wxUSE_GLCANVAS
+        if (glRenderer) glRenderer->SetVolume(&volumeData);
+#endif
+        infoText->SetValue(GetInfoString());
+
+        auto onSlice = [this, gen](int z) {
+            wxThreadEvent* e = new wxThreadEvent(EVT_SLICE_LOADED);
+            e->SetInt(z); e->SetExtraLong(gen);
+            wxQueueEvent(this, e);
+        };
+        auto onFinished = [this, gen](int count) {
+            wxThreadEvent* e = new wxThreadEvent(EVT_VOLUME_LOADED);
+            e->SetInt(count); e->SetExtraLong(gen);
+            wxQueueEvent(this, e);
+        };
+        // PACS からは届いた順にそのまま展開するので、表示の更新は読み込みと同じ経路を通る
+        if(network) pacsLoader.Start(pacsServer, pacsStudy, std::move(slices), &volumeData, PACS_CONNECTIONS, onSlice, onFinished, &histogram);
+        else loader.Start(std::move(slices), &volumeData, onSlice, onFinished, &histogram);
+        progressiveTimer.Start();
+    }
+
+    // 新しいボリュームに切り替える前の共通処理。volumeData の中身は呼び出し側で用意する
+    void BeginVolume(uint64_t key, const VolumeInfo& info, int w, int h, int d) {
+        loader.Cancel();
+        pacsLoader.Cancel();
+        prefetcher.Cancel();
+        StopCacheWrite();
+        StopPyramidBuild();
+        pyramid.reset();
+        followChanged = false;
+        sliceOffsets.clear();
+        ++loadGeneration;
+        ++contentRevision;
+        if(firstPixelArmed) { firstPixelGeneration = loadGeneration; firstPixelArmed = false; }
+        loadMBps = 0.0;
+        panelAxial->ClearFrames(); panelCoronal->ClearFrames(); panelSagittal->ClearFrames();
+        volumeKey = key; volumeInfo = info;
+        histogram.Clear();
+        rangeShown = false;
+        windowTouched = false;
+        volWidth = w; volHeight = h; volDepth = d;
+        pxSpcX = info.pxSpcX; pxSpcY = info.pxSpcY; sliceThick = info.thickness;
+        if(!info.patientName.empty()) patientName = wxString::FromUTF8(info.patientName.c_str());
+        if(!info.patientID.empty()) patientID = wxString::FromUTF8(info.patientID.c_str());
+        dirtyViews = VIEW_ALL;
+
+        sliderX->SetRange(0, volWidth - 1); sliderX->SetValue(volWidth / 2);
+        sliderY->SetRange(0, volHeight - 1); sliderY->SetValue(volHeight / 2);
+        sliderZ->SetRange(0, volDepth - 1); sliderZ->SetValue(volDepth / 2);
+        ApplyValueRange();
+        EnableControls(true);
+    }
+
+    // ウィンドウの初期値。データセットの指定、なければ分布から求めた値、どちらもなければ CT の軟部条件。
+    // スライダーは格納値なので、データセットの指定 (モダリティ値) は格納の倍率で割る
+    void InitialWindow(int& wl, int& ww) const {
+        wl = 40; ww = 400;
+        double scale = volumeInfo.valueScale;
+        if(volumeInfo.windowWidth > 0.0) { wl = (int)std::lround(volumeInfo.windowCenter / scale); ww = std::max(1, (int)std::lround(volumeInfo.windowWidth / scale)); }
+        else if(volumeInfo.range.valid) { wl = volumeInfo.range.autoWL; ww = volumeInfo.range.autoWW; }
+    }
+
+    // スライダーの範囲を画素値の範囲に合わせる。利用者が動かしていなければ値も初期値にする
+    void ApplyValueRange() {
+        int lo = -1000, hi = 3000;
+        if(volumeInfo.range.valid) { lo = volumeInfo.range.minValue; hi = std::max(volumeInfo.range.maxValue, lo + 1); }
+        int wl = wlSlider->GetValue(), ww = wwSlider->GetValue();
+        if(!windowTouched) InitialWindow(wl, ww);
+        wlSlider->SetRange(std::min(lo, wl), std::max(hi, wl));
+        wwSlider->SetRange(1, std::max(ww, hi - lo));
+        wlSlider->SetValue(wl);
+        wwSlider->SetValue(ww);
+        UpdateWindowLabel();
+        ScheduleRender();
+    }
+
+    // 格納の倍率が 1 でないシリーズは、スライダーの格納値に対応するモダリティ値を見出しに添える
+    void UpdateWindowLabel() {
+        wxString text = isJapanese ? L"ウィンドウレベル / 幅 (明るさ・コントラスト)" : L"Window Level / Width";
+        if(volumeInfo.valueScale != 1.0)
+            text += wxString::Format(L" = %.4g / %.4g", wlSlider->GetValue() * volumeInfo.valueScale, wwSlider->GetValue() * volumeInfo.valueScale);
+        labelWL->SetLabel(text);
+    }
+
+    // 描画に渡す幅。MONOCHROME1 のシリーズは負にして白黒を反転する (MakeWindowParams)
+    int DisplayWW() const { return volumeInfo.invertWindow ? -wwSlider->GetValue() : wwSlider->GetValue(); }
+
+    // 書き出しは volumeData を読むだけなので、描画と並行して進めてよい。
+    // volumeData を作り直す・変換する前には必ず StopCacheWrite で止める。
+    void StartCacheWrite() {
+        StopCacheWrite();
+        cacheCancel = false;
+        cacheWriting = true;
+        cacheWriter = std::thread([this, key = volumeKey, info = volumeInfo]() {
+            if (volumeCache.Save(key, volumeData, info, cacheCancel)) volumeCache.Prune(CACHE_BUDGET);
+            cacheWriting = false;
+        });
+    }
+
+    void StopCacheWrite() {
+        cacheCancel = true;
+        if (cacheWriter.joinable()) cacheWriter.join();
+    }
+
+    // 縮小版の作成もキャッシュの書き出しと同じく volumeData を読むだけ。止め方も同じ
+    void StartPyramidBuild() {
+        StopPyramidBuild();
+        if(volumeData.IsPaged() || std::max(volWidth, volHeight) < VolumePyramid::MIN_SIZE) return;
+        pyramidCancel = false;
+        long gen = loadGeneration;
+        pyramidBuilder = std::thread([this, gen]() {
+            auto built = std::make_shared<VolumePyramid>();
+            if(!built->Build(volumeData, pyramidCancel)) return;
+            CallAfter([this, gen, built]() {
+                if(gen != loadGeneration) return;
+                prefetcher.Cancel(); // 先読みスレッドも pyramid を読むので、入れ替える間は止めておく
+                pyramid = built;
+                TrimVolumeLru();
+            });
+        });
+    }
+
+    void StopPyramidBuild() {
+        pyramidCancel = true;
+        if(pyramidBuilder.joinable()) pyramidBuilder.join();
+    }
+
+    // 表示中の Axial スライスが届いたら即座に、それ以外は間引いて再描画する
+    void OnSliceLoaded(wxThreadEvent& evt) {
+        if(evt.GetExtraLong() != loadGeneration) return;
+        ++loadedSlices;
+        ++contentRevision;
+        // 新しいスライスは Coronal/Sagittal には必ず写り、Axial には表示中のときだけ写る
+        dirtyViews |= VIEW_CORONAL | VIEW_SAGITTAL;
+        if(evt.GetInt() == sliderZ->GetValue()) dirtyViews |= VIEW_AXIAL;
+#if wxUSE_GLCANVAS
+        if (glRenderer) glRenderer->SliceChanged(evt.GetInt());
+#endif
+        if(loadedSlices == 1 || evt.GetInt() == sliderZ->GetValue() || progressiveTimer.Time() > 200) {
+            // 中央付近の数枚が揃った時点の分布で、読み終わりを待たずにスライダーを合わせる
+            if(!rangeShown && loadedSlices >= std::min(volDepth, 16)) {
+                volumeInfo.range = histogram.Summarize();
+                rangeShown = true;
+                ApplyValueRange();
+            }
+            infoText->SetValue(GetInfoString());
+            ScheduleRender();
+            progressiveTimer.Start();
+        }
+    }
+
+    // ページングで届いたスライスは Coronal/Sagittal の 1 行分と、表示中なら Axial に写る
+    void OnPageLoaded(wxThreadEvent& evt) {
+        if(evt.GetExtraLong() != loadGeneration) return;
+        ++contentRevision;
+        dirtyViews |= VIEW_CORONAL | VIEW_SAGITTAL;
+        if(evt.GetInt() == sliderZ->GetValue()) dirtyViews |= VIEW_AXIAL;
+        if(progressiveTimer.Time() > 200) {
+            infoText->SetValue(GetInfoString());
+            progressiveTimer.Start();
+        }
+        ScheduleRender();
+    }
+
+    void OnVolumeLoaded(wxThreadEvent& evt) {
+        if(evt.GetExtraLong() != loadGeneration) return;
+        loadedSlices = evt.GetInt();
+        loadMBps = LoadThroughputMBps();
+        isLoading = false;
+        // 欠けたスライスがあるボリュームは次回も読み直したいので残さない
+        bool complete = loadedSlices == volDepth;
+        volumeInfo.range = histogram.Summarize();
+        ApplyValueRange();
+        if(!sliceOffsets.empty()) ResampleToUniform();
+        volumeData.SetLayout(PreferredLayout());
+        StartPyramidBuild();
+        infoText->SetValue(GetInfoString());
+        ScheduleRender();
+        if(complete) StartCacheWrite();
+        int clipped = loader.ClippedSlices() + pacsLoader.ClippedSlices();
+        if(clipped > 0) SetStatusText(wxString::Format(isJapanese ? L"%d 枚のスライスに int16 に収まらない値があり、端の値に丸めました" : L"%d slices had values outside the int16 range and were clamped", clipped));
+        std::string pacsError = pacsLoader.Error();
+        if(!pacsError.empty()) SetStatusText((isJapanese ? L"PACS からの取得が途中で失敗しました: " : L"PACS retrieval failed: ") + wxString::FromUTF8(pacsError.c_str()));
+    }
+
+    // 間隔が一様でないシリーズを sliceThick 間隔の格子へ一度だけ並べ直す。以降の描画・キャッシュは等間隔として扱う
+    void ResampleToUniform() {
+        prefetcher.Cancel();
+        int oldDepth = volDepth;
+        Volume uniform;
+        ResampleSlices(volumeData, sliceOffsets, sliceThick, uniform);
+        sliceOffsets.clear();
+        if(uniform.empty()) return;
+        volumeData = std::move(uniform);
+        volDepth = loadedSlices = volumeData.Depth();
+        ++contentRevision;
+        panelAxial->ClearFrames(); panelCoronal->ClearFrames(); panelSagittal->ClearFrames();
+        dirtyViews = VIEW_ALL;
+        int z = oldDepth > 1 ? (int)((int64_t)sliderZ->GetValue() * (volDepth - 1) / (oldDepth - 1)) : 0;
+        sliderZ->SetRange(0, volDepth - 1); sliderZ->SetValue(z);
+#if wxUSE_GLCANVAS
+        if (glRenderer) glRenderer->SetVolume(&volumeData);
+#endif
+        SetStatusText(wxString::Format(isJapanese ? L"スライス間隔が一様でないため %d 枚を %.2f mm 間隔の %d 枚に並べ直しました"
+                                                  : L"Non-uniform slice spacing: resampled %d slices to %.2f mm (%d slices)", oldDepth, sliceThick, volDepth));
+    }
+
+    void OnSliceChange(wxCommandEvent&) { ScheduleRender(); }
+
+    // スラブは CPU で投影するので、GPU 描画中なら CPU 描画に戻す
+    void OnSlabMode(wxCommandEvent&) {
+        bool on = slabChoice->GetSelection() > 0;
+        slabSlider->Enable(on && !volumeData.empty());
+#if wxUSE_GLCANVAS
+        if (on && glRenderer) {
+            DisableGPU();
+            GetMenuBar()->Check(1012, false);
+            SetStatusText(isJapanese ? L"スラブ投影のため GPU 描画をオフにしました" : L"GPU rendering turned off for slab projection");
+        }
+#endif
+        ScheduleRender();
+    }
+
+    // 斜め断面も CPU で標本化する
+    void OnObliqueToggle(wxCommandEvent&) {
+        bool on = obliqueCheck->GetValue();
+        tiltSlider->Enable(on && !volumeData.empty()); spinSlider->Enable(on && !volumeData.empty());
+#if wxUSE_GLCANVAS
+        if (on && glRenderer) {
+            DisableGPU();
+            GetMenuBar()->Check(1012, false);
+            SetStatusText(isJapanese ? L"斜め断面のため GPU 描画をオフにしました" : L"GPU rendering turned off for oblique reslicing");
+        }
+#endif
+        ScheduleRender();
+    }
+
+    // ページングしたボリュームはスライスを跨いで読むと取り寄せが追いつかないので、斜め断面は常駐時だけ
+    int ObliqueView() const {
+        return obliqueCheck->GetValue() && !volumeData.IsPaged() && mainView < 3 ? mainView : -1;
+    }
+
+    ObliquePlane CurrentPlane(int viewType, int outW, int outH) const {
+        const double center[3] = { (double)sliderX->GetValue(), (double)sliderY->GetValue(), (double)sliderZ->GetValue() };
+        return MakeObliquePlane(volumeData, viewType, center, tiltSlider->GetValue(), spinSlider->GetValue(),
+                                pxSpcX, pxSpcY, sliceThick, outW, outH);
+    }
+
+    SlabParams CurrentSlab() const {
+        static const SlabMode modes[4] = { SLAB_NONE, SLAB_MIP, SLAB_MINIP, SLAB_AVERAGE };
+        SlabParams p;
+        p.mode = modes[std::clamp(slabChoice->GetSelection(), 0, 3)];
+        p.thickness = p.mode == SLAB_NONE ? 1 : slabSlider->GetValue();
+        p.cache = &slabCache;
+        p.revision = contentRevision;
+        return p;
+    }
+    void OnSliceChangeRaw(wxScrollEvent&) { BeginInteraction(); ScheduleRender(); }
+
+    void OnWindowChange(wxCommandEvent& evt) { windowTouched = true; UpdateWindowLabel(); OnSliceChange(evt); }
+    void OnWindowChangeRaw(wxScrollEvent& evt) { windowTouched = true; UpdateWindowLabel(); OnSliceChangeRaw(evt); }
+
+    void BeginInteraction() {
+        interacting = true;
+        settleTimer.StartOnce(SETTLE_MS);
+    }
+
+    void OnSettleTimer(wxTimerEvent&) {
+        interacting = false;
+        dirtyViews |= coarseViews;
+        if(dirtyViews || vrtRefineRow >= 0) ScheduleRender();
+    }
+
+    // 前フレームから FRAME_MS 経っていなければ次のフレームまで待つ。
+    // 描画時にスライダーの最新値を読むので、途中の位置は自然に捨てられる。
+    void ScheduleRender() {
+        renderPending = true;
+        if(renderTimer.IsRunning()) return;
+        long wait = FRAME_MS - sinceLastFrame.Time();
+        renderTimer.StartOnce(wait > 1 ? (int)wait : 1);
+    }
+
+    void OnRenderTimer(wxTimerEvent&) {
+        if(!renderPending) return;
+        renderPending = false;
+        wxStopWatch sw;
+        uint64_t allocs = RenderAllocCount().load();
+        UpdateAllViews();
+        if(firstPixelGeneration == loadGeneration && !volumeData.empty() && loadedSlices > 0) {
+            auto now = std::chrono::steady_clock::now();
+            firstPixelMs = std::chrono::duration<double, std::milli>(now - openStart).count();
+            firstPixelGeneration = -1;
+            Profiler::Get().Record("First Pixel", openStart, now);
+        }
+        lastFrameMs = sw.TimeInMicro() / 1000.0;
+        lastFrameAllocs = RenderAllocCount().load() - allocs;
+        sinceLastFrame.Start();
+        SetStatusText(wxString::Format(isJapanese ? L"描画時間: %.1f ms" : L"Frame time: %.1f ms", lastFrameMs));
+        if(showStats) UpdateStatsOverlay();
+    }
+
+    // スライス位置・ウィンドウの変化から再描画が必要な画面を判定し、
+    // それ以外の画面は十字線だけを更新する
+    void UpdateAllViews() {
+        if(volumeData.empty()) return;
+        ScopedTimer timer("UpdateAllViews");
+        int curX = sliderX->GetValue();
+        int curY = sliderY->GetValue();
+        int curZ = sliderZ->GetValue();
+        if(windowLut.Update(wlSlider->GetValue(), DisplayWW())) dirtyViews = VIEW_ALL;
+        if(curZ != shownZ) dirtyViews |= VIEW_AXIAL;
+        if(curY != shownY) dirtyViews |= VIEW_CORONAL;
+        if(curX != shownX) dirtyViews |= VIEW_SAGITTAL;
+        shownX = curX; shownY = curY; shownZ = curZ;
+        SlabParams slab = CurrentSlab();
+        if(slab.mode != shownSlab.mode || slab.thickness != shownSlab.thickness) dirtyViews = VIEW_ALL;
+        shownSlab = slab;
+        // 斜め断面は十字線の交点を通るので、どのスライス位置が動いても描き直す
+        int obliqueView = ObliqueView();
+        int tilt = tiltSlider->GetValue(), spin = spinSlider->GetValue();
+        if(obliqueView != shownOblique) {
+            if(shownOblique >= 0) { dirtyViews |= 1 << shownOblique; PanelFor(shownOblique)->SetOblique(false); }
+            if(obliqueView >= 0) { dirtyViews |= 1 << obliqueView; PanelFor(obliqueView)->SetOblique(true); }
+        } else if(obliqueView >= 0 && (dirtyViews || tilt != shownTilt || spin != shownSpin)) {
+            dirtyViews |= 1 << obliqueView;
+        }
+        shownOblique = obliqueView; shownTilt = tilt; shownSpin = spin;
+
+        // 描き直す画面の画素計算だけを共有プールで同時に行い、受け渡しは UI スレッドで行う
+        ViewJob jobs[3];
+        int count = 0;
+        if(RefreshView(panelAxial, 0, curZ, curX, curY, jobs[count])) ++count;
+        if(RefreshView(panelCoronal, 1, curY, curX, curZ, jobs[count])) ++count;
+        if(RefreshView(panelSagittal, 2, curX, curY, curZ, jobs[count])) ++count;
+        dirtyViews = 0;
+        UpdateVolumeView();
+        if(count == 0) return;
+
+        // ワーカーは各パネルの RGB バッファへ書くだけ (wx のオブジェクトには触れない)。
+        // 作業領域は画面ごとに持ち回るので、同じ大きさで描き続ける間はヒープを確保しない
+        // 操作中は縮小版の、表示サイズを下回らない最も粗い段から描く (スラブは部分集約を使い回すので元のまま)
+        bool coarse = interacting;
+        bool timed = showStats;
+        std::shared_ptr<const VolumePyramid> lod = coarse && !slab.Active() ? pyramid : nullptr;
+        ThreadPool::Shared().ParallelFor(count, [&](int i) {
+            ViewJob& j = jobs[i];
+            if(j.key.oblique) {
+                j.quality = RenderObliqueRGB(volumeData, j.plane, j.w, j.h, coarse, &windowLut, j.key.wl, j.key.ww,
+                                             j.pixels, &viewScratch[j.key.viewType], timed ? &j.timings : nullptr);
+                return;
+            }
+            int slice = j.key.slice;
+            const Volume& src = lod ? lod->Source(volumeData, j.key.viewType, j.w, j.h, slice, j.level) : volumeData;
+            j.quality = RenderPlaneRGB(src, j.key.viewType, slice, j.w, j.h, coarse,
+                                       &windowLut, j.key.wl, j.key.ww, j.pixels, &viewScratch[j.key.viewType],
+                                       timed ? &j.timings : nullptr, &slab);
+        });
+        for(int i = 0; i < count; ++i) FinishView(jobs[i]);
+    }
+
+    struct ViewJob {
+        ImagePanel* panel = nullptr;
+        FrameKey key;
+        double relX = 0, relY = 0;
+        unsigned char* pixels = nullptr;
+        int w = 0, h = 0;
+        ResampleQuality quality = RESAMPLE_HIGH;
+        int level = 0; // 縮小版の段 (0 = 元のボリューム)
+        ObliquePlane plane; // key.oblique のときだけ使う
+        PlaneTimings timings;
+    };
+
+    // 十字線だけの更新・GPU 描画・先読みフレームの差し替えはここで済ませる。
+    // CPU で描き直す必要があるときだけ job を埋めて true を返す
+    bool RefreshView(ImagePanel* panel, int viewType, int sliceIdx, int cross1, int cross2, ViewJob& job) {
+        double relX, relY;
+        bool oblique = viewType == shownOblique;
+        int outW = 0, outH = 0;
+        ObliquePlane plane;
+        if(oblique) {
+            // 斜め断面の十字線は中心点を平面へ落とした位置 (出力の大きさによらないので先に求める)
+            PlaneFitSize(volumeData, viewType, PlaneScaleY(viewType), panel->GetClientSize().x, panel->GetClientSize().y, outW, outH);
+            plane = CurrentPlane(viewType, outW, outH);
+            relX = plane.crossX; relY = plane.crossY;
+        }
+        else CrossPosition(viewType, cross1, cross2, relX, relY);
+        if(!(dirtyViews & (1 << viewType))) {
+            panel->SetCrosshair(relX, relY);
+            return false;
+        }
+
+#if wxUSE_GLCANVAS
+        // GPU 描画中は断面の切り出しもウィンドウ処理もシェーダ側で行う
+        if (glRenderer && panel->HasGL()) {
+            GLSliceParams p;
+            p.viewType = viewType; p.slice = sliceIdx; p.scaleY = PlaneScaleY(viewType);
+            p.wl = wlSlider->GetValue(); p.ww = DisplayWW();
+            p.crossX = relX; p.crossY = relY;
+            panel->SetGLSlice(p);
+            return false;
+        }
+#endif
+
+        // ホイール操作中に先読み済みのフレームが当たれば差し替えるだけ (軽量版なので落ち着いたら描き直す)
+        FrameKey key = MakeFrameKey(panel, viewType, sliceIdx);
+        if(interacting && panel->ShowFrame(key, relX, relY)) {
+            coarseViews |= 1 << viewType;
+            return false;
+        }
+        if(!oblique) PlaneFitSize(volumeData, viewType, PlaneScaleY(viewType), key.boxW, key.boxH, outW, outH);
+        job.panel = panel; job.key = key; job.plane = plane;
+        job.relX = relX; job.relY = relY;
+        job.w = outW; job.h = outH;
+        job.pixels = panel->FrameBuffer(outW, outH);
+        return true;
+    }
+
+    void FinishView(ViewJob& job) {
+        int bit = 1 << job.key.viewType;
+        if(job.quality == RESAMPLE_HIGH) coarseViews &= ~bit;
+        else coarseViews |= bit;
+        viewTimings[job.key.viewType] = job.timings;
+        viewQuality[job.key.viewType] = job.quality;
+        viewLevel[job.key.viewType] = job.level;
+        job.panel->PresentFrame(job.w, job.h, job.relX, job.relY);
+    }
+
+    // --- 3D 画面 ---
+    // 読み込み中は中身が変わり続けるので、読み終えてから描く。ページングは視線が全スライスを跨ぐので描かない
+    void UpdateVolumeView() {
+        if(!showVolumeView) return;
+        wxSize client = panelVolume->GetClientSize();
+        if(client.x <= 0 || client.y <= 0) return;
+        if(isLoading || volumeData.IsPaged()) {
+            // 前のボリュームの絵を残さない (GPU は届いたスライスから描けるのでそのまま)
+#if wxUSE_GLCANVAS
+            if(panelVolume->HasGL()) return;
+#endif
+            if(vrtRevision == -1) return;
+            std::memset(panelVolume->FrameBuffer(client.x, client.y), VRT_BACKGROUND, (size_t)client.x * client.y * 3);
+            panelVolume->PresentFrame(client.x, client.y, -1, -1);
+            vrtRevision = -1; vrtRefineRow = -1;
+            return;
+        }
+        if(contentRevision != vrtRevision || client.x != vrtW || client.y != vrtH) vrtDirty = true;
+        const VrtTransfer& tf = VrtPresetTransfer(vrtChoice->GetSelection());
+#if wxUSE_GLCANVAS
+        // GPU は 1 フレームで全画素を歩けるので、粗い段も仕上げもない
+        if(glRenderer && panelVolume->HasGL()) {
+            if(!vrtDirty) return;
+            vrtDirty = false; vrtRevision = contentRevision; vrtW = client.x; vrtH = client.y;
+            GLSliceParams p;
+            p.viewType = 3;
+            p.vrt = MakeVrtView(volumeData, pxSpcX, pxSpcY, sliceThick, vrtCamera, vrtW, vrtH);
+            p.tf = tf;
+            panelVolume->SetGLSlice(p);
+            return;
+        }
+#endif
+        unsigned char* rgb = panelVolume->FrameBuffer(client.x, client.y);
+        if(vrtDirty) {
+            vrtDirty = false; vrtRevision = contentRevision; vrtW = client.x; vrtH = client.y;
+            raycaster.Prepare(volumeData, contentRevision);
+            vrtView = MakeVrtView(volumeData, pxSpcX, pxSpcY, sliceThick, vrtCamera, vrtW, vrtH);
+            raycaster.Render(volumeData, vrtView, tf, vrtW, vrtH, 0, vrtH, VRT_COARSE, rgb);
+            vrtRefineRow = 0;
+        } else if(vrtRefineRow >= 0 && !interacting) {
+            // 粗い画像の上を上から順に書き換える。帯の行数は直前の帯の速さから決める
+            int rows = std::clamp((int)(VRT_REFINE_MS / std::max(vrtMsPerRow, 0.01)), 1, vrtH - vrtRefineRow);
+            wxStopWatch sw;
+            raycaster.Render(volumeData, vrtView, tf, vrtW, vrtH, vrtRefineRow, vrtRefineRow + rows, 1, rgb);
+            vrtMsPerRow = sw.TimeInMicro() / 1000.0 / rows;
+            vrtRefineRow += rows;
+            if(vrtRefineRow >= vrtH) vrtRefineRow = -1;
+        } else return;
+        panelVolume->PresentFrame(vrtW, vrtH, -1, -1);
+        if(vrtRefineRow >= 0 && !interacting) ScheduleRender();
+    }
+
+    void OnVolumeDrag(int dx, int dy) {
+        if(volumeData.empty() || !showVolumeView) return;
+        vrtCamera.yaw = std::fmod(vrtCamera.yaw + dx * 0.5, 360.0);
+        vrtCamera.pitch = std::clamp(vrtCamera.pitch + dy * 0.5, -90.0, 90.0);
+        vrtDirty = true;
+        BeginInteraction();
+        ScheduleRender();
+    }
+
+    void OnVrtPreset(wxCommandEvent&) {
+        vrtDirty = true;
+        ScheduleRender();
+    }
+
+    void OnToggleVolumeView(wxCommandEvent& evt) {
+        showVolumeView = evt.IsChecked();
+        vrtDirty = true;
+        vrtRefineRow = -1;
+        SwitchLayout(mainView);
+    }
+
+    void CrossPosition(int viewType, int cross1, int cross2, double& relX, double& relY) const {
+        int w = 0, h = 0;
+        volumeData.PlaneSize(viewType, w, h);
+        relX = (double)cross1 / std::max(1, w - 1);
+        relY = (double)cross2 / std::max(1, h - 1);
+    }
+
+    double PlaneScaleY(int viewType) const { return PlaneAspect(viewType, pxSpcX, pxSpcY, sliceThick); }
+
+    FrameKey MakeFrameKey(ImagePanel* panel, int viewType, int sliceIdx) const {
+        FrameKey key;
+        wxSize client = panel->GetClientSize();
+        key.viewType = viewType; key.slice = sliceIdx;
+        key.boxW = client.x; key.boxH = client.y;
+        key.wl = wlSlider->GetValue(); key.ww = DisplayWW();
+        key.revision = contentRevision;
+        // 斜め断面は角度と 3 軸の位置で決まるので先読みしない (使い回しも避ける)
+        key.oblique = viewType == shownOblique;
+        SlabParams slab = key.oblique ? SlabParams() : CurrentSlab();
+        key.slabMode = slab.mode; key.slabThickness = slab.thickness;
+        return key;
+    }
+
+    // --- ホイール先読み ---
+    // 連続して同じ向きに回しているほど先まで描いておく (約 0.3 秒分、2〜FRAME_RING-1 枚)
+    void PrefetchAhead(int viewType, int current, int direction, int maxIndex) {
+        ScrollState& st = scrollState[viewType];
+        auto now = std::chrono::steady_clock::now();
+        double dt = std::chrono::duration<double, std::milli>(now - st.last).count();
+        if(direction != st.dir || dt > 500) st.rate = 0;
+        else st.rate = st.rate * 0.7 + 0.3 * 1000.0 / std::max(dt, 1.0);
+        st.dir = direction; st.last = now;
+
+        // 読み込み中は中身が変わり続けるので先読みしない
+        if(isLoading) return;
+        if(viewType == shownOblique) return;
+        ImagePanel* panel = PanelFor(viewType);
+#if wxUSE_GLCANVAS
+        if(glRenderer && panel->HasGL()) return;
+#endif
+        int ahead = std::clamp((int)std::lround(st.rate * 0.3), 2, ImagePanel::FRAME_RING - 1);
+        std::vector<FrameKey> keys;
+        for(int k = 1; k <= ahead; ++k) {
+            int idx = current + direction * k;
+            if(idx < 0 || idx > maxIndex) break;
+            FrameKey key = MakeFrameKey(panel, viewType, idx);
+            if(key.boxW <= 0 || key.boxH <= 0) return;
+            if(!panel->HasFrame(key)) keys.push_back(key);
+        }
+        prefetcher.Request(std::move(keys));
+    }
+
+    // 先読みスレッドから呼ばれる。出来上がった画素は UI スレッドでビットマップにして貯めておく
+    void PrefetchFrame(const FrameKey& key) {
+        int w = 0, h = 0;
+        PlaneFitSize(volumeData, key.viewType, PlaneScaleY(key.viewType), key.boxW, key.boxH, w, h);
+        // UI スレッドへ渡し終えた (参照が自分だけになった) バッファを使い回す
+        std::shared_ptr<std::vector<unsigned char>> rgb;
+        for(auto& b : prefetchBuffers) if(b.use_count() == 1) { rgb = b; break; }
+        if(!rgb) {
+            rgb = std::make_shared<std::vector<unsigned char>>();
+            prefetchBuffers.push_back(rgb);
+        }
+        // 先読みしたフレームは操作中にだけ使うので、縮小版から描いてよい
+        SlabParams slab;
+        slab.mode = (SlabMode)key.slabMode; slab.thickness = key.slabThickness;
+        slab.cache = &slabCache; slab.revision = key.revision;
+        std::shared_ptr<const VolumePyramid> lod = slab.Active() ? nullptr : pyramid;
+        int slice = key.slice, level = 0;
+        const Volume& src = lod ? lod->Source(volumeData, key.viewType, w, h, slice, level) : volumeData;
+        // 共有 LUT は UI スレッドで作り直されるので使わない
+        RenderPlaneRGB(src, key.viewType, slice, w, h, true, nullptr, key.wl, key.ww,
+                       ScratchBuffer(*rgb, (size_t)w * h * 3), &prefetchScratch, nullptr, &slab);
+        CallAfter([this, key, rgb, w, h]() {
+            if(key.revision != contentRevision) return;
+            PanelFor(key.viewType)->StoreFrame(key, rgb->data(), w, h);
+        });
+    }
+
+    ImagePanel* PanelFor(int viewType) const {
+        if(viewType == 0) return panelAxial;
+        if(viewType == 1) return panelCoronal;
+        return panelSagittal;
+    }
+};
+
+class App : public wxApp {
+    int batchResult = -1; // 一括書き出しの終了コード (-1 なら通常どおり画面を出す)
+
+public:
+    bool OnInit() {
+        wxASSERT_MSG(VerifyWindowKernels(), "SIMD window/level kernel differs from the scalar reference");
+        // 画像ハンドラは画面では使わない (描画は RGB を直接 wxImage に包む) ので、書き出しで PNG だけを登録する
+        // --export があれば MainFrame を作らずに書き出して終わる
+        // 書き出しのオプションとフォルダは UTF-8 で渡す (ロケールの文字コードに無い名前も落とさない)
+        std::vector<std::string> args;
+        for (int i = 1; i < argc; ++i) args.push_back(std::string(argv[i].utf8_str()));
+        ExportOptions opt;
+        std::string error;
+        if (ParseExportArgs(args, opt, error)) {
+#ifdef _WIN32
+            // GUI のプログラムなので、起動元のコンソールがあればそこへ出す
+            if (AttachConsole(ATTACH_PARENT_PROCESS)) { std::freopen("CONOUT$", "w", stdout); std::freopen("CONOUT$", "w", stderr); }
+#endif
+            if (!error.empty()) {
+                std::fprintf(stderr, "%s\n%s", error.c_str(), ExportUsage());
+                batchResult = 2;
+                return true;
+            }
+            wxImage::AddHandler(new wxPNGHandler);
+            batchResult = RunBatchExport(opt, [](const std::string& path, const unsigned char* rgb, int w, int h) {
+                wxImage img(w, h, const_cast<unsigned char*>(rgb), true); // 描いたバッファをそのまま使う (コピーしない)
+                return img.SaveFile(wxString(path), wxBITMAP_TYPE_PNG);
+            });
+            return true;
+        }
+        bool hasPath = argc > 1 && !argv[1].StartsWith("-");
+        (new MainFrame())->ShowAndOpen(hasPath ? argv[1] : wxString());
+        return true;
+    }
+
+    int OnRun() override { return batchResult >= 0 ? batchResult : wxApp::OnRun(); }
+};
 wxIMPLEMENT_APP(App);
\ No newline at end of file
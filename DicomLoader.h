@@ -0,0 +1,554 @@
+#pragma once
+// DICOM ファイルの走査・展開・バックグラウンド読み込み
+#include "VolumeCore.h"
+#include <cctype>
+#include <map>
+#include <string>
+
+// DCMTK headers
+#include "dcmtk/dcmdata/dctk.h"
+#include "dcmtk/dcmimgle/dcmimage.h"
+#include "dcmtk/dcmimgle/dipixel.h"
+#include "dcmtk/dcmdata/dcrledrg.h"
+#include "dcmtk/dcmjpeg/djdecode.h"
+#include "dcmtk/dcmjpls/djdecode.h"
+// JPEG 2000 / HTJ2K は DCMTK 本体に含まれないので、fmjpeg2k (OpenJPEG) があるときだけ使う
+#ifdef DICOM_WITH_FMJPEG2K
+#include "fmjpeg2k/djdecode.h"
+#endif
+
+// 圧縮された転送構文 (JPEG ベースライン/ロスレス・JPEG-LS・RLE、あれば JPEG 2000) の展開を登録する。
+// 登録はスレッド安全でないので、最初の展開の前に 1 回だけ行う
+inline void RegisterDicomCodecs() {
+    static std::once_flag once;
+    std::call_once(once, []() {
+        DJDecoderRegistration::registerCodecs();
+        DJLSDecoderRegistration::registerCodecs();
+        DcmRLEDecoderRegistration::registerCodecs();
+#ifdef DICOM_WITH_FMJPEG2K
+        FMJPEG2KDecoderRegistration::registerCodecs();
+#endif
+    });
+}
+
+// --- ヘッダ情報 (PixelData の手前まで) ---
+struct SliceHeader {
+    std::string path;
+    std::string seriesUID, seriesDescription, modality;
+    int seriesNumber = 0;
+    int instance = 0;
+    int frame = 0, frames = 1; // 複数フレーム (Enhanced CT/MR など) のファイル内での位置と総数
+    int rows = 0, cols = 0;
+    double pxSpcX = 1.0, pxSpcY = 1.0, thickness = 1.0;
+    // ImagePositionPatient を ImageOrientationPatient の法線へ射影した位置 (mm)。hasPosition のときだけ有効
+    bool hasPosition = false;
+    double location = 0.0, normal[3] = { 0.0, 0.0, 1.0 };
+    std::vector<double> frameLocations; // 複数フレームのファイルのフレームごとの位置 (ExpandFrames が各フレームへ配る)
+    double windowCenter = 0.0, windowWidth = 0.0; // データセットの表示ウィンドウ (先頭の値)。幅 0 は指定なし
+    // 保存値の取りうる範囲 (BitsStored / PixelRepresentation、なければ符号なし 16 bit) に Rescale を掛けたモダリティ値の範囲。
+    // 複数フレームのファイルは全フレーム分。integerRescale は傾き・切片がすべて整数のとき
+    double valueMin = 0.0, valueMax = 65535.0;
+    bool integerRescale = true;
+    double valueScale = 1.0; // 格納値 = モダリティ値 / valueScale。シリーズで揃え、展開の前に入れる (SeriesValueScale)
+    bool inverted = false;   // MONOCHROME1 (値が大きいほど暗く表示する)。画素はそのまま持ち、ウィンドウを反転する
+    bool color = false;      // 白黒でない (RGB など)。展開できないので開く前に断る
+    std::string patientName, patientID;
+    bool valid = false;
+};
+
+inline bool ReadDoubles(DcmItem* item, const DcmTagKey& tag, double* v, int n) {
+    for (int i = 0; i < n; ++i) if (!item || item->findAndGetFloat64(tag, v[i], i).bad()) return false;
+    return true;
+}
+
+// Enhanced 形式の機能グループ group の中の seq の先頭項目から読む
+inline bool ReadFromGroup(DcmItem* group, const DcmTagKey& seq, const DcmTagKey& tag, double* v, int n) {
+    DcmItem* item = nullptr;
+    return group && group->findAndGetSequenceItem(seq, item).good() && ReadDoubles(item, tag, v, n);
+}
+
+// RescaleSlope / Intercept。Enhanced 形式はフレームごと (なければ共通) の機能グループに持つ
+inline void ReadRescale(DcmItem* ds, int frame, double& slope, double& intercept) {
+    slope = 1.0; intercept = 0.0;
+    if (ReadDoubles(ds, DCM_RescaleIntercept, &intercept, 1)) { ReadDoubles(ds, DCM_RescaleSlope, &slope, 1); return; }
+    DcmItem *perFrame = nullptr, *shared = nullptr;
+    ds->findAndGetSequenceItem(DCM_PerFrameFunctionalGroupsSequence, perFrame, frame);
+    ds->findAndGetSequenceItem(DCM_SharedFunctionalGroupsSequence, shared);
+    for (DcmItem* group : { perFrame, shared }) {
+        if (ReadFromGroup(group, DCM_PixelValueTransformationSequence, DCM_RescaleIntercept, &intercept, 1)) {
+            ReadFromGroup(group, DCM_PixelValueTransformationSequence, DCM_RescaleSlope, &slope, 1);
+            return;
+        }
+    }
+}
+
+// ファイルのデータセットにも C-FIND の応答にも使う (応答に含まれない項目は既定値のまま)
+inline bool ReadHeader(DcmItem* ds, SliceHeader& hdr) {
+    const char* tmp = nullptr;
+    if (ds->findAndGetString(DCM_SeriesInstanceUID, tmp).bad() || !tmp) return false;
+    hdr.seriesUID = tmp;
+
+    Uint16 r = 0, c = 0;
+    ds->findAndGetUint16(DCM_Rows, r); ds->findAndGetUint16(DCM_Columns, c);
+    hdr.rows = r; hdr.cols = c;
+    Sint32 inst = 0;
+    ds->findAndGetSint32(DCM_InstanceNumber, inst);
+    hdr.instance = (int)inst;
+    Sint32 seriesNo = 0;
+    ds->findAndGetSint32(DCM_SeriesNumber, seriesNo);
+    hdr.seriesNumber = (int)seriesNo;
+    if (ds->findAndGetString(DCM_SeriesDescription, tmp).good() && tmp) hdr.seriesDescription = tmp;
+    if (ds->findAndGetString(DCM_Modality, tmp).good() && tmp) hdr.modality = tmp;
+    Sint32 frames = 1;
+    if (ds->findAndGetSint32(DCM_NumberOfFrames, frames).good() && frames > 1) hdr.frames = (int)frames;
+    // PixelSpacing は DS (文字列) なので配列では取れない。1 値ずつ読む (行間隔, 列間隔)
+    double sp[2];
+    bool hasSpacing = ReadDoubles(ds, DCM_PixelSpacing, sp, 2);
+    ds->findAndGetFloat64(DCM_SliceThickness, hdr.thickness);
+    // Enhanced 形式は画素間隔・厚みを共通の機能グループに持つ
+    DcmItem *shared = nullptr, *measures = nullptr;
+    ds->findAndGetSequenceItem(DCM_SharedFunctionalGroupsSequence, shared);
+    if (!hasSpacing && shared && shared->findAndGetSequenceItem(DCM_PixelMeasuresSequence, measures).good() && measures) {
+        hasSpacing = ReadDoubles(measures, DCM_PixelSpacing, sp, 2);
+        measures->findAndGetFloat64(DCM_SliceThickness, hdr.thickness);
+    }
+    if (hasSpacing) { hdr.pxSpcY = sp[0]; hdr.pxSpcX = sp[1]; }
+    // 位置と向き。Enhanced 形式は向きを共通 (なければ先頭フレーム) の、位置をフレームごとの機能グループに持つ
+    double iop[6], ipp[3];
+    DcmItem* perFrame = nullptr;
+    bool hasIop = ReadDoubles(ds, DCM_ImageOrientationPatient, iop, 6) ||
+                  ReadFromGroup(shared, DCM_PlaneOrientationSequence, DCM_ImageOrientationPatient, iop, 6) ||
+                  (ds->findAndGetSequenceItem(DCM_PerFrameFunctionalGroupsSequence, perFrame, 0).good() &&
+                   ReadFromGroup(perFrame, DCM_PlaneOrientationSequence, DCM_ImageOrientationPatient, iop, 6));
+    if (hasIop) {
+        double n[3] = { iop[1] * iop[5] - iop[2] * iop[4], iop[2] * iop[3] - iop[0] * iop[5], iop[0] * iop[4] - iop[1] * iop[3] };
+        double len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (len > 1e-6) {
+            for (int i = 0; i < 3; ++i) hdr.normal[i] = n[i] / len;
+            auto project = [&](const double* p) { return p[0] * hdr.normal[0] + p[1] * hdr.normal[1] + p[2] * hdr.normal[2]; };
+            if (hdr.frames == 1) {
+                if (ReadDoubles(ds, DCM_ImagePositionPatient, ipp, 3)) { hdr.location = project(ipp); hdr.hasPosition = true; }
+            } else {
+                hdr.frameLocations.reserve(hdr.frames);
+                for (int f = 0; f < hdr.frames; ++f) {
+                    DcmItem* item = nullptr;
+                    if (ds->findAndGetSequenceItem(DCM_PerFrameFunctionalGroupsSequence, item, f).bad() ||
+                        !ReadFromGroup(item, DCM_PlanePositionSequence, DCM_ImagePositionPatient, ipp, 3)) break;
+                    hdr.frameLocations.push_back(project(ipp));
+                }
+                hdr.hasPosition = (int)hdr.frameLocations.size() == hdr.frames;
+                if (!hdr.hasPosition) hdr.frameLocations.clear();
+            }
+        }
+    }
+    // 表示ウィンドウ。Enhanced 形式は共通 (なければ先頭フレーム) の機能グループに持つ
+    double window[2];
+    auto readWindow = [&](DcmItem* item) { return ReadDoubles(item, DCM_WindowCenter, window, 1) && ReadDoubles(item, DCM_WindowWidth, window + 1, 1); };
+    bool hasWindow = readWindow(ds);
+    if (!hasWindow) {
+        DcmItem *voiShared = nullptr, *voiFrame = nullptr, *voi = nullptr;
+        ds->findAndGetSequenceItem(DCM_SharedFunctionalGroupsSequence, voiShared);
+        ds->findAndGetSequenceItem(DCM_PerFrameFunctionalGroupsSequence, voiFrame, 0);
+        for (DcmItem* group : { voiShared, voiFrame })
+            if (group && group->findAndGetSequenceItem(DCM_FrameVOILUTSequence, voi).good() && readWindow(voi)) { hasWindow = true; break; }
+    }
+    if (hasWindow && window[1] > 0.0) { hdr.windowCenter = window[0]; hdr.windowWidth = window[1]; }
+    // 白黒の極性。カラーは扱わない
+    Uint16 samples = 1;
+    ds->findAndGetUint16(DCM_SamplesPerPixel, samples);
+    if (ds->findAndGetString(DCM_PhotometricInterpretation, tmp).good() && tmp) {
+        hdr.inverted = std::strncmp(tmp, "MONOCHROME1", 11) == 0;
+        hdr.color = std::strncmp(tmp, "MONOCHROME", 10) != 0;
+    }
+    hdr.color = hdr.color || samples > 1;
+    // モダリティ値の範囲。シリーズの格納の倍率を画素を読む前に決めるのに使う
+    Uint16 bits = 16, signedPx = 0;
+    ds->findAndGetUint16(DCM_BitsStored, bits); ds->findAndGetUint16(DCM_PixelRepresentation, signedPx);
+    bits = std::clamp<Uint16>(bits, 1, 32);
+    double storedLo = signedPx ? -std::ldexp(1.0, bits - 1) : 0.0, storedHi = signedPx ? std::ldexp(1.0, bits - 1) - 1.0 : std::ldexp(1.0, bits) - 1.0;
+    hdr.valueMin = INFINITY; hdr.valueMax = -INFINITY;
+    for (int f = 0; f < hdr.frames; ++f) {
+        double slope, intercept;
+        ReadRescale(ds, f, slope, intercept);
+        hdr.integerRescale = hdr.integerRescale && slope == std::floor(slope) && intercept == std::floor(intercept);
+        double a = storedLo * slope + intercept, b = storedHi * slope + intercept;
+        hdr.valueMin = std::min({ hdr.valueMin, a, b }); hdr.valueMax = std::max({ hdr.valueMax, a, b });
+    }
+    if (ds->findAndGetString(DCM_PatientName, tmp).good() && tmp) hdr.patientName = tmp;
+    if (ds->findAndGetString(DCM_PatientID, tmp).good() && tmp) hdr.patientID = tmp;
+    hdr.valid = true;
+    return true;
+}
+
+// PixelData で読み込みを止めるため、画素は一切読まない
+inline SliceHeader ScanHeader(const std::string& path) {
+    ScopedTimer timer("ScanHeader");
+    SliceHeader hdr;
+    hdr.path = path;
+    DcmFileFormat ff;
+    if (ff.loadFileUntilTag(path.c_str(), EXS_Unknown, EGL_noChange, DCM_MaxReadLength, ERM_autoDetect, DCM_PixelData).bad()) return hdr;
+    ReadHeader(ff.getDataset(), hdr);
+    return hdr;
+}
+
+// --- 複数フレームのファイル ---
+// 1 フレームずつ別のスレッドで展開するため、開いたファイルを使い回す。
+// DcmFileFormat は同時に 2 つのスレッドから読めないので、同時に使うスレッドの数だけ開く。
+// PixelData は読み込みを遅らせ、フレームごとに必要な部分だけを読む (CIF_UsePartialAccessToPixelData)
+class FrameFilePool {
+    std::mutex mtx;
+    std::map<std::string, std::vector<std::unique_ptr<DcmFileFormat>>> idle;
+
+public:
+    std::unique_ptr<DcmFileFormat> Acquire(const std::string& path) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto it = idle.find(path);
+            if (it != idle.end() && !it->second.empty()) {
+                std::unique_ptr<DcmFileFormat> ff = std::move(it->second.back());
+                it->second.pop_back();
+                return ff;
+            }
+        }
+        auto ff = std::make_unique<DcmFileFormat>();
+        if (ff->loadFile(path.c_str(), EXS_Unknown, EGL_noChange, DCM_MaxReadLength).bad()) return nullptr;
+        return ff;
+    }
+
+    void Release(const std::string& path, std::unique_ptr<DcmFileFormat> ff) {
+        std::lock_guard<std::mutex> lock(mtx);
+        idle[path].push_back(std::move(ff));
+    }
+};
+
+// シリーズの格納の倍率。Rescale がすべて整数なら 1 (モダリティ値をそのまま格納し、収まらない値は展開時に報告する)。
+// 小数の傾き・切片 (PET の Bq/ml など) は、取りうる値の範囲が int16 全体に広がる倍率で格納して桁を落とさない
+inline double SeriesValueScale(const std::vector<SliceHeader>& slices) {
+    bool integer = true;
+    double maxAbs = 0.0;
+    for (const SliceHeader& s : slices) {
+        if (!s.valid) continue;
+        integer = integer && s.integerRescale;
+        maxAbs = std::max({ maxAbs, std::abs(s.valueMin), std::abs(s.valueMax) });
+    }
+    if (integer || !(maxAbs > 0.0) || !std::isfinite(maxAbs)) return 1.0;
+    return maxAbs / INT16_MAX;
+}
+
+// 保存値をモダリティ値 (slope * v + intercept) / scale にして int16 へ収める。傾き 1 の整数切片は加算だけで済ませる。
+// int16 に収まらず丸めた画素があれば true
+template <typename T>
+inline bool RescaleToInt16(const T* src, size_t n, double slope, double intercept, double scale, int16_t* dst) {
+    bool clipped = false;
+    if (scale == 1.0 && slope == 1.0 && intercept == std::floor(intercept) && std::abs(intercept) < 65536.0) {
+        int32_t add = (int32_t)intercept;
+        for (size_t i = 0; i < n; ++i) {
+            int64_t v = (int64_t)src[i] + add;
+            clipped |= v < INT16_MIN || v > INT16_MAX;
+            dst[i] = (int16_t)std::clamp<int64_t>(v, INT16_MIN, INT16_MAX);
+        }
+        return clipped;
+    }
+    slope /= scale; intercept /= scale;
+    for (size_t i = 0; i < n; ++i) {
+        double v = src[i] * slope + intercept;
+        clipped |= v < INT16_MIN - 0.5 || v > INT16_MAX + 0.5;
+        dst[i] = (int16_t)std::lround(std::clamp(v, (double)INT16_MIN, (double)INT16_MAX));
+    }
+    return clipped;
+}
+
+// 読み込み済みのデータセット (ファイルでもネットワークで届いたものでも) から frame の 1 枚を dst (w*h) に展開する。
+// 白黒の画像は DCMTK の中間データ (保存値) を受け取り、Rescale を掛けたモダリティ値 (CT なら HU) を scale で割って格納する。
+// int16 に収まらず丸めた画素があれば clipped を立てる。
+// 表示用の出力 (VOI・16 bit への伸張) を作らないので、画素 1 周分の変換と DCMTK 内部の出力バッファが要らない。
+// MONOCHROME1 も同じく保存値を受け取る (反転は表示のウィンドウ側で掛ける、SliceHeader::inverted)。
+// カラーの画像は展開しない (false)。シリーズは開く前に SliceHeader::color で断る
+inline bool DecodeDataset(DcmDataset* ds, int frame, int16_t* dst, int w, int h, double scale = 1.0, unsigned long flags = 0,
+                          bool* clipped = nullptr) {
+    RegisterDicomCodecs();
+    DicomImage img(ds, ds->getOriginalXfer(), flags | CIF_IgnoreModalityTransformation, (unsigned long)frame, 1);
+    if (img.getStatus() != EIS_Normal || (int)img.getWidth() != w || (int)img.getHeight() != h || !img.isMonochrome()) return false;
+    const DiPixel* px = img.getInterData();
+    size_t n = (size_t)w * h;
+    if (!px || !px->getData() || px->getCount() < n) return false;
+    double slope, intercept;
+    ReadRescale(ds, frame, slope, intercept);
+    const void* data = px->getData();
+    bool over = false;
+    switch (px->getRepresentation()) {
+    case EPR_Uint8: over = RescaleToInt16((const uint8_t*)data, n, slope, intercept, scale, dst); break;
+    case EPR_Sint8: over = RescaleToInt16((const int8_t*)data, n, slope, intercept, scale, dst); break;
+    case EPR_Uint16: over = RescaleToInt16((const uint16_t*)data, n, slope, intercept, scale, dst); break;
+    case EPR_Sint16: over = RescaleToInt16((const int16_t*)data, n, slope, intercept, scale, dst); break;
+    case EPR_Uint32: over = RescaleToInt16((const uint32_t*)data, n, slope, intercept, scale, dst); break;
+    case EPR_Sint32: over = RescaleToInt16((const int32_t*)data, n, slope, intercept, scale, dst); break;
+    default: return false;
+    }
+    if (clipped) *clipped = over;
+    return true;
+}
+
+// 1 スライス分の画素を dst (w*h) に展開する。
+// 複数フレームのファイルは hdr.frame の 1 枚だけを展開する。pool を渡すとファイルを開き直さない。
+// 値は hdr.valueScale で割って格納する
+inline bool DecodeSlice(const SliceHeader& hdr, int16_t* dst, int w, int h, FrameFilePool* pool = nullptr, bool* clipped = nullptr) {
+    if (hdr.cols != w || hdr.rows != h) return false;
+    ScopedTimer timer("DecodeSlice");
+    if (hdr.frames > 1) {
+        std::unique_ptr<DcmFileFormat> ff = pool ? pool->Acquire(hdr.path) : nullptr;
+        if (!ff) {
+            ff = std::make_unique<DcmFileFormat>();
+            if (ff->loadFile(hdr.path.c_str(), EXS_Unknown, EGL_noChange, DCM_MaxReadLength).bad()) return false;
+        }
+        bool ok = DecodeDataset(ff->getDataset(), hdr.frame, dst, w, h, hdr.valueScale, CIF_UsePartialAccessToPixelData, clipped);
+        if (pool) pool->Release(hdr.path, std::move(ff));
+        return ok;
+    }
+    DcmFileFormat ff;
+    if (ff.loadFile(hdr.path.c_str()).bad()) return false;
+    // 中間データを作った時点で元の PixelData は不要なので手放させる
+    return DecodeDataset(ff.getDataset(), 0, dst, w, h, hdr.valueScale, CIF_MayDetachPixelData, clipped);
+}
+
+// --- バックグラウンド読み込み ---
+// 確保済みのボリュームバッファへ各スライスを並列に展開する。
+// 通知コールバックはワーカースレッドから呼ばれる。
+class VolumeLoader {
+    std::thread thread;
+    std::atomic<bool> cancelled{false};
+    std::atomic<int> clippedSlices{0};
+
+public:
+    ~VolumeLoader() { Cancel(); }
+
+    // slices は並べ替え済み。vol は Reset 済みで slices.size() 枚分の深さを持つ
+    void Start(std::vector<SliceHeader> slices, Volume* vol,
+               std::function<void(int)> onSlice, std::function<void(int)> onFinished, ValueHistogram* histogram = nullptr) {
+        Cancel();
+        cancelled = false;
+        clippedSlices = 0;
+        thread = std::thread([this, slices = std::move(slices), vol, onSlice, onFinished, histogram]() {
+            ScopedTimer timer("LoadVolume");
+            // 初期表示位置 (中央) から外側へ向かって読む
+            int n = (int)slices.size();
+            int w = vol->Width(), h = vol->Height();
+            std::vector<int> order;
+            order.reserve(n);
+            for (int d = 0; (int)order.size() < n; ++d) {
+                int lo = n / 2 - d, hi = n / 2 + d;
+                if (lo >= 0) order.push_back(lo);
+                if (d > 0 && hi < n) order.push_back(hi);
+            }
+            std::atomic<int> loaded{0};
+            FrameFilePool pool; // 複数フレームのファイルは読み終えるまで開いたままにする
+            ThreadPool::Shared().ParallelFor(n, [&](int i) {
+                if (cancelled) return;
+                int z = order[i];
+                bool ok = false, clipped = false;
+                if (int16_t* dst = vol->SliceData(z)) {
+                    ok = DecodeSlice(slices[z], dst, w, h, &pool, &clipped);
+                    if (ok && histogram) histogram->Add(dst, (size_t)w * h);
+                } else {
+                    // ブリック形式は一旦スライス単位で展開してから分配する
+                    thread_local std::vector<int16_t> scratch;
+                    scratch.resize((size_t)w * h);
+                    ok = DecodeSlice(slices[z], scratch.data(), w, h, &pool, &clipped);
+                    if (ok && histogram) histogram->Add(scratch.data(), (size_t)w * h);
+                    if (ok) { ScopedTimer write("WriteSlice"); vol->WriteSlice(z, scratch.data()); }
+                }
+                if (ok) {
+                    if (clipped) clippedSlices.fetch_add(1);
+                    loaded.fetch_add(1);
+                    if (!cancelled && onSlice) onSlice(z);
+                }
+            });
+            if (!cancelled && onFinished) onFinished(loaded.load());
+        });
+    }
+
+    // 実行中の読み込みを止め、バッファへの書き込みが終わるまで待つ
+    void Cancel() {
+        cancelled = true;
+        if (thread.joinable()) thread.join();
+    }
+
+    // int16 に収まらない画素を丸めたスライスの数 (次の Start で 0 に戻る)
+    int ClippedSlices() const { return clippedSlices.load(); }
+};
+
+// --- シリーズの走査と選択 ---
+// フォルダから拾うファイル。拡張子の大文字小文字は区別しない (*.DCM で書き出す装置もある)
+inline bool IsDicomFileName(const std::filesystem::path& p) {
+    std::string ext = p.extension().string();
+    return ext.size() == 4 && ext[0] == '.' && std::tolower((unsigned char)ext[1]) == 'd' &&
+           std::tolower((unsigned char)ext[2]) == 'c' && std::tolower((unsigned char)ext[3]) == 'm';
+}
+
+// 複数フレームのファイルを 1 フレーム 1 スライスに展開する
+inline std::vector<SliceHeader> ExpandFrames(std::vector<SliceHeader> headers) {
+    size_t total = 0;
+    for (const SliceHeader& h : headers) total += h.valid ? h.frames : 1;
+    if (total == headers.size()) return headers;
+    std::vector<SliceHeader> expanded;
+    expanded.reserve(total);
+    for (SliceHeader& h : headers) {
+        int frames = h.valid ? h.frames : 1;
+        std::vector<double> locations = std::move(h.frameLocations);
+        for (int f = 0; f < frames; ++f) {
+            expanded.push_back(h);
+            expanded.back().frame = f;
+            if (f < (int)locations.size()) expanded.back().location = locations[f];
+        }
+    }
+    return expanded;
+}
+
+// ヘッダだけを全コアで読む。progress には読み終えたファイル数を加算する (プログレス表示用)。
+// cancel が立つと残りは読まずに無効なヘッダのまま返す。
+// 複数フレームのファイルはフレームごとのヘッダに展開するので、返す数はファイル数より多いことがある
+inline std::vector<SliceHeader> ScanHeaders(const std::vector<std::string>& paths, std::atomic<int>* progress = nullptr,
+                                            const std::atomic<bool>* cancel = nullptr) {
+    ScopedTimer timer("ScanHeaders");
+    std::vector<SliceHeader> headers(paths.size());
+    ThreadPool::Shared().ParallelFor((int)paths.size(), [&](int i) {
+        if (cancel && *cancel) return;
+        headers[i] = ScanHeader(paths[i]);
+        if (progress) progress->fetch_add(1);
+    });
+    return ExpandFrames(std::move(headers));
+}
+
+// シリーズ内のスライスの並び (InstanceNumber 順、同じファイルならフレーム順)
+inline bool SliceBefore(const SliceHeader& a, const SliceHeader& b) {
+    return a.instance != b.instance ? a.instance < b.instance : a.frame < b.frame;
+}
+
+// 位置で並べるときの並び (法線方向の位置が大きい方から。Axial なら頭側が先頭)
+inline bool SliceAbove(const SliceHeader& a, const SliceHeader& b) { return a.location > b.location; }
+
+inline bool SameOrientation(const SliceHeader& a, const SliceHeader& b) {
+    return a.normal[0] * b.normal[0] + a.normal[1] * b.normal[1] + a.normal[2] * b.normal[2] > 0.9999;
+}
+
+// これより近い 2 枚は同じ位置の重複とみなす (mm)
+constexpr double SAME_LOCATION_MM = 1e-3;
+
+// --- スライス間隔 ---
+// 位置と向きが揃い位置順に並んでいれば (SeriesEntry::byPosition) 隣り合うスライスの距離から、そうでなければ SliceThickness から間隔を決める。
+// 距離が一様でない (欠け・重なり) ときは uniform = false とし、先頭からの距離を offsets に入れる (間隔は中央値)。
+// offsets は必ず単調に増える (ResampleSlices が二分探索する)
+struct SliceSpacing {
+    double step = 1.0;
+    bool uniform = true;
+    std::vector<double> offsets;
+};
+
+inline SliceSpacing MeasureSpacing(const std::vector<SliceHeader>& slices) {
+    SliceSpacing sp;
+    if (slices.empty()) return sp;
+    sp.step = slices.front().thickness > 0 ? slices.front().thickness : 1.0;
+    if (slices.size() < 2) return sp;
+    for (const SliceHeader& h : slices) if (!h.hasPosition || !SameOrientation(h, slices.front())) return sp;
+    std::vector<double> gaps(slices.size() - 1);
+    for (size_t i = 0; i + 1 < slices.size(); ++i) {
+        gaps[i] = slices[i].location - slices[i + 1].location;
+        if (gaps[i] <= SAME_LOCATION_MM) return sp; // InstanceNumber 順など位置順でない並び
+    }
+    std::vector<double> sorted = gaps;
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+    double median = sorted[sorted.size() / 2];
+    sp.step = median;
+    double tolerance = std::max(0.01, median * 0.01);
+    for (double g : gaps) if (std::fabs(g - median) > tolerance) sp.uniform = false;
+    if (sp.uniform) return sp;
+    sp.offsets.resize(slices.size());
+    for (size_t i = 0; i < slices.size(); ++i) sp.offsets[i] = slices.front().location - slices[i].location;
+    return sp;
+}
+
+// 1 シリーズ分のスライス (先頭と同じ画像サイズのものだけ)。
+// 全スライスの位置と向きが揃っていれば位置順 (byPosition)、そうでなければ InstanceNumber 順
+struct SeriesEntry {
+    std::string uid, description, modality;
+    int number = 0;
+    bool byPosition = false;
+    std::vector<SliceHeader> slices;
+
+    // InstanceNumber 順に並んだ slices を、位置が揃っていれば位置順に並べ直す。
+    // 同じ位置の重複 (撮り直しなど) は番号の若い 1 枚だけを残す
+    void OrderByPosition() {
+        byPosition = !slices.empty();
+        for (const SliceHeader& h : slices) if (!h.hasPosition || !SameOrientation(h, slices.front())) byPosition = false;
+        if (!byPosition) return;
+        std::stable_sort(slices.begin(), slices.end(), SliceAbove);
+        slices.erase(std::unique(slices.begin(), slices.end(), [](const SliceHeader& a, const SliceHeader& b) {
+            return std::fabs(a.location - b.location) < SAME_LOCATION_MM;
+        }), slices.end());
+    }
+
+    // 後から届いたスライスを並びを崩さずに差し込み、その位置を返す。
+    // 画像サイズが違う・位置順のシリーズに位置のないものや既にある位置のものが来たときは -1
+    int Insert(const SliceHeader& h) {
+        if (!slices.empty() && (h.cols != slices.front().cols || h.rows != slices.front().rows)) return -1;
+        if (slices.empty()) byPosition = h.hasPosition;
+        std::vector<SliceHeader>::iterator it;
+        if (byPosition) {
+            if (!h.hasPosition || !SameOrientation(h, slices.empty() ? h : slices.front())) return -1;
+            it = std::upper_bound(slices.begin(), slices.end(), h, SliceAbove);
+            if (it != slices.begin() && std::fabs((it - 1)->location - h.location) < SAME_LOCATION_MM) return -1;
+            if (it != slices.end() && std::fabs(it->location - h.location) < SAME_LOCATION_MM) return -1;
+        } else {
+            it = std::upper_bound(slices.begin(), slices.end(), h, SliceBefore);
+        }
+        int pos = (int)(it - slices.begin());
+        slices.insert(it, h);
+        return pos;
+    }
+
+    std::vector<std::string> Paths() const {
+        std::vector<std::string> paths;
+        paths.reserve(slices.size());
+        // 複数フレームのファイルは 1 回だけ数える (フレームは並びの中で連続している)
+        for (const SliceHeader& h : slices) if (paths.empty() || paths.back() != h.path) paths.push_back(h.path);
+        return paths;
+    }
+};
+
+// 走査結果をシリーズごとにまとめ、SeriesNumber 順 (同じなら UID 順) に並べる
+inline std::vector<SeriesEntry> GroupSeries(const std::vector<SliceHeader>& headers) {
+    std::map<std::string, std::vector<const SliceHeader*>> seriesMap;
+    for (const auto& h : headers) {
+        if (h.valid) seriesMap[h.seriesUID].push_back(&h);
+    }
+    std::vector<SeriesEntry> series;
+    for (auto& [uid, list] : seriesMap) {
+        std::stable_sort(list.begin(), list.end(), [](const SliceHeader* a, const SliceHeader* b){ return SliceBefore(*a, *b); });
+        const SliceHeader& first = *list.front();
+        SeriesEntry e;
+        e.uid = uid; e.description = first.seriesDescription; e.modality = first.modality; e.number = first.seriesNumber;
+        for (const SliceHeader* h : list) {
+            if (h->cols == first.cols && h->rows == first.rows) e.slices.push_back(*h);
+        }
+        e.OrderByPosition();
+        series.push_back(std::move(e));
+    }
+    std::stable_sort(series.begin(), series.end(), [](const SeriesEntry& a, const SeriesEntry& b){ return a.number < b.number; });
+    return series;
+}
+
+// 最初に開くシリーズ (最も枚数の多いもの)。空なら -1
+inline int LargestSeries(const std::vector<SeriesEntry>& series) {
+    int best = -1;
+    for (int i = 0; i < (int)series.size(); ++i) {
+        if (best < 0 || series[i].slices.size() > series[best].slices.size()) best = i;
+    }
+    return best;
+}
+
+inline std::vector<SliceHeader> SelectLargestSeries(const std::vector<SliceHeader>& headers) {
+    std::vector<SeriesEntry> series = GroupSeries(headers);
+    int best = LargestSeries(series);
+    if (best < 0) return {};
+    return std::move(series[best].slices);
+}
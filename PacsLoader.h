@@ -0,0 +1,314 @@
+#pragma once
+// PACS からの取得 (C-FIND でスライス一覧、C-GET で画素)。ファイルを介さず、届いたインスタンスをそのままボリュームへ展開する
+#include "DicomLoader.h"
+#include <unordered_map>
+
+// DCMTK headers
+#include "dcmtk/dcmnet/scu.h"
+
+// PACS 上のスライスは path に "pacs:" + SOPInstanceUID を入れ、ファイルのスライスと同じ経路 (シリーズ一覧・キャッシュキー) で扱う。
+// ファイルでない path は大きさ・更新時刻が 0 になるので、キャッシュキーは SOPInstanceUID だけで決まる
+constexpr const char PACS_PATH_PREFIX[] = "pacs:";
+inline bool IsPacsPath(const std::string& path) { return path.compare(0, sizeof(PACS_PATH_PREFIX) - 1, PACS_PATH_PREFIX) == 0; }
+inline std::string PacsInstanceUID(const std::string& path) { return path.substr(sizeof(PACS_PATH_PREFIX) - 1); }
+
+struct PacsServer {
+    std::string host = "localhost", calledAE = "ANY-SCP", callingAE = "DICOMVIEWER";
+    int port = 104;
+};
+
+// 取得を cancelled で打ち切ったときの失敗
+static const OFConditionConst PACS_CANCELLED = { OFM_dcmnet, 0x4ff, OF_error, "retrieval cancelled" };
+
+// --- 1 本の接続 ---
+// C-GET の C-STORE 副操作で届いたデータセットはディスクに書かず onInstance へ渡す。
+// 関連付けに触れてよいのは接続を持つスレッドだけ。他のスレッドからは cancelled を立てて、戻ってくるのを待つ
+class PacsConnection : public DcmSCU {
+    static constexpr Uint32 POLL_SECONDS = 1; // cancelled を見る間隔
+    bool interrupted = false;                 // 打ち切った。相手は送っている途中なので、解放 (A-RELEASE) でなく A-ABORT で閉じる
+
+public:
+    std::function<bool(DcmDataset&)> onInstance;  // false を返すと残りの取得を打ち切る
+    const std::atomic<bool>* cancelled = nullptr; // 立っていたら、応答を待つ間と次のインスタンスで打ち切る
+
+    ~PacsConnection() override {
+        if (!isConnected()) return;
+        if (Cancelled()) abortAssociation();
+        else releaseAssociation();
+    }
+
+    bool Open(const PacsServer& server, std::string& error) {
+        setAETitle(server.callingAE.c_str()); setPeerAETitle(server.calledAE.c_str());
+        setPeerHostName(server.host.c_str()); setPeerPort((Uint16)server.port);
+        // 接続と関連付けの確立は打ち切れないので短めに待つ (PacsLoader::Cancel はこの時間だけ待つことがある)。
+        // 応答は非ブロッキングで POLL_SECONDS ずつ待つ (receiveDIMSECommand)。60 秒は全体の上限
+        setConnectionTimeout(5); setACSETimeout(5); setDIMSEBlockingMode(DIMSE_NONBLOCKING); setDIMSETimeout(60);
+        OFList<OFString> plain;
+        plain.push_back(UID_LittleEndianExplicitTransferSyntax); plain.push_back(UID_LittleEndianImplicitTransferSyntax);
+        addPresentationContext(UID_FINDStudyRootQueryRetrieveInformationModel, plain);
+        addPresentationContext(UID_GETStudyRootQueryRetrieveInformationModel, plain);
+        // 圧縮された転送構文は別々の文脈で申し込み、PACS が保存している形のまま (展開し直さずに) 送れるようにする
+        static const char* const storage[] = {
+            UID_CTImageStorage, UID_EnhancedCTImageStorage, UID_MRImageStorage, UID_EnhancedMRImageStorage,
+            UID_PositronEmissionTomographyImageStorage, UID_SecondaryCaptureImageStorage,
+        };
+        static const char* const compressed[] = {
+            UID_JPEGLSLosslessTransferSyntax, UID_JPEGProcess14SV1TransferSyntax, UID_RLELosslessTransferSyntax, UID_JPEGProcess1TransferSyntax,
+#ifdef DICOM_WITH_FMJPEG2K
+            UID_JPEG2000LosslessOnlyTransferSyntax, UID_JPEG2000TransferSyntax,
+#endif
+        };
+        for (const char* sop : storage) {
+            addPresentationContext(sop, plain, ASC_SC_ROLE_SCP);
+            for (const char* ts : compressed) {
+                OFList<OFString> one;
+                one.push_back(ts);
+                addPresentationContext(sop, one, ASC_SC_ROLE_SCP);
+            }
+        }
+        OFCondition c = initNetwork();
+        if (c.good()) c = negotiateAssociation();
+        if (c.bad()) error = server.calledAE + "@" + server.host + ":" + std::to_string(server.port) + ": " + c.text();
+        return c.good();
+    }
+
+    // 応答のデータセットを 1 件ずつ fn へ渡す
+    bool Find(DcmDataset& query, const std::function<void(DcmDataset&)>& fn, std::string& error) {
+        T_ASC_PresentationContextID pc = findPresentationContextID(UID_FINDStudyRootQueryRetrieveInformationModel, "");
+        if (pc == 0) { error = "C-FIND (Study Root) was not accepted"; return false; }
+        OFList<QRResponse*> responses;
+        OFCondition c = sendFINDRequest(pc, &query, &responses);
+        for (OFListIterator(QRResponse*) it = responses.begin(); it != responses.end(); ++it) {
+            if (c.good() && (*it)->m_dataset) fn(*(*it)->m_dataset);
+            delete *it;
+        }
+        if (c.bad()) error = std::string("C-FIND: ") + c.text();
+        return c.good();
+    }
+
+    bool Get(DcmDataset& query, std::string& error) {
+        T_ASC_PresentationContextID pc = findPresentationContextID(UID_GETStudyRootQueryRetrieveInformationModel, "");
+        if (pc == 0) { error = "C-GET (Study Root) was not accepted"; return false; }
+        OFList<RetrieveResponse*> responses;
+        OFCondition c = sendCGETRequest(pc, &query, &responses);
+        for (OFListIterator(RetrieveResponse*) it = responses.begin(); it != responses.end(); ++it) delete *it;
+        if (c.bad()) error = std::string("C-GET: ") + c.text();
+        return c.good();
+    }
+
+    // IMAGE 階層の C-GET。uids はバックスラッシュ区切りの一覧でもよい
+    bool GetInstances(const std::string& studyUID, const std::string& seriesUID, const std::string& uids, std::string& error) {
+        DcmDataset q;
+        q.putAndInsertString(DCM_QueryRetrieveLevel, "IMAGE");
+        q.putAndInsertString(DCM_StudyInstanceUID, studyUID.c_str());
+        q.putAndInsertString(DCM_SeriesInstanceUID, seriesUID.c_str());
+        q.putAndInsertString(DCM_SOPInstanceUID, uids.c_str());
+        return Get(q, error);
+    }
+
+protected:
+    // 受け取ったデータセットの解放はこちらの役目
+    OFCondition handleSTORERequest(const T_ASC_PresentationContextID, DcmDataset* incomingObject,
+                                   OFBool& continueCGETSession, Uint16& cStoreReturnStatus) override {
+        std::unique_ptr<DcmDataset> ds(incomingObject);
+        if (Cancelled()) { continueCGETSession = OFFalse; return PACS_CANCELLED; }
+        cStoreReturnStatus = STATUS_Success;
+        if (ds && onInstance && !onInstance(*ds)) continueCGETSession = OFFalse;
+        return EC_Normal;
+    }
+
+    // 次の応答を POLL_SECONDS ずつ区切って待ち、その合間に cancelled を見る (待ち時間の合計は getDIMSETimeout まで)
+    OFCondition receiveDIMSECommand(T_ASC_PresentationContextID* presID, T_DIMSE_Message* msg, DcmDataset** statusDetail,
+                                    DcmDataset** commandSet = NULL, const Uint32 timeout = 0) override {
+        if (!cancelled || timeout > 0) return DcmSCU::receiveDIMSECommand(presID, msg, statusDetail, commandSet, timeout);
+        for (Uint32 waited = 0;; waited += POLL_SECONDS) {
+            if (Cancelled()) return PACS_CANCELLED;
+            OFCondition c = DcmSCU::receiveDIMSECommand(presID, msg, statusDetail, commandSet, POLL_SECONDS);
+            if (c != DIMSE_NODATAAVAILABLE || waited + POLL_SECONDS >= getDIMSETimeout()) return c;
+        }
+    }
+
+private:
+    bool Cancelled() {
+        if (cancelled && cancelled->load()) interrupted = true;
+        return interrupted;
+    }
+};
+
+// --- スタディの一覧 ---
+// studyUID の全シリーズ (seriesUID を指定したときはそのシリーズだけ) のスライス一覧を C-FIND で作る。
+// IMAGE 階層で画像サイズや画素間隔を返さない PACS もあるので、その場合はシリーズごとに 1 枚だけ取り寄せて補う
+inline bool FindPacsStudy(const PacsServer& server, const std::string& studyUID, const std::string& seriesUID,
+                          std::vector<SliceHeader>& headers, std::string& error) {
+    ScopedTimer timer("FindPacsStudy");
+    PacsConnection conn;
+    if (!conn.Open(server, error)) return false;
+
+    // シリーズの説明などは IMAGE 階層では返らないことが多いので、SERIES 階層で聞いておく
+    std::vector<SliceHeader> series;
+    DcmDataset sq;
+    sq.putAndInsertString(DCM_QueryRetrieveLevel, "SERIES");
+    sq.putAndInsertString(DCM_StudyInstanceUID, studyUID.c_str());
+    sq.putAndInsertString(DCM_SeriesInstanceUID, seriesUID.c_str());
+    sq.insertEmptyElement(DCM_SeriesNumber); sq.insertEmptyElement(DCM_SeriesDescription); sq.insertEmptyElement(DCM_Modality);
+    if (!conn.Find(sq, [&](DcmDataset& r) {
+            SliceHeader s;
+            if (ReadHeader(&r, s)) series.push_back(std::move(s));
+        }, error)) return false;
+    if (series.empty()) { error = "no series found for study " + studyUID; return false; }
+
+    std::vector<SliceHeader> found;
+    for (const SliceHeader& s : series) {
+        DcmDataset q;
+        q.putAndInsertString(DCM_QueryRetrieveLevel, "IMAGE");
+        q.putAndInsertString(DCM_StudyInstanceUID, studyUID.c_str());
+        q.putAndInsertString(DCM_SeriesInstanceUID, s.seriesUID.c_str());
+        static const DcmTagKey keys[] = {
+            DCM_SOPInstanceUID, DCM_InstanceNumber, DCM_PatientName, DCM_PatientID, DCM_Rows, DCM_Columns, DCM_PixelSpacing,
+            DCM_SliceThickness, DCM_NumberOfFrames, DCM_ImagePositionPatient, DCM_ImageOrientationPatient, DCM_WindowCenter, DCM_WindowWidth,
+            DCM_BitsStored, DCM_PixelRepresentation, DCM_RescaleSlope, DCM_RescaleIntercept,
+            DCM_SamplesPerPixel, DCM_PhotometricInterpretation,
+        };
+        for (const DcmTagKey& k : keys) q.insertEmptyElement(k);
+        size_t begin = found.size();
+        bool complete = true, hasRange = true;
+        if (!conn.Find(q, [&](DcmDataset& r) {
+                SliceHeader h;
+                const char* sop = nullptr;
+                if (r.findAndGetString(DCM_SOPInstanceUID, sop).bad() || !sop || !ReadHeader(&r, h)) return;
+                h.path = PACS_PATH_PREFIX + std::string(sop);
+                h.seriesNumber = s.seriesNumber; h.seriesDescription = s.seriesDescription; h.modality = s.modality;
+                complete = complete && h.rows > 0 && h.cols > 0 && r.tagExistsWithValue(DCM_PixelSpacing);
+                hasRange = hasRange && r.tagExistsWithValue(DCM_BitsStored) && r.tagExistsWithValue(DCM_PhotometricInterpretation);
+                found.push_back(std::move(h));
+            }, error)) return false;
+        if ((complete && hasRange) || found.size() == begin) continue;
+
+        // 中央の 1 枚のヘッダで、シリーズ共通の項目を埋める
+        SliceHeader probe;
+        conn.onInstance = [&](DcmDataset& ds) { ReadHeader(&ds, probe); return false; };
+        bool got = conn.GetInstances(studyUID, s.seriesUID, PacsInstanceUID(found[(begin + found.size()) / 2].path), error);
+        conn.onInstance = nullptr;
+        if (!got) return false;
+        if (!probe.valid) continue;
+        for (size_t i = begin; i < found.size(); ++i) {
+            SliceHeader& h = found[i];
+            h.rows = probe.rows; h.cols = probe.cols;
+            h.pxSpcX = probe.pxSpcX; h.pxSpcY = probe.pxSpcY; h.thickness = probe.thickness;
+            if (h.patientName.empty()) h.patientName = probe.patientName;
+            if (h.patientID.empty()) h.patientID = probe.patientID;
+            if (h.windowWidth <= 0.0) { h.windowCenter = probe.windowCenter; h.windowWidth = probe.windowWidth; }
+            if (!hasRange) {
+                h.valueMin = probe.valueMin; h.valueMax = probe.valueMax; h.integerRescale = probe.integerRescale;
+                h.inverted = probe.inverted; h.color = probe.color;
+            }
+        }
+    }
+    headers = ExpandFrames(std::move(found));
+    return true;
+}
+
+// --- バックグラウンド取得 ---
+// connections 本の接続でシリーズを分担して C-GET し、届いたインスタンスをその場で vol のスライスへ展開する。
+// 中央のスライスから外側へ向かって少しずつ取り寄せるので、表示位置は最初に埋まる。
+// 通知コールバックの約束は VolumeLoader と同じ (接続のスレッドから呼ばれる)
+class PacsLoader {
+    static constexpr int CHUNK = 8; // 1 回の C-GET で取り寄せるインスタンス数 (止めるときはこの単位で待つ)
+    std::thread thread;
+    std::atomic<bool> cancelled{false};
+    std::atomic<int> clippedSlices{0};
+    std::mutex errorMtx;
+    std::string error;
+
+public:
+    ~PacsLoader() { Cancel(); }
+
+    // slices は並べ替え済みで、path は PACS_PATH_PREFIX 付き。vol は Reset 済みで slices.size() 枚分の深さを持つ
+    void Start(const PacsServer& server, const std::string& studyUID, std::vector<SliceHeader> slices, Volume* vol, int connections,
+               std::function<void(int)> onSlice, std::function<void(int)> onFinished, ValueHistogram* histogram = nullptr) {
+        Cancel();
+        cancelled = false;
+        clippedSlices = 0;
+        thread = std::thread([this, server, studyUID, slices = std::move(slices), vol, connections, onSlice, onFinished, histogram]() {
+            ScopedTimer timer("RetrievePacs");
+            int n = (int)slices.size();
+            int w = vol->Width(), h = vol->Height();
+            // インスタンスごとの各フレームの行き先と、中央から外側へ向かう取得順
+            std::unordered_map<std::string, std::vector<int>> where;
+            std::vector<std::string> order;
+            for (int d = 0, placed = 0; placed < n; ++d) {
+                for (int z : { n / 2 - d, n / 2 + d }) {
+                    if (z < 0 || z >= n || (d == 0 && placed > 0)) continue;
+                    ++placed;
+                    std::vector<int>& frames = where[PacsInstanceUID(slices[z].path)];
+                    if (frames.empty()) order.push_back(PacsInstanceUID(slices[z].path));
+                    frames.resize(std::max((int)frames.size(), slices[z].frame + 1), -1);
+                    frames[slices[z].frame] = z;
+                }
+            }
+            int chunks = ((int)order.size() + CHUNK - 1) / CHUNK;
+            std::atomic<int> next{0}, loaded{0};
+            auto worker = [&]() {
+                PacsConnection conn;
+                std::string err;
+                std::vector<int16_t> scratch;
+                conn.cancelled = &cancelled;
+                conn.onInstance = [&](DcmDataset& ds) {
+                    ScopedTimer decode("DecodeInstance");
+                    const char* sop = nullptr;
+                    auto it = ds.findAndGetString(DCM_SOPInstanceUID, sop).good() && sop ? where.find(sop) : where.end();
+                    if (it == where.end()) return !cancelled.load();
+                    for (size_t f = 0; f < it->second.size() && !cancelled; ++f) {
+                        int z = it->second[f];
+                        if (z < 0) continue;
+                        int16_t* dst = vol->SliceData(z);
+                        if (!dst) { scratch.resize((size_t)w * h); dst = scratch.data(); }
+                        bool clipped = false;
+                        if (!DecodeDataset(&ds, (int)f, dst, w, h, slices[z].valueScale, 0, &clipped)) continue;
+                        if (clipped) clippedSlices.fetch_add(1);
+                        if (histogram) histogram->Add(dst, (size_t)w * h);
+                        if (dst == scratch.data()) vol->WriteSlice(z, dst);
+                        loaded.fetch_add(1);
+                        if (!cancelled && onSlice) onSlice(z);
+                    }
+                    return !cancelled.load();
+                };
+                bool ok = conn.Open(server, err);
+                for (int c; ok && !cancelled && (c = next.fetch_add(1)) < chunks; ) {
+                    std::string uids;
+                    for (int i = c * CHUNK; i < std::min((c + 1) * CHUNK, (int)order.size()); ++i) uids += (uids.empty() ? "" : "\\") + order[i];
+                    ok = conn.GetInstances(studyUID, slices.front().seriesUID, uids, err);
+                }
+                if (!ok && !cancelled) {
+                    std::lock_guard<std::mutex> lock(errorMtx);
+                    if (error.empty()) error = err;
+                }
+            };
+            // 接続は I/O で待つので共有プールではなく専用のスレッドで張る
+            std::vector<std::thread> extra;
+            for (int i = 1; i < std::min(connections, chunks); ++i) extra.emplace_back(worker);
+            worker();
+            for (std::thread& t : extra) t.join();
+            if (!cancelled && onFinished) onFinished(loaded.load());
+        });
+    }
+
+    // cancelled を立て、スレッドが抜けるのを待つ。取得中の接続は応答の待ちを区切る間隔 (PacsConnection::POLL_SECONDS) か
+    // 展開中の 1 インスタンスのうちに、各スレッドが自分で A-ABORT して抜ける。
+    // 接続を確立している途中の接続だけは、確立するか諦める (PacsConnection::Open の待ち時間) まで待つ
+    void Cancel() {
+        cancelled = true;
+        if (thread.joinable()) thread.join();
+        std::lock_guard<std::mutex> lock(errorMtx);
+        error.clear();
+    }
+
+    // int16 に収まらない画素を丸めたスライスの数 (VolumeLoader::ClippedSlices と同じ)
+    int ClippedSlices() const { return clippedSlices.load(); }
+
+    // 取得中・取得後に失敗した接続の理由 (失敗していなければ空。次の Start / Cancel で消える)
+    std::string Error() {
+        std::lock_guard<std::mutex> lock(errorMtx);
+        return error;
+    }
+};
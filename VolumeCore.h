@@ -0,0 +1,2608 @@
+#pragma once
+// ボリューム保持・断面描画パイプライン (UI / DCMTK に依存しない部分)
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <type_traits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <list>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <memory>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// --- スレッドプール ---
+// ジョブ列はリングバッファ、ParallelFor の進行状態は使い回すので、
+// 定常状態 (同じ規模の処理の繰り返し) ではヒープを確保しない。
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::vector<std::function<void()>> ring; // [head, head + queued) が待ち行列
+    size_t head = 0, queued = 0;
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool stopping = false;
+
+    // ParallelFor 1 回分。手伝いのジョブが全員抜けるまで (refs が 0 になるまで) 再利用しない
+    struct ForState {
+        std::atomic<int> next{0}, done{0}, refs{0};
+        int count = 0;
+        void (*invoke)(void* fn, int i) = nullptr;
+        void* fn = nullptr;
+        std::mutex m;
+        std::condition_variable cv;
+    };
+    std::mutex stateMtx;
+    std::vector<std::unique_ptr<ForState>> states;
+    std::vector<ForState*> freeStates;
+
+    ForState* AcquireState() {
+        std::lock_guard<std::mutex> lock(stateMtx);
+        if (freeStates.empty()) {
+            states.push_back(std::make_unique<ForState>());
+            return states.back().get();
+        }
+        ForState* st = freeStates.back();
+        freeStates.pop_back();
+        return st;
+    }
+
+    void ReleaseState(ForState* st) {
+        if (st->refs.fetch_sub(1) != 1) return;
+        std::lock_guard<std::mutex> lock(stateMtx);
+        freeStates.push_back(st);
+    }
+
+    static void RunFor(ForState* st) {
+        for (int i; (i = st->next.fetch_add(1)) < st->count; ) {
+            st->invoke(st->fn, i);
+            if (st->done.fetch_add(1) + 1 == st->count) {
+                std::lock_guard<std::mutex> lock(st->m);
+                st->cv.notify_all();
+            }
+        }
+    }
+
+public:
+    explicit ThreadPool(unsigned n = std::thread::hardware_concurrency()) {
+        if (n == 0) n = 1;
+        ring.resize(64);
+        // 手伝いが抜けきる前に次の ParallelFor が来ても足りるよう、状態は少し多めに用意しておく
+        states.reserve(64); freeStates.reserve(64);
+        for (unsigned i = 0; i < n + 8; ++i) {
+            states.push_back(std::make_unique<ForState>());
+            freeStates.push_back(states.back().get());
+        }
+        for (unsigned i = 0; i < n; ++i) {
+            workers.emplace_back([this]() {
+                for (;;) {
+                    std::function<void()> job;
+                    {
+                        std::unique_lock<std::mutex> lock(mtx);
+                        cv.wait(lock, [this]{ return stopping || queued > 0; });
+                        if (stopping && queued == 0) return;
+                        job = std::move(ring[head]); ring[head] = nullptr;
+                        head = (head + 1) % ring.size(); --queued;
+                    }
+                    job();
+                }
+            });
+        }
+    }
+
+    ~ThreadPool() {
+        { std::lock_guard<std::mutex> lock(mtx); stopping = true; }
+        cv.notify_all();
+        for (auto& t : workers) t.join();
+    }
+
+    static ThreadPool& Shared() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    unsigned Size() const { return (unsigned)workers.size(); }
+
+    void Submit(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (queued == ring.size()) {
+                std::vector<std::function<void()>> grown(ring.size() * 2);
+                for (size_t i = 0; i < queued; ++i) grown[i] = std::move(ring[(head + i) % ring.size()]);
+                ring.swap(grown);
+                head = 0;
+            }
+            ring[(head + queued) % ring.size()] = std::move(job);
+            ++queued;
+        }
+        cv.notify_one();
+    }
+
+    // [0, count) を全ワーカー + 呼び出し元スレッドで分担する。
+    // 完了数で待つので、ワーカー内から呼んでもデッドロックしない。
+    // 手伝いのジョブは状態へのポインタだけを持つので std::function の内部バッファに収まる。
+    template<typename F>
+    void ParallelFor(int count, F&& fn) {
+        if (count <= 0) return;
+        using Fn = std::remove_reference_t<F>;
+        ForState* st = AcquireState();
+        st->next = 0; st->done = 0; st->count = count;
+        st->fn = const_cast<void*>(static_cast<const void*>(&fn));
+        st->invoke = [](void* f, int i) { (*static_cast<Fn*>(f))(i); };
+        unsigned helpers = std::min<unsigned>(Size(), (unsigned)count - 1);
+        st->refs = (int)helpers + 1;
+        for (unsigned i = 0; i < helpers; ++i) Submit([this, st]() { RunFor(st); ReleaseState(st); });
+        RunFor(st);
+        {
+            std::unique_lock<std::mutex> lock(st->m);
+            st->cv.wait(lock, [st, count]{ return st->done.load() == count; });
+        }
+        ReleaseState(st);
+    }
+};
+
+// --- 区間計測とトレース出力 ---
+// 記録中だけ区間を貯め、Chrome のトレース形式 (chrome://tracing, Perfetto) で書き出す。
+// 記録していないときの ScopedTimer は atomic を 1 回読むだけ。名前は文字列リテラルを渡す。
+class Profiler {
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t MAX_EVENTS = 1 << 20; // 約 32MB。超えた分は捨てて数だけ残す
+
+private:
+    struct Event { const char* name; uint32_t tid; int64_t startNs, durNs; };
+    std::atomic<bool> tracing{false};
+    std::mutex mtx;
+    std::vector<Event> events;
+    size_t dropped = 0;
+    Clock::time_point origin = Clock::now();
+
+    static uint32_t ThreadIndex() {
+        static std::atomic<uint32_t> next{1};
+        thread_local uint32_t id = next.fetch_add(1);
+        return id;
+    }
+
+public:
+    static Profiler& Get() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    bool Tracing() const { return tracing.load(std::memory_order_relaxed); }
+
+    // 記録を始めるたびに前回の区間は捨てる
+    void SetTracing(bool on) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (on && !tracing) { events.clear(); dropped = 0; origin = Clock::now(); }
+        tracing = on;
+    }
+
+    void Record(const char* name, Clock::time_point start, Clock::time_point end) {
+        if (!Tracing()) return;
+        uint32_t tid = ThreadIndex();
+        std::lock_guard<std::mutex> lock(mtx);
+        if (events.size() >= MAX_EVENTS) { ++dropped; return; }
+        int64_t s = std::chrono::duration_cast<std::chrono::nanoseconds>(start - origin).count();
+        int64_t d = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        events.push_back({ name, tid, s, d });
+    }
+
+    size_t EventCount() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return events.size();
+    }
+
+    size_t Dropped() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return dropped;
+    }
+
+    // 完了イベント ("ph":"X") の配列として書く。時刻の単位はマイクロ秒
+    bool WriteChromeTrace(const std::string& path) {
+        std::vector<Event> snapshot;
+        { std::lock_guard<std::mutex> lock(mtx); snapshot = events; }
+        FILE* f = std::fopen(path.c_str(), "wb");
+        if (!f) return false;
+        std::fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        for (size_t i = 0; i < snapshot.size(); ++i) {
+            const Event& e = snapshot[i];
+            std::fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                         i ? ",\n" : "", e.name, e.tid, e.startNs / 1000.0, e.durNs / 1000.0);
+        }
+        std::fprintf(f, "\n]}\n");
+        return std::fclose(f) == 0;
+    }
+};
+
+class ScopedTimer {
+    const char* name;
+    Profiler::Clock::time_point start;
+    bool active;
+
+public:
+    explicit ScopedTimer(const char* n) : name(n), active(Profiler::Get().Tracing()) {
+        if (active) start = Profiler::Clock::now();
+    }
+    ~ScopedTimer() {
+        if (active) Profiler::Get().Record(name, start, Profiler::Clock::now());
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+// --- スライス単位のページング ---
+// メモリに載らないボリューム用。Axial スライス 1 枚を 1 ページとし、予算内で LRU に保持する。
+// 足りないページは共有プールで非同期に展開し、届いたら onReady (ワーカースレッド) で知らせる。
+class SlicePager {
+public:
+    using Page = std::shared_ptr<const std::vector<int16_t>>;
+    using Fetch = std::function<bool(int z, int16_t* dst)>;
+
+    SlicePager(int w, int h, int d, uint64_t budgetBytes, Fetch fetchFn, std::function<void(int)> onReadyFn)
+        : width(w), height(h), pages(d), lruPos(d), inFlight(d, 0),
+          fetch(std::move(fetchFn)), onReady(std::move(onReadyFn)) {
+        SetBudget(budgetBytes);
+    }
+
+    // 実行中の展開ジョブは this を参照しているので、全て終わるまで待つ
+    ~SlicePager() {
+        std::unique_lock<std::mutex> lock(mtx);
+        closing = true;
+        idle.wait(lock, [this]{ return pending == 0; });
+    }
+
+    void SetBudget(uint64_t bytes) {
+        std::lock_guard<std::mutex> lock(mtx);
+        capacity = (size_t)std::max<uint64_t>(1, bytes / PageBytes());
+        while (resident > capacity) EvictOne();
+    }
+
+    // 常駐していれば返す (LRU の先頭へ)。読み込みは行わない
+    Page Get(int z) {
+        std::lock_guard<std::mutex> lock(mtx);
+        Page p = pages[z];
+        if (p) lru.splice(lru.begin(), lru, lruPos[z]);
+        return p;
+    }
+
+    // mayEvict = false のときは空きがある場合だけ読む (全スライスを舐める断面で追い出し合わないように)
+    void Request(int z, bool mayEvict) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (closing || pages[z] || inFlight[z]) return;
+            if (!mayEvict && resident + pending >= capacity) return;
+            inFlight[z] = 1;
+            ++pending;
+        }
+        ThreadPool::Shared().Submit([this, z]() { Load(z); });
+    }
+
+    void Put(int z, const int16_t* src) {
+        auto page = std::make_shared<std::vector<int16_t>>(src, src + (size_t)width * height);
+        std::lock_guard<std::mutex> lock(mtx);
+        Insert(z, std::move(page));
+    }
+
+    int Resident() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return (int)resident;
+    }
+
+private:
+    int width, height;
+    mutable std::mutex mtx;
+    std::condition_variable idle;
+    std::vector<Page> pages;
+    std::list<int> lru; // 先頭が最近使ったページ
+    std::vector<std::list<int>::iterator> lruPos;
+    std::vector<char> inFlight;
+    size_t capacity = 1, resident = 0, pending = 0;
+    bool closing = false;
+    Fetch fetch;
+    std::function<void(int)> onReady;
+
+    uint64_t PageBytes() const { return std::max<uint64_t>(1, (uint64_t)width * height * sizeof(int16_t)); }
+
+    void Load(int z) {
+        bool skip;
+        { std::lock_guard<std::mutex> lock(mtx); skip = closing; }
+        std::shared_ptr<std::vector<int16_t>> page;
+        if (!skip) {
+            page = std::make_shared<std::vector<int16_t>>((size_t)width * height);
+            if (!fetch(z, page->data())) page.reset();
+        }
+        bool ok = false;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            inFlight[z] = 0;
+            if (page && !closing) { Insert(z, std::move(page)); ok = true; }
+        }
+        if (ok && onReady) onReady(z);
+        std::lock_guard<std::mutex> lock(mtx);
+        --pending;
+        idle.notify_all();
+    }
+
+    void Insert(int z, Page page) {
+        if (pages[z]) {
+            lru.splice(lru.begin(), lru, lruPos[z]);
+        } else {
+            while (resident >= capacity) EvictOne();
+            lru.push_front(z);
+            lruPos[z] = lru.begin();
+            ++resident;
+        }
+        pages[z] = std::move(page);
+    }
+
+    // 読み出し中のページは shared_ptr で保持されているので、ここで外しても安全
+    void EvictOne() {
+        int z = lru.back();
+        lru.pop_back();
+        pages[z].reset();
+        --resident;
+    }
+};
+
+// --- ブリック圧縮 ---
+// 16^3 ブリックを z 方向の 16 枚 (各 16x16) に分け、1 枚ごとに最小値を基準とした差分を最小のビット幅で詰める。
+// 並び: 基準値 int16 x 16 | ビット幅 uint8 x 16 | 1 枚目の語 | 2 枚目の語 | ...
+// 256 画素 x b ビットはちょうど 4b 語 (64 ビット) なので、どの画素も位置から直接読める。
+// 空気や一様な領域は 0 ビット (基準値だけ) になる。
+struct PackedPlane {
+    int16_t base = 0;
+    int bits = 0;
+    const uint8_t* words = nullptr;
+
+    PackedPlane(const uint8_t* blob, int lz) {
+        std::memcpy(&base, blob + 2 * lz, sizeof(base));
+        bits = blob[32 + lz];
+        size_t offset = 48;
+        for (int q = 0; q < lz; ++q) offset += 32 * (size_t)blob[32 + q];
+        words = blob + offset;
+    }
+
+    // 面内の位置 first, first + stride, ... の count 画素を out へ (outStride 間隔で) 展開する
+    void Unpack(int first, int count, int stride, int16_t* out, ptrdiff_t outStride = 1) const {
+        if (bits == 0) {
+            for (int k = 0; k < count; ++k) out[k * outStride] = base;
+            return;
+        }
+        uint32_t mask = (1u << bits) - 1;
+        if (stride == 1 && first == 0 && count == 256) {
+            // 面全体は語を順に読む
+            const uint8_t* p = words;
+            uint64_t acc = 0;
+            int avail = 0;
+            for (int k = 0; k < 256; ++k) {
+                uint32_t v;
+                if (avail >= bits) {
+                    v = (uint32_t)acc & mask;
+                    acc >>= bits; avail -= bits;
+                } else {
+                    uint64_t w;
+                    std::memcpy(&w, p, 8);
+                    p += 8;
+                    v = (uint32_t)((acc | (w << avail)) & mask);
+                    int used = bits - avail;
+                    acc = used < 64 ? w >> used : 0;
+                    avail = 64 - used;
+                }
+                out[k * outStride] = (int16_t)(uint16_t)((uint16_t)base + v);
+            }
+            return;
+        }
+        for (int k = 0; k < count; ++k) {
+            uint32_t bit = (uint32_t)(first + k * stride) * bits, shift = bit & 63;
+            uint64_t w;
+            std::memcpy(&w, words + (bit >> 6) * 8, 8);
+            uint64_t v = w >> shift;
+            if (shift + bits > 64) {
+                std::memcpy(&w, words + ((bit >> 6) + 1) * 8, 8);
+                v |= w << (64 - shift);
+            }
+            out[k * outStride] = (int16_t)(uint16_t)((uint16_t)base + (uint32_t)(v & mask));
+        }
+    }
+};
+
+inline void PackBrick(const int16_t* src, std::vector<uint8_t>& out) {
+    uint8_t header[48];
+    int bits[16];
+    size_t payload = 0;
+    for (int lz = 0; lz < 16; ++lz) {
+        const int16_t* plane = src + lz * 256;
+        auto [lo, hi] = std::minmax_element(plane, plane + 256);
+        uint32_t range = (uint32_t)(*hi - *lo);
+        int b = 0;
+        while (b < 16 && (range >> b) != 0) ++b;
+        bits[lz] = b;
+        std::memcpy(header + 2 * lz, lo, sizeof(int16_t));
+        header[32 + lz] = (uint8_t)b;
+        payload += 32 * (size_t)b;
+    }
+    out.assign(48 + payload, 0);
+    std::memcpy(out.data(), header, sizeof(header));
+    uint8_t* words = out.data() + 48;
+    for (int lz = 0; lz < 16; ++lz) {
+        int b = bits[lz];
+        if (b == 0) continue;
+        const int16_t* plane = src + lz * 256;
+        int16_t base;
+        std::memcpy(&base, header + 2 * lz, sizeof(base));
+        // 下位ビットから順に溜め、64 ビットたまるごとに書き出す
+        uint64_t acc = 0;
+        int filled = 0;
+        for (int i = 0; i < 256; ++i) {
+            uint64_t v = (uint16_t)(plane[i] - base);
+            acc |= v << filled;
+            filled += b;
+            if (filled >= 64) {
+                std::memcpy(words, &acc, 8);
+                words += 8;
+                filled -= 64;
+                acc = filled ? v >> (b - filled) : 0;
+            }
+        }
+    }
+    out.shrink_to_fit();
+}
+
+inline void UnpackBrick(const uint8_t* blob, int16_t* out) {
+    for (int lz = 0; lz < 16; ++lz) PackedPlane(blob, lz).Unpack(0, 256, 1, out + lz * 256);
+}
+
+// 圧縮したブリックを 1 画素ずつ読む (斜め断面など) ときのスレッドごとの小さな展開済みキャッシュ。
+// serial はボリュームの中身ごとに振られる番号なので、古い中身や別のボリュームのブリックは当たらない
+struct BrickCache {
+    static constexpr int SLOTS = 256; // 16^3 x 256 = 2MB
+    struct Slot { uint64_t serial = 0; size_t brick = 0; };
+    Slot slots[SLOTS];
+    std::vector<int16_t> voxels;
+
+    const int16_t* Get(uint64_t serial, size_t brick, const uint8_t* blob) {
+        if (voxels.empty()) voxels.resize((size_t)SLOTS * 4096);
+        size_t i = (brick * 0x9E3779B1u >> 7) % SLOTS;
+        int16_t* dst = voxels.data() + i * 4096;
+        if (slots[i].serial != serial || slots[i].brick != brick) {
+            UnpackBrick(blob, dst);
+            slots[i] = { serial, brick };
+        }
+        return dst;
+    }
+
+    static BrickCache& Local() {
+        thread_local BrickCache cache;
+        return cache;
+    }
+};
+
+inline uint64_t NextPackSerial() {
+    static std::atomic<uint64_t> next{1};
+    return next.fetch_add(1);
+}
+
+// --- ボリューム格納 ---
+// 線形 (z, y, x 順) か、16^3 ブリックを Morton 順に並べたブリック形式で保持する。
+// 圧縮形式はブリックごとに PackBrick で詰めて持ち、断面は必要な画素だけをその場で展開する。
+// 圧縮形式への書き込みはブリックを詰め直すので遅く、読み出しと並行してはいけない (読み込みは非圧縮で行って後から変換する)。
+// メモリに載らないときは SlicePager から必要なスライスだけを引く (ページング形式)。
+// 断面の取り出しは ExtractPlane に集約し、描画側はレイアウトを意識しない。
+class Volume {
+public:
+    enum Layout { LAYOUT_LINEAR, LAYOUT_BRICKED, LAYOUT_PAGED, LAYOUT_COMPRESSED };
+    static constexpr int BRICK = 16;
+    static constexpr int BRICK_VOXELS = BRICK * BRICK * BRICK;
+
+    Volume() = default;
+    Volume(Volume&& o) noexcept { *this = std::move(o); }
+    Volume& operator=(Volume&& o) noexcept {
+        if (this == &o) return *this;
+        owned = std::move(o.owned); brickSlot = std::move(o.brickSlot); mapping = std::move(o.mapping); pager = std::move(o.pager);
+        packed = std::move(o.packed); packSerial = o.packSerial;
+        voxels = o.voxels; voxelCount = o.voxelCount;
+        width = o.width; height = o.height; depth = o.depth;
+        nbx = o.nbx; nby = o.nby; nbz = o.nbz; layout = o.layout;
+        o.Clear();
+        return *this;
+    }
+    Volume(const Volume&) = delete;
+    Volume& operator=(const Volume&) = delete;
+
+    void Reset(int w, int h, int d, Layout l) {
+        width = w; height = h; depth = d; layout = l;
+        nbx = (w + BRICK - 1) / BRICK; nby = (h + BRICK - 1) / BRICK; nbz = (d + BRICK - 1) / BRICK;
+        mapping.reset();
+        pager.reset(); // ページングのボリュームから作り直すときに、前のページ (予算いっぱいまで常駐) を残さない
+        packed.clear();
+        if (layout == LAYOUT_COMPRESSED) {
+            std::vector<int16_t> zero(BRICK_VOXELS, 0);
+            packed.resize((size_t)nbx * nby * nbz);
+            for (auto& b : packed) PackBrick(zero.data(), b);
+            packSerial = NextPackSerial();
+            brickSlot.clear();
+            owned.clear(); owned.shrink_to_fit();
+            voxels = nullptr; voxelCount = (size_t)w * h * d;
+            return;
+        }
+        if (layout == LAYOUT_BRICKED) {
+            BuildBrickTable();
+            owned.assign((size_t)nbx * nby * nbz * BRICK_VOXELS, 0);
+        } else {
+            brickSlot.clear();
+            owned.assign((size_t)w * h * d, 0);
+        }
+        voxels = owned.data(); voxelCount = owned.size();
+    }
+
+    // 外部メモリ (キャッシュの写像など) を線形レイアウトとしてそのまま参照する。
+    // keep が生きている間だけ data は有効。書き込みが必要になった時点で自前のバッファへ複製する。
+    void AdoptMapped(int w, int h, int d, const int16_t* data, std::shared_ptr<const void> keep) {
+        Clear();
+        width = w; height = h; depth = d; layout = LAYOUT_LINEAR;
+        nbx = (w + BRICK - 1) / BRICK; nby = (h + BRICK - 1) / BRICK; nbz = (d + BRICK - 1) / BRICK;
+        mapping = std::move(keep);
+        voxels = const_cast<int16_t*>(data); voxelCount = (size_t)w * h * d;
+    }
+
+    // 画素は保持せず、ExtractPlane のたびに常駐しているページから切り出す
+    void ResetPaged(int w, int h, int d, std::shared_ptr<SlicePager> p) {
+        Clear();
+        width = w; height = h; depth = d; layout = LAYOUT_PAGED;
+        pager = std::move(p);
+    }
+
+    void Clear() {
+        owned.clear(); owned.shrink_to_fit(); brickSlot.clear(); mapping.reset(); pager.reset();
+        packed.clear(); packed.shrink_to_fit();
+        voxels = nullptr; voxelCount = 0;
+        width = height = depth = 0;
+    }
+
+    bool empty() const { return voxelCount == 0 && !pager; }
+    bool IsMapped() const { return mapping != nullptr; }
+    bool IsPaged() const { return layout == LAYOUT_PAGED; }
+    bool IsCompressed() const { return layout == LAYOUT_COMPRESSED; }
+    SlicePager* Pager() const { return pager.get(); }
+    int Width() const { return width; }
+    int Height() const { return height; }
+    int Depth() const { return depth; }
+    Layout GetLayout() const { return layout; }
+
+    // 実際に保持している画素のバイト数 (圧縮形式は詰めた後の大きさ、ページング形式は 0)
+    uint64_t StoredBytes() const {
+        if (layout == LAYOUT_PAGED) return 0;
+        if (layout != LAYOUT_COMPRESSED) return (uint64_t)voxelCount * sizeof(int16_t);
+        uint64_t total = packed.size() * sizeof(packed[0]);
+        for (const auto& b : packed) total += b.capacity();
+        return total;
+    }
+
+    // 線形レイアウトのときだけ、スライスへ直接書き込めるポインタを返す
+    int16_t* SliceData(int z) {
+        if (layout != LAYOUT_LINEAR) return nullptr;
+        Detach();
+        return voxels + (size_t)z * width * height;
+    }
+
+    const int16_t* SliceData(int z) const {
+        if (layout != LAYOUT_LINEAR) return nullptr;
+        return voxels + (size_t)z * width * height;
+    }
+
+    void WriteSlice(int z, const int16_t* src) {
+        if (layout == LAYOUT_PAGED) { pager->Put(z, src); return; }
+        if (layout == LAYOUT_COMPRESSED) { WriteSliceCompressed(z, src); return; }
+        Detach();
+        if (layout == LAYOUT_LINEAR) {
+            std::copy(src, src + (size_t)width * height, SliceData(z));
+            return;
+        }
+        int bz = z / BRICK, lz = z % BRICK;
+        for (int y = 0; y < height; ++y) {
+            int by = y / BRICK, ly = y % BRICK;
+            for (int bx = 0; bx < nbx; ++bx) {
+                int x0 = bx * BRICK, n = std::min(BRICK, width - x0);
+                int16_t* dst = voxels + BrickBase(bx, by, bz) + (lz * BRICK + ly) * BRICK;
+                std::copy(src + (size_t)y * width + x0, src + (size_t)y * width + x0 + n, dst);
+            }
+        }
+    }
+
+    int16_t At(int x, int y, int z) const {
+        if (layout == LAYOUT_PAGED) {
+            SlicePager::Page p = pager->Get(z);
+            return p ? (*p)[(size_t)y * width + x] : PAGE_FILL;
+        }
+        if (layout == LAYOUT_LINEAR) return voxels[((size_t)z * height + y) * width + x];
+        return BrickVoxels(x / BRICK, y / BRICK, z / BRICK)[((z % BRICK) * BRICK + (y % BRICK)) * BRICK + (x % BRICK)];
+    }
+
+    // ブリック形式・圧縮形式で、ブリック (bx, by, bz) の 16^3 画素の先頭を返す (線形・ページング形式は null)。
+    // 圧縮形式はスレッドごとの BrickCache 上なので、同じスレッドで別のブリックを読むまでしか有効でない
+    const int16_t* BrickVoxels(int bx, int by, int bz) const {
+        if (layout == LAYOUT_BRICKED) return voxels + BrickBase(bx, by, bz);
+        if (layout != LAYOUT_COMPRESSED) return nullptr;
+        size_t brick = BrickIndex(bx, by, bz);
+        return BrickCache::Local().Get(packSerial, brick, packed[brick].data());
+    }
+
+    // 線形レイアウトの z の位置に空のスライスを差し込み、その書き込み先を返す。
+    // 末尾への追加なら既存のスライスは動かず、バッファの伸長も償却で済む
+    int16_t* InsertSlice(int z) {
+        if (layout != LAYOUT_LINEAR || z < 0 || z > depth) return nullptr;
+        Detach();
+        size_t plane = (size_t)width * height;
+        owned.insert(owned.begin() + (ptrdiff_t)(z * plane), plane, 0);
+        ++depth;
+        nbz = (depth + BRICK - 1) / BRICK;
+        voxels = owned.data(); voxelCount = owned.size();
+        return voxels + (size_t)z * plane;
+    }
+
+    // 中身を保ったままレイアウトを切り替える
+    void SetLayout(Layout l) {
+        if (l == layout || empty() || layout == LAYOUT_PAGED || l == LAYOUT_PAGED) return;
+        ScopedTimer timer("SetLayout");
+        if (l == LAYOUT_COMPRESSED || layout == LAYOUT_COMPRESSED) { ConvertByBricks(l); return; }
+        Volume converted;
+        converted.Reset(width, height, depth, l);
+        std::vector<int16_t> slice((size_t)width * height);
+        for (int z = 0; z < depth; ++z) {
+            ExtractPlane(0, z, slice.data());
+            converted.WriteSlice(z, slice.data());
+        }
+        *this = std::move(converted);
+    }
+
+    // viewType: 0=Axial (w x h), 1=Coronal (w x d), 2=Sagittal (h x d)
+    void PlaneSize(int viewType, int& w, int& h) const {
+        if (viewType == 0) { w = width; h = height; }
+        else if (viewType == 1) { w = width; h = depth; }
+        else { w = height; h = depth; }
+    }
+
+    void ExtractPlane(int viewType, int index, int16_t* out) const {
+        if (layout == LAYOUT_PAGED) ExtractPaged(viewType, index, out);
+        else if (layout == LAYOUT_LINEAR) ExtractLinear(viewType, index, out);
+        else if (layout == LAYOUT_COMPRESSED) ExtractCompressed(viewType, index, out);
+        else ExtractBricked(viewType, index, out);
+    }
+
+private:
+    std::vector<int16_t> owned;
+    std::vector<std::vector<uint8_t>> packed; // 圧縮形式のブリック ((bz, by, bx) の線形番号順)
+    uint64_t packSerial = 0;                  // 圧縮形式の中身の番号 (BrickCache の照合用)
+    int16_t* voxels = nullptr;            // owned.data() か写像先
+    size_t voxelCount = 0;
+    std::shared_ptr<const void> mapping;  // 写像を参照している間の寿命管理
+    std::shared_ptr<SlicePager> pager;
+    static constexpr int16_t PAGE_FILL = -2048; // 未着のページ (空気より暗く、補間のにじみも小さい値)
+    std::vector<uint32_t> brickSlot; // (bz, by, bx) の線形番号 -> 格納順 (Morton 順)
+    int width = 0, height = 0, depth = 0;
+    int nbx = 0, nby = 0, nbz = 0;
+    Layout layout = LAYOUT_LINEAR;
+
+    void Detach() {
+        if (!mapping) return;
+        owned.assign(voxels, voxels + voxelCount);
+        voxels = owned.data();
+        mapping.reset();
+    }
+
+    size_t BrickIndex(int bx, int by, int bz) const { return ((size_t)bz * nby + by) * nbx + bx; }
+
+    size_t BrickBase(int bx, int by, int bz) const {
+        return (size_t)brickSlot[BrickIndex(bx, by, bz)] * BRICK_VOXELS;
+    }
+
+    // ブリック 1 個分 (16^3) を取り出す。ボリュームの外にはみ出す部分は端の画素を繰り返す (詰めたときにビット幅が増えないように)
+    void ReadBrick(int bx, int by, int bz, int16_t* dst) const {
+        if (layout == LAYOUT_COMPRESSED) { UnpackBrick(packed[BrickIndex(bx, by, bz)].data(), dst); return; }
+        int x0 = bx * BRICK, y0 = by * BRICK, z0 = bz * BRICK;
+        int nx = std::min(BRICK, width - x0);
+        for (int lz = 0; lz < BRICK; ++lz) {
+            int z = std::min(z0 + lz, depth - 1);
+            for (int ly = 0; ly < BRICK; ++ly) {
+                int y = std::min(y0 + ly, height - 1);
+                const int16_t* src = layout == LAYOUT_LINEAR ? voxels + ((size_t)z * height + y) * width + x0
+                                   : voxels + BrickBase(bx, by, z / BRICK) + ((z % BRICK) * BRICK + (y % BRICK)) * BRICK;
+                int16_t* row = dst + (lz * BRICK + ly) * BRICK;
+                std::copy(src, src + nx, row);
+                std::fill(row + nx, row + BRICK, row[nx - 1]);
+            }
+        }
+    }
+
+    // 別々のブリックへは並行して書いてよい
+    void WriteBrick(int bx, int by, int bz, const int16_t* src) {
+        if (layout == LAYOUT_COMPRESSED) { PackBrick(src, packed[BrickIndex(bx, by, bz)]); return; }
+        if (layout == LAYOUT_BRICKED) { std::copy(src, src + BRICK_VOXELS, voxels + BrickBase(bx, by, bz)); return; }
+        int x0 = bx * BRICK, y0 = by * BRICK, z0 = bz * BRICK;
+        int nx = std::min(BRICK, width - x0), ny = std::min(BRICK, height - y0), nz = std::min(BRICK, depth - z0);
+        for (int lz = 0; lz < nz; ++lz)
+            for (int ly = 0; ly < ny; ++ly) {
+                const int16_t* row = src + (lz * BRICK + ly) * BRICK;
+                std::copy(row, row + nx, voxels + ((size_t)(z0 + lz) * height + y0 + ly) * width + x0);
+            }
+    }
+
+    // 圧縮形式との変換はブリック単位で、ブリックの行ごとに共有プールで並行して行う
+    void ConvertByBricks(Layout l) {
+        Volume converted;
+        converted.Reset(width, height, depth, l);
+        ThreadPool::Shared().ParallelFor(nbz * nby, [&](int row) {
+            thread_local std::vector<int16_t> buf;
+            buf.resize(BRICK_VOXELS);
+            int bz = row / nby, by = row % nby;
+            for (int bx = 0; bx < nbx; ++bx) {
+                ReadBrick(bx, by, bz, buf.data());
+                converted.WriteBrick(bx, by, bz, buf.data());
+            }
+        });
+        *this = std::move(converted);
+    }
+
+    // 書き込む z を含むブリックの段を展開し、差し替えてから詰め直す
+    void WriteSliceCompressed(int z, const int16_t* src) {
+        int bz = z / BRICK, lz = z % BRICK;
+        std::vector<int16_t> buf(BRICK_VOXELS);
+        for (int by = 0; by < nby; ++by)
+            for (int bx = 0; bx < nbx; ++bx) {
+                std::vector<uint8_t>& blob = packed[BrickIndex(bx, by, bz)];
+                UnpackBrick(blob.data(), buf.data());
+                int x0 = bx * BRICK, nx = std::min(BRICK, width - x0);
+                for (int ly = 0; ly < BRICK; ++ly) {
+                    int y = std::min(by * BRICK + ly, height - 1);
+                    int16_t* row = buf.data() + (lz * BRICK + ly) * BRICK;
+                    std::copy(src + (size_t)y * width + x0, src + (size_t)y * width + x0 + nx, row);
+                    std::fill(row + nx, row + BRICK, row[nx - 1]);
+                }
+                PackBrick(buf.data(), blob);
+            }
+        packSerial = NextPackSerial();
+    }
+
+    static uint32_t Part1By2(uint32_t v) {
+        v &= 0x3ff;
+        v = (v | (v << 16)) & 0x030000ff;
+        v = (v | (v << 8)) & 0x0300f00f;
+        v = (v | (v << 4)) & 0x030c30c3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    }
+
+    void BuildBrickTable() {
+        size_t count = (size_t)nbx * nby * nbz;
+        std::vector<std::pair<uint32_t, uint32_t>> codes(count);
+        for (int bz = 0; bz < nbz; ++bz)
+            for (int by = 0; by < nby; ++by)
+                for (int bx = 0; bx < nbx; ++bx) {
+                    uint32_t idx = (uint32_t)(((size_t)bz * nby + by) * nbx + bx);
+                    codes[idx] = { Part1By2(bx) | (Part1By2(by) << 1) | (Part1By2(bz) << 2), idx };
+                }
+        std::sort(codes.begin(), codes.end());
+        brickSlot.assign(count, 0);
+        for (size_t slot = 0; slot < count; ++slot) brickSlot[codes[slot].second] = (uint32_t)slot;
+    }
+
+    void ExtractLinear(int viewType, int index, int16_t* out) const {
+        size_t plane = (size_t)width * height;
+        if (viewType == 0) {
+            const int16_t* src = voxels + (size_t)index * plane;
+            std::copy(src, src + plane, out);
+        } else if (viewType == 1) {
+            for (int z = 0; z < depth; ++z) {
+                const int16_t* src = voxels + (size_t)z * plane + (size_t)index * width;
+                std::copy(src, src + width, out + (size_t)z * width);
+            }
+        } else {
+            for (int z = 0; z < depth; ++z) {
+                const int16_t* src = voxels + (size_t)z * plane + index;
+                for (int y = 0; y < height; ++y) out[(size_t)z * height + y] = src[(size_t)y * width];
+            }
+        }
+    }
+
+    // 常駐していない部分は PAGE_FILL で埋めて読み込みを依頼し、届いたら描き直してもらう。
+    // Axial は表示中の 1 枚なので追い出してでも読み、Coronal/Sagittal は空きの範囲でだけ埋める。
+    void ExtractPaged(int viewType, int index, int16_t* out) const {
+        if (viewType == 0) {
+            if (SlicePager::Page p = pager->Get(index)) std::copy(p->begin(), p->end(), out);
+            else { std::fill(out, out + (size_t)width * height, PAGE_FILL); pager->Request(index, true); }
+            return;
+        }
+        int n = (viewType == 1) ? width : height;
+        for (int z = 0; z < depth; ++z) {
+            int16_t* dst = out + (size_t)z * n;
+            SlicePager::Page p = pager->Get(z);
+            if (!p) { std::fill(dst, dst + n, PAGE_FILL); pager->Request(z, false); continue; }
+            const int16_t* src = p->data();
+            if (viewType == 1) std::copy(src + (size_t)index * width, src + (size_t)index * width + width, dst);
+            else for (int y = 0; y < height; ++y) dst[y] = src[(size_t)y * width + index];
+        }
+    }
+
+    // 断面と交わるブリックだけを順に読むので、どの向きでも連続した 8KB 単位のアクセスになる
+    void ExtractBricked(int viewType, int index, int16_t* out) const {
+        const int16_t* base = voxels;
+        if (viewType == 0) {
+            int bz = index / BRICK, lz = index % BRICK;
+            for (int by = 0; by < nby; ++by)
+                for (int bx = 0; bx < nbx; ++bx) {
+                    const int16_t* brick = base + BrickBase(bx, by, bz) + lz * BRICK * BRICK;
+                    int x0 = bx * BRICK, nx = std::min(BRICK, width - x0);
+                    int y0 = by * BRICK, ny = std::min(BRICK, height - y0);
+                    for (int ly = 0; ly < ny; ++ly)
+                        std::copy(brick + ly * BRICK, brick + ly * BRICK + nx, out + (size_t)(y0 + ly) * width + x0);
+                }
+        } else if (viewType == 1) {
+            int by = index / BRICK, ly = index % BRICK;
+            for (int bz = 0; bz < nbz; ++bz)
+                for (int bx = 0; bx < nbx; ++bx) {
+                    const int16_t* brick = base + BrickBase(bx, by, bz) + ly * BRICK;
+                    int x0 = bx * BRICK, nx = std::min(BRICK, width - x0);
+                    int z0 = bz * BRICK, nz = std::min(BRICK, depth - z0);
+                    for (int lz = 0; lz < nz; ++lz)
+                        std::copy(brick + lz * BRICK * BRICK, brick + lz * BRICK * BRICK + nx, out + (size_t)(z0 + lz) * width + x0);
+                }
+        } else {
+            int bx = index / BRICK, lx = index % BRICK;
+            for (int bz = 0; bz < nbz; ++bz)
+                for (int by = 0; by < nby; ++by) {
+                    const int16_t* brick = base + BrickBase(bx, by, bz) + lx;
+                    int y0 = by * BRICK, ny = std::min(BRICK, height - y0);
+                    int z0 = bz * BRICK, nz = std::min(BRICK, depth - z0);
+                    for (int lz = 0; lz < nz; ++lz) {
+                        int16_t* dst = out + (size_t)(z0 + lz) * height + y0;
+                        for (int ly = 0; ly < ny; ++ly) dst[ly] = brick[(lz * BRICK + ly) * BRICK];
+                    }
+                }
+        }
+    }
+
+    // 断面と交わるブリックの、断面上の画素だけを展開する (ブリック全体は展開しない)
+    void ExtractCompressed(int viewType, int index, int16_t* out) const {
+        if (viewType == 0) {
+            int bz = index / BRICK, lz = index % BRICK;
+            for (int by = 0; by < nby; ++by)
+                for (int bx = 0; bx < nbx; ++bx) {
+                    PackedPlane plane(packed[BrickIndex(bx, by, bz)].data(), lz);
+                    int x0 = bx * BRICK, nx = std::min(BRICK, width - x0);
+                    int y0 = by * BRICK, ny = std::min(BRICK, height - y0);
+                    for (int ly = 0; ly < ny; ++ly) plane.Unpack(ly * BRICK, nx, 1, out + (size_t)(y0 + ly) * width + x0);
+                }
+        } else if (viewType == 1) {
+            int by = index / BRICK, ly = index % BRICK;
+            for (int bz = 0; bz < nbz; ++bz)
+                for (int bx = 0; bx < nbx; ++bx) {
+                    const uint8_t* blob = packed[BrickIndex(bx, by, bz)].data();
+                    int x0 = bx * BRICK, nx = std::min(BRICK, width - x0);
+                    int z0 = bz * BRICK, nz = std::min(BRICK, depth - z0);
+                    for (int lz = 0; lz < nz; ++lz) PackedPlane(blob, lz).Unpack(ly * BRICK, nx, 1, out + (size_t)(z0 + lz) * width + x0);
+                }
+        } else {
+            int bx = index / BRICK, lx = index % BRICK;
+            for (int bz = 0; bz < nbz; ++bz)
+                for (int by = 0; by < nby; ++by) {
+                    const uint8_t* blob = packed[BrickIndex(bx, by, bz)].data();
+                    int y0 = by * BRICK, ny = std::min(BRICK, height - y0);
+                    int z0 = bz * BRICK, nz = std::min(BRICK, depth - z0);
+                    for (int lz = 0; lz < nz; ++lz) PackedPlane(blob, lz).Unpack(lx, ny, BRICK, out + (size_t)(z0 + lz) * height + y0);
+                }
+        }
+    }
+};
+
+// --- 縮小ボリューム (操作中の軽量描画用) ---
+// 1/2, 1/4 に縮めた線形ボリューム (2x2x2 の平均)。操作中は表示サイズを下回らない最も粗い段から描き、
+// 操作が止まったら元のボリュームで描き直す。断面の画素数が行列サイズによらず表示サイズ程度に収まる。
+class VolumePyramid {
+public:
+    static constexpr int LEVELS = 2;
+    static constexpr int MIN_SIZE = 512; // これより小さい行列は元のままでも十分速い
+
+    // src は読むだけ。cancel が立つと途中で止めて false を返す
+    bool Build(const Volume& src, const std::atomic<bool>& cancel) {
+        const Volume* prev = &src;
+        for (int l = 0; l < LEVELS; ++l) {
+            Halve(*prev, levels[l], cancel);
+            if (cancel) return false;
+            prev = &levels[l];
+        }
+        return true;
+    }
+
+    // 断面が outW x outH を下回らない最も粗い段 (0 = 元のボリューム)
+    int SelectLevel(int viewType, int outW, int outH) const {
+        for (int l = LEVELS; l >= 1; --l) {
+            int w = 0, h = 0;
+            levels[l - 1].PlaneSize(viewType, w, h);
+            if (w >= outW && h >= outH) return l;
+        }
+        return 0;
+    }
+
+    uint64_t Bytes() const {
+        uint64_t total = 0;
+        for (const Volume& v : levels) total += (uint64_t)v.Width() * v.Height() * v.Depth() * sizeof(int16_t);
+        return total;
+    }
+
+    // 描画に使うボリュームを返し、slice をその段での位置に直す
+    const Volume& Source(const Volume& full, int viewType, int outW, int outH, int& slice, int& level) const {
+        level = SelectLevel(viewType, outW, outH);
+        if (level == 0) return full;
+        const Volume& v = levels[level - 1];
+        int count = viewType == 0 ? v.Depth() : (viewType == 1 ? v.Height() : v.Width());
+        slice = std::clamp(slice >> level, 0, count - 1);
+        return v;
+    }
+
+private:
+    Volume levels[LEVELS];
+
+    static void Halve(const Volume& src, Volume& dst, const std::atomic<bool>& cancel) {
+        int w = src.Width(), h = src.Height(), d = src.Depth();
+        int dw = (w + 1) / 2, dh = (h + 1) / 2, dd = (d + 1) / 2;
+        dst.Reset(dw, dh, dd, Volume::LAYOUT_LINEAR);
+        ThreadPool::Shared().ParallelFor(dd, [&](int z) {
+            if (cancel) return;
+            thread_local std::vector<int16_t> bufA, bufB;
+            auto slice = [&](int sz, std::vector<int16_t>& buf) {
+                if (const int16_t* p = src.SliceData(sz)) return p;
+                buf.resize((size_t)w * h);
+                src.ExtractPlane(0, sz, buf.data());
+                return (const int16_t*)buf.data();
+            };
+            const int16_t* a = slice(2 * z, bufA);
+            const int16_t* b = slice(std::min(2 * z + 1, d - 1), bufB);
+            int16_t* out = dst.SliceData(z);
+            for (int y = 0; y < dh; ++y) {
+                size_t r0 = (size_t)(2 * y) * w, r1 = (size_t)std::min(2 * y + 1, h - 1) * w;
+                for (int x = 0; x < dw; ++x) {
+                    int x0 = 2 * x, x1 = std::min(2 * x + 1, w - 1);
+                    int sum = a[r0 + x0] + a[r0 + x1] + a[r1 + x0] + a[r1 + x1]
+                            + b[r0 + x0] + b[r0 + x1] + b[r1 + x0] + b[r1 + x1];
+                    out[(size_t)y * dw + x] = (int16_t)((sum + 4) >> 3);
+                }
+            }
+        });
+    }
+};
+
+// --- 読み取り専用のメモリマップ ---
+class MappedFile {
+public:
+    static std::shared_ptr<MappedFile> Open(const std::string& path) {
+        std::shared_ptr<MappedFile> m(new MappedFile());
+        if (!m->Map(path)) return nullptr;
+        return m;
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (data) munmap(const_cast<uint8_t*>(data), size);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE, mapping = nullptr;
+#endif
+
+    MappedFile() = default;
+
+    bool Map(const std::string& path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER sz;
+        if (!GetFileSizeEx(file, &sz) || sz.QuadPart <= 0) return false;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) return false;
+        data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        size = (size_t)sz.QuadPart;
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        void* p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd); // 写像は fd を閉じても残る
+        if (p == MAP_FAILED) return false;
+        data = (const uint8_t*)p;
+        size = (size_t)st.st_size;
+#endif
+        return data != nullptr;
+    }
+};
+
+// --- 画素値ヒストグラム ---
+// int16 の全域を 1 値 1 ビンで数える。読み込みのワーカーはスレッドごとの部分ヒストグラムへ足し (取り合わない)、
+// 読み終えたら Summarize で合わせて、値の範囲と自動ウィンドウにまとめる
+struct ValueRange {
+    bool valid = false;
+    int minValue = 0, maxValue = 0; // 現れた値の最小・最大
+    int autoWL = 40, autoWW = 400;  // 両端 AUTO_WINDOW_TAIL ずつを除いた範囲
+};
+
+class ValueHistogram {
+public:
+    static constexpr int BINS = 65536;
+    static constexpr double AUTO_WINDOW_TAIL = 0.005;
+    static constexpr double PADDING_FRACTION = 0.01; // 最小値にこれ以上集まっていれば FOV の外の詰め物とみなす
+
+    // 読み込みを止めてから呼ぶ
+    void Clear() {
+        std::lock_guard<std::mutex> lock(mtx);
+        parts.clear(); freeParts.clear();
+    }
+
+    // 空いている部分ヒストグラムを 1 つ借りて数える (同時に呼んでよい)
+    void Add(const int16_t* px, size_t n) {
+        Part* part = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (freeParts.empty()) { parts.push_back(std::make_unique<Part>()); part = parts.back().get(); }
+            else { part = freeParts.back(); freeParts.pop_back(); }
+        }
+        uint32_t* counts = part->counts.data();
+        for (size_t i = 0; i < n; ++i) ++counts[px[i] + 32768];
+        std::lock_guard<std::mutex> lock(mtx);
+        freeParts.push_back(part);
+    }
+
+    // 読み込み中に呼ぶと、数えている最中の部分ヒストグラムは入らない (途中経過の目安になる)
+    ValueRange Summarize() const {
+        std::vector<uint64_t> total(BINS, 0);
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (const Part* part : freeParts) {
+                for (int i = 0; i < BINS; ++i) total[i] += part->counts[i];
+            }
+        }
+        ValueRange r;
+        int lo = 0, hi = BINS - 1;
+        while (lo < BINS && total[lo] == 0) ++lo;
+        while (hi > lo && total[hi] == 0) --hi;
+        if (lo == BINS) return r;
+        r.valid = true;
+        r.minValue = lo - 32768; r.maxValue = hi - 32768;
+        uint64_t count = 0;
+        for (int i = lo; i <= hi; ++i) count += total[i];
+        if (lo < hi && total[lo] > count * PADDING_FRACTION) { count -= total[lo]; total[lo] = 0; }
+        auto percentile = [&](double fraction) {
+            uint64_t target = (uint64_t)(count * fraction), sum = 0;
+            for (int i = lo; i <= hi; ++i) if ((sum += total[i]) > target) return i - 32768;
+            return hi - 32768;
+        };
+        int a = percentile(AUTO_WINDOW_TAIL), b = percentile(1.0 - AUTO_WINDOW_TAIL);
+        r.autoWL = (a + b) / 2;
+        r.autoWW = std::max(1, b - a);
+        return r;
+    }
+
+private:
+    struct Part { std::vector<uint32_t> counts = std::vector<uint32_t>(BINS, 0); };
+    mutable std::mutex mtx;
+    std::vector<std::unique_ptr<Part>> parts;
+    std::vector<Part*> freeParts;
+};
+
+// --- ボリュームキャッシュ ---
+// 読み込み済みのボリュームを線形レイアウトのまま 1 ファイルに書き出し、
+// 次回は展開せずに写像するだけで開く。キーはフォルダ内の全ファイルの名前・サイズ・更新時刻。
+struct VolumeInfo {
+    std::string seriesUID, patientName, patientID;
+    double pxSpcX = 1.0, pxSpcY = 1.0, thickness = 1.0;
+    double windowCenter = 0.0, windowWidth = 0.0; // データセットの WindowCenter / WindowWidth (幅 0 = 指定なし)
+    ValueRange range;                             // 読み終えたときのヒストグラムから (キャッシュから開くと数え直さない)
+    double valueScale = 1.0;                      // 格納値 × valueScale = モダリティ値。range と表示のスライダーは格納値のまま
+    bool invertWindow = false;                    // MONOCHROME1。表示は幅を負にして渡す (MakeWindowParams)
+};
+
+class VolumeCache {
+public:
+    void SetDirectory(const std::string& d) { dir = d; }
+
+    // ヘッダを読まずに求められるので、スキャンより前に照合できる。
+    // どれか 1 ファイルでも追加・削除・更新されれば別のキーになる。
+    static uint64_t MakeKey(std::vector<std::string> paths) {
+        namespace fs = std::filesystem;
+        std::sort(paths.begin(), paths.end());
+        std::vector<std::pair<uint64_t, uint64_t>> stamps(paths.size());
+        ThreadPool::Shared().ParallelFor((int)paths.size(), [&](int i) {
+            std::error_code ec;
+            uintmax_t sz = fs::file_size(paths[i], ec);
+            if (ec) sz = 0;
+            auto mt = fs::last_write_time(paths[i], ec);
+            stamps[i] = { (uint64_t)sz, ec ? 0 : (uint64_t)mt.time_since_epoch().count() };
+        });
+        uint64_t h = 14695981039346656037ull; // FNV-1a
+        auto mix = [&h](const void* p, size_t n) {
+            const uint8_t* b = (const uint8_t*)p;
+            for (size_t i = 0; i < n; ++i) { h ^= b[i]; h *= 1099511628211ull; }
+        };
+        mix(&FORMAT_VERSION, sizeof(FORMAT_VERSION));
+        for (size_t i = 0; i < paths.size(); ++i) {
+            mix(paths[i].data(), paths[i].size() + 1);
+            mix(&stamps[i], sizeof(stamps[i]));
+        }
+        return h;
+    }
+
+    // 成功すると vol はキャッシュファイルを直接参照する (読み取り専用)
+    bool Load(uint64_t key, Volume& vol, VolumeInfo& info) const {
+        if (dir.empty()) return false;
+        ScopedTimer timer("CacheLoad");
+        std::string path = PathFor(key);
+        std::shared_ptr<MappedFile> file = MappedFile::Open(path);
+        if (!file || file->Size() < sizeof(Header)) return false;
+        Header hdr;
+        std::memcpy(&hdr, file->Data(), sizeof(hdr));
+        if (std::memcmp(hdr.magic, MAGIC, sizeof(hdr.magic)) != 0 || hdr.version != FORMAT_VERSION || hdr.key != key) return false;
+        if (hdr.width <= 0 || hdr.height <= 0 || hdr.depth <= 0) return false;
+        uint64_t bytes = (uint64_t)hdr.width * hdr.height * hdr.depth * sizeof(int16_t);
+        if (hdr.dataBytes != bytes || hdr.dataOffset % alignof(int16_t) != 0 || hdr.dataOffset + bytes > file->Size()) return false;
+
+        info.seriesUID = FixedString(hdr.seriesUID, sizeof(hdr.seriesUID));
+        info.patientName = FixedString(hdr.patientName, sizeof(hdr.patientName));
+        info.patientID = FixedString(hdr.patientID, sizeof(hdr.patientID));
+        info.pxSpcX = hdr.pxSpcX; info.pxSpcY = hdr.pxSpcY; info.thickness = hdr.thickness;
+        info.windowCenter = hdr.windowCenter; info.windowWidth = hdr.windowWidth;
+        info.range.valid = hdr.rangeValid != 0;
+        info.range.minValue = hdr.valueMin; info.range.maxValue = hdr.valueMax;
+        info.range.autoWL = hdr.autoWL; info.range.autoWW = hdr.autoWW;
+        info.valueScale = hdr.valueScale;
+        info.invertWindow = hdr.invertWindow != 0;
+        const int16_t* data = (const int16_t*)(file->Data() + hdr.dataOffset);
+        vol.AdoptMapped(hdr.width, hdr.height, hdr.depth, data, std::move(file));
+
+        std::error_code ec; // 最近使ったものとして Prune で残す
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+        return true;
+    }
+
+    // 一時ファイルに書いてから置き換えるので、途中で止まっても壊れたキャッシュは残らない。
+    // vol への書き込みが起きないことは呼び出し側が保証する。
+    bool Save(uint64_t key, const Volume& vol, const VolumeInfo& info, const std::atomic<bool>& cancel) const {
+        namespace fs = std::filesystem;
+        if (dir.empty() || vol.empty()) return false;
+        ScopedTimer timer("CacheSave");
+        std::error_code ec;
+        fs::create_directories(dir, ec);
+        std::string path = PathFor(key), tmp = path + ".tmp";
+
+        Header hdr{};
+        std::memcpy(hdr.magic, MAGIC, sizeof(hdr.magic));
+        hdr.version = FORMAT_VERSION;
+        hdr.key = key;
+        hdr.width = vol.Width(); hdr.height = vol.Height(); hdr.depth = vol.Depth();
+        hdr.pxSpcX = info.pxSpcX; hdr.pxSpcY = info.pxSpcY; hdr.thickness = info.thickness;
+        hdr.windowCenter = info.windowCenter; hdr.windowWidth = info.windowWidth;
+        hdr.rangeValid = info.range.valid;
+        hdr.valueMin = info.range.minValue; hdr.valueMax = info.range.maxValue;
+        hdr.autoWL = info.range.autoWL; hdr.autoWW = info.range.autoWW;
+        hdr.valueScale = info.valueScale;
+        hdr.invertWindow = info.invertWindow;
+        CopyFixed(hdr.seriesUID, sizeof(hdr.seriesUID), info.seriesUID);
+        CopyFixed(hdr.patientName, sizeof(hdr.patientName), info.patientName);
+        CopyFixed(hdr.patientID, sizeof(hdr.patientID), info.patientID);
+        hdr.dataOffset = DATA_OFFSET;
+        hdr.dataBytes = (uint64_t)vol.Width() * vol.Height() * vol.Depth() * sizeof(int16_t);
+
+        bool ok = false;
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (out) {
+                std::vector<char> pad(DATA_OFFSET - sizeof(hdr), 0);
+                out.write((const char*)&hdr, sizeof(hdr));
+                out.write(pad.data(), (std::streamsize)pad.size());
+                size_t plane = (size_t)vol.Width() * vol.Height();
+                std::vector<int16_t> slice;
+                ok = true;
+                for (int z = 0; z < vol.Depth() && ok; ++z) {
+                    if (cancel) { ok = false; break; }
+                    const int16_t* src = vol.SliceData(z);
+                    if (!src) {
+                        slice.resize(plane);
+                        vol.ExtractPlane(0, z, slice.data());
+                        src = slice.data();
+                    }
+                    ok = (bool)out.write((const char*)src, (std::streamsize)(plane * sizeof(int16_t)));
+                }
+                out.close();
+                ok = ok && !out.fail();
+            }
+        }
+        if (ok) fs::rename(tmp, path, ec);
+        if (!ok || ec) { fs::remove(tmp, ec); return false; }
+        return true;
+    }
+
+    // 更新時刻の新しい順に maxBytes まで残し、古いものから消す
+    void Prune(uint64_t maxBytes) const {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        std::vector<std::pair<fs::file_time_type, fs::path>> entries;
+        for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+            if (it->path().extension() != ".vol") continue;
+            std::error_code e2;
+            entries.emplace_back(fs::last_write_time(it->path(), e2), it->path());
+        }
+        std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+        uint64_t total = 0;
+        for (const auto& e : entries) {
+            std::error_code e2;
+            total += fs::file_size(e.second, e2);
+            if (total > maxBytes) fs::remove(e.second, e2); // 写像中 (Windows) なら失敗するだけ
+        }
+    }
+
+private:
+    static constexpr char MAGIC[8] = { 'D', 'V', 'V', 'O', 'L', 'C', 'A', 'C' };
+    static constexpr uint32_t FORMAT_VERSION = 4; // 2: 画素はモダリティ値 (Rescale 適用後)、ウィンドウと値の範囲を持つ  3: 格納の倍率を持つ  4: MONOCHROME1 も保存値で持ち、反転の有無を持つ
+    static constexpr uint64_t DATA_OFFSET = 4096; // 画素をページ境界から始める
+
+    struct Header {
+        char magic[8];
+        uint32_t version, reserved;
+        uint64_t key;
+        int32_t width, height, depth;
+        double pxSpcX, pxSpcY, thickness;
+        char seriesUID[72];
+        char patientName[128];
+        char patientID[72];
+        uint64_t dataOffset, dataBytes;
+        double windowCenter, windowWidth;
+        int32_t rangeValid, valueMin, valueMax, autoWL, autoWW;
+        double valueScale;
+        int32_t invertWindow;
+    };
+    static_assert(sizeof(Header) <= DATA_OFFSET, "cache header must fit before the pixel data");
+
+    std::string dir;
+
+    std::string PathFor(uint64_t key) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.vol", (unsigned long long)key);
+        return (std::filesystem::path(dir) / name).string();
+    }
+
+    static void CopyFixed(char* dst, size_t n, const std::string& src) {
+        std::memset(dst, 0, n);
+        std::memcpy(dst, src.data(), std::min(src.size(), n - 1));
+    }
+
+    static std::string FixedString(const char* src, size_t n) {
+        return std::string(src, std::find(src, src + n, '\0'));
+    }
+};
+
+// --- ウィンドウレベル変換カーネル ---
+// int16 画素をグレーの RGB / RGBA バイト列へ変換する。
+// 境界の判定を整数にするため、全て 2 倍したスケールで計算する:
+//   t = clamp(2 * v - (2 * wl - ww), 0, 2 * ww),  p = min((t * scale) >> 16, 255)
+// SIMD 版はスカラー版と同じ式をそのまま並列化しており、結果はビット単位で一致する。
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define WL_KERNEL_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define WL_TARGET(x)
+#else
+#define WL_TARGET(x) __attribute__((target(x)))
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define WL_KERNEL_NEON 1
+#include <arm_neon.h>
+#endif
+
+struct WindowParams {
+    int32_t base = 0;  // 2 * wl - ww
+    int32_t span = 2;  // 2 * ww
+    int32_t scale = 0; // (255 << 16) / span (切り上げ)
+    uint8_t flip = 0;  // 255 なら白黒を反転する (結果と XOR)
+};
+
+// 幅が負なら幅 |ww| で白黒を反転する (MONOCHROME1 のシリーズ)
+inline WindowParams MakeWindowParams(int wl, int ww) {
+    WindowParams p;
+    if (ww < 0) { p.flip = 255; ww = -ww; }
+    if (ww < 1) ww = 1;
+    p.base = 2 * wl - ww;
+    p.span = 2 * ww;
+    p.scale = ((255 << 16) + p.span - 1) / p.span;
+    return p;
+}
+
+inline uint8_t WindowPixel(int16_t v, const WindowParams& p) {
+    int32_t t = 2 * (int32_t)v - p.base;
+    if (t < 0) t = 0;
+    if (t > p.span) t = p.span;
+    int32_t g = (t * p.scale) >> 16;
+    return (uint8_t)((g > 255 ? 255 : g) ^ p.flip);
+}
+
+// 基準実装 (SIMD 版の検証にも使う)
+inline void WindowKernelScalar(const int16_t* src, uint8_t* dst, size_t n, const WindowParams& p, int channels) {
+    if (channels == 4) {
+        for (size_t i = 0; i < n; ++i, dst += 4) {
+            uint8_t g = WindowPixel(src[i], p);
+            dst[0] = g; dst[1] = g; dst[2] = g; dst[3] = 255;
+        }
+    } else {
+        for (size_t i = 0; i < n; ++i, dst += 3) {
+            uint8_t g = WindowPixel(src[i], p);
+            dst[0] = g; dst[1] = g; dst[2] = g;
+        }
+    }
+}
+
+#if WL_KERNEL_X86
+// 16 個のグレー値を RGB (48 バイト) / RGBA (64 バイト) に展開して書き出す
+WL_TARGET("sse4.1")
+inline void StoreGray16(__m128i g, uint8_t* dst, int channels) {
+    if (channels == 4) {
+        const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+        const __m128i m0 = _mm_setr_epi8(0,0,0,-1, 1,1,1,-1, 2,2,2,-1, 3,3,3,-1);
+        const __m128i m1 = _mm_setr_epi8(4,4,4,-1, 5,5,5,-1, 6,6,6,-1, 7,7,7,-1);
+        const __m128i m2 = _mm_setr_epi8(8,8,8,-1, 9,9,9,-1, 10,10,10,-1, 11,11,11,-1);
+        const __m128i m3 = _mm_setr_epi8(12,12,12,-1, 13,13,13,-1, 14,14,14,-1, 15,15,15,-1);
+        _mm_storeu_si128((__m128i*)(dst +  0), _mm_or_si128(_mm_shuffle_epi8(g, m0), alpha));
+        _mm_storeu_si128((__m128i*)(dst + 16), _mm_or_si128(_mm_shuffle_epi8(g, m1), alpha));
+        _mm_storeu_si128((__m128i*)(dst + 32), _mm_or_si128(_mm_shuffle_epi8(g, m2), alpha));
+        _mm_storeu_si128((__m128i*)(dst + 48), _mm_or_si128(_mm_shuffle_epi8(g, m3), alpha));
+    } else {
+        const __m128i m0 = _mm_setr_epi8(0,0,0, 1,1,1, 2,2,2, 3,3,3, 4,4,4, 5);
+        const __m128i m1 = _mm_setr_epi8(5,5, 6,6,6, 7,7,7, 8,8,8, 9,9,9, 10,10);
+        const __m128i m2 = _mm_setr_epi8(10, 11,11,11, 12,12,12, 13,13,13, 14,14,14, 15,15,15);
+        _mm_storeu_si128((__m128i*)(dst +  0), _mm_shuffle_epi8(g, m0));
+        _mm_storeu_si128((__m128i*)(dst + 16), _mm_shuffle_epi8(g, m1));
+        _mm_storeu_si128((__m128i*)(dst + 32), _mm_shuffle_epi8(g, m2));
+    }
+}
+
+WL_TARGET("sse4.1")
+inline __m128i Window4SSE(__m128i v32, __m128i base, __m128i span, __m128i scale) {
+    __m128i t = _mm_sub_epi32(_mm_slli_epi32(v32, 1), base);
+    t = _mm_min_epi32(_mm_max_epi32(t, _mm_setzero_si128()), span);
+    return _mm_srli_epi32(_mm_mullo_epi32(t, scale), 16);
+}
+
+WL_TARGET("sse4.1")
+inline void WindowKernelSSE41(const int16_t* src, uint8_t* dst, size_t n, const WindowParams& p, int channels) {
+    const __m128i base = _mm_set1_epi32(p.base), span = _mm_set1_epi32(p.span), scale = _mm_set1_epi32(p.scale);
+    const __m128i flip = _mm_set1_epi8((char)p.flip);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16, dst += 16 * channels) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 8));
+        __m128i a0 = Window4SSE(_mm_cvtepi16_epi32(a), base, span, scale);
+        __m128i a1 = Window4SSE(_mm_cvtepi16_epi32(_mm_srli_si128(a, 8)), base, span, scale);
+        __m128i b0 = Window4SSE(_mm_cvtepi16_epi32(b), base, span, scale);
+        __m128i b1 = Window4SSE(_mm_cvtepi16_epi32(_mm_srli_si128(b, 8)), base, span, scale);
+        // 飽和パックで 255 へのクランプも兼ねる
+        __m128i g = _mm_packus_epi16(_mm_packus_epi32(a0, a1), _mm_packus_epi32(b0, b1));
+        StoreGray16(_mm_xor_si128(g, flip), dst, channels);
+    }
+    WindowKernelScalar(src + i, dst, n - i, p, channels);
+}
+
+WL_TARGET("avx2")
+inline __m256i Window8AVX2(__m256i v32, __m256i base, __m256i span, __m256i scale) {
+    __m256i t = _mm256_sub_epi32(_mm256_slli_epi32(v32, 1), base);
+    t = _mm256_min_epi32(_mm256_max_epi32(t, _mm256_setzero_si256()), span);
+    return _mm256_srli_epi32(_mm256_mullo_epi32(t, scale), 16);
+}
+
+WL_TARGET("avx2")
+inline void WindowKernelAVX2(const int16_t* src, uint8_t* dst, size_t n, const WindowParams& p, int channels) {
+    const __m256i base = _mm256_set1_epi32(p.base), span = _mm256_set1_epi32(p.span), scale = _mm256_set1_epi32(p.scale);
+    const __m128i flip = _mm_set1_epi8((char)p.flip);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16, dst += 16 * channels) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 8));
+        __m256i wa = Window8AVX2(_mm256_cvtepi16_epi32(a), base, span, scale);
+        __m256i wb = Window8AVX2(_mm256_cvtepi16_epi32(b), base, span, scale);
+        // packus はレーン単位なので 64bit 単位で並べ直す
+        __m256i w16 = _mm256_permute4x64_epi64(_mm256_packus_epi32(wa, wb), 0xD8);
+        __m128i g = _mm_packus_epi16(_mm256_castsi256_si128(w16), _mm256_extracti128_si256(w16, 1));
+        StoreGray16(_mm_xor_si128(g, flip), dst, channels);
+    }
+    WindowKernelScalar(src + i, dst, n - i, p, channels);
+}
+
+inline bool CpuHasAVX2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+inline bool CpuHasSSE41() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 19)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.1");
+#endif
+}
+#endif
+
+#if WL_KERNEL_NEON
+inline uint16x4_t Window4NEON(int16x4_t v, int32x4_t base, int32x4_t span, int32x4_t scale) {
+    int32x4_t t = vsubq_s32(vshlq_n_s32(vmovl_s16(v), 1), base);
+    t = vminq_s32(vmaxq_s32(t, vdupq_n_s32(0)), span);
+    return vqmovun_s32(vshrq_n_s32(vmulq_s32(t, scale), 16));
+}
+
+inline void WindowKernelNEON(const int16_t* src, uint8_t* dst, size_t n, const WindowParams& p, int channels) {
+    const int32x4_t base = vdupq_n_s32(p.base), span = vdupq_n_s32(p.span), scale = vdupq_n_s32(p.scale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8, dst += 8 * channels) {
+        int16x8_t v = vld1q_s16(src + i);
+        uint16x8_t w16 = vcombine_u16(Window4NEON(vget_low_s16(v), base, span, scale), Window4NEON(vget_high_s16(v), base, span, scale));
+        uint8x8_t g = veor_u8(vqmovn_u16(w16), vdup_n_u8(p.flip));
+        if (channels == 4) {
+            uint8x8x4_t px = { { g, g, g, vdup_n_u8(255) } };
+            vst4_u8(dst, px);
+        } else {
+            uint8x8x3_t px = { { g, g, g } };
+            vst3_u8(dst, px);
+        }
+    }
+    WindowKernelScalar(src + i, dst, n - i, p, channels);
+}
+#endif
+
+typedef void (*WindowKernelFn)(const int16_t*, uint8_t*, size_t, const WindowParams&, int);
+
+// 実行環境で使える最速のカーネルを一度だけ選ぶ
+inline WindowKernelFn SelectWindowKernel() {
+#if WL_KERNEL_X86
+    if (CpuHasAVX2()) return WindowKernelAVX2;
+    if (CpuHasSSE41()) return WindowKernelSSE41;
+#elif WL_KERNEL_NEON
+    return WindowKernelNEON;
+#endif
+    return WindowKernelScalar;
+}
+
+inline void ApplyWindow(const int16_t* src, uint8_t* dst, size_t n, int wl, int ww, int channels = 3) {
+    static const WindowKernelFn kernel = SelectWindowKernel();
+    kernel(src, dst, n, MakeWindowParams(wl, ww), channels);
+}
+
+// 利用可能な全 SIMD カーネルがスカラー版とビット単位で一致するか確認する
+inline bool VerifyWindowKernels() {
+    std::vector<WindowKernelFn> kernels;
+#if WL_KERNEL_X86
+    if (CpuHasSSE41()) kernels.push_back(WindowKernelSSE41);
+    if (CpuHasAVX2()) kernels.push_back(WindowKernelAVX2);
+#elif WL_KERNEL_NEON
+    kernels.push_back(WindowKernelNEON);
+#endif
+    // int16 の全値 + 端数が出るよう 1 つずらした長さ
+    std::vector<int16_t> src(65536 + 13);
+    for (size_t i = 0; i < src.size(); ++i) src[i] = (int16_t)(i - 32768);
+    const int windows[][2] = { {40, 400}, {-600, 1500}, {0, 1}, {-32768, 65535}, {3000, 4000}, {271, 3}, {40, -400}, {271, -3} };
+    std::vector<uint8_t> ref(src.size() * 4), out(src.size() * 4);
+    for (int channels = 3; channels <= 4; ++channels) {
+        for (const auto& win : windows) {
+            WindowParams p = MakeWindowParams(win[0], win[1]);
+            WindowKernelScalar(src.data(), ref.data(), src.size(), p, channels);
+            for (WindowKernelFn k : kernels) {
+                std::fill(out.begin(), out.end(), 0);
+                k(src.data(), out.data(), src.size(), p, channels);
+                if (!std::equal(ref.begin(), ref.begin() + src.size() * channels, out.begin())) return false;
+            }
+        }
+    }
+    return true;
+}
+
+// --- ウィンドウ LUT キャッシュ ---
+// int16 の全値 (65536 通り) に対する RGBA を表にして持ち、wl/ww が変わったときだけ作り直す。
+// 3 画面で共有するので、スライス移動だけなら変換の計算は一切発生しない。
+class WindowLut {
+    std::vector<uint32_t> table; // [v + 32768] = R, G, B, A のバイト列
+    int curWL = 0, curWW = 0;
+
+public:
+    // 作り直したら true。ww が負なら反転 (MakeWindowParams)
+    bool Update(int wl, int ww) {
+        if (ww == 0) ww = 1;
+        if (!table.empty() && wl == curWL && ww == curWW) return false;
+        static const std::vector<int16_t> ramp = [] {
+            std::vector<int16_t> r(65536);
+            for (int i = 0; i < 65536; ++i) r[i] = (int16_t)(i - 32768);
+            return r;
+        }();
+        table.resize(65536);
+        ApplyWindow(ramp.data(), (uint8_t*)table.data(), ramp.size(), wl, ww, 4);
+        curWL = wl; curWW = ww;
+        return true;
+    }
+
+    bool IsValid() const { return !table.empty(); }
+    const uint32_t* Data() const { return table.data(); }
+
+    void Apply(const int16_t* src, uint8_t* dst, size_t n, int channels = 3) const {
+        const uint32_t* t = table.data() + 32768;
+        if (channels == 4) {
+            for (size_t i = 0; i < n; ++i, dst += 4) std::memcpy(dst, &t[src[i]], 4);
+            return;
+        }
+        if (n == 0) return;
+        // 4 バイト書いて 3 バイト進める (最後の 1 画素だけははみ出さないよう 3 バイト)
+        for (size_t i = 0; i + 1 < n; ++i, dst += 3) std::memcpy(dst, &t[src[i]], 4);
+        std::memcpy(dst, &t[src[n - 1]], 3);
+    }
+};
+
+// --- 断面の拡大縮小 ---
+// ウィンドウ処理の前に int16 のまま表示サイズへ変換する (LUT は出力画素にだけ掛かる)。
+//   NEAREST / BILINEAR: 操作中に使う軽量版
+//   HIGH: Catmull-Rom を縮小率に応じて広げた分離型フィルタ (縮小時は面積平均に近い)
+enum ResampleQuality { RESAMPLE_NEAREST, RESAMPLE_BILINEAR, RESAMPLE_HIGH };
+
+// 大きな画像は行帯に分けて共有プールで処理する。fn(y0, y1) は [y0, y1) 行を担当する。
+// 画面ごとのジョブの中から呼ばれても、ParallelFor は呼び出し側も手伝うので詰まらない。
+template <typename F>
+inline void ForRowBands(int rows, size_t pixelsPerRow, F&& fn) {
+    constexpr size_t BAND_PIXELS = 32 * 1024;
+    size_t bands = std::min<size_t>(rows, (size_t)rows * pixelsPerRow / BAND_PIXELS);
+    bands = std::min<size_t>(bands, (size_t)ThreadPool::Shared().Size() * 2);
+    if (bands <= 1) { fn(0, rows); return; }
+    ThreadPool::Shared().ParallelFor((int)bands, [&](int b) {
+        fn((int)((size_t)rows * b / bands), (int)((size_t)rows * (b + 1) / bands));
+    });
+}
+
+// 画素の縦横比 (scaleY) を保ったまま、box に収まる最大サイズを求める
+inline void FitToBox(int w, int h, double scaleY, int boxW, int boxH, int& outW, int& outH) {
+    double iw = std::max(1, w), ih = std::max(1.0, h * scaleY);
+    double s = std::min(boxW / iw, boxH / ih);
+    outW = std::max(1, (int)std::lround(iw * s));
+    outH = std::max(1, (int)std::lround(ih * s));
+}
+
+// --- 描画用の作業領域 ---
+// 断面バッファ・拡大縮小の係数表を描画系統 (画面) ごとに持ち回る。足りないときだけ広げ、縮めないので、
+// 同じ大きさで描き続ける間 (スクロール中) はヒープを確保しない。広げた回数は RenderAllocCount で数える。
+inline std::atomic<uint64_t>& RenderAllocCount() {
+    static std::atomic<uint64_t> count{0};
+    return count;
+}
+
+template <typename T>
+inline T* ScratchBuffer(std::vector<T>& v, size_t n) {
+    if (v.size() < n) {
+        if (n > v.capacity()) RenderAllocCount().fetch_add(1, std::memory_order_relaxed);
+        v.resize(n);
+    }
+    return v.data();
+}
+
+// --- スラブ投影 (MIP / MinIP / 平均) ---
+// 隣り合う thickness 枚の断面を画素ごとに集約する。SlabCache を渡すと 16 枚 (ブリックと同じ厚み) ごとの
+// 部分集約を覚えておき、厚いスラブでは端の数枚だけを個別に読む (100 枚でも読むのは多くて 30 + 6 面)。
+// 線形レイアウトの Coronal/Sagittal は切り出しを挟まずボリュームを直接集約する (部分集約は使わない)。
+enum SlabMode { SLAB_NONE, SLAB_MIP, SLAB_MINIP, SLAB_AVERAGE };
+
+#if WL_KERNEL_X86 && (defined(__SSE2__) || defined(_M_X64))
+#define SLAB_KERNEL_SSE2 1
+#endif
+
+// acc = max(acc, src) / min(acc, src)。SSE2 と NEON は基本命令なので実行時の判定はいらない
+inline void SlabMax(int16_t* acc, const int16_t* src, size_t n) {
+    size_t i = 0;
+#if SLAB_KERNEL_SSE2
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i*)(acc + i), _mm_max_epi16(_mm_loadu_si128((const __m128i*)(acc + i)), _mm_loadu_si128((const __m128i*)(src + i))));
+#elif WL_KERNEL_NEON
+    for (; i + 8 <= n; i += 8) vst1q_s16(acc + i, vmaxq_s16(vld1q_s16(acc + i), vld1q_s16(src + i)));
+#endif
+    for (; i < n; ++i) acc[i] = std::max(acc[i], src[i]);
+}
+
+inline void SlabMin(int16_t* acc, const int16_t* src, size_t n) {
+    size_t i = 0;
+#if SLAB_KERNEL_SSE2
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i*)(acc + i), _mm_min_epi16(_mm_loadu_si128((const __m128i*)(acc + i)), _mm_loadu_si128((const __m128i*)(src + i))));
+#elif WL_KERNEL_NEON
+    for (; i + 8 <= n; i += 8) vst1q_s16(acc + i, vminq_s16(vld1q_s16(acc + i), vld1q_s16(src + i)));
+#endif
+    for (; i < n; ++i) acc[i] = std::min(acc[i], src[i]);
+}
+
+// 平均は int32 に足し込む (int16 を 65536 枚足しても溢れない)
+inline void SlabAdd(int32_t* acc, const int16_t* src, size_t n) {
+    size_t i = 0;
+#if SLAB_KERNEL_SSE2
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16), hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_si128((__m128i*)(acc + i), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(acc + i)), lo));
+        _mm_storeu_si128((__m128i*)(acc + i + 4), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(acc + i + 4)), hi));
+    }
+#elif WL_KERNEL_NEON
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(src + i);
+        vst1q_s32(acc + i, vaddw_s16(vld1q_s32(acc + i), vget_low_s16(v)));
+        vst1q_s32(acc + i + 4, vaddw_s16(vld1q_s32(acc + i + 4), vget_high_s16(v)));
+    }
+#endif
+    for (; i < n; ++i) acc[i] += src[i];
+}
+
+inline void SlabAdd(int32_t* acc, const int32_t* src, size_t n) {
+    size_t i = 0;
+#if SLAB_KERNEL_SSE2
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_si128((__m128i*)(acc + i), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(acc + i)), _mm_loadu_si128((const __m128i*)(src + i))));
+#elif WL_KERNEL_NEON
+    for (; i + 4 <= n; i += 4) vst1q_s32(acc + i, vaddq_s32(vld1q_s32(acc + i), vld1q_s32(src + i)));
+#endif
+    for (; i < n; ++i) acc[i] += src[i];
+}
+
+// 連続した n 個 (n >= 1) の最大・最小・合計 (Sagittal のスラブ用)
+inline int32_t SlabReduceRun(const int16_t* p, int n, SlabMode mode) {
+    int i = 0;
+    int32_t v = mode == SLAB_AVERAGE ? 0 : p[0];
+#if SLAB_KERNEL_SSE2
+    if (n >= 8) {
+        __m128i acc = mode == SLAB_AVERAGE ? _mm_setzero_si128() : _mm_loadu_si128((const __m128i*)p);
+        const __m128i ones = _mm_set1_epi16(1);
+        for (; i + 8 <= n; i += 8) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(p + i));
+            if (mode == SLAB_MIP) acc = _mm_max_epi16(acc, x);
+            else if (mode == SLAB_MINIP) acc = _mm_min_epi16(acc, x);
+            else acc = _mm_add_epi32(acc, _mm_madd_epi16(x, ones));
+        }
+        alignas(16) int32_t lanes32[4];
+        alignas(16) int16_t lanes16[8];
+        if (mode == SLAB_AVERAGE) {
+            _mm_store_si128((__m128i*)lanes32, acc);
+            v = lanes32[0] + lanes32[1] + lanes32[2] + lanes32[3];
+        } else {
+            _mm_store_si128((__m128i*)lanes16, acc);
+            for (int k = 0; k < 8; ++k) v = mode == SLAB_MIP ? std::max<int32_t>(v, lanes16[k]) : std::min<int32_t>(v, lanes16[k]);
+        }
+    }
+#elif WL_KERNEL_NEON
+    if (n >= 8) {
+        int16x8_t ext = vld1q_s16(p);
+        int32x4_t sum = vdupq_n_s32(0);
+        for (; i + 8 <= n; i += 8) {
+            int16x8_t x = vld1q_s16(p + i);
+            if (mode == SLAB_MIP) ext = vmaxq_s16(ext, x);
+            else if (mode == SLAB_MINIP) ext = vminq_s16(ext, x);
+            else sum = vpadalq_s16(sum, x);
+        }
+        int16_t lanes16[8];
+        int32_t lanes32[4];
+        if (mode == SLAB_AVERAGE) {
+            vst1q_s32(lanes32, sum);
+            v = lanes32[0] + lanes32[1] + lanes32[2] + lanes32[3];
+        } else {
+            vst1q_s16(lanes16, ext);
+            for (int k = 0; k < 8; ++k) v = mode == SLAB_MIP ? std::max<int32_t>(v, lanes16[k]) : std::min<int32_t>(v, lanes16[k]);
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        if (mode == SLAB_AVERAGE) v += p[i];
+        else if (mode == SLAB_MIP) v = std::max<int32_t>(v, p[i]);
+        else v = std::min<int32_t>(v, p[i]);
+    }
+    return v;
+}
+
+inline int PlaneCount(const Volume& vol, int viewType) {
+    return viewType == 0 ? vol.Depth() : (viewType == 1 ? vol.Height() : vol.Width());
+}
+
+// 線形レイアウトの Axial はコピーせずに読み、それ以外は buf へ切り出す
+inline const int16_t* ReadPlane(const Volume& vol, int viewType, int index, std::vector<int16_t>& buf) {
+    if (viewType == 0) {
+        if (const int16_t* p = vol.SliceData(index)) return p;
+    }
+    int w = 0, h = 0;
+    vol.PlaneSize(viewType, w, h);
+    int16_t* dst = ScratchBuffer(buf, (size_t)w * h);
+    vol.ExtractPlane(viewType, index, dst);
+    return dst;
+}
+
+// 線形レイアウトの Coronal/Sagittal は断面を切り出さないほうが速い
+inline bool SlabReadsDirect(const Volume& vol, int viewType) {
+    return viewType != 0 && vol.GetLayout() == Volume::LAYOUT_LINEAR;
+}
+
+// [lo, hi) をボリュームから直接集約し、ext (MIP/MinIP) か sum (平均用の合計) に書く。
+// 出力の 1 行 (z) ごとに、連続したボリュームの行 (Coronal) か行の中の連続区間 (Sagittal) を読む
+inline void ReduceSlabDirect(const Volume& vol, int viewType, int lo, int hi, SlabMode mode, int16_t* ext, int32_t* sum) {
+    int W = vol.Width(), H = vol.Height();
+    int outW = viewType == 1 ? W : H;
+    ForRowBands(vol.Depth(), outW, [&](int za, int zb) {
+        for (int z = za; z < zb; ++z) {
+            const int16_t* slice = vol.SliceData(z);
+            size_t row = (size_t)z * outW;
+            if (viewType == 1) {
+                if (mode == SLAB_AVERAGE) {
+                    std::fill(sum + row, sum + row + W, 0);
+                    for (int y = lo; y < hi; ++y) SlabAdd(sum + row, slice + (size_t)y * W, W);
+                    continue;
+                }
+                std::copy(slice + (size_t)lo * W, slice + (size_t)(lo + 1) * W, ext + row);
+                for (int y = lo + 1; y < hi; ++y) {
+                    if (mode == SLAB_MIP) SlabMax(ext + row, slice + (size_t)y * W, W);
+                    else SlabMin(ext + row, slice + (size_t)y * W, W);
+                }
+                continue;
+            }
+            for (int y = 0; y < H; ++y) {
+                int32_t v = SlabReduceRun(slice + (size_t)y * W + lo, hi - lo, mode);
+                if (mode == SLAB_AVERAGE) sum[row + y] = v;
+                else ext[row + y] = (int16_t)v;
+            }
+        }
+    });
+}
+
+// 16 枚ごとの部分集約 (MIP/MinIP は int16、平均は合計を int32 で持つ)。
+// 必要になった塊だけを作り、予算を超えたら古いものから捨てる。どのスレッドから使ってもよい
+class SlabCache {
+public:
+    static constexpr int BLOCK = Volume::BRICK;
+
+    struct Block {
+        std::vector<int16_t> extreme;
+        std::vector<int32_t> sum;
+    };
+
+    void SetBudget(uint64_t bytes) {
+        std::lock_guard<std::mutex> lock(mtx);
+        budget = bytes;
+        Trim();
+    }
+
+    void Clear() {
+        std::lock_guard<std::mutex> lock(mtx);
+        Reset();
+    }
+
+    // vol の viewType 方向の k 番目の塊 (k*BLOCK 枚目から BLOCK 枚)。
+    // revision (ボリュームの中身の版) か vol 自体が前回と違えば、覚えていた塊は全て捨てる
+    std::shared_ptr<const Block> Get(const Volume& vol, long revision, int viewType, SlabMode mode, int k) {
+        uint64_t key = ((uint64_t)(viewType * 4 + mode) << 32) | (uint32_t)k;
+        long gen;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (&vol != owner || revision != ownerRevision || vol.Width() != ownerW || vol.Height() != ownerH || vol.Depth() != ownerD) {
+                Reset();
+                owner = &vol; ownerRevision = revision;
+                ownerW = vol.Width(); ownerH = vol.Height(); ownerD = vol.Depth();
+            }
+            auto it = blocks.find(key);
+            if (it != blocks.end()) return it->second;
+            gen = generation;
+        }
+        // 作るのはロックの外。同じ塊を 2 つのスレッドが同時に作っても、残るのは片方だけ
+        auto block = std::make_shared<Block>();
+        int w = 0, h = 0;
+        vol.PlaneSize(viewType, w, h);
+        size_t n = (size_t)w * h;
+        if (mode == SLAB_AVERAGE) block->sum.assign(n, 0);
+        else block->extreme.resize(n);
+        if (SlabReadsDirect(vol, viewType)) {
+            ReduceSlabDirect(vol, viewType, k * BLOCK, (k + 1) * BLOCK, mode, block->extreme.data(), block->sum.data());
+        } else {
+            thread_local std::vector<int16_t> buf;
+            for (int i = k * BLOCK; i < (k + 1) * BLOCK; ++i) {
+                const int16_t* p = ReadPlane(vol, viewType, i, buf);
+                if (mode == SLAB_AVERAGE) SlabAdd(block->sum.data(), p, n);
+                else if (i == k * BLOCK) std::copy(p, p + n, block->extreme.data());
+                else if (mode == SLAB_MIP) SlabMax(block->extreme.data(), p, n);
+                else SlabMin(block->extreme.data(), p, n);
+            }
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        if (gen == generation && blocks.emplace(key, block).second) {
+            order.push_back(key);
+            bytes += BlockBytes(*block);
+            Trim();
+        }
+        return block;
+    }
+
+private:
+    std::mutex mtx;
+    std::map<uint64_t, std::shared_ptr<const Block>> blocks;
+    std::deque<uint64_t> order; // 作った順
+    uint64_t bytes = 0, budget = 512ull << 20;
+    long generation = 0;
+    const Volume* owner = nullptr;
+    long ownerRevision = 0;
+    int ownerW = 0, ownerH = 0, ownerD = 0;
+
+    static uint64_t BlockBytes(const Block& b) { return b.extreme.size() * sizeof(int16_t) + b.sum.size() * sizeof(int32_t); }
+
+    void Reset() {
+        blocks.clear(); order.clear(); bytes = 0;
+        ++generation; // 作りかけの塊は登録しない
+    }
+
+    void Trim() {
+        while (bytes > budget && !order.empty()) {
+            auto it = blocks.find(order.front());
+            order.pop_front();
+            if (it == blocks.end()) continue;
+            bytes -= BlockBytes(*it->second);
+            blocks.erase(it);
+        }
+    }
+};
+
+// スラブの 1 区切り: 単独の断面 (index >= 0) か、部分集約の塊 (-1 - 塊の番号)
+struct SlabPiece {
+    int index = 0;
+    std::shared_ptr<const SlabCache::Block> block;
+};
+
+struct SlabScratch {
+    std::vector<SlabPiece> pieces;
+    std::vector<std::vector<int16_t>> extreme, read; // 分担ごとの途中結果と切り出し用
+    std::vector<std::vector<int32_t>> sum;
+};
+
+// center を中心とする thickness 枚 (範囲外は切り詰める) を集約し、PlaneSize の大きさで out に書く。
+// 区切りを分担ごとに並列で集約してから、行の帯ごとに並列で合わせる。cache が null なら塊を使わない。
+// 直接読めるときは、塊に収まらない端の数枚を区切りにせず、まとめて直接集約する
+inline void ProjectSlab(const Volume& vol, int viewType, int center, int thickness, SlabMode mode, int16_t* out,
+                        SlabScratch& s, SlabCache* cache = nullptr, long revision = 0) {
+    const int B = SlabCache::BLOCK;
+    int w = 0, h = 0;
+    vol.PlaneSize(viewType, w, h);
+    size_t n = (size_t)w * h;
+    int count = PlaneCount(vol, viewType);
+    if (count <= 0) return;
+    int lo = std::clamp(center - (thickness - 1) / 2, 0, count - 1);
+    int hi = std::min(count, lo + std::max(1, thickness));
+    int a = cache ? std::min(hi, (lo + B - 1) / B * B) : hi, b = cache ? std::max(a, hi / B * B) : hi;
+    bool direct = SlabReadsDirect(vol, viewType);
+
+    s.pieces.clear();
+    if (!direct) for (int i = lo; i < a; ++i) s.pieces.push_back({ i, nullptr });
+    for (int k = a / B; k < b / B; ++k) s.pieces.push_back({ -1 - k, nullptr });
+    if (!direct) for (int i = b; i < hi; ++i) s.pieces.push_back({ i, nullptr });
+    int edges[2][2] = { { lo, a }, { b, hi } }, edgeCount = 0;
+    if (direct) {
+        for (auto& e : edges) if (e[0] < e[1]) { edges[edgeCount][0] = e[0]; edges[edgeCount][1] = e[1]; ++edgeCount; }
+    }
+
+    int parts = std::min<int>((int)s.pieces.size(), (int)ThreadPool::Shared().Size() + 1); // 呼び出し元も手伝う
+    int slots = parts + edgeCount;
+    if ((int)s.extreme.size() < slots) { s.extreme.resize(slots); s.read.resize(slots); s.sum.resize(slots); }
+    for (int p = 0; p < slots; ++p) {
+        if (mode == SLAB_AVERAGE) ScratchBuffer(s.sum[p], n);
+        else ScratchBuffer(s.extreme[p], n);
+    }
+    ThreadPool::Shared().ParallelFor(parts, [&](int p) {
+        size_t first = s.pieces.size() * p / parts, last = s.pieces.size() * (p + 1) / parts;
+        int16_t* ext = s.extreme[p].data();
+        int32_t* sum = mode == SLAB_AVERAGE ? s.sum[p].data() : nullptr;
+        if (sum) std::fill(sum, sum + n, 0);
+        for (size_t i = first; i < last; ++i) {
+            SlabPiece& piece = s.pieces[i];
+            const int16_t* src = nullptr;
+            if (piece.index < 0) {
+                piece.block = cache->Get(vol, revision, viewType, mode, -1 - piece.index);
+                if (sum) { SlabAdd(sum, piece.block->sum.data(), n); piece.block.reset(); continue; }
+                src = piece.block->extreme.data();
+            } else {
+                src = ReadPlane(vol, viewType, piece.index, s.read[p]);
+                if (sum) { SlabAdd(sum, src, n); continue; }
+            }
+            if (i == first) std::copy(src, src + n, ext);
+            else if (mode == SLAB_MIP) SlabMax(ext, src, n);
+            else SlabMin(ext, src, n);
+            piece.block.reset();
+        }
+    });
+    for (int e = 0; e < edgeCount; ++e) {
+        ReduceSlabDirect(vol, viewType, edges[e][0], edges[e][1], mode, s.extreme[parts + e].data(), s.sum[parts + e].data());
+    }
+
+    int slices = hi - lo;
+    ForRowBands(h, w, [&](int ya, int yb) {
+        size_t off = (size_t)ya * w, m = (size_t)(yb - ya) * w;
+        if (mode != SLAB_AVERAGE) {
+            std::copy(s.extreme[0].data() + off, s.extreme[0].data() + off + m, out + off);
+            for (int p = 1; p < slots; ++p) {
+                if (mode == SLAB_MIP) SlabMax(out + off, s.extreme[p].data() + off, m);
+                else SlabMin(out + off, s.extreme[p].data() + off, m);
+            }
+            return;
+        }
+        int32_t* acc = s.sum[0].data() + off;
+        for (int p = 1; p < slots; ++p) SlabAdd(acc, s.sum[p].data() + off, m);
+        for (size_t i = 0; i < m; ++i) {
+            int32_t v = acc[i];
+            out[off + i] = (int16_t)(v >= 0 ? (v + slices / 2) / slices : -((-v + slices / 2) / slices));
+        }
+    });
+}
+
+// 出力 1 画素が参照する入力範囲と重み。sn -> dn が同じなら作り直さない
+struct ResampleTaps {
+    std::vector<int> start, count;
+    std::vector<float> weights; // 出力画素ごとに maxTaps 個ずつ
+    int maxTaps = 0;
+    int sn = 0, dn = 0;
+};
+
+struct PlaneScratch {
+    std::vector<int16_t> plane, scaled;
+    std::vector<int> xs, x0, fx, y0, fy;
+    ResampleTaps tx, ty;
+    std::vector<float> tmp;
+    SlabScratch slab;
+};
+
+inline void ResampleNearest(const int16_t* src, int sw, int sh, int16_t* dst, int dw, int dh, PlaneScratch& s) {
+    int* xs = ScratchBuffer(s.xs, dw);
+    for (int x = 0; x < dw; ++x) xs[x] = std::min(sw - 1, (int)(((int64_t)x * 2 + 1) * sw / (2 * dw)));
+    ForRowBands(dh, dw, [&](int ya, int yb) {
+        for (int y = ya; y < yb; ++y) {
+            const int16_t* row = src + (size_t)std::min(sh - 1, (int)(((int64_t)y * 2 + 1) * sh / (2 * dh))) * sw;
+            int16_t* out = dst + (size_t)y * dw;
+            for (int x = 0; x < dw; ++x) out[x] = row[xs[x]];
+        }
+    });
+}
+
+// 8bit 固定小数点の双線形補間
+inline void ResampleBilinear(const int16_t* src, int sw, int sh, int16_t* dst, int dw, int dh, PlaneScratch& s) {
+    auto axis = [](int dn, int sn, std::vector<int>& i0v, std::vector<int>& fv) {
+        int* i0 = ScratchBuffer(i0v, dn);
+        int* f = ScratchBuffer(fv, dn);
+        double step = (double)sn / dn;
+        for (int i = 0; i < dn; ++i) {
+            double p = std::max(0.0, (i + 0.5) * step - 0.5);
+            int b = std::min((int)p, sn - 1);
+            i0[i] = b;
+            f[i] = b + 1 < sn ? (int)((p - b) * 256.0) : 0;
+        }
+    };
+    axis(dw, sw, s.x0, s.fx);
+    axis(dh, sh, s.y0, s.fy);
+    const int *x0 = s.x0.data(), *fx = s.fx.data(), *y0 = s.y0.data(), *fy = s.fy.data();
+    ForRowBands(dh, dw, [&](int ya, int yb) {
+        for (int y = ya; y < yb; ++y) {
+            const int16_t* r0 = src + (size_t)y0[y] * sw;
+            const int16_t* r1 = y0[y] + 1 < sh ? r0 + sw : r0;
+            int wy = fy[y];
+            int16_t* out = dst + (size_t)y * dw;
+            for (int x = 0; x < dw; ++x) {
+                int a = x0[x], b = a + 1 < sw ? a + 1 : a, wx = fx[x];
+                int top = r0[a] * 256 + (r0[b] - r0[a]) * wx;
+                int bot = r1[a] * 256 + (r1[b] - r1[a]) * wx;
+                int64_t v = (int64_t)top * 256 + (int64_t)(bot - top) * wy;
+                out[x] = (int16_t)((v + (1 << 15)) >> 16);
+            }
+        }
+    });
+}
+
+inline void BuildCubicTaps(int sn, int dn, ResampleTaps& t) {
+    if (t.sn == sn && t.dn == dn) return;
+    auto cubic = [](double x) {
+        const double a = -0.5;
+        x = std::fabs(x);
+        if (x < 1.0) return ((a + 2.0) * x - (a + 3.0)) * x * x + 1.0;
+        if (x < 2.0) return (((x - 5.0) * x + 8.0) * x - 4.0) * a;
+        return 0.0;
+    };
+    double scale = (double)sn / dn;
+    double fscale = std::max(1.0, scale); // 縮小時はカーネルを広げて折り返しを防ぐ
+    double support = 2.0 * fscale;
+    t.maxTaps = (int)std::ceil(support) * 2 + 1;
+    int* start = ScratchBuffer(t.start, dn);
+    int* count = ScratchBuffer(t.count, dn);
+    float* weights = ScratchBuffer(t.weights, (size_t)dn * t.maxTaps);
+    for (int i = 0; i < dn; ++i) {
+        double center = (i + 0.5) * scale;
+        int lo = std::max(0, (int)std::floor(center - support));
+        int hi = std::min(sn, (int)std::ceil(center + support));
+        float* w = weights + (size_t)i * t.maxTaps;
+        int n = 0;
+        double sum = 0.0;
+        for (int j = lo; j < hi && n < t.maxTaps; ++j, ++n) {
+            double k = cubic((j + 0.5 - center) / fscale);
+            w[n] = (float)k; sum += k;
+        }
+        start[i] = lo; count[i] = n;
+        for (int k = 0; k < n; ++k) w[k] = (float)(sum != 0.0 ? w[k] / sum : 0.0);
+    }
+    t.sn = sn; t.dn = dn;
+}
+
+inline void ResampleHigh(const int16_t* src, int sw, int sh, int16_t* dst, int dw, int dh, PlaneScratch& s) {
+    BuildCubicTaps(sw, dw, s.tx);
+    BuildCubicTaps(sh, dh, s.ty);
+    const ResampleTaps& tx = s.tx;
+    const ResampleTaps& ty = s.ty;
+    float* tmp = ScratchBuffer(s.tmp, (size_t)sh * dw);
+    // 横方向 → 縦方向の 2 回。どちらも行ごとに独立なので行帯で分けられる
+    ForRowBands(sh, (size_t)dw * tx.maxTaps, [&](int ya, int yb) {
+        for (int y = ya; y < yb; ++y) {
+            const int16_t* row = src + (size_t)y * sw;
+            float* out = tmp + (size_t)y * dw;
+            for (int x = 0; x < dw; ++x) {
+                const float* w = tx.weights.data() + (size_t)x * tx.maxTaps;
+                const int16_t* p = row + tx.start[x];
+                float acc = 0.0f;
+                for (int k = 0; k < tx.count[x]; ++k) acc += w[k] * p[k];
+                out[x] = acc;
+            }
+        }
+    });
+    ForRowBands(dh, (size_t)dw * ty.maxTaps, [&](int ya, int yb) {
+        for (int y = ya; y < yb; ++y) {
+            const float* w = ty.weights.data() + (size_t)y * ty.maxTaps;
+            int16_t* out = dst + (size_t)y * dw;
+            for (int x = 0; x < dw; ++x) {
+                const float* p = tmp + (size_t)ty.start[y] * dw + x;
+                float acc = 0.0f;
+                for (int k = 0; k < ty.count[y]; ++k) acc += w[k] * p[(size_t)k * dw];
+                long v = std::lround(acc);
+                out[x] = (int16_t)std::min(32767L, std::max(-32768L, v));
+            }
+        }
+    });
+}
+
+inline void ResamplePlane(const int16_t* src, int sw, int sh, int16_t* dst, int dw, int dh, ResampleQuality q, PlaneScratch& s) {
+    if (sw == dw && sh == dh) { std::copy(src, src + (size_t)sw * sh, dst); return; }
+    if (q == RESAMPLE_HIGH) ResampleHigh(src, sw, sh, dst, dw, dh, s);
+    else if (q == RESAMPLE_BILINEAR) ResampleBilinear(src, sw, sh, dst, dw, dh, s);
+    else ResampleNearest(src, sw, sh, dst, dw, dh, s);
+}
+
+// --- 断面描画パイプライン (切り出し → 拡大縮小 → ウィンドウ) ---
+// UI に依存しないので、ビューアーとベンチマークの両方からこの経路を使う。
+struct PlaneTimings { double extractMs = 0, resampleMs = 0, windowMs = 0; };
+
+// 断面の代わりに描くスラブ。thickness が 1 以下か SLAB_NONE なら通常の断面
+struct SlabParams {
+    SlabMode mode = SLAB_NONE;
+    int thickness = 1;
+    SlabCache* cache = nullptr;
+    long revision = 0;
+    bool Active() const { return mode != SLAB_NONE && thickness > 1; }
+};
+
+// 画素間隔から求めた断面の縦方向の倍率 (縦横比の補正)
+inline double PlaneAspect(int viewType, double pxSpcX, double pxSpcY, double thickness) {
+    double sx = (pxSpcX > 0) ? pxSpcX : 1.0;
+    double sy = (pxSpcY > 0) ? pxSpcY : 1.0;
+    double sz = (thickness > 0) ? thickness : 1.0;
+    if (viewType == 0) return sy / sx;
+    if (viewType == 1) return sz / sx;
+    return sz / sy;
+}
+
+// 断面を boxW x boxH に物理的な縦横比を保って収めたときの出力サイズ
+inline void PlaneFitSize(const Volume& vol, int viewType, double scaleY, int boxW, int boxH, int& outW, int& outH) {
+    int w = 0, h = 0;
+    vol.PlaneSize(viewType, w, h);
+    if (boxW > 0 && boxH > 0) FitToBox(w, h, scaleY, boxW, boxH, outW, outH);
+    else FitToBox(w, h, scaleY, std::max(w, 1), std::max((int)(h * scaleY), 1), outW, outH);
+}
+
+// 断面を outW x outH (PlaneFitSize の結果) の RGB として rgb に描き、使った補間を返す。
+// vol と lut を読むだけなので、どのスレッドから呼んでもよい。lut が null なら wl/ww から直接変換する。
+// scratch は同時に使わない描画系統ごとに 1 つ。null ならスレッドごとの作業領域を使う。
+// slab を渡すと slice を中心とするスラブの投影を描く (切り出しの時間に含めて数える)。
+inline ResampleQuality RenderPlaneRGB(const Volume& vol, int viewType, int slice, int outW, int outH, bool coarse,
+                                      const WindowLut* lut, int wl, int ww, unsigned char* rgb,
+                                      PlaneScratch* scratch = nullptr, PlaneTimings* timings = nullptr,
+                                      const SlabParams* slab = nullptr) {
+    using Clock = std::chrono::steady_clock;
+    auto ms = [](Clock::time_point a, Clock::time_point b) { return std::chrono::duration<double, std::milli>(b - a).count(); };
+    thread_local PlaneScratch threadScratch;
+    PlaneScratch& s = scratch ? *scratch : threadScratch;
+    int w = 0, h = 0;
+    vol.PlaneSize(viewType, w, h);
+    Clock::time_point t0 = Clock::now();
+    // 線形レイアウトの Axial はボリュームの中で連続しているので、コピーせずそのまま読む
+    const int16_t* plane = nullptr;
+    if (slab && slab->Active()) {
+        int16_t* buf = ScratchBuffer(s.plane, (size_t)w * h);
+        ProjectSlab(vol, viewType, slice, slab->thickness, slab->mode, buf, s.slab, slab->cache, slab->revision);
+        plane = buf;
+    } else if (viewType == 0) {
+        plane = vol.SliceData(slice);
+    }
+    if (!plane) {
+        int16_t* buf = ScratchBuffer(s.plane, (size_t)w * h);
+        vol.ExtractPlane(viewType, slice, buf);
+        plane = buf;
+    }
+
+    Clock::time_point t1 = Clock::now();
+    ResampleQuality quality = RESAMPLE_HIGH;
+    if (coarse) quality = (outW * 2 < w || outH * 2 < h) ? RESAMPLE_NEAREST : RESAMPLE_BILINEAR;
+    const int16_t* scaled = plane;
+    if (outW != w || outH != h) {
+        int16_t* dst = ScratchBuffer(s.scaled, (size_t)outW * outH);
+        ResamplePlane(plane, w, h, dst, outW, outH, quality, s);
+        scaled = dst;
+    }
+
+    Clock::time_point t2 = Clock::now();
+    ForRowBands(outH, outW, [&](int ya, int yb) {
+        const int16_t* src = scaled + (size_t)ya * outW;
+        unsigned char* dst = rgb + (size_t)ya * outW * 3;
+        size_t n = (size_t)(yb - ya) * outW;
+        if (lut) lut->Apply(src, dst, n);
+        else ApplyWindow(src, dst, n, wl, ww);
+    });
+    if (timings || Profiler::Get().Tracing()) {
+        Clock::time_point t3 = Clock::now();
+        if (timings) { timings->extractMs += ms(t0, t1); timings->resampleMs += ms(t1, t2); timings->windowMs += ms(t2, t3); }
+        static const char* const names[3][3] = {
+            { "Extract Axial", "Rescale Axial", "Window Axial" },
+            { "Extract Coronal", "Rescale Coronal", "Window Coronal" },
+            { "Extract Sagittal", "Rescale Sagittal", "Window Sagittal" },
+        };
+        const char* const* n = names[std::clamp(viewType, 0, 2)];
+        Profiler& prof = Profiler::Get();
+        prof.Record(n[0], t0, t1); prof.Record(n[1], t1, t2); prof.Record(n[2], t2, t3);
+    }
+    return quality;
+}
+
+// --- 斜め断面 (MPR) ---
+// 基準の断面 (Axial/Coronal/Sagittal) を、画面の横軸まわりに tilt、傾けた後の縦軸まわりに spin だけ回した平面で切る。
+// 向きと大きさは mm で決め、出力 1 画素あたりのボクセル座標の歩幅に直してから、行ごとに歩幅を足して標本化する。
+// 角度 0 では基準の断面と同じ範囲・同じ向きになる。
+constexpr int16_t OBLIQUE_FILL = -2048; // ボリュームの外 (未着のページと同じく空気より暗い値)
+
+struct ObliquePlane {
+    float origin[3] = { 0, 0, 0 };  // 出力 (0, 0) の画素中心のボクセル座標 (x, y, z)
+    float du[3] = { 0, 0, 0 };      // 右へ 1 画素進んだときのボクセル座標の変化
+    float dv[3] = { 0, 0, 0 };      // 下へ 1 画素
+    double crossX = 0.5, crossY = 0.5; // 中心点 (十字線の交点) の出力上の位置 (0〜1)
+};
+
+// center はボクセル座標。出力の大きさは基準の断面と同じく PlaneFitSize で決めたもの
+inline ObliquePlane MakeObliquePlane(const Volume& vol, int viewType, const double center[3], double tiltDeg, double spinDeg,
+                                     double pxSpcX, double pxSpcY, double thickness, int outW, int outH) {
+    const double spacing[3] = { pxSpcX, pxSpcY, thickness };
+    const int dims[3] = { vol.Width(), vol.Height(), vol.Depth() };
+    // 基準の断面の右 (u) と下 (v) のボクセル軸
+    const int axisU = viewType == 2 ? 1 : 0, axisV = viewType == 0 ? 1 : 2;
+    double u[3] = { 0, 0, 0 }, v[3] = { 0, 0, 0 }, n[3];
+    u[axisU] = 1; v[axisV] = 1;
+    auto cross = [](const double a[3], const double b[3], double out[3]) {
+        out[0] = a[1] * b[2] - a[2] * b[1]; out[1] = a[2] * b[0] - a[0] * b[2]; out[2] = a[0] * b[1] - a[1] * b[0];
+    };
+    // a を単位軸 k のまわりに rad だけ回す (Rodrigues)
+    auto rotate = [&](double a[3], const double k[3], double rad) {
+        double kxa[3], dot = a[0] * k[0] + a[1] * k[1] + a[2] * k[2], c = std::cos(rad), s = std::sin(rad);
+        cross(k, a, kxa);
+        for (int i = 0; i < 3; ++i) a[i] = a[i] * c + kxa[i] * s + k[i] * dot * (1 - c);
+    };
+    const double deg = 3.14159265358979323846 / 180.0;
+    rotate(v, u, tiltDeg * deg);
+    rotate(u, v, spinDeg * deg);
+    cross(u, v, n);
+
+    // 平面は中心点を通り、面内の位置はボリューム中心を平面へ落とした点に合わせる (角度 0 で基準の断面と一致)
+    double c[3], p[3];
+    for (int i = 0; i < 3; ++i) { c[i] = (dims[i] - 1) * 0.5 * spacing[i]; p[i] = center[i] * spacing[i]; }
+    double depth = (p[0] - c[0]) * n[0] + (p[1] - c[1]) * n[1] + (p[2] - c[2]) * n[2];
+    double mid[3];
+    for (int i = 0; i < 3; ++i) mid[i] = c[i] + n[i] * depth;
+
+    double extU = dims[axisU] * spacing[axisU], extV = dims[axisV] * spacing[axisV];
+    double stepU = extU / std::max(1, outW), stepV = extV / std::max(1, outH);
+    ObliquePlane plane;
+    for (int i = 0; i < 3; ++i) {
+        plane.du[i] = (float)(u[i] * stepU / spacing[i]);
+        plane.dv[i] = (float)(v[i] * stepV / spacing[i]);
+        plane.origin[i] = (float)((mid[i] - u[i] * stepU * (outW - 1) * 0.5 - v[i] * stepV * (outH - 1) * 0.5) / spacing[i]);
+    }
+    double offU = 0, offV = 0;
+    for (int i = 0; i < 3; ++i) { offU += (p[i] - mid[i]) * u[i]; offV += (p[i] - mid[i]) * v[i]; }
+    plane.crossX = (offU / stepU + (outW - 1) * 0.5) / std::max(1, outW - 1);
+    plane.crossY = (offV / stepV + (outH - 1) * 0.5) / std::max(1, outH - 1);
+    return plane;
+}
+
+// 出力 1 行のうち、ボクセル座標が全軸で [0, dim - 1] に収まる画素の範囲 [i0, i1)
+inline void ObliqueRowSpan(const float pos[3], const float step[3], const int dims[3], int outW, int& i0, int& i1) {
+    double lo = 0, hi = outW - 1;
+    for (int a = 0; a < 3; ++a) {
+        double limit = dims[a] - 1;
+        if (std::fabs(step[a]) < 1e-9) {
+            if (pos[a] < 0 || pos[a] > limit) { i0 = i1 = 0; return; }
+            continue;
+        }
+        double t0 = -pos[a] / step[a], t1 = (limit - pos[a]) / step[a];
+        if (t0 > t1) std::swap(t0, t1);
+        lo = std::max(lo, t0); hi = std::min(hi, t1);
+    }
+    if (lo > hi) { i0 = i1 = 0; return; } // 行全体が外 (lo が outW を超えることもある)
+    i0 = (int)std::ceil(lo); i1 = (int)std::floor(hi) + 1;
+    if (i1 < i0) i1 = i0;
+}
+
+// 操作中は最近傍、止まっているときは 3 線形で標本化する。
+// 線形レイアウトはボクセルを直接読む。ブリック・圧縮形式は直前のブリックを覚えておき、
+// 8 点が 1 つのブリックに収まるときはそこから、跨ぐときだけ At で読む (ページングには使わない)
+inline void ResliceOblique(const Volume& vol, const ObliquePlane& p, int outW, int outH, bool trilinear, int16_t* out) {
+    const int dims[3] = { vol.Width(), vol.Height(), vol.Depth() };
+    const int W = dims[0], H = dims[1], D = dims[2];
+    const size_t WH = (size_t)W * H;
+    const int16_t* voxels = vol.SliceData(0); // 線形レイアウトのときだけ非 null
+    trilinear = trilinear && W > 1 && H > 1 && D > 1;
+    ForRowBands(outH, outW, [&](int ya, int yb) {
+        for (int y = ya; y < yb; ++y) {
+            const float pos[3] = { p.origin[0] + y * p.dv[0], p.origin[1] + y * p.dv[1], p.origin[2] + y * p.dv[2] };
+            int16_t* row = out + (size_t)y * outW;
+            int i0 = 0, i1 = 0;
+            ObliqueRowSpan(pos, p.du, dims, outW, i0, i1);
+            std::fill(row, row + i0, OBLIQUE_FILL);
+            std::fill(row + i1, row + outW, OBLIQUE_FILL);
+            static_assert(Volume::BRICK == 16, "brick taps assume 16^3 bricks");
+            const int16_t* brick = nullptr;
+            int64_t brickKey = -1;
+            // At は BrickCache を書き換えるので、呼んだら覚えていたブリックは捨てる
+            auto brickAt = [&](int x, int yy, int z) {
+                int64_t key = ((int64_t)(z >> 4) << 40) | ((int64_t)(yy >> 4) << 20) | (x >> 4);
+                if (key != brickKey) { brick = vol.BrickVoxels(x >> 4, yy >> 4, z >> 4); brickKey = key; }
+                return brick + (((z & 15) * 16 + (yy & 15)) * 16 + (x & 15));
+            };
+            for (int i = i0; i < i1; ++i) {
+                // 端の丸め誤差で 1 ボクセルはみ出しても読まないように、添字は必ず範囲に収める
+                float fx = pos[0] + i * p.du[0], fy = pos[1] + i * p.du[1], fz = pos[2] + i * p.du[2];
+                if (!trilinear) {
+                    int x = std::clamp((int)(fx + 0.5f), 0, W - 1), yy = std::clamp((int)(fy + 0.5f), 0, H - 1), z = std::clamp((int)(fz + 0.5f), 0, D - 1);
+                    row[i] = voxels ? voxels[(size_t)z * WH + (size_t)yy * W + x] : *brickAt(x, yy, z);
+                    continue;
+                }
+                int x = std::clamp((int)fx, 0, W - 2), yy = std::clamp((int)fy, 0, H - 2), z = std::clamp((int)fz, 0, D - 2);
+                float tx = fx - x, ty = fy - yy, tz = fz - z;
+                float c000, c100, c010, c110, c001, c101, c011, c111;
+                if (voxels) {
+                    const int16_t* q = voxels + (size_t)z * WH + (size_t)yy * W + x;
+                    c000 = q[0]; c100 = q[1]; c010 = q[W]; c110 = q[W + 1];
+                    c001 = q[WH]; c101 = q[WH + 1]; c011 = q[WH + W]; c111 = q[WH + W + 1];
+                } else if ((x & 15) < 15 && (yy & 15) < 15 && (z & 15) < 15) {
+                    const int16_t* q = brickAt(x, yy, z);
+                    c000 = q[0]; c100 = q[1]; c010 = q[16]; c110 = q[17];
+                    c001 = q[256]; c101 = q[257]; c011 = q[272]; c111 = q[273];
+                } else {
+                    brickKey = -1;
+                    c000 = vol.At(x, yy, z); c100 = vol.At(x + 1, yy, z); c010 = vol.At(x, yy + 1, z); c110 = vol.At(x + 1, yy + 1, z);
+                    c001 = vol.At(x, yy, z + 1); c101 = vol.At(x + 1, yy, z + 1); c011 = vol.At(x, yy + 1, z + 1); c111 = vol.At(x + 1, yy + 1, z + 1);
+                }
+                float c00 = c000 + (c100 - c000) * tx, c10 = c010 + (c110 - c010) * tx;
+                float c01 = c001 + (c101 - c001) * tx, c11 = c011 + (c111 - c011) * tx;
+                float c0 = c00 + (c10 - c00) * ty, c1 = c01 + (c11 - c01) * ty;
+                row[i] = (int16_t)std::lround(c0 + (c1 - c0) * tz);
+            }
+        }
+    });
+}
+
+// 斜め断面を outW x outH の RGB として描く。断面を出力の大きさで直接標本化するので拡大縮小の段はない
+inline ResampleQuality RenderObliqueRGB(const Volume& vol, const ObliquePlane& plane, int outW, int outH, bool coarse,
+                                        const WindowLut* lut, int wl, int ww, unsigned char* rgb,
+                                        PlaneScratch* scratch = nullptr, PlaneTimings* timings = nullptr) {
+    using Clock = std::chrono::steady_clock;
+    auto ms = [](Clock::time_point a, Clock::time_point b) { return std::chrono::duration<double, std::milli>(b - a).count(); };
+    thread_local PlaneScratch threadScratch;
+    PlaneScratch& s = scratch ? *scratch : threadScratch;
+    Clock::time_point t0 = Clock::now();
+    int16_t* plane16 = ScratchBuffer(s.scaled, (size_t)outW * outH);
+    ResliceOblique(vol, plane, outW, outH, !coarse, plane16);
+    Clock::time_point t1 = Clock::now();
+    ForRowBands(outH, outW, [&](int ya, int yb) {
+        size_t n = (size_t)(yb - ya) * outW;
+        if (lut) lut->Apply(plane16 + (size_t)ya * outW, rgb + (size_t)ya * outW * 3, n);
+        else ApplyWindow(plane16 + (size_t)ya * outW, rgb + (size_t)ya * outW * 3, n, wl, ww);
+    });
+    if (timings || Profiler::Get().Tracing()) {
+        Clock::time_point t2 = Clock::now();
+        if (timings) { timings->extractMs += ms(t0, t1); timings->windowMs += ms(t1, t2); }
+        Profiler::Get().Record("Reslice Oblique", t0, t1);
+        Profiler::Get().Record("Window Oblique", t1, t2);
+    }
+    return coarse ? RESAMPLE_NEAREST : RESAMPLE_HIGH;
+}
+
+// --- 不等間隔スライスの再標本化 ---
+// offsets[z] は src の z 枚目の先頭からの距離 (mm, 昇順)。step 間隔の一様な格子へ z 方向に線形補間して dst (線形配置) を作る。
+// 欠けたスライスは前後から補い、読み込み直後に一度だけ行う
+inline void ResampleSlices(const Volume& src, const std::vector<double>& offsets, double step, Volume& dst) {
+    int w = src.Width(), h = src.Height(), d = src.Depth();
+    if (d < 2 || (int)offsets.size() != d || step <= 0) return;
+    int outDepth = std::max(1, (int)std::floor(offsets.back() / step + 0.5) + 1);
+    dst.Reset(w, h, outDepth, Volume::LAYOUT_LINEAR);
+    size_t n = (size_t)w * h;
+    ThreadPool::Shared().ParallelFor(outDepth, [&](int z) {
+        double pos = z * step;
+        int i = (int)(std::upper_bound(offsets.begin(), offsets.end(), pos) - offsets.begin()) - 1;
+        i = std::clamp(i, 0, d - 2);
+        double gap = offsets[i + 1] - offsets[i];
+        float t = gap > 0 ? (float)std::clamp((pos - offsets[i]) / gap, 0.0, 1.0) : 0.0f;
+        // 手前の 1 枚は出力先へ直接切り出し、奥の 1 枚だけをスレッドごとの作業領域に置いて混ぜる
+        int16_t* out = dst.SliceData(z);
+        src.ExtractPlane(0, i, out);
+        if (t <= 0.0f) return;
+        thread_local std::vector<int16_t> next;
+        int16_t* b = ScratchBuffer(next, n);
+        src.ExtractPlane(0, i + 1, b);
+        for (size_t k = 0; k < n; ++k) out[k] = (int16_t)std::lround(out[k] + (b[k] - out[k]) * t);
+    });
+}
+
+// --- ボリュームレンダリング (レイキャスト) ---
+// 平行投影で、カメラはボリュームの中心のまわりを回る。値から色・不透明度への変換 (伝達関数) は lo〜hi の 1 本のランプで、
+// 不透明度は 1 mm 進むあたりの値として持つ (歩幅を変えても見え方が変わらない)。
+// ランプの下端以下は透明なので、8^3 ごとの最大値が lo に届かないブロックは 1 回で飛ばす (空間の読み飛ばし)。
+// 積もった不透明度が VRT_OPAQUE を超えたら、その先は見えないので打ち切る。
+struct VrtTransfer {
+    float lo, hi;    // ランプの両端 (lo 以下は透明、hi 以上は opacity)
+    float opacity;   // 1 mm あたり
+    float colorLo[3], colorHi[3];
+};
+
+enum VrtPreset { VRT_BONE, VRT_SOFT_TISSUE, VRT_SKIN, VRT_PRESET_COUNT };
+
+inline const VrtTransfer& VrtPresetTransfer(int preset) {
+    static const VrtTransfer presets[VRT_PRESET_COUNT] = {
+        { 150, 700, 0.6f, { 0.85f, 0.55f, 0.40f }, { 1.00f, 0.97f, 0.90f } },   // 骨
+        { -50, 200, 0.08f, { 0.75f, 0.25f, 0.20f }, { 1.00f, 0.75f, 0.65f } },  // 軟部組織
+        { -500, -100, 0.5f, { 0.80f, 0.55f, 0.45f }, { 0.98f, 0.82f, 0.72f } }, // 皮膚
+    };
+    return presets[std::clamp(preset, 0, VRT_PRESET_COUNT - 1)];
+}
+
+constexpr float VRT_OPAQUE = 0.98f;
+constexpr int VRT_COARSE = 4;          // 操作中と最初の 1 枚は 4x4 画素に 1 本だけ飛ばす
+constexpr uint8_t VRT_BACKGROUND = 20; // パネルの背景と同じ
+
+struct VrtCamera {
+    double yaw = 0, pitch = 0; // 度。0, 0 で正面 (Coronal と同じ向き: 右 = +x, 下 = +z)
+    double zoom = 1.0;
+};
+
+// 1 フレーム分の視線 (mm、原点は先頭のボクセルの中心)。画素 (i, j) の視線は origin + du * i + dv * j から dir へ進む
+struct VrtView {
+    double origin[3], du[3], dv[3], dir[3];
+    double extent[3];  // 端のボクセル中心どうしの距離 (mm)
+    double spacing[3];
+};
+
+// 向きによらずボリューム全体が収まるよう、対角線を短い辺に合わせる
+inline VrtView MakeVrtView(const Volume& vol, double pxSpcX, double pxSpcY, double thickness, const VrtCamera& cam, int outW, int outH) {
+    VrtView v;
+    const int dims[3] = { vol.Width(), vol.Height(), vol.Depth() };
+    v.spacing[0] = pxSpcX; v.spacing[1] = pxSpcY; v.spacing[2] = thickness;
+    double diag = 0;
+    for (int i = 0; i < 3; ++i) { v.extent[i] = std::max(0, dims[i] - 1) * v.spacing[i]; diag += v.extent[i] * v.extent[i]; }
+    diag = std::max(1.0, std::sqrt(diag));
+    const double deg = 3.14159265358979323846 / 180.0;
+    double cp = std::cos(cam.pitch * deg), sp = std::sin(cam.pitch * deg);
+    double cy = std::cos(cam.yaw * deg), sy = std::sin(cam.yaw * deg);
+    // 正面の向き (右 +x, 下 +z, 奥 +y) を横軸まわりに pitch、体軸 (z) まわりに yaw だけ回す
+    const double u0[3] = { 1, 0, 0 }, v0[3] = { 0, -sp, cp }, d0[3] = { 0, cp, sp };
+    auto yawed = [&](const double a[3], double out[3]) { out[0] = a[0] * cy - a[1] * sy; out[1] = a[0] * sy + a[1] * cy; out[2] = a[2]; };
+    double u[3], w[3];
+    yawed(u0, u); yawed(v0, w); yawed(d0, v.dir);
+    double pixel = diag / std::max(1, std::min(outW, outH)) / std::max(0.05, cam.zoom);
+    for (int i = 0; i < 3; ++i) {
+        v.du[i] = u[i] * pixel; v.dv[i] = w[i] * pixel;
+        v.origin[i] = v.extent[i] * 0.5 - v.dir[i] * diag * 0.5 - v.du[i] * (outW - 1) * 0.5 - v.dv[i] * (outH - 1) * 0.5;
+    }
+    return v;
+}
+
+// ブロックの最大値を持ち、共有プールで視線を行ごとに飛ばす。線形レイアウトはボクセルを直接、それ以外は At で読む (ページングには使わない)
+class VolumeRaycaster {
+public:
+    static constexpr int BLOCK = 8;
+
+    // 中身の版が変わったときだけ作り直す。3 線形補間は隣のボクセルも読むので、各ブロックは次のブロックの先頭の 1 枚まで含める
+    void Prepare(const Volume& vol, long revision) {
+        if (&vol == source && revision == builtRevision && vol.Width() == dims[0] && vol.Height() == dims[1] && vol.Depth() == dims[2]) return;
+        ScopedTimer timer("Raycast Blocks");
+        source = &vol; builtRevision = revision;
+        dims[0] = vol.Width(); dims[1] = vol.Height(); dims[2] = vol.Depth();
+        for (int i = 0; i < 3; ++i) nb[i] = std::max(1, (dims[i] + BLOCK - 1) / BLOCK);
+        blockMax.assign((size_t)nb[0] * nb[1] * nb[2], INT16_MIN);
+        const int W = dims[0], H = dims[1], D = dims[2];
+        ThreadPool::Shared().ParallelFor(nb[2], [&](int bz) {
+            std::vector<int16_t> buf;
+            std::vector<int16_t> rowMax(nb[0]);
+            int16_t* layer = blockMax.data() + (size_t)bz * nb[1] * nb[0];
+            for (int z = bz * BLOCK; z <= std::min(D - 1, bz * BLOCK + BLOCK); ++z) {
+                const int16_t* plane = ReadPlane(vol, 0, z, buf);
+                for (int y = 0; y < H; ++y) {
+                    const int16_t* row = plane + (size_t)y * W;
+                    for (int bx = 0; bx < nb[0]; ++bx) {
+                        int x0 = bx * BLOCK, x1 = std::min(W - 1, x0 + BLOCK);
+                        rowMax[bx] = *std::max_element(row + x0, row + x1 + 1);
+                    }
+                    // 行 y はブロック y / BLOCK と、境目の行なら 1 つ上のブロックにも入る
+                    for (int by = y / BLOCK; by >= 0 && by * BLOCK + BLOCK >= y; --by) {
+                        if (by >= nb[1]) continue;
+                        int16_t* dst = layer + (size_t)by * nb[0];
+                        for (int bx = 0; bx < nb[0]; ++bx) dst[bx] = std::max(dst[bx], rowMax[bx]);
+                    }
+                }
+            }
+        });
+    }
+
+    // 行 [y0, y1) を描く。step > 1 なら step x step 画素に 1 本だけ飛ばして塗り広げ、歩幅も倍にする。
+    // skipEmpty = false は計測で読み飛ばしの効果を比べるときだけ使う
+    void Render(const Volume& vol, const VrtView& view, const VrtTransfer& tf, int outW, int outH, int y0, int y1, int step,
+                unsigned char* rgb, bool skipEmpty = true) const {
+        ScopedTimer timer(step > 1 ? "Raycast Coarse" : "Raycast");
+        const int W = dims[0], H = dims[1], D = dims[2];
+        y1 = std::min(y1, outH);
+        if (W < 2 || H < 2 || D < 2 || &vol != source) {
+            std::fill(rgb + (size_t)y0 * outW * 3, rgb + (size_t)y1 * outW * 3, VRT_BACKGROUND);
+            return;
+        }
+        step = std::max(1, step);
+        const size_t WH = (size_t)W * H;
+        const int16_t* voxels = vol.SliceData(0);
+        auto at = [&](int x, int y, int z) -> float { return voxels ? voxels[(size_t)z * WH + (size_t)y * W + x] : vol.At(x, y, z); };
+        const double* sp = view.spacing;
+        double dt = std::min({ sp[0], sp[1], sp[2] }) * (step > 1 ? 2 : 1);
+        // ランプ上の位置 (0〜1, 256 段) から 1 歩あたりの不透明度を引く
+        float alphaLut[257];
+        for (int i = 0; i <= 256; ++i) alphaLut[i] = 1.0f - (float)std::pow(1.0 - std::min(0.999, tf.opacity * i / 256.0), dt);
+        const float rampScale = tf.hi > tf.lo ? 1.0f / (tf.hi - tf.lo) : 1e6f;
+        const int16_t lo = (int16_t)std::clamp<float>(std::floor(tf.lo), INT16_MIN, INT16_MAX);
+        const double* dir = view.dir;
+
+        auto castRay = [&](int px, int py, unsigned char* out) {
+            double o[3], tn = -1e30, tfar = 1e30;
+            for (int a = 0; a < 3; ++a) {
+                o[a] = view.origin[a] + view.du[a] * px + view.dv[a] * py;
+                if (std::fabs(dir[a]) < 1e-12) {
+                    if (o[a] < 0 || o[a] > view.extent[a]) tfar = -1e30;
+                    continue;
+                }
+                double t0 = -o[a] / dir[a], t1 = (view.extent[a] - o[a]) / dir[a];
+                if (t0 > t1) std::swap(t0, t1);
+                tn = std::max(tn, t0); tfar = std::min(tfar, t1);
+            }
+            float acc[3] = { 0, 0, 0 }, accA = 0;
+            for (double t = tn; t <= tfar && accA < VRT_OPAQUE;) {
+                float fx = std::clamp((float)((o[0] + dir[0] * t) / sp[0]), 0.0f, (float)(W - 1));
+                float fy = std::clamp((float)((o[1] + dir[1] * t) / sp[1]), 0.0f, (float)(H - 1));
+                float fz = std::clamp((float)((o[2] + dir[2] * t) / sp[2]), 0.0f, (float)(D - 1));
+                int x = std::min((int)fx, W - 2), y = std::min((int)fy, H - 2), z = std::min((int)fz, D - 2);
+                const int b[3] = { std::min(x / BLOCK, nb[0] - 1), std::min(y / BLOCK, nb[1] - 1), std::min(z / BLOCK, nb[2] - 1) };
+                if (skipEmpty && blockMax[((size_t)b[2] * nb[1] + b[1]) * nb[0] + b[0]] <= lo) {
+                    // ブロックの出口まで進む。歩幅の格子に揃えるので、飛ばしても標本の位置は変わらない
+                    double exit = tfar;
+                    for (int a = 0; a < 3; ++a) {
+                        if (dir[a] > 1e-12) exit = std::min(exit, (std::min((b[a] + 1) * BLOCK, dims[a] - 1) * sp[a] - o[a]) / dir[a]);
+                        else if (dir[a] < -1e-12) exit = std::min(exit, (b[a] * BLOCK * sp[a] - o[a]) / dir[a]);
+                    }
+                    t += std::max(1.0, std::ceil((exit - t) / dt)) * dt;
+                    continue;
+                }
+                t += dt;
+                float tx = fx - x, ty = fy - y, tz = fz - z;
+                float c000, c100, c010, c110, c001, c101, c011, c111;
+                if (voxels) {
+                    const int16_t* q = voxels + (size_t)z * WH + (size_t)y * W + x;
+                    c000 = q[0]; c100 = q[1]; c010 = q[W]; c110 = q[W + 1];
+                    c001 = q[WH]; c101 = q[WH + 1]; c011 = q[WH + W]; c111 = q[WH + W + 1];
+                } else {
+                    c000 = at(x, y, z); c100 = at(x + 1, y, z); c010 = at(x, y + 1, z); c110 = at(x + 1, y + 1, z);
+                    c001 = at(x, y, z + 1); c101 = at(x + 1, y, z + 1); c011 = at(x, y + 1, z + 1); c111 = at(x + 1, y + 1, z + 1);
+                }
+                float c00 = c000 + (c100 - c000) * tx, c10 = c010 + (c110 - c010) * tx;
+                float c01 = c001 + (c101 - c001) * tx, c11 = c011 + (c111 - c011) * tx;
+                float c0 = c00 + (c10 - c00) * ty, c1 = c01 + (c11 - c01) * ty;
+                float r = (c0 + (c1 - c0) * tz - tf.lo) * rampScale;
+                if (r <= 0.0f) continue;
+                r = std::min(r, 1.0f);
+                float alpha = alphaLut[(int)(r * 256.0f)];
+                // 最寄りのボクセルの中心差分を法線にして、視線の向きからの光で陰影を付ける
+                int nx = (int)(fx + 0.5f), ny = (int)(fy + 0.5f), nz = (int)(fz + 0.5f);
+                float g[3] = { (at(std::min(nx + 1, W - 1), ny, nz) - at(std::max(nx - 1, 0), ny, nz)) / (float)sp[0],
+                               (at(nx, std::min(ny + 1, H - 1), nz) - at(nx, std::max(ny - 1, 0), nz)) / (float)sp[1],
+                               (at(nx, ny, std::min(nz + 1, D - 1)) - at(nx, ny, std::max(nz - 1, 0))) / (float)sp[2] };
+                float len = std::sqrt(g[0] * g[0] + g[1] * g[1] + g[2] * g[2]);
+                float shade = len > 1e-3f ? 0.3f + 0.7f * std::fabs((float)(g[0] * dir[0] + g[1] * dir[1] + g[2] * dir[2]) / len) : 1.0f;
+                float wgt = (1.0f - accA) * alpha * shade;
+                for (int c = 0; c < 3; ++c) acc[c] += wgt * (tf.colorLo[c] + (tf.colorHi[c] - tf.colorLo[c]) * r);
+                accA += (1.0f - accA) * alpha;
+            }
+            for (int c = 0; c < 3; ++c) out[c] = (uint8_t)std::clamp((int)(acc[c] * 255.0f + (1.0f - accA) * VRT_BACKGROUND + 0.5f), 0, 255);
+        };
+
+        int rays = (y1 - y0 + step - 1) / step;
+        // 1 行の重さは断面の 1 行よりずっと大きいので、行数がそのまま分割の単位になるよう重みを付ける
+        ForRowBands(rays, (size_t)outW * 256, [&](int ra, int rb) {
+            for (int r = ra; r < rb; ++r) {
+                int py = y0 + r * step, rows = std::min(step, y1 - py);
+                unsigned char* line = rgb + (size_t)py * outW * 3;
+                for (int px = 0; px < outW; px += step) {
+                    castRay(px, py, line + (size_t)px * 3);
+                    for (int k = 1; k < step && px + k < outW; ++k) std::memcpy(line + (size_t)(px + k) * 3, line + (size_t)px * 3, 3);
+                }
+                for (int k = 1; k < rows; ++k) std::memcpy(line + (size_t)k * outW * 3, line, (size_t)outW * 3);
+            }
+        });
+    }
+
+    long Revision() const { return builtRevision; }
+
+private:
+    const Volume* source = nullptr;
+    long builtRevision = -1;
+    int dims[3] = { 0, 0, 0 }, nb[3] = { 0, 0, 0 };
+    std::vector<int16_t> blockMax; // 8^3 (+1 の重なり) ごとの最大値
+};